@@ -109,7 +109,7 @@ CDCodec::CDCodec(int CDType, int n, int m, int r, CryptoPrimitive *cryptoObj)
     }
 
     if((CDType_ == AONT_RS_TYPE) || (CDType_ == OLD_CAONT_RS_TYPE) ||
-       (CDType_ == CAONT_RS_TYPE)) { /*CDCodec based on AONT-RS, old CAONT-RS, or CAONT-RS*/
+       (CDType_ == CAONT_RS_TYPE) || (CDType_ == CAONT_RS_CTR_TYPE)) { /*CDCodec based on AONT-RS or (old) CAONT-RS*/
         if(n <= 0) {
             fprintf(stdout, "Error: n should be > 0!\n");
             exit(1);
@@ -145,7 +145,7 @@ CDCodec::CDCodec(int CDType, int n, int m, int r, CryptoPrimitive *cryptoObj)
 
         /*allocate some space for storing the aligned secret*/
         alignedSecretBufferSize_ = MAX_SECRET_SIZE + bytesPerSecretWord_ * k_;
-        alignedSecretBuffer_ = (unsigned char *) malloc(sizeof(unsigned char) * alignedSecretBufferSize_);
+        alignedSecretBuffer_ = GFKernel::alignedAlloc(sizeof(unsigned char) * alignedSecretBufferSize_);
 
         if((CDType_ == AONT_RS_TYPE) || (CDType_ == OLD_CAONT_RS_TYPE)) {
             /*allocate a word of size bytesPerSecretWord_ for storing an index*/
@@ -163,7 +163,7 @@ CDCodec::CDCodec(int CDType, int n, int m, int r, CryptoPrimitive *cryptoObj)
         /*allocate some space for storing k data blocks to be encoded by systematic Cauchy RS code*/
         erasureCodingDataSize_ =
                 (bytesPerSecretWord_ * (((alignedSecretBufferSize_ / bytesPerSecretWord_) + 1) / k_)) * k_;
-        erasureCodingData_ = (unsigned char *) malloc(sizeof(unsigned char) * erasureCodingDataSize_);
+        erasureCodingData_ = GFKernel::alignedAlloc(sizeof(unsigned char) * erasureCodingDataSize_);
 
         /*initialize the gf_t object using defaults*/
         bitsPerGFWord_ = 8; /*8 bits for the use of GF(256)*/
@@ -192,6 +192,10 @@ CDCodec::CDCodec(int CDType, int n, int m, int r, CryptoPrimitive *cryptoObj)
             }
         }
 
+        /*expand the Cauchy submatrix into the lookup tables of the fused parity kernel*/
+        parityKernel_ = new GFKernel(m_, k_);
+        parityKernel_->setMatrix(&gfObj_, distributionMatrix_ + k_ * k_);
+
         /*allocate two k * k matrices for decoding*/
         squareMatrix_ = (int *) malloc(sizeof(int) * k_ * k_);
         inverseMatrix_ = (int *) malloc(sizeof(int) * k_ * k_);
@@ -204,6 +208,9 @@ CDCodec::CDCodec(int CDType, int n, int m, int r, CryptoPrimitive *cryptoObj)
         if(CDType_ == CAONT_RS_TYPE) {
             fprintf(stdout, "\nA CDCodec based on CAONT-RS has been constructed! \n");
         }
+        if(CDType_ == CAONT_RS_CTR_TYPE) {
+            fprintf(stdout, "\nA CDCodec based on CAONT-RS (CTR keystream) has been constructed! \n");
+        }
         fprintf(stdout, "Parameters: \n");
         fprintf(stdout, "      n_: %d \n", n_);
         fprintf(stdout, "      m_: %d \n", m_);
@@ -211,6 +218,7 @@ CDCodec::CDCodec(int CDType, int n, int m, int r, CryptoPrimitive *cryptoObj)
         fprintf(stdout, "      r_: %d \n", r_);
         fprintf(stdout, "      bytesPerSecretWord_: %d \n", bytesPerSecretWord_);
         fprintf(stdout, "      bitsPerGFWord_: %d \n", bitsPerGFWord_);
+        fprintf(stdout, "      parityKernel_ ISA: %d \n", GFKernel::getISA());
         fprintf(stdout, "      distributionMatrix_: (see below) \n");
         for(i = 0; i < n_; i++) {
             fprintf(stdout, "         | ");
@@ -247,7 +255,7 @@ CDCodec::~CDCodec()
     }
 
     if((CDType_ == AONT_RS_TYPE) || (CDType_ == OLD_CAONT_RS_TYPE) ||
-       (CDType_ == CAONT_RS_TYPE)) { /*CDCodec based on AONT-RS, old CAONT-RS, or CAONT-RS*/
+       (CDType_ == CAONT_RS_TYPE) || (CDType_ == CAONT_RS_CTR_TYPE)) { /*CDCodec based on AONT-RS or (old) CAONT-RS*/
         free(key_);
 
         free(alignedSecretBuffer_);
@@ -266,6 +274,11 @@ CDCodec::~CDCodec()
         gf_free(&gfObj_, 1);
 
         free(distributionMatrix_);
+        delete parityKernel_;
+
+        for(auto &it : decodeKernelCache_) {
+            delete it.second;
+        }
 
         free(squareMatrix_);
         free(inverseMatrix_);
@@ -417,6 +430,102 @@ bool CDCodec::squareMatrixInverting()
     return 1;
 }
 
+/*
+ * check that the IDs of k shares are in [0, n)
+ *
+ * @param kShareIDList - a list that stores the IDs of the k shares
+ *
+ * @return - a boolean value that indicates if every share ID is valid
+ */
+bool CDCodec::shareIDChecking(int *kShareIDList)
+{
+    int i;
+
+    for(i = 0; i < k_; i++) {
+        if((kShareIDList[i] < 0) || (kShareIDList[i] >= n_)) {
+            fprintf(stderr, "Error: invalid share ID %d (should be in [0, %d))!\n", kShareIDList[i], n_);
+
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * decode the package of AONT-RS or (old) CAONT-RS from k shares into erasureCodingData_
+ *
+ * @param shareBuffer - a buffer that stores the k shares
+ * @param kShareIDList - a list that stores the IDs of the k shares
+ * @param shareSize - the size of each share
+ *
+ * @return - a boolean value that indicates if the k shares can be decoded
+ */
+bool CDCodec::packageDecoding(unsigned char *shareBuffer, int *kShareIDList, int shareSize)
+{
+    bool systematic, ascending;
+    GFKernel *kernel;
+    int i, j;
+
+    if(!shareIDChecking(kShareIDList)) {
+        return 0;
+    }
+
+    systematic = 1;
+    ascending = 1;
+    for(i = 0; i < k_; i++) {
+        if(kShareIDList[i] != i) {
+            systematic = 0;
+        }
+        if((i > 0) && (kShareIDList[i] <= kShareIDList[i - 1])) {
+            ascending = 0;
+        }
+    }
+
+    /*the first k shares are the package itself, so no GF arithmetic is needed*/
+    if(systematic) {
+        memcpy(erasureCodingData_, shareBuffer, shareSize * k_);
+
+        return 1;
+    }
+
+    /*invert the k * k submatrix only the first time this combination of share IDs shows up*/
+    std::vector<int> combination(kShareIDList, kShareIDList + k_);
+    auto it = ascending ? decodeKernelCache_.find(combination) : decodeKernelCache_.end();
+    if(it != decodeKernelCache_.end()) {
+        it->second->encode(shareBuffer, erasureCodingData_, shareSize);
+
+        return 1;
+    }
+
+    /*store the k rows (corresponding to the k shares) of the distribution matrix into squareMatrix_*/
+    for(i = 0; i < k_; i++) {
+        for(j = 0; j < k_; j++) {
+            squareMatrix_[k_ * i + j] = distributionMatrix_[k_ * kShareIDList[i] + j];
+        }
+    }
+
+    /*invert squareMatrix_ into inverseMatrix_*/
+    if(!squareMatrixInverting()) {
+        fprintf(stderr, "Error: a k * k submatrix of the distribution matrix is noninvertible!\n");
+
+        return 0;
+    }
+
+    kernel = new GFKernel(k_, k_);
+    kernel->setMatrix(&gfObj_, inverseMatrix_);
+    kernel->encode(shareBuffer, erasureCodingData_, shareSize);
+
+    /*shares given out of order (or twice) would need a permuted matrix, so only the ascending lists are kept*/
+    if(ascending) {
+        decodeKernelCache_[combination] = kernel;
+    } else {
+        delete kernel;
+    }
+
+    return 1;
+}
+
 /*
  * encode a secret into n shares using CRSSS
  *
@@ -554,6 +663,9 @@ bool CDCodec::crsssDecoding(unsigned char *shareBuffer, int *kShareIDList, int s
 
         return 0;
     }
+    if(!shareIDChecking(kShareIDList)) {
+        return 0;
+    }
 
     /*store the k rows (corresponding to the k shares) of the distribution matrix into squareMatrix_*/
     for(i = 0; i < k_; i++) {
@@ -634,7 +746,7 @@ bool CDCodec::aontRSEncoding(unsigned char *secretBuffer, int secretSize,
 {
     int alignedSecretSize, numOfSecretWords;
     int coef;
-    int i, j;
+    int i;
 
     /*align the secret size into alignedSecretSize*/
     if(((secretSize + bytesPerSecretWord_) % (bytesPerSecretWord_ * k_)) == 0) {
@@ -712,19 +824,8 @@ bool CDCodec::aontRSEncoding(unsigned char *secretBuffer, int secretSize,
     /*directly copy the AONT package from erasureCodingData_ to shareBuffer as the first k shares*/
     memcpy(shareBuffer, erasureCodingData_, alignedSecretSize + bytesPerSecretWord_);
 
-    /*generate only the last m shares from the AONT package*/
-    for(i = 0; i < m_; i++) {
-        for(j = 0; j < k_; j++) {
-            coef = distributionMatrix_[k_ * (k_ + i) + j];
-            if(j == 0) {
-                gfObj_.multiply_region.w32(&gfObj_, erasureCodingData_ + (*shareSize) * j,
-                                           shareBuffer + (*shareSize) * (k_ + i), coef, (*shareSize), 0);
-            } else {
-                gfObj_.multiply_region.w32(&gfObj_, erasureCodingData_ + (*shareSize) * j,
-                                           shareBuffer + (*shareSize) * (k_ + i), coef, (*shareSize), 1);
-            }
-        }
-    }
+    /*generate only the last m shares from the AONT package, all in one pass over the k data shares*/
+    parityKernel_->encode(erasureCodingData_, shareBuffer + (*shareSize) * k_, (*shareSize));
 
     return 1;
 }
@@ -745,7 +846,7 @@ bool CDCodec::aontRSDecoding(unsigned char *shareBuffer, int *kShareIDList, int
 {
     int alignedSecretSize, numOfSecretWords;
     int coef;
-    int i, j;
+    int i;
 
     if((shareSize % bytesPerSecretWord_) != 0) {
         fprintf(stderr,
@@ -775,34 +876,11 @@ bool CDCodec::aontRSDecoding(unsigned char *shareBuffer, int *kShareIDList, int
         return 0;
     }
 
-    /*store the k rows (corresponding to the k shares) of the distribution matrix into squareMatrix_*/
-    for(i = 0; i < k_; i++) {
-        for(j = 0; j < k_; j++) {
-            squareMatrix_[k_ * i + j] = distributionMatrix_[k_ * kShareIDList[i] + j];
-        }
-    }
-
-    /*invert squareMatrix_ into inverseMatrix_*/
-    if(!squareMatrixInverting()) {
-        fprintf(stderr, "Error: a k * k submatrix of the distribution matrix is noninvertible!\n");
-
+    /*perform RS decoding and obtain the package in erasureCodingData_*/
+    if(!packageDecoding(shareBuffer, kShareIDList, shareSize)) {
         return 0;
     }
 
-    /*perform RS decoding and obtain the AONT package in erasureCodingData_*/
-    for(i = 0; i < k_; i++) {
-        for(j = 0; j < k_; j++) {
-            coef = inverseMatrix_[k_ * i + j];
-            if(j == 0) {
-                gfObj_.multiply_region.w32(&gfObj_, shareBuffer + shareSize * j,
-                                           erasureCodingData_ + shareSize * i, coef, shareSize, 0);
-            } else {
-                gfObj_.multiply_region.w32(&gfObj_, shareBuffer + shareSize * j,
-                                           erasureCodingData_ + shareSize * i, coef, shareSize, 1);
-            }
-        }
-    }
-
     /*generate a hash from the first numOfSecretWords AONT words, and temporarily store it into key_*/
     if(!cryptoObj_->generateHash(erasureCodingData_, alignedSecretSize, key_)) {
         fprintf(stderr, "Error: fail in the hash calculation!\n");
@@ -856,7 +934,7 @@ bool CDCodec::caontRSOldEncoding(unsigned char *secretBuffer, int secretSize,
 {
     int alignedSecretSize, numOfSecretWords;
     int coef;
-    int i, j;
+    int i;
 
     /*align the secret size into alignedSecretSize*/
     if(((secretSize + bytesPerSecretWord_) % (bytesPerSecretWord_ * k_)) == 0) {
@@ -935,19 +1013,8 @@ bool CDCodec::caontRSOldEncoding(unsigned char *secretBuffer, int secretSize,
     /*directly copy the CAONT package from erasureCodingData_ to shareBuffer as the first k shares*/
     memcpy(shareBuffer, erasureCodingData_, alignedSecretSize + bytesPerSecretWord_);
 
-    /*generate only the last m shares from the CAONT package*/
-    for(i = 0; i < m_; i++) {
-        for(j = 0; j < k_; j++) {
-            coef = distributionMatrix_[k_ * (k_ + i) + j];
-            if(j == 0) {
-                gfObj_.multiply_region.w32(&gfObj_, erasureCodingData_ + (*shareSize) * j,
-                                           shareBuffer + (*shareSize) * (k_ + i), coef, (*shareSize), 0);
-            } else {
-                gfObj_.multiply_region.w32(&gfObj_, erasureCodingData_ + (*shareSize) * j,
-                                           shareBuffer + (*shareSize) * (k_ + i), coef, (*shareSize), 1);
-            }
-        }
-    }
+    /*generate only the last m shares from the CAONT package, all in one pass over the k data shares*/
+    parityKernel_->encode(erasureCodingData_, shareBuffer + (*shareSize) * k_, (*shareSize));
 
     return 1;
 }
@@ -968,7 +1035,7 @@ bool CDCodec::caontRSOldDecoding(unsigned char *shareBuffer, int *kShareIDList,
 {
     int alignedSecretSize, numOfSecretWords;
     int coef;
-    int i, j;
+    int i;
 
     if((shareSize % bytesPerSecretWord_) != 0) {
         fprintf(stderr,
@@ -998,34 +1065,11 @@ bool CDCodec::caontRSOldDecoding(unsigned char *shareBuffer, int *kShareIDList,
         return 0;
     }
 
-    /*store the k rows (corresponding to the k shares) of the distribution matrix into squareMatrix_*/
-    for(i = 0; i < k_; i++) {
-        for(j = 0; j < k_; j++) {
-            squareMatrix_[k_ * i + j] = distributionMatrix_[k_ * kShareIDList[i] + j];
-        }
-    }
-
-    /*invert squareMatrix_ into inverseMatrix_*/
-    if(!squareMatrixInverting()) {
-        fprintf(stderr, "Error: a k * k submatrix of the distribution matrix is noninvertible!\n");
-
+    /*perform RS decoding and obtain the package in erasureCodingData_*/
+    if(!packageDecoding(shareBuffer, kShareIDList, shareSize)) {
         return 0;
     }
 
-    /*perform RS decoding and obtain the CAONT package in erasureCodingData_*/
-    for(i = 0; i < k_; i++) {
-        for(j = 0; j < k_; j++) {
-            coef = inverseMatrix_[k_ * i + j];
-            if(j == 0) {
-                gfObj_.multiply_region.w32(&gfObj_, shareBuffer + shareSize * j,
-                                           erasureCodingData_ + shareSize * i, coef, shareSize, 0);
-            } else {
-                gfObj_.multiply_region.w32(&gfObj_, shareBuffer + shareSize * j,
-                                           erasureCodingData_ + shareSize * i, coef, shareSize, 1);
-            }
-        }
-    }
-
     /*generate a hash from the first numOfSecretWords CAONT words, and temporarily store it into key_*/
     if(!cryptoObj_->generateHash(erasureCodingData_, alignedSecretSize, key_)) {
         fprintf(stderr, "Error: fail in the hash calculation!\n");
@@ -1094,7 +1138,6 @@ bool CDCodec::caontRSEncoding(unsigned char *secretBuffer, int secretSize, unsig
 {
     int alignedSecretSize;
     int coef;
-    int i, j;
 
     /*align the secret size into alignedSecretSize*/
     if(((secretSize + bytesPerSecretWord_) % (bytesPerSecretWord_ * k_)) == 0) {
@@ -1135,17 +1178,27 @@ bool CDCodec::caontRSEncoding(unsigned char *secretBuffer, int secretSize, unsig
     }
 
 
-    /*encrypt alignedSizeConstant_ of size alignedSecretSize with the hash key, and
-      temporarily store the ciphertext into erasureCodingData_*/
-    if(!cryptoObj_->encryptWithKey(alignedSizeConstant_, alignedSecretSize, key_, erasureCodingData_)) {
-        fprintf(stderr, "Error: fail in the data encryption!\n");
+    if(CDType_ == CAONT_RS_CTR_TYPE) {
+        /*the main part of the CAONT package is the aligned secret XORed with the CTR keystream of the key,
+          where the mask generation and the XOR are done in the same pass*/
+        if(!cryptoObj_->xorWithKeystream(alignedSecretBuffer_, alignedSecretSize, key_, erasureCodingData_)) {
+            fprintf(stderr, "Error: fail in the data encryption!\n");
 
-        return 0;
-    }
+            return 0;
+        }
+    } else {
+        /*encrypt alignedSizeConstant_ of size alignedSecretSize with the hash key, and
+          temporarily store the ciphertext into erasureCodingData_*/
+        if(!cryptoObj_->encryptWithKey(alignedSizeConstant_, alignedSecretSize, key_, erasureCodingData_)) {
+            fprintf(stderr, "Error: fail in the data encryption!\n");
 
-    /*the main part of the CAONT package is obtained by XORing the ciphertext with the aligned secret*/
-    coef = 1;
-    gfObj_.multiply_region.w32(&gfObj_, alignedSecretBuffer_, erasureCodingData_, coef, alignedSecretSize, 1);
+            return 0;
+        }
+
+        /*the main part of the CAONT package is obtained by XORing the ciphertext with the aligned secret*/
+        coef = 1;
+        gfObj_.multiply_region.w32(&gfObj_, alignedSecretBuffer_, erasureCodingData_, coef, alignedSecretSize, 1);
+    }
 
     /*+b) generate the tail part of the CAONT package, and store it into erasureCodingData_*/
 
@@ -1165,19 +1218,8 @@ bool CDCodec::caontRSEncoding(unsigned char *secretBuffer, int secretSize, unsig
     /*directly copy the CAONT package from erasureCodingData_ to shareBuffer as the first k shares*/
     memcpy(shareBuffer, erasureCodingData_, alignedSecretSize + bytesPerSecretWord_);
 
-    /*generate only the last m shares from the CAONT package*/
-    for(i = 0; i < m_; i++) {
-        for(j = 0; j < k_; j++) {
-            coef = distributionMatrix_[k_ * (k_ + i) + j];
-            if(j == 0) {
-                gfObj_.multiply_region.w32(&gfObj_, erasureCodingData_ + (*shareSize) * j,
-                                           shareBuffer + (*shareSize) * (k_ + i), coef, (*shareSize), 0);
-            } else {
-                gfObj_.multiply_region.w32(&gfObj_, erasureCodingData_ + (*shareSize) * j,
-                                           shareBuffer + (*shareSize) * (k_ + i), coef, (*shareSize), 1);
-            }
-        }
-    }
+    /*generate only the last m shares from the CAONT package, all in one pass over the k data shares*/
+    parityKernel_->encode(erasureCodingData_, shareBuffer + (*shareSize) * k_, (*shareSize));
 
     return 1;
 }
@@ -1198,7 +1240,6 @@ bool CDCodec::caontRSDecoding(unsigned char *shareBuffer, int *kShareIDList, int
 {
     int alignedSecretSize;
     int coef;
-    int i, j;
 
     if((shareSize % bytesPerSecretWord_) != 0) {
         fprintf(stderr,
@@ -1230,16 +1271,8 @@ bool CDCodec::caontRSDecoding(unsigned char *shareBuffer, int *kShareIDList, int
         exit(-1);
     }
 
-    /*store the k rows (corresponding to the k shares) of the distribution matrix into squareMatrix_*/
-    for(i = 0; i < k_; i++) {
-        for(j = 0; j < k_; j++) {
-            squareMatrix_[k_ * i + j] = distributionMatrix_[k_ * kShareIDList[i] + j];
-        }
-    }
-
-    /*invert squareMatrix_ into inverseMatrix_*/
-    if(!squareMatrixInverting()) {
-        fprintf(stderr, "Error: a k * k submatrix of the distribution matrix is noninvertible!\n");
+    /*perform RS decoding and obtain the package in erasureCodingData_*/
+    if(!packageDecoding(shareBuffer, kShareIDList, shareSize)) {
         printf("[CDCodec] kShareIDList:\n");
         for(int k = 0; k < k_; ++k) {
             printf("%d ", kShareIDList[k]);
@@ -1249,20 +1282,6 @@ bool CDCodec::caontRSDecoding(unsigned char *shareBuffer, int *kShareIDList, int
         exit(-1);
     }
 
-    /*perform RS decoding and obtain the CAONT package in erasureCodingData_*/
-    for(i = 0; i < k_; i++) {
-        for(j = 0; j < k_; j++) {
-            coef = inverseMatrix_[k_ * i + j];
-            if(j == 0) {
-                gfObj_.multiply_region.w32(&gfObj_, shareBuffer + shareSize * j,
-                                           erasureCodingData_ + shareSize * i, coef, shareSize, 0);
-            } else {
-                gfObj_.multiply_region.w32(&gfObj_, shareBuffer + shareSize * j,
-                                           erasureCodingData_ + shareSize * i, coef, shareSize, 1);
-            }
-        }
-    }
-
     /*generate a hash from the main part of the CAONT package, and temporarily store it into key_*/
     if(!cryptoObj_->generateHash(erasureCodingData_, alignedSecretSize, key_)) {
         fprintf(stderr, "Error: fail in the hash calculation!\n");
@@ -1274,17 +1293,26 @@ bool CDCodec::caontRSDecoding(unsigned char *shareBuffer, int *kShareIDList, int
     coef = 1;
     gfObj_.multiply_region.w32(&gfObj_, erasureCodingData_ + alignedSecretSize, key_, coef, bytesPerSecretWord_, 1);
 
-    /*encrypt alignedSizeConstant_ of size alignedSecretSize with the key, and 
-      temporarily store the ciphertext into alignedSecretBuffer_*/
-    if(!cryptoObj_->encryptWithKey(alignedSizeConstant_, alignedSecretSize, key_, alignedSecretBuffer_)) {
-        fprintf(stderr, "Error: fail in the data encryption!\n");
+    if(CDType_ == CAONT_RS_CTR_TYPE) {
+        /*the aligned secret is obtained by XORing the main part of the CAONT package with the CTR keystream*/
+        if(!cryptoObj_->xorWithKeystream(erasureCodingData_, alignedSecretSize, key_, alignedSecretBuffer_)) {
+            fprintf(stderr, "Error: fail in the data encryption!\n");
 
-        return 0;
-    }
+            return 0;
+        }
+    } else {
+        /*encrypt alignedSizeConstant_ of size alignedSecretSize with the key, and
+          temporarily store the ciphertext into alignedSecretBuffer_*/
+        if(!cryptoObj_->encryptWithKey(alignedSizeConstant_, alignedSecretSize, key_, alignedSecretBuffer_)) {
+            fprintf(stderr, "Error: fail in the data encryption!\n");
 
-    /*the aligned secret is obtained by XORing the ciphertext with the main part of the CAONT package stored in erasureCodingData_*/
-    coef = 1;
-    gfObj_.multiply_region.w32(&gfObj_, erasureCodingData_, alignedSecretBuffer_, coef, alignedSecretSize, 1);
+            return 0;
+        }
+
+        /*the aligned secret is obtained by XORing the ciphertext with the main part of the CAONT package stored in erasureCodingData_*/
+        coef = 1;
+        gfObj_.multiply_region.w32(&gfObj_, erasureCodingData_, alignedSecretBuffer_, coef, alignedSecretSize, 1);
+    }
 
     /*generate a hash from the aligned secret, and temporarily store it in the front end of erasureCodingData_*/
     if(!cryptoObj_->generateHash(alignedSecretBuffer_, alignedSecretSize, erasureCodingData_)) {
@@ -1329,7 +1357,7 @@ bool CDCodec::encoding(unsigned char *secretBuffer, int secretSize, unsigned cha
         success = caontRSOldEncoding(secretBuffer, secretSize, shareBuffer, shareSize, keyBuffer);
     }
 
-    if(CDType_ == CAONT_RS_TYPE) { /*CDCodec based on CAONT-RS*/
+    if((CDType_ == CAONT_RS_TYPE) || (CDType_ == CAONT_RS_CTR_TYPE)) { /*CDCodec based on CAONT-RS*/
         success = caontRSEncoding(secretBuffer, secretSize, shareBuffer, shareSize, keyBuffer, is_header);
     }
 
@@ -1365,9 +1393,38 @@ bool CDCodec::decoding(unsigned char *shareBuffer, int *kShareIDList, int shareS
         success = caontRSOldDecoding(shareBuffer, kShareIDList, shareSize, secretSize, secretBuffer, keyBuffer);
     }
 
-    if(CDType_ == CAONT_RS_TYPE) { /*CDCodec based on CAONT-RS*/
+    if((CDType_ == CAONT_RS_TYPE) || (CDType_ == CAONT_RS_CTR_TYPE)) { /*CDCodec based on CAONT-RS*/
         success = caontRSDecoding(shareBuffer, kShareIDList, shareSize, secretSize, secretBuffer, keyBuffer);
     }
 
     return success;
 }
+
+/*
+ * get the size of each share of a secret, before encoding it
+ *
+ * @param secretSize - the size of the secret
+ *
+ * @return - the size of each share
+ */
+int CDCodec::shareSize(int secretSize)
+{
+    int alignedSecretSize;
+
+    if(CDType_ == CRSSS_TYPE) { /*CDCodec based on CRSSS*/
+        alignedSecretSize = bytesPerGroup_ * ((secretSize + bytesPerGroup_ - 1) / bytesPerGroup_);
+
+        return bytesPerSecretWord_ * (alignedSecretSize / bytesPerGroup_);
+    }
+
+    /*CDCodec based on AONT-RS or (old) CAONT-RS*/
+    if(((secretSize + bytesPerSecretWord_) % (bytesPerSecretWord_ * k_)) == 0) {
+        alignedSecretSize = secretSize;
+    } else {
+        alignedSecretSize =
+                (bytesPerSecretWord_ * k_) * (((secretSize + bytesPerSecretWord_) / (bytesPerSecretWord_ * k_)) + 1) -
+                bytesPerSecretWord_;
+    }
+
+    return bytesPerSecretWord_ * (((alignedSecretSize / bytesPerSecretWord_) + 1) / k_);
+}
@@ -9,10 +9,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <map>
+#include <vector>
 
 /*for the use of CryptoPrimitive*/
 #include "CryptoPrimitive.hh"
 
+/*for the use of the fused GF(256) parity kernel*/
+#include "GFKernel.hh"
+
 /*for the use of gf_t object*/
 extern "C" {
 #include "gf_complete.h"
@@ -26,6 +31,8 @@ extern "C" {
 #define OLD_CAONT_RS_TYPE 2
 /*macro for the type of CAONT-RS*/
 #define CAONT_RS_TYPE 3
+/*macro for the type of CAONT-RS whose package mask is an AES-CTR keystream*/
+#define CAONT_RS_CTR_TYPE 4
 
 #define MAX_SECRET_SIZE (64 << 10)
 #define KEY_SIZE 32
@@ -80,6 +87,12 @@ private:
     /*the distribution matrix of an erasure code (IDA or RS)*/
     int *distributionMatrix_;
 
+    /*the kernel generating the m parity shares in one pass specially in AONT-RS and (old) CAONT-RS*/
+    GFKernel *parityKernel_;
+
+    /*decoding kernels of the inverted matrices, added on first use and keyed by the ascending k share IDs*/
+    std::map<std::vector<int>, GFKernel *> decodeKernelCache_;
+
     /*two k * k matrices for decoding*/
     int *squareMatrix_;
     int *inverseMatrix_;
@@ -91,6 +104,26 @@ private:
      */
     bool squareMatrixInverting();
 
+    /*
+     * check that the IDs of k shares are in [0, n)
+     *
+     * @param kShareIDList - a list that stores the IDs of the k shares
+     *
+     * @return - a boolean value that indicates if every share ID is valid
+     */
+    bool shareIDChecking(int *kShareIDList);
+
+    /*
+     * decode the package of AONT-RS or (old) CAONT-RS from k shares into erasureCodingData_
+     *
+     * @param shareBuffer - a buffer that stores the k shares
+     * @param kShareIDList - a list that stores the IDs of the k shares
+     * @param shareSize - the size of each share
+     *
+     * @return - a boolean value that indicates if the k shares can be decoded
+     */
+    bool packageDecoding(unsigned char *shareBuffer, int *kShareIDList, int shareSize);
+
     /*
      * encode a secret into n shares using CRSSS
      *
@@ -173,7 +206,8 @@ private:
                             unsigned char *secretBuffer, unsigned char *keyBuffer);
 
     /*
-     * encode a secret into n shares using CAONT-RS
+     * encode a secret into n shares using CAONT-RS (also serves CAONT_RS_CTR_TYPE, which XORs the
+     * secret with an AES-CTR keystream in one pass instead of CBC-encrypting a constant block)
      *
      * @param secretBuffer - a buffer that stores the secret
      * @param secretSize - the size of the secret
@@ -187,7 +221,7 @@ private:
                          unsigned char *keyBuffer, bool is_header);
 
     /*
-     * decode the secret from k = n - m shares using CAONT-RS
+     * decode the secret from k = n - m shares using CAONT-RS (also serves CAONT_RS_CTR_TYPE)
      *
      * @param shareBuffer - a buffer that stores the k shares 
      * @param kShareIDList - a list that stores the IDs of the k shares
@@ -252,6 +286,15 @@ public:
      */
     bool decoding(unsigned char *shareBuffer, int *kShareIDList, int shareSize, int secretSize,
                   unsigned char *secretBuffer, unsigned char *keyBuffer);
+
+    /*
+     * get the size of each share of a secret, before encoding it
+     *
+     * @param secretSize - the size of the secret
+     *
+     * @return - the size of each share
+     */
+    int shareSize(int secretSize);
 };
 
 #endif
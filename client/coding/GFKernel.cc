@@ -0,0 +1,362 @@
+/*
+ * GFKernel.cc
+ */
+
+#include "GFKernel.hh"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define GF_KERNEL_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+/*initialize the static variable*/
+int GFKernel::isa_ = -1;
+
+/*
+ * portable kernel for the positions [start, blockSize) of at most GF_KERNEL_MAX_ROWS output blocks
+ *
+ * @param tables - the lookup tables of the first output row
+ * @param rows - number of output blocks
+ * @param cols - number of input blocks
+ * @param src - the input blocks
+ * @param dst - the output blocks <return>
+ * @param blockSize - the size of each block
+ * @param start - the first position to compute
+ */
+static void encodePortable(const unsigned char *tables, int rows, int cols, unsigned char *src,
+                           unsigned char *dst, int blockSize, int start)
+{
+    unsigned char acc[GF_KERNEL_MAX_ROWS];
+    const unsigned char *table;
+    unsigned char x;
+    int p, i, j;
+
+    for(p = start; p < blockSize; p++) {
+        memset(acc, 0, rows);
+        for(j = 0; j < cols; j++) {
+            x = src[blockSize * j + p];
+            for(i = 0; i < rows; i++) {
+                table = tables + 32 * (cols * i + j);
+                acc[i] ^= table[x & 0x0f] ^ table[16 + (x >> 4)];
+            }
+        }
+        for(i = 0; i < rows; i++) {
+            dst[blockSize * i + p] = acc[i];
+        }
+    }
+}
+
+#ifdef GF_KERNEL_X86
+
+/*
+ * SSSE3 kernel, processing 16 bytes of every block per iteration
+ * (ROWS and COLS fix the shape at compile time so that the loops are unrolled, 0 means given at runtime)
+ *
+ * @return - the number of positions computed (the tail is left to the portable kernel)
+ */
+template <int ROWS, int COLS>
+__attribute__((target("ssse3")))
+static int encodeSSSE3(const unsigned char *tables, int rows, int cols, unsigned char *src,
+                       unsigned char *dst, int blockSize)
+{
+    if(ROWS > 0) {
+        rows = ROWS;
+    }
+    if(COLS > 0) {
+        cols = COLS;
+    }
+
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i acc[GF_KERNEL_MAX_ROWS];
+    __m128i x, lo, hi, tableLo, tableHi;
+    const unsigned char *table;
+    int p, i, j;
+
+    for(p = 0; p + 16 <= blockSize; p += 16) {
+        for(i = 0; i < rows; i++) {
+            acc[i] = _mm_setzero_si128();
+        }
+        for(j = 0; j < cols; j++) {
+            x = _mm_loadu_si128((const __m128i *) (src + blockSize * j + p));
+            lo = _mm_and_si128(x, mask);
+            hi = _mm_and_si128(_mm_srli_epi64(x, 4), mask);
+            for(i = 0; i < rows; i++) {
+                table = tables + 32 * (cols * i + j);
+                tableLo = _mm_load_si128((const __m128i *) table);
+                tableHi = _mm_load_si128((const __m128i *) (table + 16));
+                acc[i] = _mm_xor_si128(acc[i], _mm_xor_si128(_mm_shuffle_epi8(tableLo, lo),
+                                                             _mm_shuffle_epi8(tableHi, hi)));
+            }
+        }
+        for(i = 0; i < rows; i++) {
+            _mm_storeu_si128((__m128i *) (dst + blockSize * i + p), acc[i]);
+        }
+    }
+
+    return p;
+}
+
+/*
+ * AVX2 kernel, processing 32 bytes of every block per iteration
+ * (ROWS and COLS fix the shape at compile time so that the loops are unrolled, 0 means given at runtime)
+ *
+ * @return - the number of positions computed (the tail is left to the portable kernel)
+ */
+template <int ROWS, int COLS>
+__attribute__((target("avx2")))
+static int encodeAVX2(const unsigned char *tables, int rows, int cols, unsigned char *src,
+                      unsigned char *dst, int blockSize)
+{
+    if(ROWS > 0) {
+        rows = ROWS;
+    }
+    if(COLS > 0) {
+        cols = COLS;
+    }
+
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    __m256i acc[GF_KERNEL_MAX_ROWS];
+    __m256i x, lo, hi, tableLo, tableHi;
+    const unsigned char *table;
+    int p, i, j;
+
+    for(p = 0; p + 32 <= blockSize; p += 32) {
+        for(i = 0; i < rows; i++) {
+            acc[i] = _mm256_setzero_si256();
+        }
+        for(j = 0; j < cols; j++) {
+            x = _mm256_loadu_si256((const __m256i *) (src + blockSize * j + p));
+            lo = _mm256_and_si256(x, mask);
+            hi = _mm256_and_si256(_mm256_srli_epi64(x, 4), mask);
+            for(i = 0; i < rows; i++) {
+                table = tables + 32 * (cols * i + j);
+                tableLo = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *) table));
+                tableHi = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *) (table + 16)));
+                acc[i] = _mm256_xor_si256(acc[i], _mm256_xor_si256(_mm256_shuffle_epi8(tableLo, lo),
+                                                                   _mm256_shuffle_epi8(tableHi, hi)));
+            }
+        }
+        for(i = 0; i < rows; i++) {
+            _mm256_storeu_si256((__m256i *) (dst + blockSize * i + p), acc[i]);
+        }
+    }
+
+    return p;
+}
+
+/*
+ * GFNI kernel, processing 32 bytes of every block per iteration: a product by a constant is linear
+ * over GF(2), so gf2p8affineqb computes it with the bit matrix of the coefficient whatever the polynomial
+ * (ROWS and COLS fix the shape at compile time so that the loops are unrolled, 0 means given at runtime)
+ *
+ * @param tables - the bit matrices of the first output row
+ *
+ * @return - the number of positions computed (the tail is left to the portable kernel)
+ */
+template <int ROWS, int COLS>
+__attribute__((target("gfni,avx2")))
+static int encodeGFNI(const unsigned char *tables, int rows, int cols, unsigned char *src,
+                      unsigned char *dst, int blockSize)
+{
+    if(ROWS > 0) {
+        rows = ROWS;
+    }
+    if(COLS > 0) {
+        cols = COLS;
+    }
+
+    __m256i acc[GF_KERNEL_MAX_ROWS];
+    __m256i x, matrix;
+    long long bits;
+    int p, i, j;
+
+    for(p = 0; p + 32 <= blockSize; p += 32) {
+        for(i = 0; i < rows; i++) {
+            acc[i] = _mm256_setzero_si256();
+        }
+        for(j = 0; j < cols; j++) {
+            x = _mm256_loadu_si256((const __m256i *) (src + blockSize * j + p));
+            for(i = 0; i < rows; i++) {
+                memcpy(&bits, tables + 8 * (cols * i + j), sizeof(bits));
+                matrix = _mm256_set1_epi64x(bits);
+                acc[i] = _mm256_xor_si256(acc[i], _mm256_gf2p8affine_epi64_epi8(x, matrix, 0));
+            }
+        }
+        for(i = 0; i < rows; i++) {
+            _mm256_storeu_si256((__m256i *) (dst + blockSize * i + p), acc[i]);
+        }
+    }
+
+    return p;
+}
+
+/*
+ * pick the SIMD kernel for a shape, specialized for the geometries we deploy (n/k = 4/3, 6/4 and 8/6
+ * with their m * k parity and k * k decoding matrices, plus the parity of the n + 1 header codec)
+ */
+#define GF_KERNEL_PICK_SHAPE(KERNEL, rows, cols) \
+    (((rows) == 1 && (cols) == 3) ? &KERNEL<1, 3> : \
+     ((rows) == 1 && (cols) == 4) ? &KERNEL<1, 4> : \
+     ((rows) == 3 && (cols) == 3) ? &KERNEL<3, 3> : \
+     ((rows) == 4 && (cols) == 4) ? &KERNEL<4, 4> : \
+     ((rows) == 2 && (cols) == 4) ? &KERNEL<2, 4> : \
+     ((rows) == 2 && (cols) == 6) ? &KERNEL<2, 6> : \
+     ((rows) == 6 && (cols) == 6) ? &KERNEL<6, 6> : \
+     &KERNEL<0, 0>)
+
+#endif
+
+/*
+ * constructor of GFKernel
+ *
+ * @param rows - number of output blocks
+ * @param cols - number of input blocks
+ */
+GFKernel::GFKernel(int rows, int cols)
+{
+    rows_ = rows;
+    cols_ = cols;
+
+    tables_ = alignedAlloc(32 * rows_ * cols_);
+    if(tables_ == NULL) {
+        fprintf(stderr, "Error: fail to allocate the lookup tables of GFKernel!\n");
+        exit(1);
+    }
+    memset(tables_, 0, 32 * rows_ * cols_);
+
+    affine_ = alignedAlloc(8 * rows_ * cols_);
+    if(affine_ == NULL) {
+        fprintf(stderr, "Error: fail to allocate the bit matrices of GFKernel!\n");
+        exit(1);
+    }
+    memset(affine_, 0, 8 * rows_ * cols_);
+
+    /*bind the kernel once, the shape-specialized one if there is a single group of rows*/
+    kernel_ = NULL;
+#ifdef GF_KERNEL_X86
+    if(getISA() == GF_KERNEL_GFNI) {
+        kernel_ = (rows_ <= GF_KERNEL_MAX_ROWS) ? GF_KERNEL_PICK_SHAPE(encodeGFNI, rows_, cols_) : &encodeGFNI<0, 0>;
+    } else if(getISA() == GF_KERNEL_AVX2) {
+        kernel_ = (rows_ <= GF_KERNEL_MAX_ROWS) ? GF_KERNEL_PICK_SHAPE(encodeAVX2, rows_, cols_) : &encodeAVX2<0, 0>;
+    } else if(getISA() == GF_KERNEL_SSSE3) {
+        kernel_ = (rows_ <= GF_KERNEL_MAX_ROWS) ? GF_KERNEL_PICK_SHAPE(encodeSSSE3, rows_, cols_) : &encodeSSSE3<0, 0>;
+    }
+#else
+    getISA();
+#endif
+}
+
+/*
+ * destructor of GFKernel
+ */
+GFKernel::~GFKernel()
+{
+    free(tables_);
+    free(affine_);
+}
+
+/*
+ * allocate a buffer aligned to GF_KERNEL_ALIGNMENT which can be released by free()
+ *
+ * @param size - the size of the buffer
+ *
+ * @return - the aligned buffer, or NULL if the allocation fails
+ */
+unsigned char *GFKernel::alignedAlloc(size_t size)
+{
+    void *buffer;
+
+    if(posix_memalign(&buffer, GF_KERNEL_ALIGNMENT, size) != 0) {
+        return NULL;
+    }
+
+    return (unsigned char *) buffer;
+}
+
+/*
+ * get the instruction set used by encode()
+ *
+ * @return - GF_KERNEL_PORTABLE, GF_KERNEL_SSSE3, GF_KERNEL_AVX2 or GF_KERNEL_GFNI
+ */
+int GFKernel::getISA()
+{
+    if(isa_ < 0) {
+        int isa = GF_KERNEL_PORTABLE;
+#ifdef GF_KERNEL_X86
+        __builtin_cpu_init();
+        unsigned int eax, ebx, ecx = 0, edx;
+        /*CPUID.(EAX=7,ECX=0):ECX bit 8 reports GFNI, its VEX form needs AVX2 as well*/
+        bool gfni = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ecx & (1 << 8));
+        if(gfni && __builtin_cpu_supports("avx2")) {
+            isa = GF_KERNEL_GFNI;
+        } else if(__builtin_cpu_supports("avx2")) {
+            isa = GF_KERNEL_AVX2;
+        } else if(__builtin_cpu_supports("ssse3")) {
+            isa = GF_KERNEL_SSSE3;
+        }
+#endif
+        isa_ = isa;
+    }
+
+    return isa_;
+}
+
+/*
+ * expand a rows * cols coefficient matrix into the lookup tables and the bit matrices
+ *
+ * @param gfObj - the gf_t object (w = 8) defining the field
+ * @param matrix - the row-major coefficient matrix
+ */
+void GFKernel::setMatrix(gf_t *gfObj, int *matrix)
+{
+    unsigned char *table, *affine;
+    unsigned char column;
+    int i, x, b;
+
+    for(i = 0; i < rows_ * cols_; i++) {
+        table = tables_ + 32 * i;
+        for(x = 0; x < 16; x++) {
+            table[x] = (unsigned char) gfObj->multiply.w32(gfObj, matrix[i], x);
+            table[16 + x] = (unsigned char) gfObj->multiply.w32(gfObj, matrix[i], x << 4);
+        }
+
+        /*column b is the product of the coefficient and 2^b, bit x of the product lands in byte 7 - x*/
+        affine = affine_ + 8 * i;
+        memset(affine, 0, 8);
+        for(b = 0; b < 8; b++) {
+            column = (unsigned char) gfObj->multiply.w32(gfObj, matrix[i], 1 << b);
+            for(x = 0; x < 8; x++) {
+                affine[7 - x] |= ((column >> x) & 1) << b;
+            }
+        }
+    }
+}
+
+/*
+ * compute dst[i] = sum_j matrix[i][j] * src[j] for all rows in one pass
+ *
+ * @param src - cols input blocks stored back to back
+ * @param dst - a buffer for storing the rows output blocks back to back <return>
+ * @param blockSize - the size of each block
+ */
+void GFKernel::encode(unsigned char *src, unsigned char *dst, int blockSize)
+{
+    int row, rows, done;
+
+    /*more than GF_KERNEL_MAX_ROWS outputs would spill the accumulators, so split them into groups*/
+    for(row = 0; row < rows_; row += GF_KERNEL_MAX_ROWS) {
+        rows = rows_ - row;
+        if(rows > GF_KERNEL_MAX_ROWS) {
+            rows = GF_KERNEL_MAX_ROWS;
+        }
+
+        done = 0;
+        if(kernel_ != NULL && isa_ == GF_KERNEL_GFNI) {
+            done = kernel_(affine_ + 8 * cols_ * row, rows, cols_, src, dst + blockSize * row, blockSize);
+        } else if(kernel_ != NULL) {
+            done = kernel_(tables_ + 32 * cols_ * row, rows, cols_, src, dst + blockSize * row, blockSize);
+        }
+        encodePortable(tables_ + 32 * cols_ * row, rows, cols_, src, dst + blockSize * row, blockSize, done);
+    }
+}
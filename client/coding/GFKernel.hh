@@ -0,0 +1,104 @@
+/*
+ * GFKernel.hh
+ */
+
+#ifndef __GFKERNEL_HH__
+#define __GFKERNEL_HH__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*for the use of gf_t object*/
+extern "C" {
+#include "gf_complete.h"
+}
+
+/*macro for the alignment of coding buffers and lookup tables*/
+#define GF_KERNEL_ALIGNMENT 64
+/*macro for the maximum number of output blocks accumulated in a single pass*/
+#define GF_KERNEL_MAX_ROWS 8
+
+/*macros for the instruction set chosen at runtime*/
+#define GF_KERNEL_PORTABLE 0
+#define GF_KERNEL_SSSE3 1
+#define GF_KERNEL_AVX2 2
+#define GF_KERNEL_GFNI 3
+
+/*the SIMD kernel type: computes the leading positions of rows output blocks and returns how many it did*/
+typedef int (*GFKernelFunc)(const unsigned char *tables, int rows, int cols, unsigned char *src,
+                            unsigned char *dst, int blockSize);
+
+/*
+ * fused GF(256) matrix-region multiplication: every output block is computed in a single
+ * pass over the input blocks with split-nibble table lookups (pshufb on SSSE3/AVX2),
+ * or with one 8x8 bit-matrix affine transform per coefficient (gf2p8affineqb on GFNI)
+ */
+class GFKernel {
+private:
+    /*number of output blocks (rows of the coefficient matrix)*/
+    int rows_;
+    /*number of input blocks (columns of the coefficient matrix)*/
+    int cols_;
+
+    /*32 bytes per coefficient: the products of the low nibbles followed by those of the high nibbles*/
+    unsigned char *tables_;
+
+    /*8 bytes per coefficient: the multiplication by it as an 8x8 bit matrix, in the gf2p8affineqb layout*/
+    unsigned char *affine_;
+
+    /*the instruction set used by encode(), probed once for all instances*/
+    static int isa_;
+
+    /*the SIMD kernel bound at construction (NULL for the portable kernel only)*/
+    GFKernelFunc kernel_;
+
+public:
+    /*
+     * constructor of GFKernel
+     *
+     * @param rows - number of output blocks
+     * @param cols - number of input blocks
+     */
+    GFKernel(int rows, int cols);
+
+    /*
+     * destructor of GFKernel
+     */
+    ~GFKernel();
+
+    /*
+     * allocate a buffer aligned to GF_KERNEL_ALIGNMENT which can be released by free()
+     *
+     * @param size - the size of the buffer
+     *
+     * @return - the aligned buffer, or NULL if the allocation fails
+     */
+    static unsigned char *alignedAlloc(size_t size);
+
+    /*
+     * get the instruction set used by encode()
+     *
+     * @return - GF_KERNEL_PORTABLE, GF_KERNEL_SSSE3, GF_KERNEL_AVX2 or GF_KERNEL_GFNI
+     */
+    static int getISA();
+
+    /*
+     * expand a rows * cols coefficient matrix into the lookup tables and the bit matrices
+     *
+     * @param gfObj - the gf_t object (w = 8) defining the field
+     * @param matrix - the row-major coefficient matrix
+     */
+    void setMatrix(gf_t *gfObj, int *matrix);
+
+    /*
+     * compute dst[i] = sum_j matrix[i][j] * src[j] for all rows in one pass
+     *
+     * @param src - cols input blocks stored back to back
+     * @param dst - a buffer for storing the rows output blocks back to back <return>
+     * @param blockSize - the size of each block
+     */
+    void encode(unsigned char *src, unsigned char *dst, int blockSize);
+};
+
+#endif
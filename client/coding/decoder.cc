@@ -6,7 +6,7 @@
 #include "decoder.hh"
 
 /*
- * thread handler for decode shares into secret
+ * thread handler for decode shares into secret and write it into the output file
  *
  *
  */
@@ -20,15 +20,16 @@ void *Decoder::thread_handler(void *param)
     long countSize = 0;
 
     double decode_time = 0;
+    double write_time = 0;
 
     /* main loop for decode shares into secret */
     ShareChunk_t temp;
     Secret_t input;
+    auto *shareBuffer = (unsigned char *) malloc(SHARE_BUFFER_SIZE);
     while(true) {
 
         if(obj->inputbuffer_[index]->done_ && obj->inputbuffer_[index]->is_empty()) {
             // thread finished its mission, exit
-            obj->outputbuffer_[index]->set_job_done();
             break;
         }
 
@@ -45,103 +46,102 @@ void *Decoder::thread_handler(void *param)
 #ifdef BREAKDOWN_ENABLED
         Logger::measure_time([&]() {
 #endif
-        obj->decodeObj_[index]->decoding((unsigned char *) temp.data, temp.kShareIDList,
+        /* the codec takes the k shares side by side, gather them out of the received containers */
+        for(int i = 0; i < obj->k_; i++) {
+            memcpy(shareBuffer + i * temp.shareSize, temp.shares[i], temp.shareSize);
+            releaseShareBuffer(temp.buffers[i]);
+        }
+        obj->decodeObj_[index]->decoding(shareBuffer, temp.kShareIDList,
                                          temp.shareSize, temp.secretSize,
                                          (unsigned char *) input.data, key);
 #ifdef BREAKDOWN_ENABLED
         }, decode_time);
 #endif
 
-        /* add secret into output buffer */
-        obj->outputbuffer_[index]->push(input);
-        if(countSize == obj->totalFileSize_) {
-            printf("[Decoder] <thread_decoding:%d> Finish decoding!! Exiting...\n", index);
+        /* write the secret at its place, the other threads go on with theirs meanwhile */
+#ifdef BREAKDOWN_ENABLED
+        Logger::measure_time([&]() {
+#endif
+        if(!obj->writeSecret(input.data, input.secretSize, temp.offset)) {
+            // keep draining the shares so that the downloader does not block on a full queue
+            obj->failed_ = true;
         }
+#ifdef BREAKDOWN_ENABLED
+        }, write_time);
+#endif
     }
+    free(shareBuffer);
+    printf("[Decoder] <thread_decoding:%d> Finish decoding %ld bytes!! Exiting...\n", index, countSize);
 #ifdef BREAKDOWN_ENABLED
     printf("\n[Time] ===================\n");
     fprintf(stderr, "[Time] [Decoder] <thread_decoding:%d> decode time: is /%lf/ s\n", index, decode_time);
+    fprintf(stderr, "[Time] [Decoder] <thread_decoding:%d> write time: is /%lf/ s\n", index, write_time);
     printf("[Time]===================\n\n");
 #endif
     return NULL;
 }
 
 /*
- * collect thread for sequencially get secrets
+ * write the part of a decoded secret inside the restored byte range at its place in the output
+ *
+ * @param data - the decoded secret
+ * @param secretSize - the size of the secret
+ * @param offset - the offset of the secret in the restored secrets
  *
+ * @return - a boolean value that indicates if the write succeeds
  */
-void *Decoder::collect(void *param)
+bool Decoder::writeSecret(char *data, int secretSize, long offset)
 {
-
-    /* parse parameters */
-    char *buf = (char *) malloc(FWRITE_BUFFER_SIZE);
-    Decoder *obj = (Decoder *) param;
-    int count = 0;
-    long countSize = 0;
-    // out write pointer
-    int out_wp = 0;
-    bool job_done[DECODE_NUM_THREADS];
-    for(bool &i : job_done) {
-        i = false;
+    long begin = (offset < rangeSkip_) ? rangeSkip_ - offset : 0;
+    long end = secretSize;
+    if(rangeLength_ >= 0 && offset + end > rangeSkip_ + rangeLength_) {
+        end = rangeSkip_ + rangeLength_ - offset;
     }
 
-    double collect_time = 0;
-    /* main loop for get secrets */
-    Secret_t temp;
-    int loop_index = 0;
-    while(true) {
-        if(obj->outputbuffer_[loop_index]->done_ && obj->outputbuffer_[loop_index]->is_empty()) {
-            job_done[loop_index] = true;
-        }
-
-        if(obj->check_all_job_done(job_done)) {
-            // all jobs done, break for exiting
-            break;
-        }
-
-        if(job_done[loop_index]) {
-            loop_index = (loop_index + 1) % DECODE_NUM_THREADS;
-        }
+    if(!streaming_) {
+        return writeOutput(data, begin, end, offset);
+    }
 
-        /* extract secret object */
-        if(!obj->outputbuffer_[loop_index]->pop(temp)) {
-            continue;
-        }
-        loop_index = (loop_index + 1) % DECODE_NUM_THREADS;
+    /* a stream cannot seek, so wait for the secrets before this one to be written */
+    std::unique_lock<std::mutex> locker(streamMutex_);
+    streamCv_.wait(locker, [&]() { return streamOffset_ == offset; });
+    bool ret = writeOutput(data, begin, end, offset);
+    // the next secret goes on even if this write fails, the other threads must not wait forever
+    streamOffset_ = offset + secretSize;
+    locker.unlock();
+    streamCv_.notify_all();
+    return ret;
+}
 
-#ifdef BREAKDOWN_ENABLED
-        Logger::measure_time([&]() {
-#endif
-        /* if write buffer full then write to file */
-        if(out_wp + temp.secretSize > FWRITE_BUFFER_SIZE) {
-            fwrite(buf, out_wp, 1, obj->fw_);
-            out_wp = 0;
+/*
+ * write the bytes [begin, end) of a decoded secret into the output
+ *
+ * @param data - the decoded secret
+ * @param begin - the first byte to write
+ * @param end - the byte after the last one to write
+ * @param offset - the offset of the secret in the restored secrets
+ *
+ * @return - a boolean value that indicates if the write succeeds
+ */
+bool Decoder::writeOutput(char *data, long begin, long end, long offset)
+{
+    while(begin < end) {
+        ssize_t written;
+        if(streaming_) {
+            written = write(fd_, data + begin, end - begin);
+        } else {
+            written = pwrite(fd_, data + begin, end - begin, offset + begin - rangeSkip_);
         }
-
-        /* copy secret to write buffer */
-        memcpy(buf + out_wp, temp.data, temp.secretSize);
-        out_wp += temp.secretSize;
-        countSize += temp.secretSize;
-
-        /* if this is the last secret, write to file and  exit the collect */
-        count++;
-
-        if(countSize == obj->totalFileSize_) {
-            if(out_wp > 0) {
-                fwrite(buf, out_wp, 1, obj->fw_);
+        if(written == -1) {
+            if(errno == EINTR) {
+                continue;
             }
+            fprintf(stderr, "[Decoder] fail to write the secret at offset %ld! Error code: %d\n", offset, errno);
+            return false;
         }
-#ifdef BREAKDOWN_ENABLED
-        }, collect_time);
-#endif
+        begin += written;
     }
-#ifdef BREAKDOWN_ENABLED
-    printf("\n[Time] ===================\n");
-    fprintf(stderr, "[Time] [Decoder] <collect> decode time: is /%lf/ s\n", collect_time);
-    printf("[Time]===================\n\n");
-#endif
-    free(buf);
-    return nullptr;
+    return true;
 }
 
 /*
@@ -158,21 +158,26 @@ Decoder::Decoder(int type, int n, int m, int kmServerCount, int r, int securetyp
 {
     int i;
     n_ = n;
-
-    if(n - kmServerCount - m != NUM_OF_SHARES_NEEDED) {
-        printf("[Decoder] Error setting!!! k is not equal to macros. Change both!\n");
+    rangeSkip_ = 0;
+    rangeLength_ = -1;
+    fd_ = -1;
+    streaming_ = false;
+    streamOffset_ = 0;
+    failed_ = false;
+
+    k_ = n - kmServerCount - m;
+    if(k_ < 1 || k_ > MAX_SHARES_NEEDED) {
+        printf("[Decoder] Error setting!!! k = %d should be in [1, %d]\n", k_, MAX_SHARES_NEEDED);
         exit(-1);
     }
 
     /* initialization */
     cryptoObj_ = (CryptoPrimitive **) malloc(sizeof(CryptoPrimitive *) * n_);
     inputbuffer_ = (MessageQueue<ShareChunk_t> **) malloc(sizeof(MessageQueue<ShareChunk_t> *) * DECODE_NUM_THREADS);
-    outputbuffer_ = (MessageQueue<Secret_t> **) malloc(sizeof(MessageQueue<Secret_t> *) * DECODE_NUM_THREADS);
 
     /* initialization for variables of each thread */
     for(i = 0; i < DECODE_NUM_THREADS; i++) {
         inputbuffer_[i] = new MessageQueue<ShareChunk_t>(DECODE_QUEUE_SIZE);
-        outputbuffer_[i] = new MessageQueue<Secret_t>(DECODE_QUEUE_SIZE);
         cryptoObj_[i] = new CryptoPrimitive(securetype);
         decodeObj_[i] = new CDCodec(type, n - kmServerCount, m, r, cryptoObj_[i]);
         param_decoder *temp = (param_decoder *) malloc(sizeof(param_decoder));
@@ -186,16 +191,22 @@ Decoder::Decoder(int type, int n, int m, int kmServerCount, int r, int securetyp
     /* this decodeObj[DECODE_NUM_THREADS] is used for encoding header in order to have n shares for n servers */
     /* `r + 1` used for making up for param settings loss due to added KM-assisted server */
     decodeObj_[DECODE_NUM_THREADS] = new CDCodec(type, n, m, r + 1, cryptoObj_[0]);
-    /* create collect thread */
-    pthread_create(&tid_[DECODE_NUM_THREADS], 0, &collect, (void *) this);
 }
 
 /* 
  * test whether the decode thread returned
+ *
+ * @return - 1 if every secret is written into the output, 0 otherwise
  */
 int Decoder::indicateEnd()
 {
-    pthread_join(tid_[DECODE_NUM_THREADS], NULL);
+    for(int i = 0; i < DECODE_NUM_THREADS; i++) {
+        pthread_join(tid_[i], NULL);
+    }
+    if(failed_) {
+        fprintf(stderr, "[Decoder] the restored file is incomplete, some secrets could not be written!\n");
+        return 0;
+    }
     return 1;
 }
 
@@ -208,11 +219,9 @@ Decoder::~Decoder()
         delete (decodeObj_[i]);
         delete (cryptoObj_[i]);
         delete (inputbuffer_[i]);
-        delete (outputbuffer_[i]);
     }
     delete decodeObj_[DECODE_NUM_THREADS];
     free(inputbuffer_);
-    free(outputbuffer_);
     free(cryptoObj_);
 }
 
@@ -237,6 +246,55 @@ int Decoder::add(ShareChunk_t *item, int index)
 int Decoder::setFilePointer(FILE *fp)
 {
     fw_ = fp;
+    fd_ = fileno(fp);
+    streaming_ = false;
+    return 1;
+}
+
+/*
+ * stream the restored file into a file descriptor in order
+ *
+ * @param fd - the output file descriptor
+ */
+int Decoder::setStream(int fd)
+{
+    fw_ = nullptr;
+    fd_ = fd;
+    streaming_ = true;
+    streamOffset_ = 0;
+    return 1;
+}
+
+/*
+ * reserve the space of the restored file, once its size and byte range are set
+ */
+int Decoder::preallocate()
+{
+    long size = totalFileSize_ - rangeSkip_;
+    if(rangeLength_ >= 0 && rangeLength_ < size) {
+        size = rangeLength_;
+    }
+    if(DECODE_PREALLOCATE_ENABLED && !streaming_ && size > 0) {
+        /* the secrets are written in any order, so reserve the whole file at once rather than growing it */
+        int ret = posix_fallocate(fd_, 0, size);
+        if(ret != 0) {
+            fprintf(stderr, "[Decoder] fail to reserve %ld bytes for the restored file! Error code: %d\n", size, ret);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * write only a byte range of the decoded secrets
+ *
+ * @param skip - the bytes of the first secret before the range
+ * @param length - the length of the range (< 0 for up to the last secret)
+ */
+int Decoder::setRange(long skip, long length)
+{
+    rangeSkip_ = skip;
+    rangeLength_ = length;
     return 1;
 }
 
@@ -274,13 +332,3 @@ int Decoder::setFileSize(long totalFileSize)
     totalFileSize_ = totalFileSize;
     return 1;
 }
-
-bool Decoder::check_all_job_done(const bool *job_done)
-{
-    for(int i = 0; i < DECODE_NUM_THREADS; ++i) {
-        if(!job_done[i]) {
-            return false;
-        }
-    }
-    return true;
-}
@@ -6,6 +6,12 @@
 #define __DECODER_HH__
 
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
 #include "conf.hh"
 #include "DataStruct.hh"
 #include "CDCodec.hh"
@@ -16,8 +22,11 @@
 /* num of decoder threads */
 #define DECODE_NUM_THREADS 2
 
-/* buffer queue size */
-#define DECODE_QUEUE_SIZE (2)
+/* buffer queue size, deep enough that a slow secret does not stall the other decode threads */
+#define DECODE_QUEUE_SIZE (64)
+
+/* reserve the space of the restored file before writing it (1: enable, 0: disable) */
+#define DECODE_PREALLOCATE_ENABLED 1
 
 /* max secret size */
 #define SECRET_SIZE (16 * 1024)
@@ -25,15 +34,33 @@
 /* max share buffer size */
 #define SHARE_BUFFER_SIZE (4 * 16 * 1024)
 
-/* max write buffer size */
-#define FWRITE_BUFFER_SIZE (4 * 1024 * 1024)
-
-/* the k value */
-#define NUM_OF_SHARES_NEEDED (3)
+/* max k value, the k shares of a secret come from as many servers */
+#define MAX_SHARES_NEEDED MAX_SHARES_NUM
 
 class Decoder {
 private:
-    bool check_all_job_done(const bool *job_done);
+    /*
+     * write the part of a decoded secret inside the restored byte range at its place in the output
+     *
+     * @param data - the decoded secret
+     * @param secretSize - the size of the secret
+     * @param offset - the offset of the secret in the restored secrets
+     *
+     * @return - a boolean value that indicates if the write succeeds
+     */
+    bool writeSecret(char *data, int secretSize, long offset);
+
+    /*
+     * write the bytes [begin, end) of a decoded secret into the output
+     *
+     * @param data - the decoded secret
+     * @param begin - the first byte to write
+     * @param end - the byte after the last one to write
+     * @param offset - the offset of the secret in the restored secrets
+     *
+     * @return - a boolean value that indicates if the write succeeds
+     */
+    bool writeOutput(char *data, long begin, long end, long offset);
 
 public:
     /* thread parameter structure */
@@ -51,21 +78,20 @@ public:
 
     /* share metadata structure */
     typedef struct {
-        char data[SHARE_BUFFER_SIZE];
+        char *shares[MAX_SHARES_NEEDED]; // the k shares, inside the containers they were received in
+        ShareBuffer_t *buffers[MAX_SHARES_NEEDED]; // the containers, one reference held by each share
         int secretSize;
         int shareSize;
         int secretID;
-        int kShareIDList[NUM_OF_SHARES_NEEDED];
+        int kShareIDList[MAX_SHARES_NEEDED];
+        long offset; // offset of the secret in the restored secrets
     } ShareChunk_t;
 
     /* input share buffer */
     MessageQueue<ShareChunk_t> **inputbuffer_;
 
-    /* output secret buffer */
-    MessageQueue<Secret_t> **outputbuffer_;
-
     /* thread id array */
-    pthread_t tid_[DECODE_NUM_THREADS + 1];
+    pthread_t tid_[DECODE_NUM_THREADS];
 
     /* total number of secrets */
     int totalSecrets_;
@@ -73,12 +99,37 @@ public:
     /* file size of file */
     long totalFileSize_;
 
+    /* bytes of the first secret before the restored byte range */
+    long rangeSkip_;
+
+    /* length of the restored byte range (< 0 for all the secrets) */
+    long rangeLength_;
+
     /* total number of clouds */
     int n_;
 
+    /* number of shares needed to decode a secret */
+    int k_;
+
     /* output file pointer */
     FILE *fw_;
 
+    /* output file descriptor, written by every decode thread at the offsets of the secrets */
+    int fd_;
+
+    /* the output is a stream (stdout or a pipe), the secrets are written in order */
+    bool streaming_;
+
+    /* offset in the restored secrets of the next secret to write into the stream */
+    long streamOffset_;
+
+    //mutex and condition_variable for writing the secrets into the stream in order
+    std::mutex streamMutex_;
+    std::condition_variable streamCv_;
+
+    /* a secret could not be written into the output, the restored file is incomplete */
+    std::atomic<bool> failed_;
+
     /* share ID list pointer */
     int *kShareIDList_;
 
@@ -124,6 +175,14 @@ public:
      */
     int setFileSize(long totalSecrets);
 
+    /*
+     * write only a byte range of the decoded secrets
+     *
+     * @param skip - the bytes of the first secret before the range
+     * @param length - the length of the range (< 0 for up to the last secret)
+     */
+    int setRange(long skip, long length);
+
     /*
      * set the file output pointer
      *
@@ -131,6 +190,18 @@ public:
      */
     int setFilePointer(FILE *fp);
 
+    /*
+     * stream the restored file into a file descriptor in order, instead of writing it at offsets
+     *
+     * @param fd - the output file descriptor (e.g., stdout or a pipe)
+     */
+    int setStream(int fd);
+
+    /*
+     * reserve the space of the restored file, once its size and byte range are set
+     */
+    int preallocate();
+
     /*
      * set the k shareID list
      *
@@ -149,23 +220,16 @@ public:
     /*
      * test if it's the end of decoding a file
      *
-     *
+     * @return - 1 if every secret is written into the output, 0 otherwise
      */
     int indicateEnd();
 
     /*
-     * thread handler for decode shares into secret
+     * thread handler for decode shares into secret and write it into the output file
      *
      * @param param - input parameters for decode thread
      */
     static void *thread_handler(void *param);
-
-    /*
-     * collect thread for getting secret in order
-     *
-     * @param param - input parameters for collect thread
-     */
-    static void *collect(void *param);
 };
 
 #endif
@@ -4,11 +4,12 @@
  */
 
 #include "encoder.hh"
+#include "DeltaVarint.hh"
 
 using namespace std;
 
 /*
- * thread handler for encoding each secret into shares
+ * thread handler for encoding each secret into shares and fingerprinting each share
  *
  * @param param - parameters for encode thread
  */
@@ -22,6 +23,7 @@ void *Encoder::thread_handler(void *param)
 
     // Add time
     double encoding_time = 0;
+    double generate_hash_time = 0;
 
     Chunk_t temp;
     unsigned char encoded_data[MAX_DATA_SIZE]{};
@@ -31,7 +33,7 @@ void *Encoder::thread_handler(void *param)
 
         if(obj->inputbuffer_[index]->done_ && obj->inputbuffer_[index]->is_empty()) {
             // thread finished its mission, exit
-            obj->calc_inputbuffer_[index]->set_job_done();
+            obj->outputbuffer_[index]->set_job_done();
             break;
         }
 
@@ -41,6 +43,12 @@ void *Encoder::thread_handler(void *param)
         }
 
 
+        /* a secret larger than SECRET_SIZE would get shares larger than the constructor checked */
+        if(temp.chunk_size > SECRET_SIZE) {
+            printf("[Encoder] secret of %d bytes exceeds SECRET_SIZE\n", temp.chunk_size);
+            exit(-1);
+        }
+
         /* if it's share object */
 #ifdef BREAKDOWN_ENABLED
         Logger::measure_time([&]() {
@@ -50,77 +58,32 @@ void *Encoder::thread_handler(void *param)
 #ifdef BREAKDOWN_ENABLED
         }, encoding_time);
 #endif
-        // content role changed: content <=> encrypted data chunk
-        memcpy(temp.content, encoded_data, share_size * TOTAL_SHARES_NUM);
-
-        temp.share_size = (short) share_size;
-
-        /* add the object to output buffer */
-        obj->calc_inputbuffer_[index]->push(temp);
-    }
-
-#ifdef BREAKDOWN_ENABLED
-    printf("\n[Time] ===================\n");
-    fprintf(stderr, "[Time] [Encoder] <thread_handler> encoding time: is /%lf/ s\n", encoding_time);
-    printf("[Time]===================\n\n");
-#endif
-    return nullptr;
-}
-
-/*
- * thread handler for calculating hash of data shares
- *
- * @param param - parameters for encode thread
- */
-void *Encoder::thread_handler_hash(void *param)
-{
-
-    /* parse parameters */
-    int index = ((param_encoder *) param)->index;
-    Encoder *obj = ((param_encoder *) param)->obj;
-    free(param);
-
-    // Add time
-    double generate_hash_time = 0;
-
-    short shareSize = 0;
-    /* main loop for getting secrets and encode them into shares*/
-    Chunk_t temp;
-    while(true) {
-        if(obj->calc_inputbuffer_[index]->done_ && obj->calc_inputbuffer_[index]->is_empty()) {
-            // thread finished its mission, exit
-            obj->calc_outputbuffer_[index]->set_job_done();
-            break;
-        }
-
-        /* get an object from input buffer */
-        if(!obj->calc_inputbuffer_[index]->pop(temp)) {
-            continue;
-        }
 
-        /* if it's share object */
-
-        // split into `n_ - kmServerCount_` shares (currently, set to 4)
-        shareSize = temp.share_size;
+        /* fingerprint the `n_ - kmServerCount_` shares while they are still in cache, which must come after
+           encoding since total_FP carries the key into it */
 #ifdef BREAKDOWN_ENABLED
         Logger::measure_time([&]() {
 #endif
-            for(int i = 0; i < (obj->n_ - obj->kmServerCount_); ++i) {
-                obj->calc_cryptoObj_[index]->generateHash(temp.content + i * shareSize, shareSize,
-                                                          temp.total_FP + i * FP_SIZE);
-            }
+        for(int i = 0; i < (obj->n_ - obj->kmServerCount_); ++i) {
+            obj->cryptoObj_[index]->generateHash(encoded_data + i * share_size, share_size,
+                                                 temp.total_FP + i * FP_SIZE);
+        }
 #ifdef BREAKDOWN_ENABLED
         }, generate_hash_time);
 #endif
+        // content role changed: content <=> encrypted data chunk
+        memcpy(temp.content, encoded_data, share_size * (obj->n_ - obj->kmServerCount_));
+
+        temp.share_size = (short) share_size;
 
         /* add the object to output buffer */
-        obj->calc_outputbuffer_[index]->push(temp);
+        obj->outputbuffer_[index]->push(temp);
     }
 
-
 #ifdef BREAKDOWN_ENABLED
     printf("\n[Time] ===================\n");
-    fprintf(stderr, "[Time] [Encoder] <thread_hash:%d> generate hash time: is /%lf/ s\n", index, generate_hash_time);
+    fprintf(stderr, "[Time] [Encoder] <thread_handler> encoding time: is /%lf/ s\n", encoding_time);
+    fprintf(stderr, "[Time] [Encoder] <thread_handler:%d> generate hash time: is /%lf/ s\n", index, generate_hash_time);
     printf("[Time]===================\n\n");
 #endif
     return nullptr;
@@ -146,8 +109,10 @@ void *Encoder::collect(void *param)
     for(int i = 0; i < obj->n_; i++) {
         metaChunkCounter[i] = 0;
         metaChunkID[i] = -1;
-        metaSize[i] = sizeof(int);
+        metaSize[i] = META_CHUNK_HEAD_SIZE;
     }
+    // the previous metaNode of each metadata chunk, which the compact format is delta-coded against
+    auto previousMetaNode = std::make_unique<metaNode[]>(obj->n_);
     auto metaChunkBuffer = std::make_unique<std::unique_ptr<unsigned char[]>[]>(obj->n_);
     for(int i = 0; i < obj->n_; ++i) {
         metaChunkBuffer[i] = std::make_unique<unsigned char[]>(SECRET_SIZE_META);
@@ -173,18 +138,15 @@ void *Encoder::collect(void *param)
     Chunk_t temp;
     /* main loop for collecting shares */
     while(true) {
-        if(obj->calc_outputbuffer_[nextBufferIndex]->done_ &&
-           obj->calc_outputbuffer_[nextBufferIndex]->is_empty()) {
+        if(obj->outputbuffer_[nextBufferIndex]->done_ &&
+           obj->outputbuffer_[nextBufferIndex]->is_empty()) {
             // thread finished its mission, exit
-            for(int i = 0; i < obj->uploadObj_->total_ / 2; ++i) {
-                obj->uploadObj_->ringBuffer_[i]->set_job_done();
-                obj->uploadObj_->ringBufferMeta_[i]->set_job_done();
-            }
+            obj->uploadObj_->finishInput(obj->fileID_);
             break;
         }
 
         /* extract an object from a certain ringbuffer */
-        if(!obj->calc_outputbuffer_[nextBufferIndex]->pop(temp)) {
+        if(!obj->outputbuffer_[nextBufferIndex]->pop(temp)) {
             continue;
         }
 
@@ -195,7 +157,11 @@ void *Encoder::collect(void *param)
         /* if it's share object */
         int kmServerID = temp.kmCloudIndex;
 
-        // one segment to one meta data chunk
+        // one segment to one meta data chunk: the compact metaNodes only make each chunk smaller, the number of
+        // metadata chunks (and of their index entries and recipe entries) stays one per segment and server.
+        // Segments are not packed together since the KM server, and so the set of servers holding the shares,
+        // changes with the segment, and a metadata chunk is deduplicated as a whole, so an unchanged segment
+        // would stop deduplicating against the previous backup once its neighbours change
         // IF new segment encountered, assemble metaNodes into metadata and send it to uploader
         if(previousSegID != temp.seg_id) {
 
@@ -212,7 +178,7 @@ void *Encoder::collect(void *param)
                     /* skip kmServer when processing previous segment */
                     metaChunkUploadObj.type = SHARE_OBJECT;
 
-                    obj->assignMetaShareHeader(metaChunkUploadObj, metaChunkID[i], metaChunkCounter[i],
+                    obj->assignMetaShareHeader(metaChunkUploadObj, metaChunkID[i], metaSize[i],
                                                previousSegID, shareIndex[i], temp.kmCloudIndex);
                     metaChunkID[i]--;
 
@@ -222,11 +188,12 @@ void *Encoder::collect(void *param)
                 }, generate_meta_chunk_time);
 #endif
 
-                obj->uploadObj_->addMeta(metaChunkUploadObj, i);
+                obj->uploadObj_->addMeta(metaChunkUploadObj, i, obj->fileID_);
 
                 /* prepare for (next segment | meta data chunk) */
-                metaSize[i] = 0;
+                metaSize[i] = META_CHUNK_HEAD_SIZE;
                 memset(&metaChunkUploadObj, 0, sizeof(Uploader::ItemMeta_t));
+                memset(&previousMetaNode[i], 0, sizeof(metaNode));
                 metaChunkCounter[i] = 0;
             }
             previousSegID = temp.seg_id;
@@ -270,8 +237,8 @@ void *Encoder::collect(void *param)
                     fakeInputMeta.shareObj.share_header.secretID = META_SECRET_ID_END_INDICATOR;
 
                     printf("[collect] Add fake data and metaData to Uploader RingBuffer\n");
-                    obj->uploadObj_->add(fakeInput, kmServerID);
-                    obj->uploadObj_->addMeta(fakeInputMeta, kmServerID);
+                    obj->uploadObj_->add(fakeInput, kmServerID, obj->fileID_);
+                    obj->uploadObj_->addMeta(fakeInputMeta, kmServerID, obj->fileID_);
                 }
                 /* do not send data to KM server, thus skip kmServerID */
                 ++loop_count;
@@ -314,16 +281,15 @@ void *Encoder::collect(void *param)
 #endif
             temp.share_id = shareID;
 
-            obj->uploadObj_->add(temp, loop_index);
+            obj->uploadObj_->add(temp, loop_index, obj->fileID_);
 
-            if(metaSize[loop_index] + sizeof(metaNode) >= SECRET_SIZE_META) {
+            if(metaSize[loop_index] + META_NODE_MAX_COMPACT_SIZE >= SECRET_SIZE_META) {
                 printf("[collect] may overflow!!Exiting...\n");
                 exit(-5);
             }
-            // metaChunkBuffer structure: count<int> + [metaChunk_1, ... , metaChunk_n]
-            memcpy(metaChunkBuffer[loop_index].get() + sizeof(int) + metaChunkCounter[loop_index] * sizeof(metaNode),
-                   &metaChunkTemp, sizeof(metaNode));
-            metaSize[loop_index] = metaSize[loop_index] + sizeof(metaNode);
+            // metaChunkBuffer structure: magic<int> + count<int> + [metaChunk_1, ... , metaChunk_n] (compact)
+            metaSize[loop_index] = obj->appendMetaNode(metaChunkBuffer[loop_index].get(), metaSize[loop_index],
+                                                       metaChunkTemp, previousMetaNode[loop_index]);
 
             //Increase count
             metaChunkCounter[loop_index]++;
@@ -339,7 +305,7 @@ void *Encoder::collect(void *param)
                     metaChunkUploadObj.type = SHARE_END;
 
                     obj->assignMetaShareHeader(metaChunkUploadObj, metaChunkID[loop_index],
-                                               metaChunkCounter[loop_index], temp.seg_id, shareID, temp.kmCloudIndex);
+                                               metaSize[loop_index], temp.seg_id, shareID, temp.kmCloudIndex);
                     metaChunkID[loop_index]--;
 
                     obj->assembleMetadataChunks(metaChunkUploadObj, metaChunkBuffer[loop_index].get(),
@@ -349,7 +315,7 @@ void *Encoder::collect(void *param)
 #endif
 
                 ++metaChunkCount[loop_index];
-                obj->uploadObj_->addMeta(metaChunkUploadObj, loop_index);
+                obj->uploadObj_->addMeta(metaChunkUploadObj, loop_index, obj->fileID_);
             }
 
             // preserve shareID for future packing up metadata chunks
@@ -389,17 +355,19 @@ void Encoder::indicateEnd()
  * @param r - confidentiality degree
  * @param securetype - encryption and hash type
  * @param uploaderObj - pointer link to uploader object
+ * @param fileID - slot of the file in the uploader
  *
  */
-Encoder::Encoder(int type, int n, int m, int kmServerCount, int r, int securetype, Uploader *uploaderObj)
+Encoder::Encoder(int type, int n, int m, int kmServerCount, int r, int securetype, Uploader *uploaderObj,
+                 int fileID)
 {
 
     /* initialization of variables */
     n_ = n;
     kmServerCount_ = kmServerCount;
-    if(n_ - kmServerCount_ != TOTAL_SHARES_NUM) {
+    if(n_ - kmServerCount_ < 1 || n_ - kmServerCount_ > MAX_SHARES_NUM) {
         printf("[Encoder] Mismatch setting detected. Please check your setting. \n");
-        printf("[Encoder] Total number of shares set in Encoder macros is %d\n", TOTAL_SHARES_NUM);
+        printf("[Encoder] Max number of shares set in Encoder macros is %d\n", MAX_SHARES_NUM);
         printf("[Encoder] Total number of shares set via Encoder constructor is %d\n", n_ - kmServerCount_);
         exit(-1);
     }
@@ -407,38 +375,35 @@ Encoder::Encoder(int type, int n, int m, int kmServerCount, int r, int securetyp
     cryptoObj_ = (CryptoPrimitive **) malloc(sizeof(CryptoPrimitive *) * (NUM_THREADS + 1));
     inputbuffer_ = (MessageQueue<Chunk_t> **) malloc(sizeof(MessageQueue<Secret_Item_t> *) * NUM_THREADS);
 
-    calc_inputbuffer_ = new MessageQueue<Chunk_t> *[NUM_THREADS];
-    calc_outputbuffer_ = new MessageQueue<Chunk_t> *[NUM_THREADS];
-    calc_cryptoObj_ = new CryptoPrimitive *[NUM_THREADS];
+    outputbuffer_ = new MessageQueue<Chunk_t> *[NUM_THREADS];
 
     /* initialization of objects - 2 threads */
     for(int i = 0; i < NUM_THREADS; ++i) {
         inputbuffer_[i] = new MessageQueue<Chunk_t>(QUEUE_SIZE);
+        outputbuffer_[i] = new MessageQueue<Chunk_t>(QUEUE_SIZE);
         cryptoObj_[i] = new CryptoPrimitive(securetype);
         encodeObj_[i] = new CDCodec(type, n_ - kmServerCount_, m, r, cryptoObj_[i]);
+    }
 
-        auto *temp = (param_encoder *) malloc(sizeof(param_encoder));
-        temp->index = i;
-        temp->obj = this;
-
-        /* create encoding threads */
-        pthread_create(&tid_[i], 0, &thread_handler, (void *) temp);
+    /* the shares of the largest secret must fit in the share buffer of the encoding threads */
+    int maxShareSize = encodeObj_[0]->shareSize(SECRET_SIZE);
+    if(maxShareSize * (n_ - kmServerCount_) > MAX_DATA_SIZE) {
+        printf("[Encoder] %d shares of %d bytes exceed MAX_DATA_SIZE (%d bytes)\n", n_ - kmServerCount_,
+               maxShareSize, MAX_DATA_SIZE);
+        exit(-1);
     }
 
-    /* threads for calculating hashes */
     for(int i = 0; i < NUM_THREADS; ++i) {
-        calc_inputbuffer_[i] = new MessageQueue<Chunk_t>(QUEUE_SIZE);
-        calc_outputbuffer_[i] = new MessageQueue<Chunk_t>(QUEUE_SIZE);
-        calc_cryptoObj_[i] = new CryptoPrimitive(securetype);
         auto *temp = (param_encoder *) malloc(sizeof(param_encoder));
         temp->index = i;
         temp->obj = this;
 
-        /* create calculating hashes threads */
-        pthread_create(&calc_tid_[i], 0, &thread_handler_hash, (void *) temp);
+        /* create encoding threads */
+        pthread_create(&tid_[i], 0, &thread_handler, (void *) temp);
     }
 
     uploadObj_ = uploaderObj;
+    fileID_ = fileID;
     cryptoObj_[NUM_THREADS] = new CryptoPrimitive(securetype);
     /* this encodeObj[NUM_THREADS] is used for encoding header in order to have n shares for n servers */
     /* `r + 1` used for making up for param settings loss due to added KM-assisted server */
@@ -457,17 +422,12 @@ Encoder::~Encoder()
         delete cryptoObj_[i];
         delete encodeObj_[i];
         delete inputbuffer_[i];
-
-        delete calc_inputbuffer_[i];
-        delete calc_outputbuffer_[i];
-        delete calc_cryptoObj_[i];
+        delete outputbuffer_[i];
     }
     delete encodeObj_[NUM_THREADS];
     delete cryptoObj_[NUM_THREADS];
 
-    delete[] calc_inputbuffer_;
-    delete[] calc_outputbuffer_;
-    delete[] calc_cryptoObj_;
+    delete[] outputbuffer_;
 
     free(inputbuffer_);
     free(cryptoObj_);
@@ -494,18 +454,18 @@ int Encoder::add(Chunk_t &item)
  *
  * @param metaChunkUploadObj - the metadata chunk to be sent to uploader
  * @param metaChunkID - the ID of metadata chunk
- * @param counter - count the number of metaNodes
+ * @param metaChunkSize - the size of the encoded metadata chunk (head included)
  * @param segID - the ID of segment
  * @param shareID - the ID of current share of a data chunk
  * @param kmCloudIndex - the index of Key Manager Server
  *
  */
-void Encoder::assignMetaShareHeader(Uploader::ItemMeta_t &metaChunkUploadObj, int &metaChunkID, int &counter,
+void Encoder::assignMetaShareHeader(Uploader::ItemMeta_t &metaChunkUploadObj, int &metaChunkID, int &metaChunkSize,
                                     int &segID, int &shareID, short &kmCloudIndex)
 {
     metaChunkUploadObj.shareObj.share_header.secretID = metaChunkID;
-    metaChunkUploadObj.shareObj.share_header.secretSize = sizeof(int) + counter * sizeof(metaNode);
-    metaChunkUploadObj.shareObj.share_header.shareSize = sizeof(int) + counter * sizeof(metaNode);
+    metaChunkUploadObj.shareObj.share_header.secretSize = metaChunkSize;
+    metaChunkUploadObj.shareObj.share_header.shareSize = metaChunkSize;
     metaChunkUploadObj.shareObj.share_header.segID = segID;
     metaChunkUploadObj.shareObj.share_header.shareID = shareID;
     metaChunkUploadObj.kmCloudIndex = kmCloudIndex;
@@ -522,8 +482,10 @@ void Encoder::assignMetaShareHeader(Uploader::ItemMeta_t &metaChunkUploadObj, in
 void Encoder::assembleMetadataChunks(Uploader::ItemMeta_t &metaChunkUploadObj, unsigned char *metaChunkBuffer,
                                      int &counter)
 {
-    // update count in the head of metaChunkBuffer[loop_index].get()
-    memcpy(metaChunkBuffer, &counter, sizeof(int));
+    // update magic and count in the head of metaChunkBuffer[loop_index].get()
+    int magic = META_CHUNK_COMPACT_MAGIC;
+    memcpy(metaChunkBuffer, &magic, sizeof(int));
+    memcpy(metaChunkBuffer + sizeof(int), &counter, sizeof(int));
 
     // add metaChunkBuffer[loop_index].get() into uploader Obj buffer
     memcpy(metaChunkUploadObj.shareObj.data, metaChunkBuffer, metaChunkUploadObj.shareObj.share_header.shareSize);
@@ -534,6 +496,33 @@ void Encoder::assembleMetadataChunks(Uploader::ItemMeta_t &metaChunkUploadObj, u
                                                 metaChunkUploadObj.shareObj.share_header.shareFP);
 }
 
+/*
+ * Append a metaNode to a metadata chunk in the compact format
+ *
+ * @param metaChunkBuffer - buffer of the metadata chunk
+ * @param offset - the size of the metadata chunk so far
+ * @param node - the metaNode to be appended
+ * @param previousNode - the previous metaNode of this chunk (all zero for the first one) <return>
+ *
+ * @return - the size of the metadata chunk after appending
+ */
+int Encoder::appendMetaNode(unsigned char *metaChunkBuffer, int offset, metaNode &node, metaNode &previousNode)
+{
+    // the fingerprint is random, so it is the only field kept in full width
+    memcpy(metaChunkBuffer + offset, node.shareFP, HASH_SIZE);
+    offset += HASH_SIZE;
+
+    // consecutive nodes of a chunk mostly differ by one secretID and nothing else
+    int fields[DELTA_FIELDS] = {node.secretID, node.secretSize, node.shareSize, node.segID, node.shareID};
+    int previous[DELTA_FIELDS] = {previousNode.secretID, previousNode.secretSize, previousNode.shareSize,
+                                  previousNode.segID, previousNode.shareID};
+    offset = putDeltaFields(metaChunkBuffer, offset, fields, previous);
+
+    memcpy(&previousNode, &node, sizeof(metaNode));
+
+    return offset;
+}
+
 /*
  * collect file header
  *
@@ -567,9 +556,9 @@ void Encoder::collect_header(FileHeader_t &header)
     for(int i = 0; i < this->n_; i++) {
         memcpy(header.encoded_file_name, tmp + i * tmp_s, tmp_s);
         // add to data_thread
-        this->uploadObj_->collect_header(header, i + this->n_);
+        this->uploadObj_->collect_header(header, i + this->n_, this->fileID_);
         // add to meta_thread
-        this->uploadObj_->collect_header(header, i);
+        this->uploadObj_->collect_header(header, i, this->fileID_);
     }
 #endif
 }
@@ -24,9 +24,6 @@
 #define HASH_SIZE 32
 #define KEY_SIZE 32
 
-/* num of total shares in this system. 4 is default(k + 1) */
-#define TOTAL_SHARES_NUM 4
-
 /* num of encoder threads */
 #define NUM_THREADS 2
 
@@ -36,6 +33,13 @@
 /* max share buffer size */
 #define SHARE_BUFFER_SIZE (4 * 16 * 1024)
 
+/* metadata chunk format: magic<int> + count<int> + [shareFP + varints of the zigzag deltas of
+   (secretID, secretSize, shareSize, segID, shareID) against the previous node] ... */
+#define META_CHUNK_COMPACT_MAGIC (-0x4d43)
+#define META_CHUNK_HEAD_SIZE ((int) (2 * sizeof(int)))
+/* a 32-bit varint takes at most 5 bytes */
+#define META_NODE_MAX_COMPACT_SIZE (HASH_SIZE + 5 * 5)
+
 /* object type indicators */
 #define FILE_OBJECT 1
 #define FILE_HEADER (-9)
@@ -59,14 +63,14 @@ private:
      *
      * @param metaChunkUploadObj - the metadata chunk to be sent to uploader
      * @param metaChunkID - the ID of metadata chunk
-     * @param counter - count the number of metaNodes
+     * @param metaChunkSize - the size of the encoded metadata chunk (head included)
      * @param segID - the ID of segment
      * @param shareID - the ID of current share of a data chunk
      * @param kmCloudIndex - the index of Key Manager Server
      *
      */
-    void assignMetaShareHeader(Uploader::ItemMeta_t &metaChunkUploadObj, int &metaChunkID, int &counter, int &segID,
-                               int &shareID, short &kmCloudIndex);
+    void assignMetaShareHeader(Uploader::ItemMeta_t &metaChunkUploadObj, int &metaChunkID, int &metaChunkSize,
+                               int &segID, int &shareID, short &kmCloudIndex);
 
     /*
      * Assemble metaNodes into metadata chunks
@@ -79,19 +83,12 @@ private:
     void assembleMetadataChunks(Uploader::ItemMeta_t &metaChunkUploadObj, unsigned char *metaChunkBuffer, int &counter);
 
     /*
-     * thread handler for encoding secret into shares
+     * thread handler for encoding secret into shares and fingerprinting each share
      *
      * @param param - parameters for each thread
      */
     static void *thread_handler(void *param);
 
-    /*
-     * thread handler for calculating hash of data shares
-     *
-     * @param param - parameters for each thread
-     */
-    static void *thread_handler_hash(void *param);
-
     /*
      * collect thread for getting share objects in order
      *
@@ -157,20 +154,12 @@ public:
     /* the input secret ringbuffer */
     MessageQueue<Chunk_t> **inputbuffer_;
 
-    /* the input secret buffer queue for calculating hashes */
-    MessageQueue<Chunk_t> **calc_inputbuffer_;
+    /* the output buffer queue of encoded and fingerprinted shares */
+    MessageQueue<Chunk_t> **outputbuffer_;
 
-    /* the output secret buffer queue for calculating hashes */
-    MessageQueue<Chunk_t> **calc_outputbuffer_;
     /* thread id array */
     pthread_t tid_[NUM_THREADS + 1];
 
-    /* thread id array */
-    pthread_t calc_tid_[NUM_THREADS];
-
-    // crpyto object
-    CryptoPrimitive **calc_cryptoObj_;
-
     /* the total number of clouds */
     int n_;
 
@@ -186,6 +175,9 @@ public:
     /* uploader object */
     Uploader *uploadObj_;
 
+    /* slot of the file in the uploader */
+    int fileID_;
+
     /* crypto object array */
     CryptoPrimitive **cryptoObj_;
 
@@ -200,6 +192,18 @@ public:
         int shareID;
     } metaNode;
 
+    /*
+     * Append a metaNode to a metadata chunk in the compact format
+     *
+     * @param metaChunkBuffer - buffer of the metadata chunk
+     * @param offset - the size of the metadata chunk so far
+     * @param node - the metaNode to be appended
+     * @param previousNode - the previous metaNode of this chunk (all zero for the first one) <return>
+     *
+     * @return - the size of the metadata chunk after appending
+     */
+    int appendMetaNode(unsigned char *metaChunkBuffer, int offset, metaNode &node, metaNode &previousNode);
+
     /*
      * constructor of encoder
      *
@@ -210,6 +214,7 @@ public:
      * @param r - confidentiality degree
      * @param securetype - encryption and hash type
      * @param uploaderObj - pointer link to uploader object
+     * @param fileID - slot of the file in the uploader
      *
      *
      */
@@ -219,7 +224,8 @@ public:
             int kmServerCount,
             int r,
             int securetype,
-            Uploader *uploaderObj);
+            Uploader *uploaderObj,
+            int fileID);
 
     /*
      * destructor of encoder
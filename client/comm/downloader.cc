@@ -11,221 +11,394 @@ std::mutex Downloader::count_mutex;
 std::condition_variable Downloader::cv_mutex;
 
 /*
- * downloader thread handler
- * 
- * @param param - input param structure
+ * get a monotonic time stamp
  *
+ * @return - the time stamp in microseconds
  */
-void *Downloader::thread_handler(void *param)
+static long clock_micros()
 {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
 
-    /* parse parameters*/
-    param_t *temp_param = (param_t *) param;
-    int cloudIndex = temp_param->cloudIndex;
-    int numOfCloud = temp_param->numOfCloud;
-    Downloader *obj = temp_param->obj;
-    free(temp_param);
-
-    /* get the download initiate signal */
-    init_t signal;
-    while(obj->signalBuffer_[cloudIndex]->is_empty());
-    obj->signalBuffer_[cloudIndex]->pop(signal);
-
-    /* get filename & name size*/
-    char *filename = signal.filename;
-    int nameSize = signal.nameSize;
-    int retSize;
-    int index = 0;
-    int end = 0;
-
-    // set bool value for sending special indicator to server to not sending the 4-th shares of data chunks
-    obj->socketArray_[cloudIndex]->initDownload(filename, nameSize);
-    printf("[Data] [download] <%d> Start to download Chunk\n", cloudIndex);
-    /* start to download data into container */
-    obj->socketArray_[cloudIndex]->downloadChunk(obj->downloadContainer_[cloudIndex], &retSize, end);
-    printf("[Data] [download] <%d> retSize = %d\n", cloudIndex, retSize);
-
-    Item_t headerObj;
-    /* if no data chunk found in server, exiting... */
-    if(retSize == 0) {
-        printf("[Data] [download] <%d> No data chunks found. Exiting thread...\n", cloudIndex);
-        /* fake header data to tell Downloader::downloadFile to exit normally */
-        headerObj.type = -1;
-        /* add fake header object into ringbuffer */
-        obj->ringBuffer_[cloudIndex - DOWNLOAD_SERVER_NUMBER]->push(headerObj);
+/*
+ * receive the next reply of a server through the network engine
+ *
+ * @param conn - the server connection
+ * @param stage - the stage of the reply
+ * @param buffer - the buffer for the reply <return>
+ * @param size - the size of the reply
+ */
+void Downloader::receive_reply(serverConn_t *conn, int stage, char *buffer, int size)
+{
+    conn->stage = stage;
+    conn->lastMicros = clock_micros();
+    conn->waiting = true;
+    engine_->submitRecv(conn->cloudIndex, buffer, size, -1,
+                        (conn->cloudIndex < total_ / 2) ? &metaReceived : &dataReceived, conn);
+}
 
-        return nullptr;
+/*
+ * network engine callback of the meta servers: a reply of the meta list or the file recipe is received
+ *
+ * @param arg - the server connection
+ * @param result - the bytes received, or -errno if the server stops responding
+ */
+void Downloader::metaReceived(void *arg, int result)
+{
+    auto *conn = (serverConn_t *) arg;
+    Downloader *obj = conn->obj;
+    int cloudIndex = conn->cloudIndex;
+    conn->waiting = false;
+
+    if(result < 0) {
+        /* the server stops responding, restore from the other servers */
+        printf("[Download] <%d> server stops responding, skipped\n", cloudIndex);
+        obj->server_failed_[cloudIndex] = true;
+        obj->count_MetaList_item_[cloudIndex] = 0;
+        obj->finish_meta(conn, false);
+        return;
     }
 
-    /* get the header */
-    auto *header = (shareFileHead_t *) obj->downloadContainer_[cloudIndex];
-
-    /* parse the header object */
-    headerObj.type = 0;
-    memcpy(&(headerObj.fileObj.file_header), header, sizeof(shareFileHead_t));
-    index = sizeof(shareFileHead_t);
-
-    /* add the header object into ringbuffer */
-    obj->ringBuffer_[cloudIndex - DOWNLOAD_SERVER_NUMBER]->push(headerObj);
-    /* main loop to get data */
-    int count = 0;
-    int numOfChunk = header->numOfShares;
-    if(retSize - sizeof(shareFileHead_t) == 0) {
-        printf("[Data] [download] <%d> no need to download this chunk from this server. Exiting thread...\n",
-               cloudIndex);
-        pthread_exit(0);
-    }
+    switch(conn->stage) {
+        case DOWNLOAD_STAGE_INDICATOR:
+            if(conn->reply == INODE_NOT_FOUND) {
+                printf("[download_meta_list] Not found in server:%d\n", cloudIndex);
+                exit(-1);
+            }
+            if(conn->reply != RECEIVE_META_LIST) {
+                printf("[download_meta_list] Not correct indicator for downloading metalist\n");
+                exit(-1);
+            }
 
-    printf("[Data] [download] <%d> numOfChunk = %d in this server\n", cloudIndex, numOfChunk);
+            /* the buffer keeps the layout of the meta list: the counter, then the MetaList of every chunk */
+            obj->count_MetaList_item_[cloudIndex] = 0;
+            obj->meta_list_buffer_[cloudIndex].assign(sizeof(int), 0);
+            conn->chunk = (char *) malloc(METALIST_CHUNK_SIZE);
+            obj->receive_reply(conn, DOWNLOAD_STAGE_SIZE, (char *) &conn->reply, sizeof(int));
+            break;
 
-    double download_chunk_time = 0;
+        case DOWNLOAD_STAGE_SIZE:
+            if(conn->reply < (int) sizeof(int) || conn->reply > METALIST_CHUNK_SIZE) {
+                printf("[download_meta_list] <%d> bad meta list chunk size %d\n", cloudIndex, conn->reply);
+                metaReceived(arg, -EPROTO);
+                break;
+            }
+            conn->retSize = conn->reply;
+            obj->receive_reply(conn, DOWNLOAD_STAGE_CHUNK, conn->chunk, conn->retSize);
+            break;
 
-    while(true) {
+        case DOWNLOAD_STAGE_CHUNK: {
+            int count = 0;
+            memcpy(&count, conn->chunk, sizeof(int));
+            if(conn->retSize != (int) (sizeof(int) + count * sizeof(MetaList))) {
+                printf("[download_meta_list] <%d> meta list chunk of %d bytes holds %d entries\n", cloudIndex,
+                       conn->retSize, count);
+                metaReceived(arg, -EPROTO);
+                break;
+            }
 
-        /* if the current container has been proceed, download next container */
-        if(index == retSize) {
-#ifdef BREAKDOWN_ENABLED
-            Logger::measure_time([&]() {
-#endif
-            obj->socketArray_[cloudIndex]->downloadChunk(obj->downloadContainer_[cloudIndex], &retSize, end);
-#ifdef BREAKDOWN_ENABLED
-            }, download_chunk_time);
-#endif
-            index = 0;
-            if(retSize == 0) {
-                printf("\n[Downloader] [Data-Thread] <%d> no more data from container!!\n\n", cloudIndex);
+            /* an empty chunk ends the meta list, the file recipe indicator follows */
+            if(count > 0) {
+                std::vector<unsigned char> &metaList = obj->meta_list_buffer_[cloudIndex];
+                metaList.insert(metaList.end(), conn->chunk + sizeof(int),
+                                conn->chunk + sizeof(int) + count * sizeof(MetaList));
+                obj->count_MetaList_item_[cloudIndex] += count;
+                obj->receive_reply(conn, DOWNLOAD_STAGE_SIZE, (char *) &conn->reply, sizeof(int));
                 break;
             }
+            memcpy(obj->meta_list_buffer_[cloudIndex].data(), &obj->count_MetaList_item_[cloudIndex], sizeof(int));
+            obj->receive_reply(conn, DOWNLOAD_STAGE_RECIPE, (char *) &conn->reply, sizeof(int));
+            break;
         }
 
-        /* get the share object */
-        auto *temp = (shareEntry_t *) (obj->downloadContainer_[cloudIndex] + index);
-        int shareSize = temp->shareSize;
-
-        index += sizeof(shareEntry_t);
-
-        /* parse the share object */
-        Item_t output;
-        output.type = 1;
-        memcpy(&(output.shareObj.share_header), temp, sizeof(shareEntry_t));
-        memcpy(output.shareObj.data, obj->downloadContainer_[cloudIndex] + index, shareSize);
+        case DOWNLOAD_STAGE_RECIPE:
+            if(conn->reply == END_DOWNLOAD_INDICATOR) {
+                printf("[Download] <%d> indicator = %d! No meta data found!\n", cloudIndex, conn->reply);
+                printf("[Download] \tFile may not exist in this server!\n");
+                obj->finish_meta(conn, false);
+                break;
+            }
+            if(conn->reply != FILE_RECIPE_SUCCESS) {
+                printf("[Download] File recipe indicator error!! indicator = %d\n", conn->reply);
+                exit(-1);
+            }
 
-        index += shareSize;
+            /* the file recipe starts with the secret holding the first byte of the range */
+            obj->receive_reply(conn, DOWNLOAD_STAGE_SKIP, (char *) &conn->rangeSkip, sizeof(long));
+            break;
 
-        /* add the share object to ringbuffer */
-        obj->ringBuffer_[cloudIndex - DOWNLOAD_SERVER_NUMBER]->push(output);
-        count++;
-        if(end == 1 && index == retSize) {
-            printf("\n[Downloader] [Data-Thread] <%d> All container data processed!!(%d chunks downloaded)\n\n",
-                   cloudIndex, count);
+        case DOWNLOAD_STAGE_SKIP:
+            /* the data server hands over the file recipe of this restore only for its token */
+            obj->receive_reply(conn, DOWNLOAD_STAGE_TOKEN, (char *) &conn->recipeToken, sizeof(long));
             break;
-        }
-        if(count == numOfChunk) {
-            printf("\n[Downloader] [Data-Thread] <%d> Finish downloading all numOfChunk(%d)\n\n", cloudIndex,
-                   numOfChunk);
+
+        case DOWNLOAD_STAGE_TOKEN:
+            obj->finish_meta(conn, true);
             break;
-        }
     }
+}
+
+/*
+ * the meta list and the file recipe of a meta server are done, let downloadFile proceed once all are
+ *
+ * @param conn - the server connection
+ * @param recipe - whether the server generated the file recipe
+ */
+void Downloader::finish_meta(serverConn_t *conn, bool recipe)
+{
+    conn->stage = DOWNLOAD_STAGE_DONE;
+    free(conn->chunk);
+    conn->chunk = nullptr;
 
 #ifdef BREAKDOWN_ENABLED
     printf("\n[Time] ===================\n");
-    fprintf(stderr, "[Time] [Downloader] <data:%d> chunk_download time: is /%lf/ s\n", cloudIndex, download_chunk_time);
+    fprintf(stderr, "[Time] [Downloader] <meta:%d> metadata_handling time: is /%lf/ s\n", conn->cloudIndex,
+            (clock_micros() - conn->requestMicros) / 1e6);
     printf("[Time]===================\n\n");
 #endif
-    pthread_exit(0);
+
+    /* notify Downloader::downloadFile to proceed,
+     * which is used for preventing server blocked by minDedupCore and DedupCore at the same time*/
+    std::lock_guard<std::mutex> lock(count_mutex);
+    if(recipe) {
+        range_skip_ = conn->rangeSkip;
+    }
+    --server_mutex_num;
+    printf("[Download] <%d> server_mutex_num = %d\n", conn->cloudIndex, server_mutex_num);
+    printf("[Download] <%d> Server finished generating file recipes\n", conn->cloudIndex);
+    cv_mutex.notify_all();
 }
 
 /*
- * downloader thread handler for downloading file recipes
- * 
- * @param param - input param structure
+ * network engine callback of the data servers: a reply of the shares is received
  *
+ * @param arg - the server connection
+ * @param result - the bytes received, or -errno if the server stops responding
  */
-void *Downloader::thread_handler_meta(void *param)
+void Downloader::dataReceived(void *arg, int result)
 {
+    auto *conn = (serverConn_t *) arg;
+    Downloader *obj = conn->obj;
+    int cloudIndex = conn->cloudIndex;
+    int serverIndex = conn->serverIndex;
+
+    std::lock_guard<std::mutex> lock(conn->lock);
+    conn->waiting = false;
+    if(conn->finished) {
+        return;
+    }
 
-    /* parse parameters*/
-    auto *temp = (param_t *) param;
-    int cloudIndex = temp->cloudIndex;
-    Downloader *obj = temp->obj;
-    int numOfCloud = temp->numOfCloud;
-    string plainFileName = temp->fileName;
-    int plainFileNameLength = temp->fileNameLength;
-    free(temp);
+    if(obj->restore_done_) {
+        printf("\n[Downloader] [Data] <%d> secrets restored without the remaining shares\n\n", cloudIndex);
+        obj->finish_data(conn);
+        return;
+    }
+    if(result < 0) {
+        /* the shares received so far are still used, the other servers make up for the rest */
+        printf("\n[Downloader] [Data] <%d> server stops responding, skipped\n\n", cloudIndex);
+        obj->server_failed_[serverIndex] = true;
+        obj->finish_data(conn);
+        return;
+    }
 
-    double meta_handling_download_time = 0;
+    switch(conn->stage) {
+        case DOWNLOAD_STAGE_INDICATOR:
+            /* `NO_DATA_CHUNKS_FOUND` means empty data chunks */
+            if(ntohl(conn->reply) == NO_DATA_CHUNKS_FOUND) {
+                printf("[Data] [download] <%d> Indicator = -6! Empty data chunks.\n", cloudIndex);
+                obj->finish_data(conn);
+                break;
+            }
 
-    /* get the download initiate signal */
-    init_t signal;
-    // wait for data coming
-    while(obj->signalBuffer_[cloudIndex]->is_empty());
-    obj->signalBuffer_[cloudIndex]->pop(signal);
+            /* `END_OF_DATA_CHUNKS` means less chunks received than expected but this is normal */
+            conn->end = (ntohl(conn->reply) == END_OF_DATA_CHUNKS);
+            obj->receive_reply(conn, DOWNLOAD_STAGE_SIZE, (char *) &conn->reply, sizeof(int));
+            break;
 
-    /* get filename & name size*/
-    char *filename = signal.filename;
-    int namesize = signal.nameSize;
+        case DOWNLOAD_STAGE_SIZE:
+            conn->retSize = ntohl(conn->reply);
+            if(conn->retSize <= 0 || conn->retSize > DOWNLOAD_BUFFER_SIZE) {
+                printf("\n[Downloader] [Data] <%d> no more data from container!!(size %d)\n\n", cloudIndex,
+                       conn->retSize);
+                obj->finish_data(conn);
+                break;
+            }
 
-    char buffer[256]{};
+            /* the shares still queued keep the previous container alive, the next one is received aside */
+            conn->container = newShareBuffer(DOWNLOAD_BUFFER_SIZE);
+            obj->receive_reply(conn, DOWNLOAD_STAGE_CHUNK, conn->container->data, conn->retSize);
+            break;
 
-    /*
-     * when `down_server_index_ = 2`, and `kmServerID = 2`,
-     * in this case, `server[1]` should discard shares when `shareID = 3`
-     *
-     * But server itself do not know its own server index, so client has to send special indicator to tell server
-     * to discard shares when `shareID = 3`
-     *
-     * Q: Why are we doing this?
-     * A: 1. You may draw a table. You may find out only the server who decides to discard shareID is the one where
-     *       the last shares of data chunks stores.
-     *    2. This method could accelerate downloading speed and discard the 4-th shares for restoring in current scheme
-     * */
-    int last_share_server_ID =
-            (obj->down_server_index_ - obj->down_server_num_ + DOWNLOAD_SERVER_NUMBER) % DOWNLOAD_SERVER_NUMBER;
+        case DOWNLOAD_STAGE_CHUNK: {
+            /* the time to the first container is the latency of the server */
+            double seconds = (clock_micros() - conn->requestMicros) / 1e6;
+            if(!conn->headerSent) {
+                obj->server_latency_[serverIndex] = seconds;
+            }
+            obj->server_time_[serverIndex] += seconds;
+            obj->server_bytes_[serverIndex] += conn->retSize;
+            conn->index = 0;
+
+            /* the first container starts with the header of the file */
+            if(!conn->headerSent) {
+                auto *header = (shareFileHead_t *) conn->container->data;
+                Item_t headerObj;
+                headerObj.type = 0;
+                memcpy(&(headerObj.fileObj.file_header), header, sizeof(shareFileHead_t));
+                obj->headerBuffer_[serverIndex]->push(headerObj);
+                conn->headerSent = true;
+                conn->numOfShares = header->numOfShares;
+                conn->index = sizeof(shareFileHead_t);
+                printf("[Data] [download] <%d> numOfChunk = %d in this server\n", cloudIndex, conn->numOfShares);
+
+                if(conn->retSize == conn->index) {
+                    printf("[Data] [download] <%d> no need to download this chunk from this server.\n",
+                           cloudIndex);
+                    obj->finish_data(conn);
+                    break;
+                }
+            }
+            obj->dispatch_shares(conn);
+            break;
+        }
+    }
+}
 
-    /* initiate download request */
-    obj->socketArray_[cloudIndex]->initDownloadWithFileMeta(filename, namesize,
-                                                            plainFileName.c_str(), plainFileNameLength,
-                                                            last_share_server_ID == cloudIndex);
+/*
+ * hand the shares of the current container of a data server to the assemble threads, receive the next
+ * container once all are handed over, park the connection while a share ringbuffer is full (conn->lock held)
+ *
+ * @param conn - the server connection
+ */
+void Downloader::dispatch_shares(serverConn_t *conn)
+{
+    ShareBuffer_t *container = conn->container;
 
-#ifdef BREAKDOWN_ENABLED
-    Logger::measure_time([&]() {
-#endif
-    obj->download_meta_list(obj->meta_list_buffer_[cloudIndex].get(), obj->socketArray_[cloudIndex],
-                            obj->count_MetaList_item_[cloudIndex], cloudIndex);
+    while(conn->index < conn->retSize) {
+        /* get the share object */
+        auto *temp = (shareEntry_t *) (container->data + conn->index);
 
+        /* parse the share object */
+        Item_t output;
+        output.type = 1;
+        memcpy(&(output.shareObj.share_header), temp, sizeof(shareEntry_t));
+        output.shareObj.data = container->data + conn->index + sizeof(shareEntry_t);
+        output.shareObj.buffer = container;
+
+        /*
+         * add the share object to the ringbuffer of the thread assembling its secret; when it is full the
+         * connection waits for the thread to take a share instead of holding up the other servers
+         */
+        int assembler = (output.shareObj.share_header.secretID / DOWNLOAD_ASSEMBLE_RANGE) % DOWNLOAD_ASSEMBLE_THREADS;
+        MessageQueue<Item_t> *queue = share_buffer(conn->serverIndex, assembler);
+        holdShareBuffer(container);
+        if(!queue->try_push(output)) {
+            /* parked before trying again, so a share taken meanwhile resumes the connection */
+            conn->parked = true;
+            if(!queue->try_push(output)) {
+                releaseShareBuffer(container);
+                return;
+            }
+            conn->parked = false;
+        }
 
-    int indicator = 0;
-    obj->socketArray_[cloudIndex]->genericDownload(buffer, sizeof(int));
-    memcpy(&indicator, buffer, sizeof(int));
-    if(indicator == END_DOWNLOAD_INDICATOR) {
-        printf("[Download] <%d> indicator = %d! No meta data found!\n", cloudIndex, indicator);
-        printf("[Download] \tFile may not exist in this server!\n");
+        conn->index += sizeof(shareEntry_t) + temp->shareSize;
+        conn->count++;
+        if(conn->end && conn->index == conn->retSize) {
+            printf("\n[Downloader] [Data] <%d> All container data processed!!(%d chunks downloaded)\n\n",
+                   conn->cloudIndex, conn->count);
+            finish_data(conn);
+            return;
+        }
+        if(conn->count == conn->numOfShares) {
+            printf("\n[Downloader] [Data] <%d> Finish downloading all numOfChunk(%d)\n\n", conn->cloudIndex,
+                   conn->numOfShares);
+            finish_data(conn);
+            return;
+        }
     }
-    if(indicator != FILE_RECIPE_SUCCESS && indicator != END_DOWNLOAD_INDICATOR) {
-        printf("[Download] File recipe indicator error!! indicator = %d\n", indicator);
-        exit(-1);
+
+    /* the shares hold the container now, receive the next one */
+    releaseShareBuffer(container);
+    conn->container = nullptr;
+    conn->requestMicros = clock_micros();
+    receive_reply(conn, DOWNLOAD_STAGE_INDICATOR, (char *) &conn->reply, sizeof(int));
+}
+
+/*
+ * a data server sends no more shares: mark its share ringbuffers as done (conn->lock held)
+ *
+ * @param conn - the server connection
+ */
+void Downloader::finish_data(serverConn_t *conn)
+{
+    conn->stage = DOWNLOAD_STAGE_DONE;
+    conn->parked = false;
+    conn->finished = true;
+    if(conn->container != nullptr) {
+        releaseShareBuffer(conn->container);
+        conn->container = nullptr;
     }
 
-    /* notify Downloader::downloadFile to proceed,
-     * which is used for preventing server blocked by minDedupCore and DedupCore at the same time*/
-    std::lock_guard<std::mutex> lock(count_mutex);
-    --server_mutex_num;
-    printf("[Download] <%d> server_mutex_num = %d\n", cloudIndex, server_mutex_num);
-    if(server_mutex_num == 0) {
-        cv_mutex.notify_one();
+    /* a server without data chunks of the file sends a fake header to tell Downloader::downloadFile */
+    if(!conn->headerSent) {
+        Item_t headerObj;
+        headerObj.type = -1;
+        headerBuffer_[conn->serverIndex]->push(headerObj);
+        conn->headerSent = true;
     }
-    printf("[Download] <%d> Server finished generating file recipes\n", cloudIndex);
-#ifdef BREAKDOWN_ENABLED
-    }, meta_handling_download_time);
-#endif
+    finish_share_buffers(conn->serverIndex);
 
 #ifdef BREAKDOWN_ENABLED
     printf("\n[Time] ===================\n");
-    fprintf(stderr, "[Time] [Downloader] <meta:%d> metadata_handling time: is /%lf/ s\n", cloudIndex, meta_handling_download_time);
+    fprintf(stderr, "[Time] [Downloader] <data:%d> chunk_download time: is /%lf/ s\n", conn->cloudIndex,
+            server_time_[conn->serverIndex]);
     printf("[Time]===================\n\n");
 #endif
 
-    pthread_exit(0);
+    std::lock_guard<std::mutex> lock(count_mutex);
+    running_data_--;
+    cv_mutex.notify_all();
+}
+
+/*
+ * go on handing over the shares of a data server parked on a full share ringbuffer, after a share of it
+ * is taken
+ *
+ * @param serverIndex - the index of data server (0 to total_ / 2 - 1)
+ */
+void Downloader::resume_server(int serverIndex)
+{
+    serverConn_t *conn = conns_[serverIndex + total_ / 2];
+    if(!conn->parked) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(conn->lock);
+    if(conn->parked && !conn->finished) {
+        conn->parked = false;
+        dispatch_shares(conn);
+    }
+}
+
+/*
+ * cut off the servers taking more than DOWNLOAD_SERVER_TIMEOUT for a reply, the network engine then
+ * completes the reply with an error and the server is skipped
+ */
+void Downloader::check_server_timeouts()
+{
+    long now = clock_micros();
+    for(int i = 0; i < total_; i++) {
+        serverConn_t *conn = conns_[i];
+        if(conn == nullptr || !conn->waiting || conn->timedOut ||
+           now - conn->lastMicros < DOWNLOAD_SERVER_TIMEOUT * 1000000L) {
+            continue;
+        }
+        printf("[Download] <%d> no reply for %d s\n", i, DOWNLOAD_SERVER_TIMEOUT);
+        conn->timedOut = true;
+        shutdown(socketArray_[i]->hostSock_, SHUT_RDWR);
+    }
 }
 
 /*
@@ -248,22 +421,34 @@ Downloader::Downloader(int total, int subset, int down_server_index, int down_se
     subset_ = subset;
     decodeObj_ = obj;
     memcpy(name_, fileName, nameSize);
+    name_size_ = nameSize;
     userID_ = userID;
     down_server_index_ = down_server_index;
     down_server_num_ = down_server_num;
     server_mutex_num = total - down_server_num;
+    range_offset_ = 0;
+    range_length_ = -1;
+    range_skip_ = 0;
+    restore_done_ = false;
+    restore_failed_ = false;
 
     /* initialization */
-    ringBuffer_ = (MessageQueue<Item_t> **) malloc(sizeof(MessageQueue<Item_t> *) * total);
+    headerBuffer_ = (MessageQueue<Item_t> **) malloc(sizeof(MessageQueue<Item_t> *) * total);
+    ringBuffer_ = (MessageQueue<Item_t> **) malloc(sizeof(MessageQueue<Item_t> *) * total *
+                                                   DOWNLOAD_ASSEMBLE_THREADS);
     ringBufferMeta_ = (MessageQueue<ItemMeta_t> **) malloc(sizeof(MessageQueue<ItemMeta_t> *) * total);
-    signalBuffer_ = (MessageQueue<init_t> **) malloc(sizeof(MessageQueue<init_t> *) * total_);
     downloadMetaBuffer_ = (char **) malloc(sizeof(char *) * total_);
     downloadContainer_ = (char **) malloc(sizeof(char *) * total_);
     socketArray_ = (Socket **) malloc(sizeof(Socket *) * total_);
     headerArray_ = (fileShareMDHead_t **) malloc(sizeof(fileShareMDHead_t *) * total_);
     fileSizeCounter = (int *) malloc(sizeof(int) * total);
-    meta_list_buffer_ = std::make_unique<std::unique_ptr<unsigned char[]>[]>(total);
+    meta_list_buffer_ = std::make_unique<std::vector<unsigned char>[]>(total);
     count_MetaList_item_ = std::make_unique<int[]>(total);
+    server_bytes_ = std::make_unique<long[]>(total);
+    server_time_ = std::make_unique<double[]>(total);
+    server_latency_ = std::make_unique<double[]>(total);
+    server_used_shares_ = std::make_unique<long[]>(total);
+    server_failed_ = std::make_unique<bool[]>(total);
 
     /* open config file */
     FILE *fp = fopen("./config", "rb");
@@ -277,20 +462,10 @@ Downloader::Downloader(int total, int subset, int down_server_index, int down_se
             this->skip_config_one_line(fp, line);
             continue;
         }
-        signalBuffer_[i] = new MessageQueue<init_t>(DOWNLOAD_QUEUE_SIZE);
         ringBufferMeta_[i] = new MessageQueue<ItemMeta_t>(DOWNLOAD_QUEUE_SIZE);
         downloadMetaBuffer_[i] = (char *) malloc(sizeof(char) * DOWNLOAD_BUFFER_SIZE);
         downloadContainer_[i] = (char *) malloc(sizeof(char) * DOWNLOAD_BUFFER_SIZE);
-        meta_list_buffer_[i] = std::make_unique<unsigned char[]>(METALIST_BUFFER_SIZE);
 
-        /* create threads */
-        param_t *param = (param_t *) malloc(sizeof(param_t)); // thread's parameter
-        param->cloudIndex = i;
-        param->numOfCloud = subset_;
-        param->obj = this;
-        memcpy(param->fileName, fileName, nameSize);
-        param->fileNameLength = nameSize;
-        pthread_create(&tid_[i], 0, &thread_handler_meta, (void *) param);
         /* get config parameters */
         int ret = fscanf(fp, "%s", line);
         if(ret == 0)
@@ -304,22 +479,21 @@ Downloader::Downloader(int total, int subset, int down_server_index, int down_se
         socketArray_[i] = new Socket(ip, port, userID);
     }
     for(int i = total; i < total_; i++) {
-        if(i == (down_server_index + DOWNLOAD_SERVER_NUMBER)) {
+        if(down_server_index >= 0 && i == (down_server_index + DOWNLOAD_SERVER_NUMBER)) {
             // skip downed-server
             this->skip_config_one_line(fp, line);
             continue;
         }
-        signalBuffer_[i] = new MessageQueue<init_t>(DOWNLOAD_QUEUE_SIZE);
-        ringBuffer_[i - total] = new MessageQueue<Item_t>(DOWNLOAD_QUEUE_SIZE);
+        headerBuffer_[i - total] = new MessageQueue<Item_t>(1);
+        /* the shares of a server are spread over the assemble threads, so each takes a part of the queue size */
+        for(int j = 0; j < DOWNLOAD_ASSEMBLE_THREADS; j++) {
+            ringBuffer_[(i - total) * DOWNLOAD_ASSEMBLE_THREADS + j] =
+                    new MessageQueue<Item_t>(DOWNLOAD_QUEUE_SIZE / DOWNLOAD_ASSEMBLE_THREADS);
+        }
         downloadMetaBuffer_[i] = (char *) malloc(sizeof(char) * DOWNLOAD_BUFFER_SIZE);
-        downloadContainer_[i] = (char *) malloc(sizeof(char) * DOWNLOAD_BUFFER_SIZE);
+        // a container is allocated for every receive
+        downloadContainer_[i] = nullptr;
 
-        /* create threads */
-        param_t *param = (param_t *) malloc(sizeof(param_t)); // thread's parameter
-        param->cloudIndex = i;
-        param->numOfCloud = subset_;
-        param->obj = this;
-        pthread_create(&tid_[i], 0, &thread_handler, (void *) param);
         /* get config parameters */
         int ret = fscanf(fp, "%s", line);
         if(ret == 0)
@@ -335,6 +509,29 @@ Downloader::Downloader(int total, int subset, int down_server_index, int down_se
     fclose(fp);
     fileMDHeadSize_ = sizeof(fileShareMDHead_t);
     shareMDEntrySize_ = sizeof(shareMDEntry_t);
+
+    /* one network engine thread drives the connections of all the servers */
+    engine_ = new NetEngine(total_, DOWNLOAD_NET_BACKEND);
+    conns_ = (serverConn_t **) malloc(sizeof(serverConn_t *) * total_);
+    for(int i = 0; i < total_; i++) {
+        conns_[i] = nullptr;
+        if(i == down_server_index || (down_server_index >= 0 && i == (down_server_index + DOWNLOAD_SERVER_NUMBER))) {
+            continue;
+        }
+        conns_[i] = new serverConn_t();
+        conns_[i]->obj = this;
+        conns_[i]->cloudIndex = i;
+        conns_[i]->serverIndex = i % total;
+        conns_[i]->stage = DOWNLOAD_STAGE_INDICATOR;
+        conns_[i]->chunk = nullptr;
+        conns_[i]->container = nullptr;
+        conns_[i]->recipeToken = 0;
+        conns_[i]->waiting = false;
+        conns_[i]->parked = false;
+        engine_->addConnection(i, socketArray_[i]->hostSock_);
+    }
+    engine_->start();
+    printf("[Downloader] network engine: %s\n", engine_->getBackend() == NET_ENGINE_URING ? "io_uring" : "epoll");
 }
 
 /*
@@ -343,11 +540,13 @@ Downloader::Downloader(int total, int subset, int down_server_index, int down_se
  */
 Downloader::~Downloader()
 {
+    delete engine_;
     for(int i = 0; i < total_; i++) {
-        if(i == down_server_index_ || i == (down_server_index_ + DOWNLOAD_SERVER_NUMBER)) {
+        if(i == down_server_index_ || (down_server_index_ >= 0 && i == (down_server_index_ + DOWNLOAD_SERVER_NUMBER))) {
             continue;
         }
-        delete signalBuffer_[i];
+        free(conns_[i]->chunk);
+        delete conns_[i];
         free(downloadMetaBuffer_[i]);
         free(downloadContainer_[i]);
         delete socketArray_[i];
@@ -357,10 +556,14 @@ Downloader::~Downloader()
             continue;
         }
         delete ringBufferMeta_[i];
-        delete ringBuffer_[i];
+        delete headerBuffer_[i];
+        for(int j = 0; j < DOWNLOAD_ASSEMBLE_THREADS; j++) {
+            delete share_buffer(i, j);
+        }
     }
 
-    free(signalBuffer_);
+    free(conns_);
+    free(headerBuffer_);
     free(ringBuffer_);
     free(ringBufferMeta_);
     free(headerArray_);
@@ -382,225 +585,594 @@ Downloader::~Downloader()
 int Downloader::downloadFile(char *filename, int namesize, int numOfCloud, int numOfRestoreServer)
 {
 
-    /* temp share buffer for assemble the ring buffer data chunks*/
-    unsigned char *shareBuffer;
-    shareBuffer = (unsigned char *) malloc(sizeof(unsigned char) * RING_BUFFER_DATA_SIZE * MAX_NUMBER_OF_CLOUDS);
-
     char buffer[256];
 
     printf("[Download] [downloadFile] Wait for finishing...\n");
-    /* wait for Downloader::preDownloadFile to finish */
-    std::unique_lock<std::mutex> locker(m_mutex);
-    cv_mutex.wait(locker);
-    printf("\n[Download] [downloadFile] Start to send signal to thread_handler\n");
+    /* wait for the meta servers to generate the file recipes, cutting off the ones not replying */
+    {
+        std::unique_lock<std::mutex> locker(count_mutex);
+        while(server_mutex_num > 0) {
+            cv_mutex.wait_for(locker, std::chrono::seconds(1));
+            check_server_timeouts();
+        }
+    }
+    printf("\n[Download] [downloadFile] Start to request the shares\n");
+
+    /* tell each data server which shares to send */
+    num_of_restore_server_ = numOfRestoreServer;
+    plan_share_selection();
 
-    /* add init object for download */
-    init_t input;
+    memset(buffer, 0, 256);
+    sprintf(buffer, "%s.recipe", name_);
+    int recipeNameSize = strlen(buffer);
 
+    int numOfServer = (down_server_index_ >= 0 && down_server_index_ < total_ / 2) ? total_ / 2 - 1 : total_ / 2;
+    {
+        std::lock_guard<std::mutex> locker(count_mutex);
+        running_data_ = numOfServer;
+    }
     for(int i = total_ / 2; i < total_; i++) {
-        if(i == (down_server_index_ + DOWNLOAD_SERVER_NUMBER)) {
+        serverConn_t *conn = conns_[i];
+        if(conn == nullptr) {
             // skip downed-server
             continue;
         }
 
-        input.type = 1;
-        //copy the corresponding share as file name
-        memset(buffer, 0, 256);
-        sprintf(buffer, "%s.recipe", name_);
+        // a server failed while generating the file recipe is not asked for data
+        if(server_failed_[i - total_ / 2]) {
+            printf("[Data] [download] <%d> No data chunks found.\n", i);
+            std::lock_guard<std::mutex> locker(conn->lock);
+            finish_data(conn);
+            continue;
+        }
 
-        string uploadRecipeFileName(buffer);
-        input.nameSize = uploadRecipeFileName.length();
-        memcpy(&input.filename, uploadRecipeFileName.c_str(), input.nameSize);
-        signalBuffer_[i]->push(input);
+        struct iovec vec[DOWNLOAD_REQUEST_MAX_IOV];
+        std::vector<int> &selection = selection_[i - total_ / 2];
+        memcpy(conn->fileName, buffer, recipeNameSize);
+        int count = Socket::buildDownloadRequest(vec, conn->head, conn->fileName, recipeNameSize,
+                                                 &conns_[i - total_ / 2]->recipeToken, selection.data(),
+                                                 DOWNLOAD_MINIMAL_SHARES_ENABLED ? (int) (selection.size() / 2) : -1);
+
+        printf("[Data] [download] <%d> Start to download Chunk\n", i);
+        std::lock_guard<std::mutex> locker(conn->lock);
+        conn->requestMicros = clock_micros();
+        engine_->submitSend(i, vec, count, NULL, NULL);
+        receive_reply(conn, DOWNLOAD_STAGE_INDICATOR, (char *) &conn->reply, sizeof(int));
     }
-    printf("data download thread start\n");
 
-    /* get the header object from buffer */
-    Item_t headerObj[this->total_ / 2];
-    auto numOfShares = std::make_unique<int[]>(total_ / 2);
-
-    /* used for skipping specific server, which is no data chunks found */
-    /* for a small file, only one server with no data chunks at most */
-    int fakeIndex = -1;
-    for(int i = 0; i < total_ / 2; i++) {
-        if(i == down_server_index_) {
-            // skip downed-server
-            continue;
-        }
-        while(ringBuffer_[i]->is_empty());
-        ringBuffer_[i]->pop(headerObj[i]);
-        if(headerObj[i].type == -1) {
-            /* if it's fake headerObj, skip */
-            fakeIndex = i;
-            printf("[Data] <%d> fakeIndex = %d\n", i, fakeIndex);
+    /*
+     * start as soon as a server tells the file header, the slower servers catch up or are skipped;
+     * a server without data chunks of the file (e.g., a small file) sends a fake header
+     */
+    Item_t headerObj;
+    shareFileHead_t *header = nullptr;
+    auto headerReceived = std::make_unique<bool[]>(total_ / 2);
+    int numOfHeaders = 0;
+    while(header == nullptr && numOfHeaders < numOfServer) {
+        check_server_timeouts();
+        for(int i = 0; i < total_ / 2; i++) {
+            if(i == down_server_index_ || headerReceived[i] || !headerBuffer_[i]->pop(headerObj)) {
+                continue;
+            }
+            headerReceived[i] = true;
+            numOfHeaders++;
+            printf("[Data] [downloadFile] %d's header extracted\n", i + total_ / 2);
+            if(headerObj.type != -1) {
+                header = &(headerObj.fileObj.file_header);
+                break;
+            }
         }
-        numOfShares[i] = headerObj[i].fileObj.file_header.numOfShares;
-        printf("[Data] [downloadFile] %d's header extracted\n", i + total_ / 2);
     }
-
-    /* parse header object, tell decoder the total number of secret */
-    shareFileHead_t *header;
-    for(int i = 0; i < this->total_ / 2; ++i) {
-        if(headerObj[i].type != -1 && i != this->down_server_index_) {
-            // only get valid data from one time under complex situation then break
-            header = &(headerObj[i].fileObj.file_header);
-            break;
+    if(header == nullptr) {
+        // e.g., a byte range behind the end of the file
+        printf("[Data] [downloadFile] no data chunks to restore\n");
+        decodeObj_->setFileSize(0);
+        for(int i = 0; i < DECODE_NUM_THREADS; ++i) {
+            decodeObj_->inputbuffer_[i]->set_job_done();
         }
+        return 0;
     }
+
+    /* for a byte range, the size of the secrets covering the range */
     long fileSize = header->fileSize;
     decodeObj_->setFileSize(fileSize);
+    decodeObj_->setRange(range_skip_, range_length_);
+    decodeObj_->preallocate();
     printf("fileSize = %ld\n", fileSize);
 
-    /* proceed each secret */
-    int count = 0;
-    long countSize = 0;
-    auto countShares = std::make_unique<int[]>(total_ / 2);
-    auto meta_list_array = std::make_unique<MetaList[]>(total_ / 2);
-
-    auto meta_list_loop_num = std::make_unique<int[]>(total_ / 2);
-    auto meta_list_offset = std::make_unique<int[]>(total_ / 2);
-    auto chunk_num_in_meta_chunk = std::make_unique<int[]>(total_ / 2);
-    auto segID = std::make_unique<int[]>(total_ / 2);
-    std::vector<int> kShareIDList(numOfRestoreServer);
-    for(int i = 0; i < total_ / 2; ++i) {
-        if(i == this->down_server_index_) {
-            // skip downed-server
-            continue;
-        }
-        segID[i] = -1;
-        meta_list_loop_num[i] = 0;
-        meta_list_offset[i] = sizeof(int);
+    /* assemble the secrets in parallel, every thread takes every DOWNLOAD_ASSEMBLE_THREADS-th range of secrets */
+    handoff_range_ = 0;
+    handoff_offset_ = 0;
+    running_assemblers_ = DOWNLOAD_ASSEMBLE_THREADS;
+    for(int i = 0; i < DOWNLOAD_ASSEMBLE_THREADS; i++) {
+        auto *param = (assembleParam_t *) malloc(sizeof(assembleParam_t));
+        param->index = i;
+        param->obj = this;
+        pthread_create(&assembleTid_[i], 0, &assemble_handler, (void *) param);
     }
 
-    int secretID = 0;
+    /* the servers not replying meanwhile are cut off, so the assemble threads do not wait for them forever */
+    {
+        std::unique_lock<std::mutex> locker(handoff_mutex_);
+        while(running_assemblers_ > 0) {
+            handoff_cv_.wait_for(locker, std::chrono::seconds(1));
+            check_server_timeouts();
+        }
+    }
+    for(int i = 0; i < DOWNLOAD_ASSEMBLE_THREADS; i++) {
+        pthread_join(assembleTid_[i], NULL);
+    }
 
-    double assemble_time = 0;
+    for(int i = 0; i < DECODE_NUM_THREADS; ++i) {
+        decodeObj_->inputbuffer_[i]->set_job_done();
+    }
 
-    while(countSize < fileSize) {
-        int secretSize = 0;
-        int shareSize = 0;
-        int shareBufferIndex = 0;
-        // skip current chunk once reached k shares
-        int share_num = 0;
-        if(!TRACE_DRIVEN_FSL_ENABLED) {
-            if(count % 10000 == 0) {
-                // print message to tell users the program is still working
-                printf("\n==============  ID = %d\n", count);
+    /*
+     * the secrets are restored, stop receiving the shares of the slower servers that are not needed any more:
+     * a reply being received is cut off and ends the server, a parked server is ended at once
+     */
+    restore_done_ = true;
+    for(int i = total_ / 2; i < total_; i++) {
+        serverConn_t *conn = conns_[i];
+        if(conn == nullptr) {
+            continue;
+        }
+        std::lock_guard<std::mutex> locker(conn->lock);
+        if(conn->finished) {
+            continue;
+        }
+        if(conn->waiting) {
+            shutdown(socketArray_[i]->hostSock_, SHUT_RDWR);
+        } else {
+            finish_data(conn);
+        }
+    }
+    {
+        std::unique_lock<std::mutex> locker(count_mutex);
+        cv_mutex.wait(locker, [&]() { return running_data_ == 0; });
+    }
+    for(int i = 0; i < total_ / 2; i++) {
+        if(i == down_server_index_) {
+            continue;
+        }
+        // drop the shares not used
+        Item_t discard;
+        for(int j = 0; j < DOWNLOAD_ASSEMBLE_THREADS; j++) {
+            MessageQueue<Item_t> *queue = share_buffer(i, j);
+            while(queue->pop(discard)) {
+                releaseShareBuffer(discard.shareObj.buffer);
             }
         }
-        int extract_num = 0;
-        int shareID = 0;
+    }
 
-        for(int i = 0; i < total_ / 2; i++) {
-            if(i == this->down_server_index_ || i == fakeIndex) {
-                // 1. skip downed server
-                // 2. skip the remaining precess when fake header encountered
-                continue;
-            }
+    print_server_stats();
+    if(restore_failed_) {
+        printf("download failed!\n");
+        return -1;
+    }
+    printf("download over!\n");
+    return 0;
+}
 
-            if(meta_list_loop_num[i] == this->count_MetaList_item_[i] && secretID > meta_list_array[i].end_secretID) {
-                // already extracted all metalist, no more data shares on server[i], skip
-                continue;
-            }
+/*
+ * assemble thread handler: assemble the secrets of every DOWNLOAD_ASSEMBLE_THREADS-th range and hand them
+ * to the decoder in order
+ *
+ * @param param - input param structure
+ *
+ */
+void *Downloader::assemble_handler(void *param)
+{
+    /* parse parameters*/
+    auto *temp = (assembleParam_t *) param;
+    int index = temp->index;
+    Downloader *obj = temp->obj;
+    free(temp);
 
-            Item_t output;
+    int numOfServer = obj->total_ / 2;
 
-            ringBuffer_[i]->read(output);
-            this->error_check_segID(output);
+    /* the secrets of a range are handed to the decoder together */
+    auto *batch = (Decoder::ShareChunk_t *) malloc(sizeof(Decoder::ShareChunk_t) * DOWNLOAD_ASSEMBLE_RANGE);
 
-            if(output.shareObj.share_header.secretID != secretID) {
-                // not the right time to extract from this server, then skip item from this server
-                continue;
-            }
+    /* every thread walks the meta lists on its own, as it only sees a part of the shares of each server */
+    auto meta_list_array = std::make_unique<MetaList[]>(numOfServer);
+    auto meta_list_loop_num = std::make_unique<int[]>(numOfServer);
+    auto meta_list_offset = std::make_unique<int[]>(numOfServer);
+    auto segID = std::make_unique<int[]>(numOfServer);
+    auto usedShares = std::make_unique<long[]>(numOfServer);
+    std::vector<int> kShareIDList(obj->num_of_restore_server_);
+    for(int i = 0; i < numOfServer; ++i) {
+        segID[i] = -1;
+        usedShares[i] = 0;
+        meta_list_loop_num[i] = 0;
+        meta_list_offset[i] = sizeof(int);
+    }
 
 #ifdef BREAKDOWN_ENABLED
-            Logger::measure_time([&]() {
+    double assemble_time = 0;
+    double handoff_time = 0;
 #endif
-            if(output.shareObj.share_header.segID != segID[i]) {
-                this->extract_meta_list(this->meta_list_buffer_[i].get(), meta_list_offset[i], meta_list_loop_num[i],
-                                        meta_list_array[i]);
-                segID[i] = meta_list_array[i].id;
-            }
+    int numOfSecrets = 0;
 
+    for(int range = index;; range += DOWNLOAD_ASSEMBLE_THREADS) {
+        int batchSize = 0;
 #ifdef BREAKDOWN_ENABLED
-            }, assemble_time);
+        Logger::measure_time([&]() {
 #endif
-            if(!ringBuffer_[i]->pop(output)){
-                continue;
+        batchSize = obj->assemble_range(range, batch, kShareIDList, meta_list_array.get(), meta_list_offset.get(),
+                                        meta_list_loop_num.get(), segID.get(), usedShares.get());
+#ifdef BREAKDOWN_ENABLED
+        }, assemble_time);
+#endif
+        if(batchSize < 0) {
+            // wake up the threads waiting for this range to be handed over
+            {
+                std::lock_guard<std::mutex> locker(obj->handoff_mutex_);
             }
+            obj->handoff_cv_.notify_all();
+            break;
+        }
+        if(batchSize == 0) {
+            // the file ended in an earlier range
+            break;
+        }
 
-            if(output.shareObj.share_header.shareID == -1) {
-                // skip the placeholder of data shares
-                continue;
+        bool handedOver = false;
+#ifdef BREAKDOWN_ENABLED
+        Logger::measure_time([&]() {
+#endif
+        /* wait for the previous range to be handed over, it tells where the secrets of this range start */
+        {
+            std::unique_lock<std::mutex> locker(obj->handoff_mutex_);
+            obj->handoff_cv_.wait(locker, [&]() { return obj->handoff_range_ == range || obj->restore_failed_; });
+        }
+        handedOver = !obj->restore_failed_;
+        if(handedOver) {
+            for(int j = 0; j < batchSize; j++) {
+                batch[j].offset = obj->handoff_offset_;
+                obj->handoff_offset_ += batch[j].secretSize;
+                obj->decodeObj_->add(&batch[j], batch[j].secretID % DECODE_NUM_THREADS);
             }
 
+            {
+                std::lock_guard<std::mutex> locker(obj->handoff_mutex_);
+                obj->handoff_range_ = range + 1;
+            }
+            obj->handoff_cv_.notify_all();
+        }
 #ifdef BREAKDOWN_ENABLED
-            Logger::measure_time([&]() {
+        }, handoff_time);
 #endif
-            this->assign_kShareID_in_list(kShareIDList[shareBufferIndex], meta_list_array[i].shareID);
-
-            ++countShares[i];
-            ++extract_num;
-            secretSize = output.shareObj.share_header.secretSize;
-            shareSize = output.shareObj.share_header.shareSize;
-            secretID = output.shareObj.share_header.secretID;
-            shareID = output.shareObj.share_header.shareID;
-            if(shareID < 0) {
-                printf("[DownloadFile] shareID = %d!! Exiting...", shareID);
-                exit(-1);
-            }
+        if(!handedOver) {
+            // another thread gave up before this range was handed over
+            obj->release_batch(batch, batchSize);
+            break;
+        }
+        numOfSecrets += batchSize;
 
-            ++share_num;
+        if(batchSize < DOWNLOAD_ASSEMBLE_RANGE) {
+            // last range of the file
+            break;
+        }
+    }
+
+    free(batch);
+    printf("[Downloader] <assemble:%d> %d secrets assembled\n", index, numOfSecrets);
+    {
+        std::lock_guard<std::mutex> locker(obj->handoff_mutex_);
+        for(int i = 0; i < numOfServer; ++i) {
+            obj->server_used_shares_[i] += usedShares[i];
+        }
+        obj->running_assemblers_--;
+    }
+    obj->handoff_cv_.notify_all();
 
-            memcpy(shareBuffer + shareBufferIndex * shareSize, output.shareObj.data, shareSize);
-            shareBufferIndex++;
 #ifdef BREAKDOWN_ENABLED
-            }, assemble_time);
+    printf("\n[Time] ===================\n");
+    fprintf(stderr, "[Time] [Downloader] <assemble:%d> assemble time: is /%lf/ s\n", index, assemble_time);
+    fprintf(stderr, "[Time] [Downloader] <assemble:%d> handoff time: is /%lf/ s\n", index, handoff_time);
+    printf("[Time]===================\n\n");
 #endif
-        }
-        countSize += secretSize;
+    return nullptr;
+}
+
+/*
+ * assemble the secrets of one range: take the first shares of each secret that arrive from the servers
+ *
+ * @param range - the index of the range of secrets
+ * @param batch - the buffer for the assembled secrets<return>
+ * @param kShareIDList - the IDs of the k shares of the last assembled secret<return>
+ * @param meta_list_array - the current MetaList of each server<return>
+ * @param meta_list_offset - the offset of reading meta_list of each server<return>
+ * @param meta_list_loop_num - the number of extracted MetaList of each server<return>
+ * @param segID - the segment ID of the current MetaList of each server<return>
+ * @param usedShares - the number of shares of each server used for the secrets<return>
+ *
+ * @return - the number of assembled secrets, less than a range only at the end of the file
+ * */
+int Downloader::assemble_range(int range, Decoder::ShareChunk_t *batch, std::vector<int> &kShareIDList,
+                               MetaList *meta_list_array, int *meta_list_offset, int *meta_list_loop_num, int *segID,
+                               long *usedShares)
+{
+    int assembler = range % DOWNLOAD_ASSEMBLE_THREADS;
+    int batchSize = 0;
+    Item_t output;
+
+    int numOfServer = total_ / 2;
+    auto pending = std::make_unique<bool[]>(numOfServer);
+
+    for(int secretID = range * DOWNLOAD_ASSEMBLE_RANGE; secretID < (range + 1) * DOWNLOAD_ASSEMBLE_RANGE; secretID++) {
+        Decoder::ShareChunk_t *package = &batch[batchSize];
+        int secretSize = 0;
+        int shareSize = 0;
+        int shareBufferIndex = 0;
+        // the number of servers holding the secret, the placeholders of data shares included
+        int found = 0;
+
         if(!TRACE_DRIVEN_FSL_ENABLED) {
-            if(count % 10000 == 0 && count != 0) {
-                printf("[Data] [DownloadFile] 3000 chunks downloaded\n");
+            if(secretID % 10000 == 0) {
+                // print message to tell users the program is still working
+                printf("\n==============  ID = %d\n", secretID);
             }
         }
 
-        /* add the share buffer to the decoder ringbuffer */
-        Decoder::ShareChunk_t package;
-#ifdef BREAKDOWN_ENABLED
-        Logger::measure_time([&]() {
-#endif
-        package.secretSize = secretSize;
-        package.shareSize = shareSize;
-        package.secretID = secretID;
+        /*
+         * every server is asked for the secret, the first k shares that arrive are used:
+         * a slow server is not waited for once the others have made up the k shares;
+         * in the minimal shares mode only the servers picked for the secret send it, the others are not waited for
+         */
+        int numOfPending = 0;
+        for(int i = 0; i < numOfServer; i++) {
+            pending[i] = (i != this->down_server_index_) &&
+                         (!DOWNLOAD_MINIMAL_SHARES_ENABLED || is_selected(i, secretID));
+            numOfPending += pending[i];
+        }
+        if(DOWNLOAD_MINIMAL_SHARES_ENABLED && numOfPending == 0) {
+            // no server is picked for the secret, the file ends before it
+            break;
+        }
+        while(shareBufferIndex < num_of_restore_server_ && numOfPending > 0 && !restore_failed_) {
+            for(int i = 0; i < numOfServer && shareBufferIndex < num_of_restore_server_; i++) {
+                if(!pending[i]) {
+                    continue;
+                }
+
+                MessageQueue<Item_t> *queue = share_buffer(i, assembler);
+                if(queue->is_empty()) {
+                    if(queue->done_ && queue->is_empty()) {
+                        // no more data shares on server[i] for this thread
+                        pending[i] = false;
+                        numOfPending--;
+                    }
+                    // otherwise look at the other servers while this one catches up
+                    continue;
+                }
+
+                queue->read(output);
+                this->error_check_segID(output);
+
+                if(output.shareObj.share_header.secretID < secretID) {
+                    // a late share of a secret restored from the faster servers, drop it
+                    queue->pop(output);
+                    releaseShareBuffer(output.shareObj.buffer);
+                    resume_server(i);
+                    continue;
+                }
+                pending[i] = false;
+                numOfPending--;
+                if(output.shareObj.share_header.secretID > secretID) {
+                    // the server holds no share of the secret
+                    continue;
+                }
+                ++found;
+
+                /*
+                 * the thread skips the shares of other ranges, so move forward to the MetaList of the segment;
+                 * the MetaLists of a segment repeated in the file carry the same shareID
+                 */
+                while(output.shareObj.share_header.segID != segID[i]) {
+                    if(meta_list_loop_num[i] == this->count_MetaList_item_[i]) {
+                        printf("[DownloadFile] <%d> segID = %d not in meta_list!! Exiting...\n", i,
+                               output.shareObj.share_header.segID);
+                        exit(-1);
+                    }
+                    this->extract_meta_list(this->meta_list_buffer_[i].data(), meta_list_offset[i],
+                                            meta_list_loop_num[i], meta_list_array[i]);
+                    segID[i] = meta_list_array[i].id;
+                }
+
+                queue->pop(output);
+                resume_server(i);
+
+                if(output.shareObj.share_header.shareID == -1) {
+                    // skip the placeholder of data shares
+                    releaseShareBuffer(output.shareObj.buffer);
+                    continue;
+                }
+
+                this->assign_kShareID_in_list(kShareIDList[shareBufferIndex], meta_list_array[i].shareID);
+
+                secretSize = output.shareObj.share_header.secretSize;
+                shareSize = output.shareObj.share_header.shareSize;
+                if(output.shareObj.share_header.shareID < 0) {
+                    printf("[DownloadFile] shareID = %d!! Exiting...", output.shareObj.share_header.shareID);
+                    exit(-1);
+                }
+
+                // the share is decoded from its container, the reference of the item goes with it
+                package->shares[shareBufferIndex] = output.shareObj.data;
+                package->buffers[shareBufferIndex] = output.shareObj.buffer;
+                shareBufferIndex++;
+                usedShares[i]++;
+            }
+        }
+
+        if(!DOWNLOAD_MINIMAL_SHARES_ENABLED && !restore_failed_ && found == 0) {
+            // every server has sent all its shares, the file ends before this secret
+            break;
+        }
+        if(restore_failed_ || shareBufferIndex < num_of_restore_server_) {
+            if(!restore_failed_) {
+                printf("[DownloadFile] only %d shares of secret %d received!! The restore fails\n", shareBufferIndex,
+                       secretID);
+                restore_failed_ = true;
+            }
+            for(int j = 0; j < shareBufferIndex; j++) {
+                releaseShareBuffer(package->buffers[j]);
+            }
+            release_batch(batch, batchSize);
+            return -1;
+        }
+
+        package->secretSize = secretSize;
+        package->shareSize = shareSize;
+        package->secretID = secretID;
 
         // update kShareIDList for this data chunk
         for(int j = 0; j < kShareIDList.size(); ++j) {
-            package.kShareIDList[j] = kShareIDList[j];
+            package->kShareIDList[j] = kShareIDList[j];
         }
+        batchSize++;
+    }
 
-        memcpy(&(package.data), shareBuffer, numOfRestoreServer * shareSize);
-#ifdef BREAKDOWN_ENABLED
-        }, assemble_time);
-#endif
-        decodeObj_->add(&package, count % DECODE_NUM_THREADS);
-        // pre-assign what the next secretID is
-        ++secretID;
-        count++;
+    return batchSize;
+}
+
+/*
+ * test if the shares of a secret are requested from a server, in the minimal shares mode
+ *
+ * @param serverIndex - the index of data server (0 to total_ / 2 - 1)
+ * @param secretID - the ID of the secret
+ *
+ * @return - a boolean value that indicates if the server sends its share of the secret
+ * */
+bool Downloader::is_selected(int serverIndex, int secretID)
+{
+    /* the ranges are sorted [first, last] pairs, an odd position is inside a range */
+    std::vector<int> &ranges = selection_[serverIndex];
+    auto position = std::lower_bound(ranges.begin(), ranges.end(), secretID) - ranges.begin();
+    if(position == (long) ranges.size()) {
+        return false;
     }
-    for(int i = 0; i < DECODE_NUM_THREADS; ++i) {
-        decodeObj_->inputbuffer_[i]->set_job_done();
+    return (position % 2 == 1) || ranges[position] == secretID;
+}
+
+/*
+ * give back the shares of the secrets not handed to the decoder
+ *
+ * @param batch - the assembled secrets
+ * @param batchSize - the number of assembled secrets
+ * */
+void Downloader::release_batch(Decoder::ShareChunk_t *batch, int batchSize)
+{
+    for(int i = 0; i < batchSize; i++) {
+        for(int j = 0; j < num_of_restore_server_; j++) {
+            releaseShareBuffer(batch[i].buffers[j]);
+        }
     }
+}
 
-    free(shareBuffer);
-    printf("download over!\n");
+/*
+ * print how each server served the restore
+ * */
+void Downloader::print_server_stats()
+{
+    printf("\n[Downloader] servers of the restore:\n");
+    for(int i = 0; i < total_ / 2; i++) {
+        if(i == down_server_index_) {
+            continue;
+        }
+        double throughput = (server_time_[i] > 0) ? server_bytes_[i] / server_time_[i] / 1024 / 1024 : 0;
+        printf("\t<%d> latency %lf s, %ld bytes received at %.2lf MB/s, %ld shares used%s\n", i + total_ / 2,
+               server_latency_[i], server_bytes_[i], throughput, server_used_shares_[i],
+               server_failed_[i] ? ", stopped responding" : "");
+    }
+}
 
-#ifdef BREAKDOWN_ENABLED
-    printf("\n[Time] ===================\n");
-    fprintf(stderr, "[Time] [Downloader] <downloadFile> assemble time: is /%lf/ s\n", assemble_time);
-    printf("[Time]===================\n\n");
-#endif
-    return 0;
+/*
+ * pick the k servers sending the shares of each segment of the file from the meta lists, the least loaded
+ * servers first, into selection_
+ * */
+void Downloader::plan_share_selection()
+{
+    int numOfServer = total_ / 2;
+    selection_.assign(numOfServer, std::vector<int>());
+    if(!DOWNLOAD_MINIMAL_SHARES_ENABLED) {
+        return;
+    }
+
+    /* the segments in the order of the file (by their last secret), with the servers holding them */
+    std::map<int, std::vector<int>> holders;
+    MetaList metaList;
+    for(int i = 0; i < numOfServer; i++) {
+        if(i == down_server_index_ || server_failed_[i]) {
+            continue;
+        }
+        int offset = sizeof(int);
+        int loopNum = 0;
+        while(loopNum < count_MetaList_item_[i]) {
+            extract_meta_list(meta_list_buffer_[i].data(), offset, loopNum, metaList);
+            std::vector<int> &servers = holders[metaList.end_secretID];
+            if(servers.empty() || servers.back() != i) {
+                servers.push_back(i);
+            }
+        }
+    }
+
+    auto load = std::make_unique<long[]>(numOfServer);
+    int firstSecretID = 0;
+    for(auto &segment : holders) {
+        int lastSecretID = segment.first;
+        std::vector<int> &servers = segment.second;
+        if((int) servers.size() < num_of_restore_server_) {
+            printf("[Download] only %lu servers hold secrets %d to %d!!\n", servers.size(), firstSecretID,
+                   lastSecretID);
+        }
+        std::stable_sort(servers.begin(), servers.end(), [&](int a, int b) { return load[a] < load[b]; });
+        for(int j = 0; j < num_of_restore_server_ && j < (int) servers.size(); j++) {
+            load[servers[j]] += lastSecretID - firstSecretID + 1;
+            std::vector<int> &ranges = selection_[servers[j]];
+            if(!ranges.empty() && ranges.back() == firstSecretID - 1) {
+                ranges.back() = lastSecretID;
+            } else {
+                ranges.push_back(firstSecretID);
+                ranges.push_back(lastSecretID);
+            }
+        }
+        firstSecretID = lastSecretID + 1;
+    }
+
+    for(int i = 0; i < numOfServer; i++) {
+        if(i != down_server_index_) {
+            printf("[Download] <%d> shares of %ld secrets in %lu ranges requested\n", i + numOfServer, load[i],
+                   selection_[i].size() / 2);
+        }
+    }
+}
+
+/*
+ * get the share ringbuffer of a server read by an assemble thread
+ *
+ * @param serverIndex - the index of data server (0 to total_ / 2 - 1)
+ * @param assembler - the index of assemble thread
+ *
+ * @return - the ringbuffer
+ * */
+MessageQueue<Downloader::Item_t> *Downloader::share_buffer(int serverIndex, int assembler)
+{
+    return ringBuffer_[serverIndex * DOWNLOAD_ASSEMBLE_THREADS + assembler];
+}
+
+/*
+ * mark every share ringbuffer of a server as done, no more shares come from the server
+ *
+ * @param serverIndex - the index of data server (0 to total_ / 2 - 1)
+ * */
+void Downloader::finish_share_buffers(int serverIndex)
+{
+    for(int j = 0; j < DOWNLOAD_ASSEMBLE_THREADS; j++) {
+        share_buffer(serverIndex, j)->set_job_done();
+    }
 }
 
 /*
@@ -633,19 +1205,38 @@ int Downloader::preDownloadFile(char *filename, int nameSize, int numOfCloud)
     printf("\n");
     printf("[preDownloadFile] encoded file name size: %d\n", tmp_s);
 
-    /* add init object for download */
-    init_t input;
+    /*
+     * when `down_server_index_ = 2`, and `kmServerID = 2`,
+     * in this case, `server[1]` should discard shares when `shareID = 3`
+     *
+     * But server itself do not know its own server index, so client has to send special indicator to tell server
+     * to discard shares when `shareID = 3`
+     *
+     * Q: Why are we doing this?
+     * A: 1. You may draw a table. You may find out only the server who decides to discard shareID is the one where
+     *       the last shares of data chunks stores.
+     *    2. This method could accelerate downloading speed and discard the 4-th shares for restoring in current scheme
+     * */
+    int last_share_server_ID =
+            (down_server_index_ - down_server_num_ + DOWNLOAD_SERVER_NUMBER) % DOWNLOAD_SERVER_NUMBER;
+
+    /* initiate download request, the corresponding share of the encoded name is the file name */
     for(int i = 0; i < numOfCloud; i++) {
-        if(i == this->down_server_index_) {
+        serverConn_t *conn = conns_[i];
+        if(conn == nullptr) {
             // skip downed-server
             continue;
         }
-        input.type = 1;
 
-        //copy the corresponding share as file name
-        memcpy(&input.filename, tmp + i * tmp_s, tmp_s);
-        input.nameSize = tmp_s;
-        signalBuffer_[i]->push(input);
+        struct iovec vec[DOWNLOAD_REQUEST_MAX_IOV];
+        memcpy(conn->fileName, tmp + i * tmp_s, tmp_s);
+        int count = Socket::buildMetaRequest(vec, conn->head, conn->range, conn->fileName, tmp_s, name_, name_size_,
+                                             !DOWNLOAD_MINIMAL_SHARES_ENABLED && down_server_num_ > 0 &&
+                                             last_share_server_ID == i, range_offset_, range_length_);
+
+        conn->requestMicros = clock_micros();
+        engine_->submitSend(i, vec, count, NULL, NULL);
+        receive_reply(conn, DOWNLOAD_STAGE_INDICATOR, (char *) &conn->reply, sizeof(int));
     }
 
     printf("pre - download over!\n");
@@ -659,55 +1250,12 @@ int Downloader::preDownloadFile(char *filename, int nameSize, int numOfCloud)
  */
 int Downloader::indicateEnd()
 {
-    for(int i = 0; i < total_; i++) {
-        if(i == this->down_server_index_ || i == (this->down_server_index_ + this->total_ / 2)) {
-            continue;
-        }
-        /* trying to join all threads */
-        pthread_join(tid_[i], NULL);
-    }
+    /* every server is done once the file is restored */
+    engine_->stop();
     return 1;
 }
 
 
-/*
- * download meta list from server
- *
- * @param metalist_buffer - the buffer storing meta_list<return>
- * @param socket - socket object for receiving data from server
- * @param counter - count the number of meta_list in meta_list_buffer
- *
- * */
-void Downloader::download_meta_list(unsigned char *metalist_buffer, Socket *socket, int &counter, int cloudIndex)
-{
-    auto buffer = std::make_unique<char[]>(256);
-
-    // 1. receive indicator
-    int indicator = 0;
-    socket->genericDownload(buffer.get(), sizeof(int));
-    memcpy(&indicator, buffer.get(), sizeof(int));
-
-    if(indicator == INODE_NOT_FOUND) {
-        printf("[download_meta_list] Not found in server:%d\n", cloudIndex);
-        exit(-1);
-    }
-
-    if(indicator != RECEIVE_META_LIST) {
-        printf("[download_meta_list] Not correct indicator for downloading metalist\n");
-        exit(-1);
-    }
-
-    // 2. receive totalSize
-    int totalSize = 0;
-
-    socket->genericDownload(buffer.get(), sizeof(int));
-    memcpy(&totalSize, buffer.get(), sizeof(int));
-
-    // 3. receive metalist_buffer
-    socket->genericDownload((char *) metalist_buffer, totalSize);
-    memcpy(&counter, metalist_buffer, sizeof(int));
-}
-
 /*
  * set the number of downed servers
  *
@@ -730,6 +1278,19 @@ void Downloader::set_down_server_index(int index)
     this->down_server_index_ = index;
 }
 
+/*
+ * restore a byte range of the file instead of the whole file, set before preDownloadFile
+ *
+ * @param offset - the offset of the byte range
+ * @param length - the length of the byte range (< 0 for up to the end of the file)
+ *
+ * */
+void Downloader::set_restore_range(long offset, long length)
+{
+    this->range_offset_ = offset;
+    this->range_length_ = length;
+}
+
 /*
  * skip one line from config file
  *
@@ -11,6 +11,7 @@
 #include <cerrno>
 #include <fcntl.h>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <netinet/in.h>
@@ -21,6 +22,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
 #include <vector>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -31,6 +33,7 @@
 #include "decoder.hh"
 #include "Logger.hh"
 #include "MessageQueue.hh"
+#include "NetEngine.hh"
 #include "socket.hh"
 
 /* Server Number (may be deleted in later version)*/
@@ -39,6 +42,35 @@
 /* downloader buffer queue size */
 #define DOWNLOAD_QUEUE_SIZE 2048
 
+/* number of threads assembling shares into secrets for the decoder */
+#define DOWNLOAD_ASSEMBLE_THREADS 4
+
+/* number of consecutive secrets assembled by one thread before the next thread takes over */
+#define DOWNLOAD_ASSEMBLE_RANGE 32
+
+/* seconds a server may take for a reply before it is taken as down and skipped */
+#define DOWNLOAD_SERVER_TIMEOUT 30
+
+/* backend of the network engine (io_uring where the kernel supports it, epoll otherwise) */
+#define DOWNLOAD_NET_BACKEND NET_ENGINE_AUTO
+
+/* stages of a server connection, by the reply being received */
+#define DOWNLOAD_STAGE_INDICATOR 0 // meta: the meta list indicator; data: the indicator of a container
+#define DOWNLOAD_STAGE_SIZE 1 // meta: the size of a meta list chunk; data: the size of a container
+#define DOWNLOAD_STAGE_CHUNK 2 // meta: a meta list chunk; data: a container
+#define DOWNLOAD_STAGE_RECIPE 3 // meta: the file recipe indicator
+#define DOWNLOAD_STAGE_SKIP 4 // meta: where the byte range starts in the first secret
+#define DOWNLOAD_STAGE_TOKEN 5 // meta: the token of the restore, sent back to the data server
+#define DOWNLOAD_STAGE_DONE 6
+
+/*
+ * ask each server only for the shares of the secrets it is picked for, every secret from k servers
+ * (1: enable, saves the bandwidth of the other shares, but the shares of a failed server are not asked again
+ * from the other servers holding them, so the restore fails; 0: every server sends all its shares, the first k
+ * that arrive are used, which rides out a failed server)
+ */
+#define DOWNLOAD_MINIMAL_SHARES_ENABLED 0
+
 /* downloader ringbuffer data max size */
 // META_BUFFER supports up to 16MB segment size
 #define RING_BUFFER_DATA_SIZE (16 * 1024)
@@ -57,8 +89,8 @@
 #define END_DOWNLOAD_INDICATOR (-12)
 #define FILE_RECIPE_SUCCESS (-111)
 
-/* the size of metalist buffer */
-#define METALIST_BUFFER_SIZE (100 << 20) // size: 100MB
+/* the max size of a chunk of the meta list streamed from a server, an empty chunk ends the meta list */
+#define METALIST_CHUNK_SIZE (64 << 10) // size: 64KB
 
 /* the indicator of downloading meta_list back from server */
 #define RECEIVE_META_LIST (1001)
@@ -91,15 +123,14 @@ private:
     //count servers to prevent downloadFile starting before finishing downloadFileRecipe
     static int server_mutex_num;
 
-    //mutex for server_mutex_num
+    //mutex for server_mutex_num and running_data_
     static std::mutex count_mutex;
 
-    //mutex for condition_variable
-    std::mutex m_mutex;
+    //condition_variable notified when a server finishes
     static std::condition_variable cv_mutex;
 
-    // buffer for storing metalist
-    std::unique_ptr<std::unique_ptr<unsigned char[]>[]> meta_list_buffer_;
+    // buffer for storing metalist, growing with the chunks received
+    std::unique_ptr<std::vector<unsigned char>[]> meta_list_buffer_;
 
     // count the number in a meta_list
     std::unique_ptr<int[]> count_MetaList_item_;
@@ -114,15 +145,6 @@ private:
     static int downloadFileRecipe(std::string &recipeName, int cloudIndex, Downloader *obj);
 
 
-    /*
-     * download meta list from server
-     *
-     * @param metalist_buffer - the buffer storing meta_list<return>
-     * @param socket - socket object for receiving data from server
-     *
-     * */
-    void download_meta_list(unsigned char *metalist_buffer, Socket *socket, int &counter, int cloudIndex);
-
     /*
      * skip one line from config file
      *
@@ -197,13 +219,13 @@ public:
     /* file header object structure for ringbuffer */
     typedef struct {
         shareFileHead_t file_header;
-        char data[RING_BUFFER_DATA_SIZE];
     } fileHeaderObj_t;
 
     /* share header object structure for ringbuffer */
     typedef struct {
         shareEntry_t share_header;
-        char data[RING_BUFFER_DATA_SIZE];
+        char *data; // the share inside the container it was received in
+        ShareBuffer_t *buffer; // the container, the item holds one reference
     } shareHeaderObj_t;
 
     /* share header object structure for ringbuffer */
@@ -230,21 +252,11 @@ public:
         };
     } ItemMeta_t;
 
-    /* init object for initiating download */
-    typedef struct {
-        int type;
-        char filename[256];
-        int nameSize;
-    } init_t;
-
-    /* thread parameter structure */
+    /* assemble thread parameter structure */
     typedef struct {
-        int cloudIndex;
-        int numOfCloud;
-        char fileName[256];
-        int fileNameLength;
+        int index;
         Downloader *obj;
-    } param_t;
+    } assembleParam_t;
 
     typedef struct {
         unsigned char shareFP[HASH_SIZE];
@@ -271,7 +283,7 @@ public:
     /* metadata buffer */
     char **downloadMetaBuffer_;
 
-    /* container buffer */
+    /* container buffer (the data servers are received into ref-counted containers of their own instead) */
     char **downloadContainer_;
 
     /* size of file header */
@@ -280,19 +292,20 @@ public:
     /* size of share header */
     int shareMDEntrySize_;
 
-    /* thread id array */
-    pthread_t tid_[DOWNLOAD_SERVER_NUMBER * 2];
+    /* assemble thread id array */
+    pthread_t assembleTid_[DOWNLOAD_ASSEMBLE_THREADS];
 
     /* decoder object pointer */
     Decoder *decodeObj_;
 
-    /* signal buffer */
-    MessageQueue<init_t> **signalBuffer_;
+    /* header ringbuffer of each data server */
+    MessageQueue<Item_t> **headerBuffer_;
 
-    /* download ringbuffer */
+    /* download ringbuffer, one per data server and assemble thread */
     MessageQueue<Item_t> **ringBuffer_;
     MessageQueue<ItemMeta_t> **ringBufferMeta_;
     char name_[256];
+    int name_size_;
 
     int *fileSizeCounter;
     int userID_;
@@ -332,6 +345,7 @@ public:
      * @param numOfCloud - number of clouds that we download data
      * @param numOfRestoreServer - number of servers at least that we needed to download data
      *
+     * @return - 0 if every secret is handed to the decoder, -1 if a secret cannot be assembled
      */
     int downloadFile(char *filename, int namesize, int numOfCloud, int numOfRestoreServer);
 
@@ -348,20 +362,13 @@ public:
     int preDownloadFile(char *filename, int nameSize, int numOfCloud);
 
     /*
-     * downloader thread handler
-     *
-     * @param param - input param structure
-     *
-     */
-    static void *thread_handler(void *param);
-
-    /*
-     * downloader thread handler for downloading file recipes
+     * assemble thread handler: assemble the secrets of every DOWNLOAD_ASSEMBLE_THREADS-th range and hand them
+     * to the decoder in order
      *
      * @param param - input param structure
      *
      */
-    static void *thread_handler_meta(void *param);
+    static void *assemble_handler(void *param);
 
     /*
      * set the number of downed servers
@@ -379,6 +386,15 @@ public:
      * */
     void set_down_server_index(int index);
 
+    /*
+     * restore a byte range of the file instead of the whole file, set before preDownloadFile
+     *
+     * @param offset - the offset of the byte range
+     * @param length - the length of the byte range (< 0 for up to the end of the file)
+     *
+     * */
+    void set_restore_range(long offset, long length);
+
     /*
      * Check whether segID < 0, which is abnormal
      *
@@ -398,6 +414,219 @@ public:
      * */
     void extract_meta_list(unsigned char *metalist_buffer, int &offset, int &loop_num,
                            Downloader::MetaList &meta_list);
+
+private:
+    /* a server connection driven by the network engine */
+    typedef struct {
+        Downloader *obj;
+        int cloudIndex;
+        int serverIndex;
+        int stage;
+        /* the request, kept until it is sent */
+        int head[DOWNLOAD_HEAD_MAX_INTS];
+        long range[2];
+        char fileName[256];
+        /* the reply being received */
+        int reply;
+        long rangeSkip;
+        long recipeToken;
+        char *chunk;
+        ShareBuffer_t *container;
+        int retSize;
+        int index;
+        int end;
+        int count;
+        int numOfShares;
+        bool headerSent;
+        /* a reply is being received since lastMicros (only the engine thread starts and ends one) */
+        boost::atomic<bool> waiting;
+        boost::atomic<long> lastMicros;
+        bool timedOut;
+        long requestMicros;
+        /* the shares of the container wait for room in a full share ringbuffer */
+        boost::atomic<bool> parked;
+        bool finished;
+        /* serializes the engine thread and the assemble threads resuming a parked connection */
+        std::mutex lock;
+    } serverConn_t;
+
+    /*
+     * network engine callback of the meta servers: a reply of the meta list or the file recipe is received
+     *
+     * @param arg - the server connection
+     * @param result - the bytes received, or -errno if the server stops responding
+     */
+    static void metaReceived(void *arg, int result);
+
+    /*
+     * network engine callback of the data servers: a reply of the shares is received
+     *
+     * @param arg - the server connection
+     * @param result - the bytes received, or -errno if the server stops responding
+     */
+    static void dataReceived(void *arg, int result);
+
+    /*
+     * receive the next reply of a server through the network engine
+     *
+     * @param conn - the server connection
+     * @param stage - the stage of the reply
+     * @param buffer - the buffer for the reply <return>
+     * @param size - the size of the reply
+     */
+    void receive_reply(serverConn_t *conn, int stage, char *buffer, int size);
+
+    /*
+     * the meta list and the file recipe of a meta server are done, let downloadFile proceed once all are
+     *
+     * @param conn - the server connection
+     * @param recipe - whether the server generated the file recipe
+     */
+    void finish_meta(serverConn_t *conn, bool recipe);
+
+    /*
+     * hand the shares of the current container of a data server to the assemble threads, receive the next
+     * container once all are handed over, park the connection while a share ringbuffer is full (conn->lock held)
+     *
+     * @param conn - the server connection
+     */
+    void dispatch_shares(serverConn_t *conn);
+
+    /*
+     * a data server sends no more shares: mark its share ringbuffers as done (conn->lock held)
+     *
+     * @param conn - the server connection
+     */
+    void finish_data(serverConn_t *conn);
+
+    /*
+     * go on handing over the shares of a data server parked on a full share ringbuffer, after a share of it
+     * is taken
+     *
+     * @param serverIndex - the index of data server (0 to total_ / 2 - 1)
+     */
+    void resume_server(int serverIndex);
+
+    /*
+     * cut off the servers taking more than DOWNLOAD_SERVER_TIMEOUT for a reply, the network engine then
+     * completes the reply with an error and the server is skipped
+     */
+    void check_server_timeouts();
+
+    /*
+     * get the share ringbuffer of a server read by an assemble thread
+     *
+     * @param serverIndex - the index of data server (0 to total_ / 2 - 1)
+     * @param assembler - the index of assemble thread
+     *
+     * @return - the ringbuffer
+     * */
+    MessageQueue<Item_t> *share_buffer(int serverIndex, int assembler);
+
+    /*
+     * mark every share ringbuffer of a server as done, no more shares come from the server
+     *
+     * @param serverIndex - the index of data server (0 to total_ / 2 - 1)
+     * */
+    void finish_share_buffers(int serverIndex);
+
+    /*
+     * assemble the secrets of one range: take the first shares of each secret that arrive from the servers
+     *
+     * @param range - the index of the range of secrets
+     * @param batch - the buffer for the assembled secrets<return>
+     * @param kShareIDList - the IDs of the k shares of the last assembled secret<return>
+     * @param meta_list_array - the current MetaList of each server<return>
+     * @param meta_list_offset - the offset of reading meta_list of each server<return>
+     * @param meta_list_loop_num - the number of extracted MetaList of each server<return>
+     * @param segID - the segment ID of the current MetaList of each server<return>
+     * @param usedShares - the number of shares of each server used for the secrets<return>
+     *
+     * @return - the number of assembled secrets, less than a range only at the end of the file; -1 if the
+     * restore fails
+     * */
+    int assemble_range(int range, Decoder::ShareChunk_t *batch, std::vector<int> &kShareIDList,
+                       MetaList *meta_list_array, int *meta_list_offset, int *meta_list_loop_num, int *segID,
+                       long *usedShares);
+
+    /*
+     * test if the shares of a secret are requested from a server, in the minimal shares mode
+     *
+     * @param serverIndex - the index of data server (0 to total_ / 2 - 1)
+     * @param secretID - the ID of the secret
+     *
+     * @return - a boolean value that indicates if the server sends its share of the secret
+     * */
+    bool is_selected(int serverIndex, int secretID);
+
+    /*
+     * give back the shares of the secrets not handed to the decoder
+     *
+     * @param batch - the assembled secrets
+     * @param batchSize - the number of assembled secrets
+     * */
+    void release_batch(Decoder::ShareChunk_t *batch, int batchSize);
+
+    /*
+     * print how each server served the restore
+     * */
+    void print_server_stats();
+
+    /*
+     * pick the k servers sending the shares of each segment of the file from the meta lists, the least loaded
+     * servers first, into selection_
+     * */
+    void plan_share_selection();
+
+    // the byte range to be restored, length < 0 for up to the end of the file
+    long range_offset_;
+    long range_length_;
+
+    // the bytes of the first restored secret before the byte range, told by the meta servers
+    long range_skip_;
+
+    // the secrets are restored, the data servers are not received from any more
+    boost::atomic<bool> restore_done_;
+
+    // a secret cannot be assembled from the shares received, the assemble threads give up
+    boost::atomic<bool> restore_failed_;
+
+    // number of shares needed to restore a secret
+    int num_of_restore_server_;
+
+    // the range of secrets whose turn it is to be handed to the decoder
+    int handoff_range_;
+
+    // the offset in the restored secrets of the next secret handed to the decoder
+    long handoff_offset_;
+
+    //mutex and condition_variable for handing ranges to the decoder in order
+    std::mutex handoff_mutex_;
+    std::condition_variable handoff_cv_;
+
+    // per server: the bytes received, the time spent receiving and the time to the first container of data
+    std::unique_ptr<long[]> server_bytes_;
+    std::unique_ptr<double[]> server_time_;
+    std::unique_ptr<double[]> server_latency_;
+
+    // per server: the number of its shares used for restoring secrets
+    std::unique_ptr<long[]> server_used_shares_;
+
+    // per server: the server stopped responding and is skipped
+    std::unique_ptr<bool[]> server_failed_;
+
+    // per server: the sorted ranges [first, last] of the secret IDs whose shares are requested from it
+    std::vector<std::vector<int>> selection_;
+
+    // the network engine driving the connections of all the servers, and the state of each connection
+    NetEngine *engine_;
+    serverConn_t **conns_;
+
+    // the data servers still sending shares
+    int running_data_;
+
+    // the assemble threads still running, guarded by handoff_mutex_
+    int running_assemblers_;
 };
 
 #endif
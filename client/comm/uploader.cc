@@ -3,336 +3,529 @@
  */
 
 #include "uploader.hh"
+#include "DeltaVarint.hh"
 
 using namespace std;
 
 /*
- * uploader thread handler
+ * uploader thread handler: a single dispatcher serves the queues of all clouds, while the
+ * network engine thread sends the batches and receives their replies
  *
- * @param param - input structure
+ * @param param - the uploader
  *
  */
 void *Uploader::thread_handler(void *param)
 {
-    /* get input parameters */
-    param_t *temp = (param_t *) param;
-    int cloudIndex = temp->cloudIndex;
-    Uploader *obj = temp->obj;
-    free(temp);
+    Uploader *obj = (Uploader *) param;
 
     Chunk_t tmp;
     Item_t output;
+    ItemMeta_t outputMeta;
 
-    // Add time
-    double perform_upload_time = 0;
-    double recipe_handling_time = 0;
+    uploadFile_t *files[UPLOAD_MAX_FILES];
+    int numOfFiles, cloudIndex, i;
+    unsigned int round = 0;
+    bool progress;
 
-    /* main loop for uploader, end when indicator recv.ed */
+    /* main loop for uploader, end when no more files are opened and every open file is finished */
     while(true) {
-        if(obj->ringBuffer_[cloudIndex - UPLOAD_SERVER_NUMBER]->done_ &&
-           obj->ringBuffer_[cloudIndex - UPLOAD_SERVER_NUMBER]->is_empty()) {
-            // thread finished its mission, exit
-            break;
+        /* the files whose batches are not all acknowledged yet */
+        pthread_mutex_lock(&obj->fileLock_);
+        numOfFiles = 0;
+        for(i = 0; i < UPLOAD_MAX_FILES; i++) {
+            if(obj->files_[i] != NULL && !obj->fileDone_[i]) {
+                files[numOfFiles++] = obj->files_[i];
+            }
         }
-
-        /* get object from ringbuffer */
-        if(!obj->ringBuffer_[cloudIndex - UPLOAD_SERVER_NUMBER]->pop(tmp)) {
+        if(numOfFiles == 0) {
+            if(obj->closing_) {
+                pthread_mutex_unlock(&obj->fileLock_);
+                break;
+            }
+            /* nothing to upload until a file is opened */
+            pthread_cond_wait(&obj->fileCond_, &obj->fileLock_);
+            pthread_mutex_unlock(&obj->fileLock_);
             continue;
         }
+        pthread_mutex_unlock(&obj->fileLock_);
+
+        /* one object of every file for every cloud, starting from another file each round so that
+           the files share the credits of the servers */
+        progress = false;
+        round++;
+        for(i = 0; i < numOfFiles; i++) {
+            uploadFile_t *file = files[(i + round) % numOfFiles];
+            for(cloudIndex = 0; cloudIndex < obj->total_; cloudIndex++) {
+                if(obj->stepFile(file, cloudIndex, tmp, output, outputMeta)) {
+                    progress = true;
+                }
+            }
+            if(file->remaining > 0) {
+                continue;
+            }
 
-        obj->copy_Chunk_to_Item(output, tmp);
+#ifdef BREAKDOWN_ENABLED
+            printf("\n[Time] ===================\n");
+            for(cloudIndex = 0; cloudIndex < obj->total_; cloudIndex++) {
+                const char *type = (cloudIndex < obj->total_ / 2) ? "meta" : "data";
+                fprintf(stderr, "[Time] [Uploader] {%s} <%s:%d> perform_upload time: is /%lf/ s\n", file->name,
+                        type, cloudIndex, file->performUploadTime[cloudIndex]);
+                fprintf(stderr, "[Time] [Uploader] {%s} <%s:%d> recipe_handling time: is /%lf/ s\n", file->name,
+                        type, cloudIndex, file->recipeHandlingTime[cloudIndex]);
+            }
+            printf("[Time]===================\n\n");
+#endif
+            /* every cloud acknowledged the file, it is left to indicateEnd from now on */
+            pthread_mutex_lock(&obj->fileLock_);
+            obj->fileDone_[file->fileID] = true;
+            pthread_cond_broadcast(&obj->fileCond_);
+            pthread_mutex_unlock(&obj->fileLock_);
+        }
 
-        /* fake data -> exit thread */
-        if(output.kmCloudIndex == cloudIndex - UPLOAD_SERVER_NUMBER && output.type == SHARE_END
-           && output.shareObj.share_header.secretID == 0) {
-            printf("[Uploader] [Data] <%d> secretID = %d\n", cloudIndex, output.shareObj.share_header.secretID);
-            printf("[Uploader] [Data] <%d> fake data detected!! Exiting thread!!\n", cloudIndex);
-            pthread_exit(NULL);
+        if(!progress) {
+            sched_yield();
         }
+    }
+
+    pthread_exit(NULL);
+}
+
+/*
+ * handle the next object of a file queued for a cloud
+ *
+ * @param file - the file
+ * @param cloudIndex - indicate targeting cloud
+ * @param tmp - buffer for the queued chunk
+ * @param output - buffer for the share header
+ * @param outputMeta - buffer for the queued metadata share
+ *
+ * @return - a boolean value that indicates if any progress is made
+ */
+bool Uploader::stepFile(uploadFile_t *file, int cloudIndex, Chunk_t &tmp, Item_t &output, ItemMeta_t &outputMeta)
+{
+    int ret;
+
+    if(file->state[cloudIndex] == UPLOAD_CLOUD_FINISHED) {
+        return false;
+    }
+    if(file->state[cloudIndex] == UPLOAD_CLOUD_DRAINING) {
+        if(isDrained(file, cloudIndex)) {
+            file->state[cloudIndex] = UPLOAD_CLOUD_FINISHED;
+            file->remaining--;
+            return true;
+        }
+        return false;
+    }
+
+    /* leave the shares queued while the server has no credit left, other clouds and files go on */
+    if(!hasCredit(cloudIndex)) {
+        return false;
+    }
 
-        if(output.shareObj.share_header.secretID == DATA_SECRET_ID_END_INDICATOR) {
-            /* IF it's SHARE_END and KM server,
-             * then this fake data comes from other server(Encoder::collect) to perform uploading properly */
-            printf("[Uploader] [Data] <%d> Share End and Upload remaining data to KM server\n", cloudIndex);
-            printf("[Uploader] [Data] <%d> item info:\n", cloudIndex);
-            printf("[Uploader] [Data] <%d> \tsecretID: %d\n", cloudIndex,
-                   output.shareObj.share_header.secretID);
+    if(cloudIndex < total_ / 2) {
+        ret = stepMeta(file, cloudIndex, outputMeta, file->totalChunks[cloudIndex],
+                       file->performUploadTime[cloudIndex], file->recipeHandlingTime[cloudIndex]);
+    } else {
+        ret = stepData(file, cloudIndex, tmp, output, file->performUploadTime[cloudIndex],
+                       file->recipeHandlingTime[cloudIndex]);
+    }
+    if(ret < 0) {
+        file->state[cloudIndex] = UPLOAD_CLOUD_DRAINING;
+    }
+    return (ret != 0);
+}
+
+/*
+ * handle the next share queued for a data cloud
+ *
+ * @param file - the file
+ * @param cloudIndex - indicate targeting cloud
+ * @param tmp - buffer for the queued chunk
+ * @param output - buffer for the share header
+ * @param perform_upload_time - accumulated time of performing upload <return>
+ * @param recipe_handling_time - accumulated time of buffering shares <return>
+ *
+ * @return - 1 if an object is handled, 0 if none is queued, -1 if the cloud gets no more shares
+ */
+int Uploader::stepData(uploadFile_t *file, int cloudIndex, Chunk_t &tmp, Item_t &output,
+                       double &perform_upload_time, double &recipe_handling_time)
+{
+    /* the data clouds follow the meta clouds, one ring buffer each */
+    int dataIndex = cloudIndex - total_ / 2;
+    if(file->ringBuffer[dataIndex]->done_ && file->ringBuffer[dataIndex]->is_empty()) {
+        // cloud finished its mission
+        return -1;
+    }
+
+    /* get object from ringbuffer */
+    if(!file->ringBuffer[dataIndex]->pop(tmp)) {
+        return 0;
+    }
+
+    copy_Chunk_to_Item(output, tmp);
+
+    /* fake data -> cloud finished */
+    if(output.kmCloudIndex == dataIndex && output.type == SHARE_END
+       && output.shareObj.share_header.secretID == 0) {
+        printf("[Uploader] [Data] <%d> secretID = %d\n", cloudIndex, output.shareObj.share_header.secretID);
+        printf("[Uploader] [Data] <%d> fake data detected!! Finishing cloud!!\n", cloudIndex);
+        return -1;
+    }
+
+    if(output.shareObj.share_header.secretID == DATA_SECRET_ID_END_INDICATOR) {
+        /* IF it's SHARE_END and KM server,
+         * then this fake data comes from other server(Encoder::collect) to perform uploading properly */
+        printf("[Uploader] [Data] <%d> Share End and Upload remaining data to KM server\n", cloudIndex);
+        printf("[Uploader] [Data] <%d> item info:\n", cloudIndex);
+        printf("[Uploader] [Data] <%d> \tsecretID: %d\n", cloudIndex,
+               output.shareObj.share_header.secretID);
+        if(isResumedFully(file, cloudIndex)) {
+            printf("[Uploader] [Data] <%d> all shares acknowledged before the restart\n", cloudIndex);
+            return -1;
+        }
 #ifdef BREAKDOWN_ENABLED
-            Logger::measure_time([&]() {
+        Logger::measure_time([&]() {
 #endif
-                obj->performUpload(cloudIndex, false);
+            performUpload(file, cloudIndex, false);
 #ifdef BREAKDOWN_ENABLED
-            }, perform_upload_time);
+        }, perform_upload_time);
 #endif
-            printf("[Uploader] [Data] <%d> Data uploaded!!\n", cloudIndex);
-            break;
-        }
-        /* IF this is share object */
-        int shareSize = output.shareObj.share_header.shareSize;
+        printf("[Uploader] [Data] <%d> Data uploaded!!\n", cloudIndex);
+        return -1;
+    }
+    /* IF this is share object */
+    if(skipShare(file, cloudIndex)) {
+        return 1;
+    }
+    int shareSize = output.shareObj.share_header.shareSize;
 
-        /* see if the container buffer can hold the coming share, if not then perform upload */
-        if(shareSize + obj->containerWP_[cloudIndex] > UPLOAD_BUFFER_SIZE) {
+    /* see if the container buffer can hold the coming share, if not then perform upload */
+    if(shareSize + file->containerWP[cloudIndex] > UPLOAD_BUFFER_SIZE) {
 #ifdef BREAKDOWN_ENABLED
-            Logger::measure_time([&]() {
+        Logger::measure_time([&]() {
 #endif
-                obj->performUpload(cloudIndex, false);
+            performUpload(file, cloudIndex, false);
 #ifdef BREAKDOWN_ENABLED
-            }, perform_upload_time);
+        }, perform_upload_time);
 #endif
-            obj->updateHeader(cloudIndex);
-        }
+        updateHeader(file, cloudIndex);
+    }
 
 #ifdef BREAKDOWN_ENABLED
-        Logger::measure_time([&]() {
+    Logger::measure_time([&]() {
 #endif
-        /* copy share header into metabuffer */
-        memcpy(obj->uploadMetaBuffer_[cloudIndex] + obj->metaWP_[cloudIndex], &(output.shareObj.share_header),
-               obj->shareMDEntrySize_);
-
-        shareEntry_t shareHeader;
-        memcpy(&shareHeader, obj->uploadMetaBuffer_[cloudIndex] + obj->metaWP_[cloudIndex],
-               obj->shareMDEntrySize_);
-
-        obj->metaWP_[cloudIndex] += obj->shareMDEntrySize_;
+    /* copy share header into metabuffer */
+    memcpy(file->uploadMetaBuffer[cloudIndex] + file->metaWP[cloudIndex], &(output.shareObj.share_header),
+           shareMDEntrySize_);
+    file->metaWP[cloudIndex] += shareMDEntrySize_;
 
-        /* copy share data into container buffer */
-        memcpy(obj->uploadContainer_[cloudIndex] + obj->containerWP_[cloudIndex], output.shareObj.data,
-               shareSize);
-        obj->containerWP_[cloudIndex] += shareSize;
+    /* copy share data into container buffer straight from the encoded chunk */
+    memcpy(file->uploadContainer[cloudIndex] + file->containerWP[cloudIndex],
+           tmp.content + tmp.share_id * tmp.share_size, shareSize);
+    file->containerWP[cloudIndex] += shareSize;
 
-        // record share size
-        obj->shareSizeArray_[cloudIndex][obj->numOfShares_[cloudIndex]] = shareSize;
-        obj->numOfShares_[cloudIndex]++;
+    // record share size and fingerprint
+    recordShare(file, cloudIndex, shareSize, output.shareObj.share_header.shareFP);
 
-        /* update file header pointer */
-        obj->headerArray_[cloudIndex]->numOfComingSecrets += 1;
-        obj->headerArray_[cloudIndex]->sizeOfComingSecrets += output.shareObj.share_header.secretSize;
+    /* update file header pointer */
+    file->headerArray[cloudIndex]->numOfComingSecrets += 1;
+    file->headerArray[cloudIndex]->sizeOfComingSecrets += output.shareObj.share_header.secretSize;
+    file->lastSecretID[cloudIndex] = output.shareObj.share_header.secretID;
 
 #ifdef BREAKDOWN_ENABLED
-        }, recipe_handling_time);
+    }, recipe_handling_time);
 #endif
-        /* IF this is the last share object, perform upload and exit thread */
-        if(output.type == SHARE_END) {
+    /* IF this is the last share object, perform upload */
+    if(output.type == SHARE_END) {
 #ifdef BREAKDOWN_ENABLED
-            Logger::measure_time([&]() {
+        Logger::measure_time([&]() {
 #endif
-                obj->performUpload(cloudIndex, false);
+            performUpload(file, cloudIndex, false);
 #ifdef BREAKDOWN_ENABLED
-            }, perform_upload_time);
+        }, perform_upload_time);
 #endif
-            printf("[Uploader] <Data:%d> SHARE_END\n", cloudIndex);
-        }
+        printf("[Uploader] <Data:%d> SHARE_END\n", cloudIndex);
     }
 
-#ifdef BREAKDOWN_ENABLED
-    printf("\n[Time] ===================\n");
-    fprintf(stderr, "[Time] [Uploader] <data:%d> perform_upload time: is /%lf/ s\n", cloudIndex, perform_upload_time);
-    fprintf(stderr, "[Time] [Uploader] <data:%d> recipe_handling time: is /%lf/ s\n", cloudIndex, recipe_handling_time);
-    printf("[Time]===================\n\n");
-#endif
-    pthread_exit(NULL);
+    return 1;
 }
 
 /*
- * uploader thread handler
+ * handle the next share queued for a metadata cloud
  *
- * @param param - input structure
+ * @param file - the file
+ * @param cloudIndex - indicate targeting cloud
+ * @param output - buffer for the queued share
+ * @param total_chunks - number of shares handled <return>
+ * @param perform_upload_time - accumulated time of performing upload <return>
+ * @param recipe_handling_time - accumulated time of buffering shares <return>
  *
+ * @return - 1 if an object is handled, 0 if none is queued, -1 if the cloud gets no more shares
  */
-void *Uploader::thread_handler_meta(void *param)
+int Uploader::stepMeta(uploadFile_t *file, int cloudIndex, ItemMeta_t &output, int &total_chunks,
+                       double &perform_upload_time, double &recipe_handling_time)
 {
-    /* get input parameters */
-    param_t *temp = (param_t *) param;
-    int cloudIndex = temp->cloudIndex;
-    Uploader *obj = temp->obj;
-    free(temp);
-
-    int total_chunks = 0;
-
-    ItemMeta_t output;
+    if(file->ringBufferMeta[cloudIndex]->done_ && file->ringBufferMeta[cloudIndex]->is_empty()) {
+        // cloud finished its mission
+        return -1;
+    }
 
-    // Add time
-    double perform_upload_time = 0;
-    double recipe_handling_time = 0;
+    /* get object from ringbuffer */
+    if(!file->ringBufferMeta[cloudIndex]->pop(output)) {
+        return 0;
+    }
 
-    /* main loop for uploader, end when indicator recv.ed */
-    while(true) {
-        if(obj->ringBufferMeta_[cloudIndex]->done_ && obj->ringBufferMeta_[cloudIndex]->is_empty()) {
-            // thread finished its mission, exit
-            break;
-        }
+    /* fake data -> cloud finished */
+    if(output.kmCloudIndex == cloudIndex && output.type == SHARE_END
+       && output.shareObj.share_header.secretID == 0) {
+        printf("[Uploader] [Meta] <%d> secretID = %d\n", cloudIndex, output.shareObj.share_header.secretID);
+        printf("[Uploader] [Meta] <%d> fake data detected!! Finishing cloud!!\n", cloudIndex);
+        return -1;
+    }
 
-        /* get object from ringbuffer */
-        if(!obj->ringBufferMeta_[cloudIndex]->pop(output)) {
-            continue;
-        }
 
-        /* fake data -> exit thread */
-        if(output.kmCloudIndex == cloudIndex && output.type == SHARE_END
-           && output.shareObj.share_header.secretID == 0) {
-            printf("[Uploader] [Meta] <%d> secretID = %d\n", cloudIndex, output.shareObj.share_header.secretID);
-            printf("[Uploader] [Meta] <%d> fake data detected!! Exiting thread!!\n", cloudIndex);
-            pthread_exit(NULL);
+    if(output.shareObj.share_header.secretID == META_SECRET_ID_END_INDICATOR) {
+        /* IF it's SHARE_END and KM server,
+         * then this fake data comes from other server(Encoder::collect) to perform uploading properly */
+        printf("[Uploader] [Meta] <%d> Share End and Upload remaining data to KM server\n", cloudIndex);
+        printf("[Uploader] [Meta] <%d> item info:\n", cloudIndex);
+        printf("[Uploader] [Meta] <%d> \tsecretID: %d\n", cloudIndex,
+               output.shareObj.share_header.secretID);
+        if(isResumedFully(file, cloudIndex)) {
+            printf("[Uploader] [Meta] <%d> all shares acknowledged before the restart\n", cloudIndex);
+            return -1;
         }
-
-
-        if(output.shareObj.share_header.secretID == META_SECRET_ID_END_INDICATOR) {
-            /* IF it's SHARE_END and KM server,
-             * then this fake data comes from other server(Encoder::collect) to perform uploading properly */
-            printf("[Uploader] [Meta] <%d> Share End and Upload remaining data to KM server\n", cloudIndex);
-            printf("[Uploader] [Meta] <%d> item info:\n", cloudIndex);
-            printf("[Uploader] [Meta] <%d> \tsecretID: %d\n", cloudIndex,
-                   output.shareObj.share_header.secretID);
 #ifdef BREAKDOWN_ENABLED
-            Logger::measure_time([&]() {
+        Logger::measure_time([&]() {
 #endif
-                obj->performUpload(cloudIndex, true);
+            performUpload(file, cloudIndex, true);
 #ifdef BREAKDOWN_ENABLED
-            }, perform_upload_time);
+        }, perform_upload_time);
 #endif
-            printf("[Uploader] <meta:%d> total_chunks: %d\n", cloudIndex, total_chunks);
-            printf("[Uploader] <meta:%d> Data uploaded!! END!\n", cloudIndex);
-            break;
-        }
+        printf("[Uploader] <meta:%d> total_chunks: %d\n", cloudIndex, total_chunks);
+        printf("[Uploader] <meta:%d> Data uploaded!! END!\n", cloudIndex);
+        return -1;
+    }
 
-        /* IF this is share object */
-        int shareSize = output.shareObj.share_header.shareSize;
+    /* IF this is share object */
+    if(skipShare(file, cloudIndex)) {
+        return 1;
+    }
+    int shareSize = output.shareObj.share_header.shareSize;
 
-        /* see if the container buffer can hold the coming share, if not then perform upload */
-        if(shareSize + obj->containerWP_[cloudIndex] > UPLOAD_BUFFER_SIZE) {
+    /* see if the container buffer can hold the coming share, if not then perform upload */
+    if(shareSize + file->containerWP[cloudIndex] > UPLOAD_BUFFER_SIZE) {
 #ifdef BREAKDOWN_ENABLED
-            Logger::measure_time([&]() {
+        Logger::measure_time([&]() {
 #endif
-                obj->performUpload(cloudIndex, false);
+            performUpload(file, cloudIndex, false);
 #ifdef BREAKDOWN_ENABLED
-            }, perform_upload_time);
+        }, perform_upload_time);
 #endif
-            obj->updateHeader(cloudIndex);
-        }
+        updateHeader(file, cloudIndex);
+    }
 
 #ifdef BREAKDOWN_ENABLED
-        Logger::measure_time([&]() {
+    Logger::measure_time([&]() {
 #endif
-        /* copy share header into metabuffer */
-        memcpy(obj->uploadMetaBuffer_[cloudIndex] + obj->metaWP_[cloudIndex], &(output.shareObj.share_header),
-               obj->shareMDEntrySize_);
-        obj->metaWP_[cloudIndex] += obj->shareMDEntrySize_;
-
-        /* copy share data into container buffer */
-        memcpy(obj->uploadContainer_[cloudIndex] + obj->containerWP_[cloudIndex], output.shareObj.data,
-               shareSize);
-        obj->containerWP_[cloudIndex] += shareSize;
-
-        /* record share size */
-        obj->shareSizeArray_[cloudIndex][obj->numOfShares_[cloudIndex]] = shareSize;
-        obj->numOfShares_[cloudIndex]++;
-
-        /* update file header pointer */
-        obj->headerArray_[cloudIndex]->numOfComingSecrets += 1;
-        ++total_chunks;
-        obj->headerArray_[cloudIndex]->sizeOfComingSecrets += output.shareObj.share_header.secretSize;
+    /* copy share header into metabuffer */
+    memcpy(file->uploadMetaBuffer[cloudIndex] + file->metaWP[cloudIndex], &(output.shareObj.share_header),
+           shareMDEntrySize_);
+    file->metaWP[cloudIndex] += shareMDEntrySize_;
+
+    /* copy share data into container buffer */
+    memcpy(file->uploadContainer[cloudIndex] + file->containerWP[cloudIndex], output.shareObj.data, shareSize);
+    file->containerWP[cloudIndex] += shareSize;
+
+    /* record share size and fingerprint */
+    recordShare(file, cloudIndex, shareSize, output.shareObj.share_header.shareFP);
+
+    /* update file header pointer */
+    file->headerArray[cloudIndex]->numOfComingSecrets += 1;
+    ++total_chunks;
+    file->headerArray[cloudIndex]->sizeOfComingSecrets += output.shareObj.share_header.secretSize;
+    file->lastSecretID[cloudIndex] = output.shareObj.share_header.secretID;
 #ifdef BREAKDOWN_ENABLED
-        }, recipe_handling_time);
+    }, recipe_handling_time);
 #endif
 
-        /* IF this is the last share object, perform upload and exit thread */
-        if(output.type == SHARE_END) {
+    /* IF this is the last share object, perform upload */
+    if(output.type == SHARE_END) {
 #ifdef BREAKDOWN_ENABLED
-            Logger::measure_time([&]() {
+        Logger::measure_time([&]() {
 #endif
-                obj->performUpload(cloudIndex, true);
+            performUpload(file, cloudIndex, true);
 #ifdef BREAKDOWN_ENABLED
-            }, perform_upload_time);
+        }, perform_upload_time);
 #endif
-            printf("[Uploader] <meta:%d> SHARE_END\n", cloudIndex);
-            printf("[Uploader] <meta:%d> total_chunks: %d\n", cloudIndex, total_chunks);
+        printf("[Uploader] <meta:%d> SHARE_END\n", cloudIndex);
+        printf("[Uploader] <meta:%d> total_chunks: %d\n", cloudIndex, total_chunks);
+    }
+
+    return 1;
+}
+
+/*
+ * record the size and fingerprint of a share buffered for a cloud
+ *
+ * @param file - the file
+ * @param cloudIndex - indicate targeting cloud
+ * @param shareSize - the size of the share
+ * @param shareFP - the fingerprint of the share
+ *
+ */
+void Uploader::recordShare(uploadFile_t *file, int cloudIndex, int shareSize, unsigned char *shareFP)
+{
+    file->shareSizeArray[cloudIndex][file->numOfShares[cloudIndex]] = shareSize;
+    memcpy(file->shareFPArray[cloudIndex] + file->numOfShares[cloudIndex] * FP_SIZE, shareFP, FP_SIZE);
+
+    /* the filter is also updated by the network engine thread */
+    pthread_mutex_lock(&windowLock_);
+    if(shareFilter_[cloudIndex]->lookup(shareFP)) {
+        file->numOfHints[cloudIndex]++;
+    }
+    pthread_mutex_unlock(&windowLock_);
+
+    file->numOfShares[cloudIndex]++;
+}
+
+/*
+ * check if a share was acknowledged by the cloud before a restart, so it is not sent again
+ *
+ * @param file - the file
+ * @param cloudIndex - indicate targeting cloud
+ *
+ * @return - a boolean value that indicates if the share is skipped
+ */
+bool Uploader::skipShare(uploadFile_t *file, int cloudIndex)
+{
+    /* the shares of a cloud come in the same order in every run, so a count identifies them */
+    return (file->secretCount[cloudIndex]++ < file->resumeSecrets[cloudIndex]);
+}
+
+/*
+ * check if every share of a cloud was acknowledged before a restart, so nothing is left to send
+ *
+ * @param file - the file
+ * @param cloudIndex - indicate targeting cloud
+ *
+ * @return - a boolean value that indicates if the cloud has been completed
+ */
+bool Uploader::isResumedFully(uploadFile_t *file, int cloudIndex)
+{
+    return (file->resumeSecrets[cloudIndex] > 0 && file->numOfBatches[cloudIndex] == 0 &&
+            file->numOfShares[cloudIndex] == 0);
+}
+
+/*
+ * pack the share metadata of a batch into a reference list
+ *
+ * @param metaBuffer - the share metadata: [fileShareMDHead_t + full file name + shareMDEntry_t ...] ...
+ * @param metaSize - the size of the share metadata
+ * @param refList - a buffer for storing the reference list (no larger than the share metadata) <return>
+ *
+ * @return - the size of the reference list
+ */
+int Uploader::packReferences(const char *metaBuffer, int metaSize, char *refList)
+{
+    fileShareMDHead_t head;
+    shareMDEntry_t entry;
+    int previous[DELTA_FIELDS];
+    int metaOffset = 0, refSize = 0;
+
+    while(metaOffset < metaSize) {
+        /* the file head and name are kept as they are */
+        memcpy(&head, metaBuffer + metaOffset, sizeof(fileShareMDHead_t));
+        memcpy(refList + refSize, metaBuffer + metaOffset, sizeof(fileShareMDHead_t) + head.fullNameSize);
+        metaOffset += sizeof(fileShareMDHead_t) + head.fullNameSize;
+        refSize += sizeof(fileShareMDHead_t) + head.fullNameSize;
+
+        /* the shares of a file mostly differ by one secretID from the previous one */
+        memset(previous, 0, sizeof(previous));
+        for(int i = 0; i < head.numOfComingSecrets; i++) {
+            memcpy(&entry, metaBuffer + metaOffset, sizeof(shareMDEntry_t));
+            metaOffset += sizeof(shareMDEntry_t);
+
+            memcpy(refList + refSize, entry.shareFP, FP_SIZE);
+            refSize += FP_SIZE;
+            int fields[DELTA_FIELDS] = {entry.secretID, entry.secretSize, entry.shareSize, entry.segID, entry.shareID};
+            refSize = putDeltaFields((unsigned char *) refList, refSize, fields, previous);
         }
     }
 
-#ifdef BREAKDOWN_ENABLED
-    printf("\n[Time] ===================\n");
-    fprintf(stderr, "[Time] [Uploader] <meta:%d> perform_upload time: is /%lf/ s\n", cloudIndex, perform_upload_time);
-    fprintf(stderr, "[Time] [Uploader] <meta:%d> recipe_handling time: is /%lf/ s\n", cloudIndex, recipe_handling_time);
-    printf("[Time]===================\n\n");
-#endif
-    pthread_exit(NULL);
+    return refSize;
 }
 
 /*
- * constructor
+ * constructor: connect to the servers, files are then opened for uploading
  *
- * @param p - input large prime number
  * @param total - input total number of clouds
  * @param subset - input number of clouds to be chosen
+ * @param userID - the user id
  *
  */
-Uploader::Uploader(int total, int subset, int userID, char *fileName, int nameSize)
+Uploader::Uploader(int total, int subset, int userID)
 {
+    char filterPath[256];
 
     total_ = total * 2;
     subset_ = subset;
-
-    memcpy(name_, fileName, nameSize);
+    userID_ = userID;
 
     /* initialization */
-    ringBuffer_ = (MessageQueue<Chunk_t> **) malloc(sizeof(MessageQueue<Chunk_t> *) * total_);
-    ringBufferMeta_ = (MessageQueue<ItemMeta_t> **) malloc(sizeof(MessageQueue<ItemMeta_t> *) * total);
-    uploadMetaBuffer_ = (char **) malloc(sizeof(char *) * total_);
-    uploadContainer_ = (char **) malloc(sizeof(char *) * total_);
-    containerWP_ = (int *) malloc(sizeof(int) * total_);
-    metaWP_ = (int *) malloc(sizeof(int) * total_);
-    numOfShares_ = (int *) malloc(sizeof(int) * total_);
     socketArray_ = (Socket **) malloc(sizeof(Socket *) * total_);
-    headerArray_ = (fileShareMDHead_t **) malloc(sizeof(fileShareMDHead_t *) * total_);
-    shareSizeArray_ = (int **) malloc(sizeof(int *) * total_);
+    uploadWindow_ = (uploadBatch_t **) malloc(sizeof(uploadBatch_t *) * total_);
+    windowHead_ = (int *) malloc(sizeof(int) * total_);
+    windowCount_ = (int *) malloc(sizeof(int) * total_);
+    windowSize_ = (int *) malloc(sizeof(int) * total_);
+    nextBatchID_ = (int *) malloc(sizeof(int) * total_);
+    shareFilter_ = (ShareFilter **) malloc(sizeof(ShareFilter *) * total_);
+    statusBuffer_ = (char **) malloc(sizeof(char *) * total_);
+    receiving_ = (bool *) malloc(sizeof(bool) * total_);
+    replyParam_ = (param_t *) malloc(sizeof(param_t) * total_);
+    pthread_mutex_init(&windowLock_, NULL);
+
+    /* no file is open yet */
+    for(int i = 0; i < UPLOAD_MAX_FILES; i++) {
+        files_[i] = NULL;
+        fileDone_[i] = false;
+    }
+    closing_ = false;
+    pthread_mutex_init(&fileLock_, NULL);
+    pthread_cond_init(&fileCond_, NULL);
+
+    /* set upload windows, each batch slot owns a spare container for the thread to fill meanwhile */
+    for(int i = 0; i < total_; i++) {
+        uploadWindow_[i] = (uploadBatch_t *) malloc(sizeof(uploadBatch_t) * UPLOAD_WINDOW_SIZE);
+        for(int j = 0; j < UPLOAD_WINDOW_SIZE; j++) {
+            uploadWindow_[i][j].container = (char *) malloc(sizeof(char) * UPLOAD_BUFFER_SIZE);
+            uploadWindow_[i][j].shareSizeArray = (int *) malloc(sizeof(int) * UPLOAD_BUFFER_SIZE);
+            uploadWindow_[i][j].shareFPArray = (unsigned char *) malloc(FP_SIZE * UPLOAD_MAX_SHARES);
+            uploadWindow_[i][j].metaBuffer = (char *) malloc(sizeof(char) * UPLOAD_BUFFER_SIZE);
+            uploadWindow_[i][j].cloudIndex = i;
+            uploadWindow_[i][j].file = NULL;
+            uploadWindow_[i][j].obj = this;
+        }
+        statusBuffer_[i] = (char *) malloc(UPLOAD_STATUS_BUFFER_SIZE);
+        receiving_[i] = false;
+        replyParam_[i].cloudIndex = i;
+        replyParam_[i].obj = this;
+
+        /* shares known per user, since duplicates are checked within a user's own shares */
+        sprintf(filterPath, "%s%d_%d", SHARE_FILTER_PREFIX, userID, i);
+        shareFilter_[i] = new ShareFilter(filterPath);
+        windowHead_[i] = 0;
+        windowCount_[i] = 0;
+        windowSize_[i] = UPLOAD_WINDOW_SIZE;
+        nextBatchID_[i] = 0;
+    }
 
     /* read server ip & port from config file */
     FILE *fp = fopen("./config", "rb");
     char line[225];
     const char ch[2] = ":";
 
-    for(int i = 0; i < total; i++) {
-        ringBufferMeta_[i] = new MessageQueue<ItemMeta_t>(UPLOAD_QUEUE_SIZE);
-        shareSizeArray_[i] = (int *) malloc(sizeof(int) * UPLOAD_BUFFER_SIZE);
-        uploadMetaBuffer_[i] = (char *) malloc(sizeof(char) * UPLOAD_BUFFER_SIZE);
-        uploadContainer_[i] = (char *) malloc(sizeof(char) * UPLOAD_BUFFER_SIZE);
-        containerWP_[i] = 0;
-        metaWP_[i] = 0;
-        numOfShares_[i] = 0;
-
-        param_t *param = (param_t *) malloc(sizeof(param_t)); // thread's parameter
-        param->cloudIndex = i;
-        param->obj = this;
-        pthread_create(&tid_[i], 0, &thread_handler_meta, (void *) param);
-
-        /* line by line read config file*/
-        int ret = fscanf(fp, "%s", line);
-        if(ret == 0)
-            printf("fail to load config file\n");
-        char *token = strtok(line, ch);
-        char *ip = token;
-        token = strtok(NULL, ch);
-        int port = atoi(token);
-
-        /* set sockets */
-        socketArray_[i] = new Socket(ip, port, userID);
-        accuData_[i] = 0;
-        accuUnique_[i] = 0;
-    }
-    for(int i = total; i < total_; i++) {
-        ringBuffer_[i - total] = new MessageQueue<Chunk_t>(UPLOAD_QUEUE_SIZE);
-        shareSizeArray_[i] = (int *) malloc(sizeof(int) * UPLOAD_BUFFER_SIZE);
-        uploadMetaBuffer_[i] = (char *) malloc(sizeof(char) * UPLOAD_BUFFER_SIZE);
-        uploadContainer_[i] = (char *) malloc(sizeof(char) * UPLOAD_BUFFER_SIZE);
-        containerWP_[i] = 0;
-        metaWP_[i] = 0;
-        numOfShares_[i] = 0;
-
-        param_t *param = (param_t *) malloc(sizeof(param_t)); // thread's parameter
-        param->cloudIndex = i;
-        param->obj = this;
-        pthread_create(&tid_[i], 0, &thread_handler, (void *) param);
-
+    for(int i = 0; i < total_; i++) {
         /* line by line read config file*/
         int ret = fscanf(fp, "%s", line);
         if(ret == 0)
@@ -344,123 +537,667 @@ Uploader::Uploader(int total, int subset, int userID, char *fileName, int nameSi
 
         /* set sockets */
         socketArray_[i] = new Socket(ip, port, userID);
-        accuData_[i] = 0;
-        accuUnique_[i] = 0;
+        if(socketArray_[i]->credit_ < windowSize_[i]) {
+            windowSize_[i] = socketArray_[i]->credit_;
+        }
     }
     fclose(fp);
     fileMDHeadSize_ = sizeof(fileShareMDHead_t);
     shareMDEntrySize_ = sizeof(shareMDEntry_t);
+
+    /* one engine thread drives all connections, receiving the replies into registered buffers */
+    engine_ = new NetEngine(total_, UPLOAD_NET_BACKEND);
+    struct iovec *statusVector = (struct iovec *) malloc(sizeof(struct iovec) * total_);
+    for(int i = 0; i < total_; i++) {
+        engine_->addConnection(i, socketArray_[i]->hostSock_);
+        fillIOV(statusVector[i], statusBuffer_[i], UPLOAD_STATUS_BUFFER_SIZE);
+    }
+    engine_->registerBuffers(statusVector, total_);
+    free(statusVector);
+    engine_->start();
+    printf("[Uploader] network engine: %s\n", engine_->getBackend() == NET_ENGINE_URING ? "io_uring" : "epoll");
+
+    pthread_create(&tid_, 0, &thread_handler, (void *) this);
 }
 
 /*
- * destructor
+ * destructor: wait for the files being uploaded and close the connections
  */
 Uploader::~Uploader()
 {
+    /* the dispatcher exits once every open file is finished, the engine has nothing left to do then */
+    pthread_mutex_lock(&fileLock_);
+    closing_ = true;
+    pthread_cond_broadcast(&fileCond_);
+    pthread_mutex_unlock(&fileLock_);
+    pthread_join(tid_, NULL);
+    engine_->stop();
+
+    /* keep the share filters for the next upload */
+    for(int i = 0; i < total_; i++) {
+        shareFilter_[i]->save();
+    }
+
+    delete engine_;
+    for(int i = 0; i < UPLOAD_MAX_FILES; i++) {
+        if(files_[i] != NULL) {
+            freeFile(files_[i]);
+        }
+    }
     for(int i = 0; i < total_; i++) {
-        free(shareSizeArray_[i]);
-        free(uploadMetaBuffer_[i]);
-        free(uploadContainer_[i]);
+        for(int j = 0; j < UPLOAD_WINDOW_SIZE; j++) {
+            free(uploadWindow_[i][j].container);
+            free(uploadWindow_[i][j].shareSizeArray);
+            free(uploadWindow_[i][j].shareFPArray);
+            free(uploadWindow_[i][j].metaBuffer);
+        }
+        free(statusBuffer_[i]);
+        free(uploadWindow_[i]);
+        delete shareFilter_[i];
         delete socketArray_[i];
     }
+    free(uploadWindow_);
+    free(windowHead_);
+    free(windowCount_);
+    free(windowSize_);
+    free(nextBatchID_);
+    free(shareFilter_);
+    free(statusBuffer_);
+    free(receiving_);
+    free(replyParam_);
+    pthread_mutex_destroy(&windowLock_);
+    pthread_mutex_destroy(&fileLock_);
+    pthread_cond_destroy(&fileCond_);
+    free(socketArray_);
+}
+
+/*
+ * open a file for uploading, its batches are interleaved with those of the other open files
+ * (waits while UPLOAD_MAX_FILES files are being uploaded)
+ *
+ * @param fileName - the file to be uploaded
+ * @param nameSize - the size of the file name
+ *
+ * @return - the slot of the file
+ */
+int Uploader::openFile(char *fileName, int nameSize)
+{
+    uploadFile_t *file = createFile(fileName, nameSize);
+    int fileID;
+
+    /* a slot is reused only after every server recorded the previous file in it */
+    pthread_mutex_lock(&fileLock_);
+    while(true) {
+        for(fileID = 0; fileID < UPLOAD_MAX_FILES; fileID++) {
+            if(files_[fileID] == NULL) {
+                break;
+            }
+        }
+        if(fileID < UPLOAD_MAX_FILES) {
+            break;
+        }
+        pthread_cond_wait(&fileCond_, &fileLock_);
+    }
+    file->fileID = fileID;
+    files_[fileID] = file;
+    fileDone_[fileID] = false;
+    pthread_cond_broadcast(&fileCond_);
+    pthread_mutex_unlock(&fileLock_);
+
+    printf("[Uploader] '%s' opened in slot %d\n", file->name, fileID);
+    return fileID;
+}
+
+/*
+ * get the checkpoint of an open file
+ *
+ * @param fileID - the slot of the file
+ *
+ * @return - the checkpoint keeping the progress and the keys of the file
+ */
+UploadCheckpoint *Uploader::getCheckpoint(int fileID)
+{
+    return files_[fileID]->checkpoint;
+}
+
+/*
+ * allocate the queues, buffers and checkpoint of a file to be uploaded
+ *
+ * @param fileName - the file to be uploaded
+ * @param nameSize - the size of the file name
+ *
+ * @return - the file
+ */
+Uploader::uploadFile_t *Uploader::createFile(char *fileName, int nameSize)
+{
+    uploadFile_t *file = (uploadFile_t *) malloc(sizeof(uploadFile_t));
+    long resumeSize;
+
+    memcpy(file->name, fileName, nameSize < (int) sizeof(file->name) ? nameSize : (int) sizeof(file->name));
+    file->name[nameSize < (int) sizeof(file->name) ? nameSize : (int) sizeof(file->name) - 1] = '\0';
+    file->fileID = -1;
+
+    file->ringBuffer = (MessageQueue<Chunk_t> **) malloc(sizeof(MessageQueue<Chunk_t> *) * (total_ / 2));
+    file->ringBufferMeta = (MessageQueue<ItemMeta_t> **) malloc(sizeof(MessageQueue<ItemMeta_t> *) * (total_ / 2));
     for(int i = 0; i < total_ / 2; i++) {
-        delete ringBuffer_[i];
-        delete ringBufferMeta_[i];
+        file->ringBuffer[i] = new MessageQueue<Chunk_t>(UPLOAD_QUEUE_SIZE);
+        file->ringBufferMeta[i] = new MessageQueue<ItemMeta_t>(UPLOAD_QUEUE_SIZE);
     }
-    free(ringBuffer_);
-    free(ringBufferMeta_);
-    free(shareSizeArray_);
-    free(headerArray_);
-    free(socketArray_);
-    free(numOfShares_);
-    free(metaWP_);
-    free(containerWP_);
-    free(uploadContainer_);
-    free(uploadMetaBuffer_);
+
+    file->headerArray = (fileShareMDHead_t **) malloc(sizeof(fileShareMDHead_t *) * total_);
+    file->uploadMetaBuffer = (char **) malloc(sizeof(char *) * total_);
+    file->uploadContainer = (char **) malloc(sizeof(char *) * total_);
+    file->containerWP = (int *) malloc(sizeof(int) * total_);
+    file->metaWP = (int *) malloc(sizeof(int) * total_);
+    file->numOfShares = (int *) malloc(sizeof(int) * total_);
+    file->shareSizeArray = (int **) malloc(sizeof(int *) * total_);
+    file->shareFPArray = (unsigned char **) malloc(sizeof(unsigned char *) * total_);
+    file->numOfHints = (int *) malloc(sizeof(int) * total_);
+    file->resumeSecrets = (int *) malloc(sizeof(int) * total_);
+    file->secretCount = (int *) malloc(sizeof(int) * total_);
+    file->lastSecretID = (int *) malloc(sizeof(int) * total_);
+    file->numOfBatches = (int *) malloc(sizeof(int) * total_);
+    file->outstanding = (int *) malloc(sizeof(int) * total_);
+    file->state = (int *) malloc(sizeof(int) * total_);
+    file->accuData = (long long *) malloc(sizeof(long long) * total_);
+    file->accuUnique = (long long *) malloc(sizeof(long long) * total_);
+    file->totalChunks = (int *) malloc(sizeof(int) * total_);
+    file->performUploadTime = (double *) malloc(sizeof(double) * total_);
+    file->recipeHandlingTime = (double *) malloc(sizeof(double) * total_);
+
+    /* resume from the checkpoint of the file, if a previous upload of it was interrupted */
+    file->checkpoint = new UploadCheckpoint(UPLOAD_CHECKPOINT_PREFIX, userID_, file->name, total_);
+
+    for(int i = 0; i < total_; i++) {
+        file->headerArray[i] = NULL;
+        file->uploadMetaBuffer[i] = (char *) malloc(sizeof(char) * UPLOAD_BUFFER_SIZE);
+        file->uploadContainer[i] = (char *) malloc(sizeof(char) * UPLOAD_BUFFER_SIZE);
+        file->containerWP[i] = 0;
+        file->metaWP[i] = 0;
+        file->numOfShares[i] = 0;
+        file->shareSizeArray[i] = (int *) malloc(sizeof(int) * UPLOAD_BUFFER_SIZE);
+        file->shareFPArray[i] = (unsigned char *) malloc(FP_SIZE * UPLOAD_MAX_SHARES);
+        file->numOfHints[i] = 0;
+        file->resumeSecrets[i] = file->checkpoint->getResumeSecrets(i, &resumeSize);
+        file->secretCount[i] = 0;
+        file->lastSecretID[i] = 0;
+        file->numOfBatches[i] = 0;
+        file->outstanding[i] = 0;
+        file->state[i] = UPLOAD_CLOUD_ACTIVE;
+        file->accuData[i] = 0;
+        file->accuUnique[i] = 0;
+        file->totalChunks[i] = 0;
+        file->performUploadTime[i] = 0;
+        file->recipeHandlingTime[i] = 0;
+    }
+    file->remaining = total_;
+
+    return file;
 }
 
 /*
- * Initiate upload
+ * free a file whose upload is finished
+ *
+ * @param file - the file
  *
+ */
+void Uploader::freeFile(uploadFile_t *file)
+{
+    for(int i = 0; i < total_ / 2; i++) {
+        delete file->ringBuffer[i];
+        delete file->ringBufferMeta[i];
+    }
+    for(int i = 0; i < total_; i++) {
+        free(file->uploadMetaBuffer[i]);
+        free(file->uploadContainer[i]);
+        free(file->shareSizeArray[i]);
+        free(file->shareFPArray[i]);
+    }
+    delete file->checkpoint;
+    free(file->ringBuffer);
+    free(file->ringBufferMeta);
+    free(file->headerArray);
+    free(file->uploadMetaBuffer);
+    free(file->uploadContainer);
+    free(file->containerWP);
+    free(file->metaWP);
+    free(file->numOfShares);
+    free(file->shareSizeArray);
+    free(file->shareFPArray);
+    free(file->numOfHints);
+    free(file->resumeSecrets);
+    free(file->secretCount);
+    free(file->lastSecretID);
+    free(file->numOfBatches);
+    free(file->outstanding);
+    free(file->state);
+    free(file->accuData);
+    free(file->accuUnique);
+    free(file->totalChunks);
+    free(file->performUploadTime);
+    free(file->recipeHandlingTime);
+    free(file);
+}
+
+/*
+ * Initiate upload: queue the metadata of the buffered shares and keep the batch outstanding
+ * until the server acknowledges it, so the next batch can be filled in the meantime
+ * (the caller makes sure the server has credit left)
+ *
+ * @param file - the file the shares belong to
  * @param cloudIndex - indicate targeting cloud
  * @param end - indicate ending(only used for metaDedupCore)
  *
  */
-int Uploader::performUpload(int cloudIndex, bool end)
+int Uploader::performUpload(uploadFile_t *file, int cloudIndex, bool end)
+{
+    pthread_mutex_lock(&windowLock_);
+
+    /* 1. park the metadata and shares in the window and hand a spare container back to the dispatcher */
+    uploadBatch_t *batch = &uploadWindow_[cloudIndex][(windowHead_[cloudIndex] + windowCount_[cloudIndex]) %
+                                                      UPLOAD_WINDOW_SIZE];
+    char *container = batch->container;
+    int *shareSizeArray = batch->shareSizeArray;
+    unsigned char *shareFPArray = batch->shareFPArray;
+
+    /* the metadata buffer keeps the file header being updated, so the batch gets a copy (only the reference
+       list if the filter knows every share) */
+    batch->ref = (file->numOfShares[cloudIndex] > 0 && file->numOfHints[cloudIndex] == file->numOfShares[cloudIndex]);
+    if(batch->ref) {
+        batch->metaSize = packReferences(file->uploadMetaBuffer[cloudIndex], file->metaWP[cloudIndex],
+                                         batch->metaBuffer);
+    } else {
+        memcpy(batch->metaBuffer, file->uploadMetaBuffer[cloudIndex], file->metaWP[cloudIndex]);
+        batch->metaSize = file->metaWP[cloudIndex];
+    }
+    batch->batchID = nextBatchID_[cloudIndex]++;
+    batch->end = end;
+    batch->container = file->uploadContainer[cloudIndex];
+    batch->shareSizeArray = file->shareSizeArray[cloudIndex];
+    batch->shareFPArray = file->shareFPArray[cloudIndex];
+    batch->numOfShares = file->numOfShares[cloudIndex];
+    batch->numOfSecrets = file->headerArray[cloudIndex]->numOfComingSecrets;
+    batch->sizeOfSecrets = file->headerArray[cloudIndex]->sizeOfComingSecrets;
+    batch->lastSecretID = file->lastSecretID[cloudIndex];
+    batch->statusDone = false;
+    batch->acked = false;
+    batch->dataPending = false;
+    batch->file = file;
+    windowCount_[cloudIndex]++;
+    file->numOfBatches[cloudIndex]++;
+    file->outstanding[cloudIndex]++;
+
+    file->uploadContainer[cloudIndex] = container;
+    file->shareSizeArray[cloudIndex] = shareSizeArray;
+    file->shareFPArray[cloudIndex] = shareFPArray;
+    file->containerWP[cloudIndex] = 0;
+    file->numOfShares[cloudIndex] = 0;
+    file->numOfHints[cloudIndex] = 0;
+
+    /* 2. send metadata tagged with the batch ID and the file slot, as references if the filter knows every share */
+    struct iovec vec[2];
+    fillIOV(vec[0], batch->metaHead, Socket::buildUploadHead(batch->metaHead, batch->ref ? SEND_META_REF : SEND_META,
+                                                             cloudIndex < total_ / 2, end, batch->batchID,
+                                                             file->fileID, batch->metaSize));
+    fillIOV(vec[1], batch->metaBuffer, batch->metaSize);
+    engine_->submitSend(cloudIndex, vec, 2, NULL, NULL);
+
+    /* 3. wait for its status list (or acknowledgement), unless an earlier reply is being received */
+    startReplyRecv(cloudIndex);
+
+    pthread_mutex_unlock(&windowLock_);
+    return 0;
+}
+
+/*
+ * start receiving the next reply of a cloud while a batch still waits for its status list or
+ * acknowledgement (with windowLock_ held), replies share one buffer, so one is received at a time
+ *
+ * @param cloudIndex - indicate targeting cloud
+ *
+ */
+void Uploader::startReplyRecv(int cloudIndex)
 {
-    /* 1. send metadata */
-    socketArray_[cloudIndex]->sendMeta(uploadMetaBuffer_[cloudIndex], metaWP_[cloudIndex]);
+    if(receiving_[cloudIndex]) {
+        return;
+    }
 
-    /* 2. get back the status list */
-    int numOfShares;
-    bool *statusList = (bool *) malloc(sizeof(bool) * (numOfShares_[cloudIndex] + 1));
-    socketArray_[cloudIndex]->getStatus(statusList, &numOfShares);
+    for(int i = 0; i < windowCount_[cloudIndex]; i++) {
+        uploadBatch_t *batch = &uploadWindow_[cloudIndex][(windowHead_[cloudIndex] + i) % UPLOAD_WINDOW_SIZE];
+        if(!batch->statusDone || !batch->acked) {
+            receiving_[cloudIndex] = true;
+            engine_->submitRecv(cloudIndex, statusBuffer_[cloudIndex], UPLOAD_STATUS_HEAD_SIZE, cloudIndex,
+                                &replyHeadReceived, &replyParam_[cloudIndex]);
+            return;
+        }
+    }
+}
 
-    /* 3. according to status list, reconstruct the container buffer */
-    int buffer_size = 0;
-    bool metaType = false;
-    if(cloudIndex < total_ / 2) {
-        buffer_size = RING_BUFFER_META_SIZE;
-        metaType = true;
+/*
+ * network engine callback: the head of a reply (a status list or an acknowledgement) is received
+ *
+ * @param arg - the reply parameter of the cloud
+ * @param result - the number of bytes received, or -errno
+ *
+ */
+void Uploader::replyHeadReceived(void *arg, int result)
+{
+    param_t *param = (param_t *) arg;
+    Uploader *obj = param->obj;
+    int cloudIndex = param->cloudIndex;
+    int *head = (int *) obj->statusBuffer_[cloudIndex];
+    uploadBatch_t *batch = NULL;
+    int i;
+
+    pthread_mutex_lock(&obj->windowLock_);
+    obj->receiving_[cloudIndex] = false;
+
+    if(result < 0) {
+        fprintf(stderr, "[Uploader] <%d> fail to receive the replies of the server\n", cloudIndex);
+        obj->abortUpload(cloudIndex);
+        pthread_mutex_unlock(&obj->windowLock_);
+        return;
+    }
+
+    /* indicator, batch ID and number of shares: the status lists come back in batch order, except that
+       accepted references get none */
+    if(head[0] == GET_STAT && head[2] >= 0 && head[2] <= (int) UPLOAD_MAX_SHARES) {
+        for(i = 0; i < obj->windowCount_[cloudIndex]; i++) {
+            batch = &obj->uploadWindow_[cloudIndex][(obj->windowHead_[cloudIndex] + i) % UPLOAD_WINDOW_SIZE];
+            if(!batch->statusDone && (batch->batchID == head[1] || !batch->ref)) {
+                break;
+            }
+        }
+        if(i == obj->windowCount_[cloudIndex] || head[1] != batch->batchID) {
+            fprintf(stderr, "[Uploader] <%d> status of unexpected batch %d received\n", cloudIndex, head[1]);
+            obj->abortUpload(cloudIndex);
+        } else if(head[2] == 0) {
+            obj->completeUpload(batch, 0);
+        } else {
+            obj->receiving_[cloudIndex] = true;
+            obj->engine_->submitRecv(cloudIndex, obj->statusBuffer_[cloudIndex] + UPLOAD_STATUS_HEAD_SIZE, head[2],
+                                     cloudIndex, &statusListReceived, batch);
+        }
+        pthread_mutex_unlock(&obj->windowLock_);
+        return;
+    }
+
+    /* indicator, batch ID and result: the server recorded the batch, also in batch order */
+    if(head[0] == GET_ACK) {
+        for(i = 0; i < obj->windowCount_[cloudIndex]; i++) {
+            batch = &obj->uploadWindow_[cloudIndex][(obj->windowHead_[cloudIndex] + i) % UPLOAD_WINDOW_SIZE];
+            if(!batch->acked) {
+                break;
+            }
+        }
+        if(i == obj->windowCount_[cloudIndex] || head[1] != batch->batchID || (!batch->statusDone && !batch->ref)) {
+            fprintf(stderr, "[Uploader] <%d> acknowledgement of unexpected batch %d received\n", cloudIndex,
+                    head[1]);
+            obj->abortUpload(cloudIndex);
+        } else {
+            if(!batch->statusDone) {
+                obj->acceptReferences(batch);
+            }
+            obj->acknowledgeUpload(batch, head[2] == 1);
+        }
+        pthread_mutex_unlock(&obj->windowLock_);
+        return;
+    }
+
+    fprintf(stderr, "[Uploader] <%d> invalid reply %d received\n", cloudIndex, head[0]);
+    obj->abortUpload(cloudIndex);
+    pthread_mutex_unlock(&obj->windowLock_);
+}
+
+/*
+ * network engine callback: a status list is received
+ *
+ * @param arg - the upload batch
+ * @param result - the number of bytes received, or -errno
+ *
+ */
+void Uploader::statusListReceived(void *arg, int result)
+{
+    uploadBatch_t *batch = (uploadBatch_t *) arg;
+    Uploader *obj = batch->obj;
+
+    pthread_mutex_lock(&obj->windowLock_);
+    obj->receiving_[batch->cloudIndex] = false;
+    if(result < 0) {
+        fprintf(stderr, "[Uploader] <%d> fail to receive the status of batch %d\n", batch->cloudIndex,
+                batch->batchID);
+        obj->abortUpload(batch->cloudIndex);
     } else {
-        buffer_size = RING_BUFFER_DATA_SIZE;
+        obj->completeUpload(batch, result / sizeof(bool));
     }
-    char temp[buffer_size];
+    pthread_mutex_unlock(&obj->windowLock_);
+}
+
+/*
+ * network engine callback: the data of a batch is sent
+ *
+ * @param arg - the upload batch
+ * @param result - the number of bytes sent, or -errno
+ *
+ */
+void Uploader::dataSent(void *arg, int result)
+{
+    uploadBatch_t *batch = (uploadBatch_t *) arg;
+    Uploader *obj = batch->obj;
+
+    if(result < 0) {
+        fprintf(stderr, "[Uploader] <%d> fail to send the data of batch %d\n", batch->cloudIndex, batch->batchID);
+    }
+
+    pthread_mutex_lock(&obj->windowLock_);
+    batch->dataPending = false;
+    obj->releaseBatches(batch->cloudIndex);
+    pthread_mutex_unlock(&obj->windowLock_);
+}
+
+/*
+ * finish a batch whose status list arrived (with windowLock_ held): send the unique data
+ *
+ * @param batch - the upload batch
+ * @param numOfShares - the number of entries in the status list
+ *
+ */
+int Uploader::completeUpload(uploadBatch_t *batch, int numOfShares)
+{
+    int cloudIndex = batch->cloudIndex;
+    bool *statusList = (bool *) (statusBuffer_[cloudIndex] + UPLOAD_STATUS_HEAD_SIZE);
+
+    batch->statusDone = true;
+
+    /* 1. a status list for references means the server rejected them, so the data follows after all */
+    if(batch->ref) {
+        printf("[Uploader] <%d> references of batch %d rejected, sending data\n", cloudIndex, batch->batchID);
+    }
+
+    /* 2. according to status list, gather the unique shares in place (adjacent ones in one buffer) */
+    bool metaType = (cloudIndex < total_ / 2);
+    struct iovec *dataVector = (struct iovec *) malloc(sizeof(struct iovec) * (numOfShares + 1));
+    int vectorCount = 1;
     int indexCount = 0;
     int containerIndex = 0;
     int currentSize = 0;
     for(int i = 0; i < numOfShares; i++) {
-        currentSize = shareSizeArray_[cloudIndex][i];
+        currentSize = batch->shareSizeArray[i];
         if(statusList[i] == 0) {
-            memcpy(temp, uploadContainer_[cloudIndex] + containerIndex, currentSize);
-            memcpy(uploadContainer_[cloudIndex] + indexCount, temp, currentSize);
+            if(vectorCount > 1 && (char *) dataVector[vectorCount - 1].iov_base +
+                                  dataVector[vectorCount - 1].iov_len == batch->container + containerIndex) {
+                dataVector[vectorCount - 1].iov_len += currentSize;
+            } else {
+                fillIOV(dataVector[vectorCount], batch->container + containerIndex, currentSize);
+                vectorCount++;
+            }
             indexCount += currentSize;
         }
         containerIndex += currentSize;
+
+        /* the share is stored from now on, either as a duplicate or by the data sent below */
+        shareFilter_[cloudIndex]->insert(batch->shareFPArray + i * FP_SIZE);
     }
 
     /* calculate the amount of sent data */
-    accuData_[cloudIndex] += containerIndex;
-    accuUnique_[cloudIndex] += indexCount;
+    batch->file->accuData[cloudIndex] += containerIndex;
+    batch->file->accuUnique[cloudIndex] += indexCount;
+
+    /* 3. finally send the unique data to the cloud, the container is reused once it is out */
+    fillIOV(dataVector[0], batch->dataHead, Socket::buildUploadHead(batch->dataHead, SEND_DATA, metaType, batch->end,
+                                                                    batch->batchID, 0, indexCount));
+    batch->dataPending = true;
+    engine_->submitSend(cloudIndex, dataVector, vectorCount, &dataSent, batch);
+    free(dataVector);
+
+    /* 4. go on with the next reply: the status list of the next batch or an acknowledgement */
+    startReplyRecv(cloudIndex);
+    return 0;
+}
 
-    /* 4. finally send the unique data to the cloud */
-    socketArray_[cloudIndex]->sendData(uploadContainer_[cloudIndex], indexCount, metaType, end);
+/*
+ * finish a batch of references acknowledged without a status list (with windowLock_ held)
+ *
+ * @param batch - the upload batch
+ *
+ */
+void Uploader::acceptReferences(uploadBatch_t *batch)
+{
+    batch->statusDone = true;
+    for(int i = 0; i < batch->numOfShares; i++) {
+        batch->file->accuData[batch->cloudIndex] += batch->shareSizeArray[i];
+    }
+}
 
-    free(statusList);
-    return 0;
+/*
+ * record the acknowledgement of a batch in the checkpoint (with windowLock_ held)
+ *
+ * @param batch - the upload batch
+ * @param recorded - if the server recorded the batch
+ *
+ */
+void Uploader::acknowledgeUpload(uploadBatch_t *batch, bool recorded)
+{
+    int cloudIndex = batch->cloudIndex;
+
+    batch->acked = true;
+    if(recorded) {
+        batch->file->checkpoint->acknowledge(cloudIndex, batch->numOfSecrets, batch->sizeOfSecrets,
+                                             batch->lastSecretID);
+        batch->file->checkpoint->save();
+    } else {
+        fprintf(stderr, "[Uploader] <%d> server fails to record batch %d of '%s'\n", cloudIndex, batch->batchID,
+                batch->file->name);
+        batch->file->checkpoint->fail(cloudIndex);
+    }
+
+    releaseBatches(cloudIndex);
+    startReplyRecv(cloudIndex);
+}
+
+/*
+ * give up the batches of a cloud whose replies cannot be received (with windowLock_ held)
+ *
+ * @param cloudIndex - indicate targeting cloud
+ *
+ */
+void Uploader::abortUpload(int cloudIndex)
+{
+    /* the reply stream is lost, so is whatever the server still had to acknowledge */
+    for(int i = 0; i < windowCount_[cloudIndex]; i++) {
+        uploadBatch_t *batch = &uploadWindow_[cloudIndex][(windowHead_[cloudIndex] + i) % UPLOAD_WINDOW_SIZE];
+        batch->statusDone = true;
+        batch->acked = true;
+        batch->file->checkpoint->fail(cloudIndex);
+    }
+    releaseBatches(cloudIndex);
+
+    /* fail the sends still queued at once rather than let them write reused buffers */
+    shutdown(socketArray_[cloudIndex]->hostSock_, SHUT_RDWR);
+}
+
+/*
+ * free the finished batches at the head of the window, in batch order (with windowLock_ held)
+ *
+ * @param cloudIndex - indicate targeting cloud
+ *
+ */
+void Uploader::releaseBatches(int cloudIndex)
+{
+    while(windowCount_[cloudIndex] > 0) {
+        uploadBatch_t *batch = &uploadWindow_[cloudIndex][windowHead_[cloudIndex]];
+        if(!batch->statusDone || !batch->acked || batch->dataPending) {
+            break;
+        }
+        windowHead_[cloudIndex] = (windowHead_[cloudIndex] + 1) % UPLOAD_WINDOW_SIZE;
+        windowCount_[cloudIndex]--;
+        batch->file->outstanding[cloudIndex]--;
+    }
+}
+
+/*
+ * check if another batch can be sent to a cloud
+ *
+ * @param cloudIndex - indicate targeting cloud
+ *
+ * @return - a boolean value that indicates if the server has credit left
+ */
+bool Uploader::hasCredit(int cloudIndex)
+{
+    pthread_mutex_lock(&windowLock_);
+    bool ret = (windowCount_[cloudIndex] < windowSize_[cloudIndex]);
+    pthread_mutex_unlock(&windowLock_);
+    return ret;
+}
+
+/*
+ * check if all batches of a file sent to a cloud are finished
+ *
+ * @param file - the file
+ * @param cloudIndex - indicate targeting cloud
+ *
+ * @return - a boolean value that indicates if none of its batches is left in the window
+ */
+bool Uploader::isDrained(uploadFile_t *file, int cloudIndex)
+{
+    pthread_mutex_lock(&windowLock_);
+    bool ret = (file->outstanding[cloudIndex] == 0);
+    pthread_mutex_unlock(&windowLock_);
+    return ret;
 }
 
 /*
  * procedure for update headers when upload finished
- * 
+ *
+ * @param file - the file
  * @param cloudIndex - indicating targeting cloud
  *
  *
  *
  */
 // 	SEND 1: (4 byte) state update indicator
-int Uploader::updateHeader(int cloudIndex)
+int Uploader::updateHeader(uploadFile_t *file, int cloudIndex)
 {
 
     /* get the file name size */
-    int offset = headerArray_[cloudIndex]->fullNameSize;
+    int offset = file->headerArray[cloudIndex]->fullNameSize;
 
     /* update header counts */
-    headerArray_[cloudIndex]->numOfPastSecrets += headerArray_[cloudIndex]->numOfComingSecrets;
-    headerArray_[cloudIndex]->sizeOfPastSecrets += headerArray_[cloudIndex]->sizeOfComingSecrets;
+    file->headerArray[cloudIndex]->numOfPastSecrets += file->headerArray[cloudIndex]->numOfComingSecrets;
+    file->headerArray[cloudIndex]->sizeOfPastSecrets += file->headerArray[cloudIndex]->sizeOfComingSecrets;
 
     /* reset coming counts */
-    headerArray_[cloudIndex]->numOfComingSecrets = 0;
-    headerArray_[cloudIndex]->sizeOfComingSecrets = 0;
+    file->headerArray[cloudIndex]->numOfComingSecrets = 0;
+    file->headerArray[cloudIndex]->sizeOfComingSecrets = 0;
 
     /* reset all index (means buffers are empty) */
-    containerWP_[cloudIndex] = 0;
-    metaWP_[cloudIndex] = 0;
-    numOfShares_[cloudIndex] = 0;
+    file->containerWP[cloudIndex] = 0;
+    file->metaWP[cloudIndex] = 0;
+    file->numOfShares[cloudIndex] = 0;
 
     /* copy the header into metabuffer */
-    memcpy(uploadMetaBuffer_[cloudIndex], headerArray_[cloudIndex], fileMDHeadSize_ + offset);
-    metaWP_[cloudIndex] += fileMDHeadSize_ + offset;
+    memcpy(file->uploadMetaBuffer[cloudIndex], file->headerArray[cloudIndex], fileMDHeadSize_ + offset);
+    file->metaWP[cloudIndex] += fileMDHeadSize_ + offset;
 
     return 1;
 }
@@ -470,11 +1207,12 @@ int Uploader::updateHeader(int cloudIndex)
  *
  * @param item - the object to be added
  * @param index - the buffer index
+ * @param fileID - the slot of the file
  *
  */
-int Uploader::add(Chunk_t &item, int index)
+int Uploader::add(Chunk_t &item, int index, int fileID)
 {
-    ringBuffer_[index]->push(item);
+    files_[fileID]->ringBuffer[index]->push(item);
     return 1;
 }
 
@@ -483,30 +1221,64 @@ int Uploader::add(Chunk_t &item, int index)
  *
  * @param item - the object to be added
  * @param index - the buffer index
+ * @param fileID - the slot of the file
  *
  */
-int Uploader::addMeta(ItemMeta_t &item, int index)
+int Uploader::addMeta(ItemMeta_t &item, int index, int fileID)
 {
-    ringBufferMeta_[index]->push(item);
+    files_[fileID]->ringBufferMeta[index]->push(item);
     return 1;
 }
 
 /*
- * indicate the end of uploading a file
- * 
+ * mark the ringbuffers of a file as done, no more objects are added to them
+ *
+ * @param fileID - the slot of the file
+ *
+ */
+void Uploader::finishInput(int fileID)
+{
+    for(int i = 0; i < total_ / 2; i++) {
+        files_[fileID]->ringBuffer[i]->set_job_done();
+        files_[fileID]->ringBufferMeta[i]->set_job_done();
+    }
+}
+
+/*
+ * indicate the end of uploading a file: wait until every cloud acknowledged it and free its slot
+ *
+ * @param fileID - the slot of the file
  * @return total - total amount of data that input to uploader
  * @return uniq - the amount of unique data that transferred in network
  *
  */
-int Uploader::indicateEnd(long long *total, long long *uniq)
+int Uploader::indicateEnd(int fileID, long long *total, long long *uniq)
 {
+    uploadFile_t *file;
 
-    for(int i = 0; i < UPLOAD_NUM_THREADS * 2; i++) {
+    /* the dispatcher hands the file over once all its batches are acknowledged */
+    pthread_mutex_lock(&fileLock_);
+    while(!fileDone_[fileID]) {
+        pthread_cond_wait(&fileCond_, &fileLock_);
+    }
+    file = files_[fileID];
+    pthread_mutex_unlock(&fileLock_);
 
-        pthread_join(tid_[i], NULL);
-        *total += accuData_[i];
-        *uniq += accuUnique_[i];
+    for(int i = 0; i < total_; i++) {
+        *total += file->accuData[i];
+        *uniq += file->accuUnique[i];
     }
+
+    /* the checkpoint is no longer needed once every batch is acknowledged */
+    file->checkpoint->finish();
+    freeFile(file);
+
+    /* the slot can take the next file */
+    pthread_mutex_lock(&fileLock_);
+    files_[fileID] = NULL;
+    fileDone_[fileID] = false;
+    pthread_cond_broadcast(&fileCond_);
+    pthread_mutex_unlock(&fileLock_);
     return 1;
 }
 
@@ -515,31 +1287,38 @@ int Uploader::indicateEnd(long long *total, long long *uniq)
  *
  * @param header - file header to be collect in Uploader
  * @param cloudIndex - the index of cloud server
+ * @param fileID - the slot of the file
  *
  */
-void Uploader::collect_header(FileHeader_t &header, int cloudIndex)
+void Uploader::collect_header(FileHeader_t &header, int cloudIndex, int fileID)
 {
+    uploadFile_t *file = this->files_[fileID];
+
     /* copy object content into metabuffer */
-    memcpy(this->uploadMetaBuffer_[cloudIndex] + this->metaWP_[cloudIndex],
+    memcpy(file->uploadMetaBuffer[cloudIndex] + file->metaWP[cloudIndex],
            &(header.file_shareMD_header), this->fileMDHeadSize_);
 
     /* head array point to new file header */
-    this->headerArray_[cloudIndex] = (fileShareMDHead_t *) (this->uploadMetaBuffer_[cloudIndex] +
-                                                            this->metaWP_[cloudIndex]);
+    file->headerArray[cloudIndex] = (fileShareMDHead_t *) (file->uploadMetaBuffer[cloudIndex] +
+                                                           file->metaWP[cloudIndex]);
 
     /* meta index update */
-    this->metaWP_[cloudIndex] += this->fileMDHeadSize_;
+    file->metaWP[cloudIndex] += this->fileMDHeadSize_;
+
+    /* a resumed upload continues the recipe after the secrets acknowledged before the restart */
+    file->headerArray[cloudIndex]->numOfPastSecrets =
+            file->checkpoint->getResumeSecrets(cloudIndex, &(file->headerArray[cloudIndex]->sizeOfPastSecrets));
 
     /* copy file full path name */
-    memcpy(this->uploadMetaBuffer_[cloudIndex] + this->metaWP_[cloudIndex], header.encoded_file_name,
+    memcpy(file->uploadMetaBuffer[cloudIndex] + file->metaWP[cloudIndex], header.encoded_file_name,
            header.file_shareMD_header.fullNameSize);
 
     /* meta index update */
-    this->metaWP_[cloudIndex] += this->headerArray_[cloudIndex]->fullNameSize;
+    file->metaWP[cloudIndex] += file->headerArray[cloudIndex]->fullNameSize;
 }
 
 /*
- * copy Chunk_t to Item_t
+ * copy the share header of Chunk_t to Item_t (the share data is copied into the container directly)
  *
  * @param output - dest of data structure
  * @param input - src of data structure
@@ -554,7 +1333,6 @@ void Uploader::copy_Chunk_to_Item(Uploader::Item_t &output, Chunk_t &input)
     memcpy(output.shareObj.share_header.shareFP, input.total_FP + input.share_id * FP_SIZE, FP_SIZE);
     output.shareObj.share_header.segID = input.seg_id;
 
-    memcpy(output.shareObj.data, input.content + input.share_id * input.share_size, input.share_size);
     output.kmCloudIndex = input.kmCloudIndex;
     if(input.end == 1) {
         output.type = SHARE_END;
@@ -27,24 +27,57 @@
 #include "DataStruct.hh"
 #include "Logger.hh"
 #include "MessageQueue.hh"
+#include "NetEngine.hh"
+#include "ShareFilter.hh"
+#include "UploadCheckpoint.hh"
 #include "socket.hh"
 
-/* Server Number (may be deleted in later version)*/
-#define UPLOAD_SERVER_NUMBER 5
-
 /* upload buffer queue size */
 #define UPLOAD_QUEUE_SIZE 2048
 
 /* upload buffer size */
 #define UPLOAD_BUFFER_SIZE (4 * 1024 * 1024)
 
+/* max number of upload batches outstanding per server (further limited by the server-granted credits) */
+#define UPLOAD_WINDOW_SIZE 4
+
 /* fingerprint size */
 #define FP_SIZE 32
 
-/* num of upload threads */
-/* one thread for one server => 5 thread for 5 servers */
+/* max number of shares in an upload batch (bounded by the share entries fitting in the metadata buffer) */
+#define UPLOAD_MAX_SHARES (UPLOAD_BUFFER_SIZE / (FP_SIZE + 5 * sizeof(int)))
+
+/* prefix of the files keeping the share filters, followed by <userID>_<cloudIndex> */
+#define SHARE_FILTER_PREFIX "./shareFilter_"
+
+/* prefix of the files keeping the upload checkpoints, followed by <userID>_<hash of the file name> */
+#define UPLOAD_CHECKPOINT_PREFIX "./uploadCheckpoint_"
+
+/* max number of files uploaded at once over the same connections (each one takes a slot on the servers) */
+#define UPLOAD_MAX_FILES 4
+
+/* a batch of references (SEND_META_REF) goes out as a reference list: [fileShareMDHead_t + full file name +
+   [shareFP + varints of the zigzag deltas of (secretID, secretSize, shareSize, segID, shareID) against the
+   previous share] ...] ..., the server acknowledges it without a status list once it accepts the references */
+
+/* size of the head of a reply: indicator, batch ID, and the number of shares (status list) or the result (ack) */
+#define UPLOAD_STATUS_HEAD_SIZE (3 * sizeof(int))
+
+/* size of the buffer receiving the status lists of a server */
+#define UPLOAD_STATUS_BUFFER_SIZE (UPLOAD_STATUS_HEAD_SIZE + UPLOAD_MAX_SHARES * sizeof(bool))
+
+/* backend of the network engine (io_uring where the kernel supports it, epoll otherwise) */
+#define UPLOAD_NET_BACKEND NET_ENGINE_AUTO
+
+/* num of servers of each kind (metadata and data) */
+/* all of them are served by one dispatcher thread and one network engine thread */
 #define UPLOAD_NUM_THREADS 5
 
+/* dispatcher states of a cloud */
+#define UPLOAD_CLOUD_ACTIVE 0
+#define UPLOAD_CLOUD_DRAINING 1
+#define UPLOAD_CLOUD_FINISHED 2
+
 /* object type indicators */
 #define FILE_HEADER (-9)
 #define SHARE_OBJECT (-8)
@@ -148,12 +181,96 @@ public:
         int kmCloudIndex;
     } ItemMeta_t;
 
-    /* thread parameter structure */
+    /* parameter of the reply callbacks of a cloud */
     typedef struct {
         int cloudIndex;
         Uploader *obj;
     } param_t;
 
+    /* a file being uploaded: its queues, buffers and progress on each cloud */
+    typedef struct {
+        /* slot of the file, tagged on its batches so the servers keep its recipe apart */
+        int fileID;
+        char name[256];
+
+        /* ringbuffers filled by the encoder of the file */
+        MessageQueue<Chunk_t> **ringBuffer;
+        MessageQueue<ItemMeta_t> **ringBufferMeta;
+
+        /* file header pointer array for modifying header */
+        fileShareMDHead_t **headerArray;
+
+        /* metadata buffer, container buffer and their write pointers */
+        char **uploadMetaBuffer;
+        char **uploadContainer;
+        int *containerWP;
+        int *metaWP;
+
+        /* number of shares in a buffer, their sizes and fingerprints */
+        int *numOfShares;
+        int **shareSizeArray;
+        unsigned char **shareFPArray;
+
+        /* indicate the number of shares in a buffer that the share filter knows as stored */
+        int *numOfHints;
+
+        /* checkpoint of the upload: secrets acknowledged by each cloud and keys obtained */
+        UploadCheckpoint *checkpoint;
+
+        /* number of secrets each cloud acknowledged before a restart, they are not sent again */
+        int *resumeSecrets;
+
+        /* number of secrets queued for each cloud so far */
+        int *secretCount;
+
+        /* ID of the last secret buffered for each cloud */
+        int *lastSecretID;
+
+        /* number of batches sent to each cloud, and of those still in its window */
+        int *numOfBatches;
+        int *outstanding;
+
+        /* dispatcher state of each cloud, and number of clouds not finished */
+        int *state;
+        int remaining;
+
+        /* record accumulated processed data and unique data */
+        long long *accuData;
+        long long *accuUnique;
+
+        /* statistics of the dispatcher */
+        int *totalChunks;
+        double *performUploadTime;
+        double *recipeHandlingTime;
+    } uploadFile_t;
+
+    /* upload batch whose metadata is sent and whose status list and acknowledgement are awaited */
+    typedef struct {
+        int batchID;
+        bool end;
+        bool ref;
+        char *metaBuffer;
+        int metaSize;
+        char *container;
+        int *shareSizeArray;
+        unsigned char *shareFPArray;
+        int numOfShares;
+        /* frame heads, kept until the network engine has sent them */
+        int metaHead[UPLOAD_HEAD_MAX_INTS];
+        int dataHead[UPLOAD_HEAD_MAX_INTS];
+        /* secrets of the batch (for the checkpoint) */
+        int numOfSecrets;
+        long sizeOfSecrets;
+        int lastSecretID;
+        /* indicate the status list is handled, the server recorded the batch, and its data is being sent */
+        bool statusDone;
+        bool acked;
+        bool dataPending;
+        int cloudIndex;
+        uploadFile_t *file;
+        Uploader *obj;
+    } uploadBatch_t;
+
     typedef struct {
         unsigned char shareFP[32];
         unsigned char other[18];
@@ -168,29 +285,57 @@ public:
     //total number of clouds
     int total_;
 
-    /* file header pointer array for modifying header */
-    fileShareMDHead_t **headerArray_;
+    /* the user id */
+    int userID_;
 
     /* socket array */
     Socket **socketArray_;
 
-    /* metadata buffer */
-    char **uploadMetaBuffer_;
+    /* files being uploaded, indexed by their slots (NULL if free) */
+    uploadFile_t *files_[UPLOAD_MAX_FILES];
+
+    /* indicate every cloud of the file in the slot is finished */
+    bool fileDone_[UPLOAD_MAX_FILES];
+
+    /* indicate no more files are opened, so the dispatcher exits once the open ones finish */
+    bool closing_;
+
+    /* lock and condition of the file slots, shared by the dispatcher and the callers */
+    pthread_mutex_t fileLock_;
+    pthread_cond_t fileCond_;
 
-    /* container buffer */
-    char **uploadContainer_;
+    /* filter of the shares already stored on each cloud */
+    ShareFilter **shareFilter_;
 
-    /* container write pointer */
-    int *containerWP_;
+    /* window of outstanding upload batches for each cloud */
+    uploadBatch_t **uploadWindow_;
 
-    /* metadata write pointer */
-    int *metaWP_;
+    /* index of the oldest outstanding batch in the window */
+    int *windowHead_;
 
-    /* indicate the number of shares in a buffer */
-    int *numOfShares_;
+    /* number of outstanding batches in the window */
+    int *windowCount_;
 
-    /* array for record each share size */
-    int **shareSizeArray_;
+    /* number of outstanding batches allowed (min of UPLOAD_WINDOW_SIZE and the server credits) */
+    int *windowSize_;
+
+    /* ID of the next upload batch */
+    int *nextBatchID_;
+
+    /* lock of the windows and share filters, shared by the dispatcher and the network engine thread */
+    pthread_mutex_t windowLock_;
+
+    /* buffer receiving the status lists of each cloud */
+    char **statusBuffer_;
+
+    /* indicate a reply of the cloud is being received */
+    bool *receiving_;
+
+    /* parameters of the reply callbacks of each cloud */
+    param_t *replyParam_;
+
+    /* network engine driving all connections */
+    NetEngine *engine_;
 
     /* size of file metadata header */
     int fileMDHeadSize_;
@@ -198,110 +343,329 @@ public:
     /* size of share metadata header */
     int shareMDEntrySize_;
 
-    /* thread id array */
-    pthread_t tid_[UPLOAD_NUM_THREADS * 2];
-
-    /* record accumulated processed data */
-    long long accuData_[UPLOAD_NUM_THREADS * 2];
-
-    /* record accumulated unique data */
-    long long accuUnique_[UPLOAD_NUM_THREADS * 2];
-
-    /* uploader ringbuffer array */
-    MessageQueue<Chunk_t> **ringBuffer_;
-    MessageQueue<ItemMeta_t> **ringBufferMeta_;
-    char name_[256];
+    /* dispatcher thread id */
+    pthread_t tid_;
 
     /*
-     * constructor
+     * constructor: connect to the servers, files are then opened for uploading
      *
-     * @param p - input large prime number
      * @param total - input total number of clouds
      * @param subset - input number of clouds to be chosen
+     * @param userID - the user id
      *
      */
-    Uploader(int total, int subset, int userID, char *fileName, int nameSize);
+    Uploader(int total, int subset, int userID);
 
     /*
-     * destructor
+     * destructor: wait for the files being uploaded and close the connections
      */
     ~Uploader();
 
     /*
-     * Initiate upload
+     * open a file for uploading, its batches are interleaved with those of the other open files
+     * (waits while UPLOAD_MAX_FILES files are being uploaded)
      *
+     * @param fileName - the file to be uploaded
+     * @param nameSize - the size of the file name
+     *
+     * @return - the slot of the file
+     */
+    int openFile(char *fileName, int nameSize);
+
+    /*
+     * get the checkpoint of an open file
+     *
+     * @param fileID - the slot of the file
+     *
+     * @return - the checkpoint keeping the progress and the keys of the file
+     */
+    UploadCheckpoint *getCheckpoint(int fileID);
+
+    /*
+     * Initiate upload: queue the metadata of the buffered shares and keep the batch outstanding
+     * until the server acknowledges it, so the next batch can be filled in the meantime
+     * (the caller makes sure the server has credit left)
+     *
+     * @param file - the file the shares belong to
      * @param cloudIndex - indicate targeting cloud
+     * @param end - indicate ending(only used for metaDedupCore)
      * 
      */
-    int performUpload(int cloudIndex, bool end);
+    int performUpload(uploadFile_t *file, int cloudIndex, bool end);
 
     /*
-     * indicate the end of uploading a file
-     * 
+     * check if another batch can be sent to a cloud
+     *
+     * @param cloudIndex - indicate targeting cloud
+     *
+     * @return - a boolean value that indicates if the server has credit left
+     */
+    bool hasCredit(int cloudIndex);
+
+    /*
+     * check if all batches of a file sent to a cloud are finished
+     *
+     * @param file - the file
+     * @param cloudIndex - indicate targeting cloud
+     *
+     * @return - a boolean value that indicates if none of its batches is left in the window
+     */
+    bool isDrained(uploadFile_t *file, int cloudIndex);
+
+    /*
+     * indicate the end of uploading a file: wait until every cloud acknowledged it and free its slot
+     *
+     * @param fileID - the slot of the file
      * @return total - total amount of data that input to uploader
      * @return uniq - the amount of unique data that transferred in network
      *
      */
-    int indicateEnd(long long *total, long long *uniq);
+    int indicateEnd(int fileID, long long *total, long long *uniq);
 
     /*
      * interface for adding object to ringbuffer
      *
      * @param item - the object to be added
      * @param index - the buffer index
+     * @param fileID - the slot of the file
      *
      */
-    int add(Chunk_t &item, int index);
+    int add(Chunk_t &item, int index, int fileID);
 
     /*
      * interface for adding object to ringbuffer
      *
      * @param item - the object to be added
      * @param index - the buffer index
+     * @param fileID - the slot of the file
      *
      */
-    int addMeta(ItemMeta_t &item, int index);
+    int addMeta(ItemMeta_t &item, int index, int fileID);
+
+    /*
+     * mark the ringbuffers of a file as done, no more objects are added to them
+     *
+     * @param fileID - the slot of the file
+     *
+     */
+    void finishInput(int fileID);
 
     /*
      * procedure for update headers when upload finished
      * 
+     * @param file - the file
      * @param cloudIndex - indicating targeting cloud
      *
      *
      *
      */
-    int updateHeader(int cloudIndex);
+    int updateHeader(uploadFile_t *file, int cloudIndex);
 
     /*
-     * uploader thread handler
+     * uploader thread handler: a single dispatcher serves the queues of all clouds, while the
+     * network engine thread sends the batches and receives their replies
      *
-     * @param param - input structure
+     * @param param - the uploader
      *
      */
     static void *thread_handler(void *param);
 
+
     /*
-     * uploader thread handler
+     * collect file header
      *
-     * @param param - input structure
+     * @param header - file header to be collect in Uploader
+     * @param cloudIndex - the index of cloud server
+     * @param fileID - the slot of the file
      *
      */
-    static void *thread_handler_meta(void *param);
+    void collect_header(FileHeader_t &header, int cloudIndex, int fileID);
 
+private:
 
     /*
-     * collect file header
+     * allocate the queues, buffers and checkpoint of a file to be uploaded
      *
-     * @param header - file header to be collect in Uploader
-     * @param cloudIndex - the index of cloud server
+     * @param fileName - the file to be uploaded
+     * @param nameSize - the size of the file name
      *
+     * @return - the file
      */
-    void collect_header(FileHeader_t &header, int cloudIndex);
+    uploadFile_t *createFile(char *fileName, int nameSize);
 
-private:
+    /*
+     * free a file whose upload is finished
+     *
+     * @param file - the file
+     *
+     */
+    void freeFile(uploadFile_t *file);
+
+    /*
+     * handle the next object of a file queued for a cloud
+     *
+     * @param file - the file
+     * @param cloudIndex - indicate targeting cloud
+     * @param tmp - buffer for the queued chunk
+     * @param output - buffer for the share header
+     * @param outputMeta - buffer for the queued metadata share
+     *
+     * @return - a boolean value that indicates if any progress is made
+     */
+    bool stepFile(uploadFile_t *file, int cloudIndex, Chunk_t &tmp, Item_t &output, ItemMeta_t &outputMeta);
+
+    /*
+     * handle the next share queued for a data cloud
+     *
+     * @param file - the file
+     * @param cloudIndex - indicate targeting cloud
+     * @param tmp - buffer for the queued chunk
+     * @param output - buffer for the share header
+     * @param perform_upload_time - accumulated time of performing upload <return>
+     * @param recipe_handling_time - accumulated time of buffering shares <return>
+     *
+     * @return - 1 if an object is handled, 0 if none is queued, -1 if the cloud gets no more shares
+     */
+    int stepData(uploadFile_t *file, int cloudIndex, Chunk_t &tmp, Item_t &output, double &perform_upload_time,
+                 double &recipe_handling_time);
+
+    /*
+     * handle the next share queued for a metadata cloud
+     *
+     * @param file - the file
+     * @param cloudIndex - indicate targeting cloud
+     * @param output - buffer for the queued share
+     * @param total_chunks - number of shares handled <return>
+     * @param perform_upload_time - accumulated time of performing upload <return>
+     * @param recipe_handling_time - accumulated time of buffering shares <return>
+     *
+     * @return - 1 if an object is handled, 0 if none is queued, -1 if the cloud gets no more shares
+     */
+    int stepMeta(uploadFile_t *file, int cloudIndex, ItemMeta_t &output, int &total_chunks,
+                 double &perform_upload_time, double &recipe_handling_time);
+
+    /*
+     * record the size and fingerprint of a share buffered for a cloud
+     *
+     * @param file - the file
+     * @param cloudIndex - indicate targeting cloud
+     * @param shareSize - the size of the share
+     * @param shareFP - the fingerprint of the share
+     *
+     */
+    void recordShare(uploadFile_t *file, int cloudIndex, int shareSize, unsigned char *shareFP);
+
+    /*
+     * check if a share was acknowledged by the cloud before a restart, so it is not sent again
+     *
+     * @param file - the file
+     * @param cloudIndex - indicate targeting cloud
+     *
+     * @return - a boolean value that indicates if the share is skipped
+     */
+    bool skipShare(uploadFile_t *file, int cloudIndex);
+
+    /*
+     * check if every share of a cloud was acknowledged before a restart, so nothing is left to send
+     *
+     * @param file - the file
+     * @param cloudIndex - indicate targeting cloud
+     *
+     * @return - a boolean value that indicates if the cloud has been completed
+     */
+    bool isResumedFully(uploadFile_t *file, int cloudIndex);
+
+    /*
+     * pack the share metadata of a batch into a reference list
+     *
+     * @param metaBuffer - the share metadata: [fileShareMDHead_t + full file name + shareMDEntry_t ...] ...
+     * @param metaSize - the size of the share metadata
+     * @param refList - a buffer for storing the reference list (no larger than the share metadata) <return>
+     *
+     * @return - the size of the reference list
+     */
+    static int packReferences(const char *metaBuffer, int metaSize, char *refList);
+
+    /*
+     * start receiving the next reply of a cloud while a batch still waits for its status list or
+     * acknowledgement (with windowLock_ held), replies share one buffer, so one is received at a time
+     *
+     * @param cloudIndex - indicate targeting cloud
+     *
+     */
+    void startReplyRecv(int cloudIndex);
+
+    /*
+     * network engine callback: the head of a reply (a status list or an acknowledgement) is received
+     *
+     * @param arg - the reply parameter of the cloud
+     * @param result - the number of bytes received, or -errno
+     *
+     */
+    static void replyHeadReceived(void *arg, int result);
+
+    /*
+     * network engine callback: a status list is received
+     *
+     * @param arg - the upload batch
+     * @param result - the number of bytes received, or -errno
+     *
+     */
+    static void statusListReceived(void *arg, int result);
+
+    /*
+     * network engine callback: the data of a batch is sent
+     *
+     * @param arg - the upload batch
+     * @param result - the number of bytes sent, or -errno
+     *
+     */
+    static void dataSent(void *arg, int result);
+
+    /*
+     * finish a batch whose status list arrived (with windowLock_ held): send the unique data
+     *
+     * @param batch - the upload batch
+     * @param numOfShares - the number of entries in the status list
+     *
+     */
+    int completeUpload(uploadBatch_t *batch, int numOfShares);
+
+    /*
+     * finish a batch of references acknowledged without a status list (with windowLock_ held)
+     *
+     * @param batch - the upload batch
+     *
+     */
+    void acceptReferences(uploadBatch_t *batch);
+
+    /*
+     * record the acknowledgement of a batch in the checkpoint (with windowLock_ held)
+     *
+     * @param batch - the upload batch
+     * @param recorded - if the server recorded the batch
+     *
+     */
+    void acknowledgeUpload(uploadBatch_t *batch, bool recorded);
+
+    /*
+     * give up the batches of a cloud whose replies cannot be received (with windowLock_ held)
+     *
+     * @param cloudIndex - indicate targeting cloud
+     *
+     */
+    void abortUpload(int cloudIndex);
+
+    /*
+     * free the finished batches at the head of the window, in batch order (with windowLock_ held)
+     *
+     * @param cloudIndex - indicate targeting cloud
+     *
+     */
+    void releaseBatches(int cloudIndex);
 
     /*
-     * copy Chunk_t to Item_t
+     * copy the share header of Chunk_t to Item_t (the share data is copied into the container directly)
      *
      * @param output - dest of data structure
      * @param input - src of data structure
@@ -113,7 +113,7 @@ void *KeyEx::threadHandlerChunk(void *param)
             } else {
                 // cache miss
                 /* perform key generation */
-                obj->keyExchange(hash_tmp.get(), 1, keyBuffer.get(), obj->cryptoObj_, segID);
+                obj->obtainKey(hash_tmp.get(), keyBuffer.get(), segID);
 
                 //insert into cache
                 cache_value.assign((char *) keyBuffer.get(), KEY_SIZE);
@@ -121,7 +121,7 @@ void *KeyEx::threadHandlerChunk(void *param)
             }
         } else {
             /* perform key generation */
-            obj->keyExchange(hash_tmp.get(), 1, keyBuffer.get(), obj->cryptoObj_, segID);
+            obj->obtainKey(hash_tmp.get(), keyBuffer.get(), segID);
         }
 
         /* bind data with MLE-derived key for encoder module */
@@ -260,7 +260,7 @@ void *KeyEx::threadHandlerMinHash(void *param)
                     /* send the key batch to key manager server */
                     if(countChunkInSeg != 0) {
                         /* perform key generation */
-                        obj->keyExchange(current, 1, keyBuffer.get(), obj->cryptoObj_, kmServerIndex);
+                        obj->obtainKey(current, keyBuffer.get(), kmServerIndex);
                     }
 
                     //insert into cache
@@ -274,7 +274,7 @@ void *KeyEx::threadHandlerMinHash(void *param)
 #endif
                     if(countChunkInSeg != 0) {
                         /* perform key generation */
-                        obj->keyExchange(current, 1, keyBuffer.get(), obj->cryptoObj_, kmServerIndex);
+                        obj->obtainKey(current, keyBuffer.get(), kmServerIndex);
                     }
 #ifdef BREAKDOWN_ENABLED
                 }, exchange_key_time);
@@ -362,13 +362,14 @@ KeyEx::KeyEx(Encoder *obj, int secureType, std::unique_ptr<KMServerConf[]> kmSer
     }
     encodeObj_ = obj;
     serverCount_ = obj->n_;
+    checkpoint_ = obj->uploadObj_->getCheckpoint(obj->fileID_);
 
     record_ = (BIGNUM **) malloc(sizeof(BIGNUM *) * n_);
     for(int i = 0; i < n_; i++) {
         record_[i] = BN_new();
     }
 
-    sock_ = new Ssl *[SEND_THREADS];
+    sock_ = new Ssl *[serverCount_]();
 
     inputbuffer_ = new MessageQueue<Chunk_t> *[KEYEX_NUM_THREADS];
     outputbuffer_ = new MessageQueue<Chunk_t> *[KEYEX_NUM_THREADS];
@@ -387,7 +388,7 @@ KeyEx::KeyEx(Encoder *obj, int secureType, std::unique_ptr<KMServerConf[]> kmSer
     temp->obj = this;
     readKeyFile();
 
-    for(int i = 0; i < obj->n_; ++i) {
+    for(int i = 0; i < serverCount_; ++i) {
         sock_[i] = new Ssl((char *) kmServerConf[i].ip.c_str(), kmServerConf[i].port, userID);
     }
 
@@ -423,6 +424,7 @@ KeyEx::KeyEx(int cloudNumber, int down_server_index, int down_server_num,
              std::unique_ptr<KMServerConf[]> kmServerConf, int userID, int kmServerType)
 {
     uploadFlag = false;
+    checkpoint_ = NULL;
 
     this->down_server_index_ = down_server_index;
     this->down_server_num_ = down_server_num;
@@ -439,7 +441,9 @@ KeyEx::KeyEx(int cloudNumber, int down_server_index, int down_server_num,
         exit(-1);
     }
 
-    sock_ = new Ssl *[SEND_THREADS];
+    /* one connection per KM server, the down server is left out */
+    serverCount_ = cloudNumber;
+    sock_ = new Ssl *[serverCount_]();
 
     for(int i = 0; i < cloudNumber; ++i) {
         if(i == down_server_index) {
@@ -469,7 +473,7 @@ KeyEx::~KeyEx()
             BN_clear_free(record_[i]);
         }
         free(record_);
-        for(int i = 0; i < SEND_THREADS; ++i) {
+        for(int i = 0; i < serverCount_; ++i) {
             delete sock_[i];
         }
         delete[] sock_;
@@ -484,7 +488,7 @@ KeyEx::~KeyEx()
         delete[] calc_cryptoObj_;
         delete cryptoObj_;
     } else {
-        for(int i = 0; i < SEND_THREADS; ++i) {
+        for(int i = 0; i < serverCount_; ++i) {
             if(i == this->down_server_index_) {
                 continue;
             }
@@ -620,6 +624,27 @@ void KeyEx::decoration(unsigned char *hash_buf, int size, unsigned char *ret_buf
     //	BN_bn2bin(mid_,ret_buf);
 }
 
+/*
+ * function : get the key of a hash, from the upload checkpoint if it was obtained before a restart,
+ *            otherwise by key generation with key server (the key is then logged in the checkpoint)
+ *  input :
+ *      @param hash_buf - the buffer holding the hash value
+ *      @param key_buf - the returned buffer contains the key <return>
+ *      @param cloudIndex - index of KM server
+ * */
+void KeyEx::obtainKey(unsigned char *hash_buf, unsigned char *key_buf, int cloudIndex)
+{
+    if(checkpoint_ != NULL && checkpoint_->lookupKey(hash_buf, key_buf)) {
+        return;
+    }
+
+    keyExchange(hash_buf, 1, key_buf, cryptoObj_, cloudIndex);
+
+    if(checkpoint_ != NULL) {
+        checkpoint_->recordKey(hash_buf, key_buf);
+    }
+}
+
 /*
  * function : main procedure for init key generation with key server
  *  input :
@@ -68,9 +68,6 @@
 //#define CHUNK_DATA_SIZE (16 * 1024)
 #define CHUNK_QUEUE_NUM 1024
 
-/* 5 km server -> 5 send threads */
-#define SEND_THREADS 5
-
 /* num of keyExchange threads */
 #define KEYEX_NUM_THREADS 2
 
@@ -134,6 +131,9 @@ private:
 
     Encoder *encodeObj_;
 
+    // keys obtained before a restart of the upload (NULL for download)
+    UploadCheckpoint *checkpoint_;
+
     // check procedure type: upload | download
     bool uploadFlag;
 
@@ -257,6 +257,16 @@ public:
      * */
     void keyExchange(unsigned char *hash_buf, int num, unsigned char *key_buf, CryptoPrimitive *obj, int cloudIndex);
 
+    /*
+     * function : get the key of a hash, from the upload checkpoint if it was obtained before a restart,
+     *            otherwise by key generation with key server (the key is then logged in the checkpoint)
+     *  input :
+     *      @param hash_buf - the buffer holding the hash value
+     *      @param key_buf - the returned buffer contains the key <return>
+     *      @param cloudIndex - index of KM server
+     * */
+    void obtainKey(unsigned char *hash_buf, unsigned char *key_buf, int cloudIndex);
+
     /*
      *   function : thread handler with min_hash(Paper: REED)
      *
@@ -5,6 +5,9 @@
 #include <cstdio>
 #include <cstdlib>
 #include <sys/time.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
 
 #include "CDCodec.hh"
 #include "CryptoPrimitive.hh"
@@ -19,9 +22,7 @@
 
 using namespace std;
 
-Chunker *chunkerObj;
 Decoder *decoderObj;
-Encoder *encoderObj;
 Uploader *uploaderObj;
 Downloader *downloaderObj;
 Configuration *confObj;
@@ -29,21 +30,175 @@ Configuration *confObj;
 struct timeval timestart;
 struct timeval timeend;
 
+/* parameters of uploading a file */
+typedef struct {
+    char *fileName;
+    int userID;
+    int secureType;
+    int n, m, kmServerCount, r;
+    int bufferSize;
+    int chunkEndIndexListSize;
+    std::unique_ptr<KMServerConf[]> kmServerConf;
+} uploadParam_t;
+
 void usage(char *s)
 {
 
-    printf("usage: %s [filename] [userID] [action] [secureType]\n", s);
-    printf("\t- [filename]: full path of the file;\n");
+    printf("usage: %s [filename] [userID] [action] [secureType] ([offset] [length])\n", s);
+    printf("\t- [filename]: full path of the file (files separated by ',' are uploaded at once);\n");
     printf("\t- [userID]: use ID of current client;\n");
-    printf("\t- [action]: [-u] upload; [-d] download;\n");
+    printf("\t- [action]: [-u] upload; [-d] download; [-s] download into stdout (logs go to stderr);\n");
     printf("\t- [securityType]: [HIGH] AES-256 & SHA-256; [LOW] AES-128 & SHA-1\n");
+    printf("\t- [offset] [length]: download only the byte range of the file (length -1: up to the end);\n");
+}
+
+/*
+ * upload a file through the shared uploader, with its own chunker, key exchanger and encoder
+ *
+ * @param param - the parameters of the upload (freed here)
+ */
+void uploadFile(uploadParam_t *param)
+{
+    char *fileName = param->fileName;
+    int namesize = strlen(fileName) + 1;
+    struct timeval fileStart, fileEnd;
+    int numOfChunks;
+    long size = 0;
+    Chunker *chunkerObj;
+
+    FILE *fin = nullptr;
+    if(!TRACE_DRIVEN_FSL_ENABLED) {
+        printf("\n[main] normal file mode...\n");
+        fin = fopen(fileName, "r");
+        if(fin == nullptr) {
+            printf("[main] File '%s' not found!!\n", fileName);
+            delete param;
+            return;
+        }
+        chunkerObj = new Chunker(VAR_SIZE_TYPE);
+
+        /* get file size */
+        fseek(fin, 0, SEEK_END);
+        size = ftell(fin);
+        fseek(fin, 0, SEEK_SET);
+    } else {
+        printf("\n[main] FSL trace-driven mode...\n");
+        // IF normal file instead of trace-driven FSL
+        chunkerObj = new Chunker(TRACE_FSL_TYPE);
+        size = chunkerObj->get_trace_size(fileName);
+        printf("[main] file size = %ld\n", size);
+    }
+
+    /* wait for a free slot of the uploader, then build the pipeline of the file */
+    int fileID = uploaderObj->openFile(fileName, namesize);
+
+    auto *encoderObj = new Encoder(CD_CODEC_TYPE, param->n + param->kmServerCount, param->m, param->kmServerCount,
+                                   param->r, param->secureType, uploaderObj, fileID);
+
+    auto *keyObj = new KeyEx(encoderObj, param->secureType, std::move(param->kmServerConf), param->userID,
+                             CHARA_MIN_HASH, VAR_SEG, DYNAMIC_KM_SERVER, DISABLE_LRU_CACHE);
+
+    gettimeofday(&fileStart, NULL);
+
+    //chunking
+    FileHeader_t header;
+    memcpy(header.file_header.file_name, fileName, namesize);
+    header.file_header.fullNameSize = namesize;
+    header.file_header.fileSize = size;
+
+    // do header encoder
+    std::thread header_th(&Encoder::collect_header, encoderObj, std::ref(header));
+    header_th.detach();
+
+    printf("[Main] header inserted into encoder\n");
+
+    if(!TRACE_DRIVEN_FSL_ENABLED) {
+        auto *buffer = (unsigned char *) malloc(sizeof(unsigned char) * param->bufferSize);
+        auto *chunkEndIndexList = (int *) malloc(sizeof(int) * param->chunkEndIndexListSize);
+
+        double chunking_time = 0;
+
+        bool job_done = false;
+        long total = 0;
+        int totalChunks = 0;
+        while(total < size) {
+
+            int ret = fread(buffer, 1, param->bufferSize, fin);
+#ifdef BREAKDOWN_ENABLED
+            Logger::measure_time([&]() {
+#endif
+            chunkerObj->chunking(buffer, ret, chunkEndIndexList, &numOfChunks);
+#ifdef BREAKDOWN_ENABLED
+            }, chunking_time);
+#endif
+            int count = 0;
+            int preEnd = -1;
+            Chunk_t input;
+            while(count < numOfChunks) {
+                input.chunk_id = totalChunks;
+                input.chunk_size = chunkEndIndexList[count] - preEnd;
+                // content <=> chunk data
+                memcpy(input.content, buffer + preEnd + 1, input.chunk_size);
+                input.end = 0;
+
+                if(total + ret == size && count + 1 == numOfChunks) {
+                    input.end = 1;
+                    job_done = true;
+                }
+
+                keyObj->add(input);
+
+                if(job_done) {
+                    // notify thread to exit
+                    for(int i = 0; i < KEYEX_NUM_THREADS; ++i) {
+                        keyObj->inputbuffer_[i]->set_job_done();
+                    }
+                }
+                totalChunks++;
+                preEnd = chunkEndIndexList[count];
+                count++;
+            }
+            total += ret;
+        }
+        printf("\n[!>] <main> %s: Total chunks = %d\n", fileName, totalChunks);
+
+#ifdef BREAKDOWN_ENABLED
+        printf("\n[Time] ===================\n");
+        fprintf(stderr, "[Time] [Chunker] %s: Chunking time is /%lf/ s\n", fileName, chunking_time);
+        printf("[Time]===================\n\n");
+#endif
+        free(buffer);
+        free(chunkEndIndexList);
+    } else {
+        chunkerObj->set_key_obj(keyObj);
+        chunkerObj->trace_driven_FSL_chunking(fileName);
+    }
+
+    long long tt = 0, unique = 0;
+    printf("\n[!>] <main> Indicate Start ===>\n");
+    uploaderObj->indicateEnd(fileID, &tt, &unique);
+    printf("\n[!>] <main> Indicate End ===>\n");
+
+    gettimeofday(&fileEnd, NULL);
+    long diff_global = 1000000 * (fileEnd.tv_sec - fileStart.tv_sec) + fileEnd.tv_usec - fileStart.tv_usec;
+    double second_global = diff_global / 1000000.0;
+    fprintf(stderr, "%s (%.2lf MB): upload time is /%lf/ s\n", fileName, (double)size * 1.0 / 1024 / 1024, second_global);
+    printf("\n");
+
+    delete chunkerObj;
+    delete encoderObj;
+    delete keyObj;
+    if(!TRACE_DRIVEN_FSL_ENABLED) {
+        fclose(fin);
+    }
+    delete param;
 }
 
 int main(int argc, char *argv[])
 {
 
     /* argument test */
-    if(argc != 5) {
+    if(argc != 5 && argc != 7) {
         usage(argv[0]);
         return -1;
     }
@@ -51,12 +206,8 @@ int main(int argc, char *argv[])
     int userID = atoi(argv[2]);
     char *opt = argv[3];
     char *securesetting = argv[4];
-    /* read file */
-    unsigned char *buffer;
-    int *chunkEndIndexList;
-    int numOfChunks;
     int n, m, kmServerCount, k, r;
-    long size = 0;
+    bool restoreFailed = false;
 
     /* initialize openssl locks */
     if(!CryptoPrimitive::opensslLockSetup()) {
@@ -73,7 +224,7 @@ int main(int argc, char *argv[])
     r = confObj->getR();
     std::unique_ptr<KMServerConf[]> kmServerConf = confObj->getKMServerConf();
     printf("\n[Main] KM server info:\n");
-    for(int i = 0; i < n + 1; ++i) {
+    for(int i = 0; i < n + kmServerCount; ++i) {
         printf("[%d] %s:%d\n", i, kmServerConf[i].ip.c_str(), kmServerConf[i].port);
     }
 
@@ -82,8 +233,6 @@ int main(int argc, char *argv[])
     int chunkEndIndexListSize = confObj->getListSize();
 
     delete confObj;
-    buffer = (unsigned char *) malloc(sizeof(unsigned char) * bufferSize);
-    chunkEndIndexList = (int *) malloc(sizeof(int) * chunkEndIndexListSize);
 
     /* full file name size process */
     int namesize = 0;
@@ -100,167 +249,100 @@ int main(int argc, char *argv[])
 
     if(strncmp(opt, "-u", 2) == 0) {
 
-        uploaderObj = new Uploader(n + 1, n + 1, userID, argv[1], namesize);
+        uploaderObj = new Uploader(n + kmServerCount, n + kmServerCount, userID);
 
-        encoderObj = new Encoder(CAONT_RS_TYPE, n + 1, m, kmServerCount, r, secureType, uploaderObj);
-
-
-        auto *keyObj = new KeyEx(encoderObj, secureType, std::move(kmServerConf), userID,
-                                 CHARA_MIN_HASH, VAR_SEG, DYNAMIC_KM_SERVER, DISABLE_LRU_CACHE);
-
-        FILE *fin;
-        if(!TRACE_DRIVEN_FSL_ENABLED) {
-            printf("\n[main] normal file mode...\n");
-            chunkerObj = new Chunker(VAR_SIZE_TYPE);
-            fin = fopen(argv[1], "r");
-            if(fin == nullptr) {
-                printf("[main] File not found!!\n");
-                delete uploaderObj;
-                delete chunkerObj;
-                delete encoderObj;
-                fclose(fin);
-
-                free(buffer);
-                free(chunkEndIndexList);
-                return -1;
-            }
-
-            /* get file size */
-            fseek(fin, 0, SEEK_END);
-            size = ftell(fin);
-            fseek(fin, 0, SEEK_SET);
-        } else {
-            printf("\n[main] FSL trace-driven mode...\n");
-            // IF normal file instead of trace-driven FSL
-            chunkerObj = new Chunker(TRACE_FSL_TYPE);
-            size = chunkerObj->get_trace_size(argv[1]);
-            printf("[main] file size = %ld\n", size);
+        /* every file gets its own pipeline, their batches share the connections of the uploader */
+        std::vector<char *> fileNames;
+        for(char *name = strtok(argv[1], ","); name != NULL; name = strtok(NULL, ",")) {
+            fileNames.push_back(name);
         }
 
-        gettimeofday(&timestart, NULL);
-
-        //chunking
-        FileHeader_t header;
-        memcpy(header.file_header.file_name, argv[1], namesize);
-        header.file_header.fullNameSize = namesize;
-        header.file_header.fileSize = size;
-
-        // do header encoder
-        std::thread header_th(&Encoder::collect_header, encoderObj, std::ref(header));
-        header_th.detach();
-
-        printf("[Main] header inserted into encoder\n");
-
-        if(!TRACE_DRIVEN_FSL_ENABLED) {
-
-            double chunking_time = 0;
-
-            bool job_done = false;
-            long total = 0;
-            int totalChunks = 0;
-            while(total < size) {
-
-                int ret = fread(buffer, 1, bufferSize, fin);
-#ifdef BREAKDOWN_ENABLED
-                Logger::measure_time([&]() {
-#endif
-                chunkerObj->chunking(buffer, ret, chunkEndIndexList, &numOfChunks);
-#ifdef BREAKDOWN_ENABLED
-                }, chunking_time);
-#endif
-                int count = 0;
-                int preEnd = -1;
-                Chunk_t input;
-                while(count < numOfChunks) {
-                    input.chunk_id = totalChunks;
-                    input.chunk_size = chunkEndIndexList[count] - preEnd;
-                    // content <=> chunk data
-                    memcpy(input.content, buffer + preEnd + 1, input.chunk_size);
-                    input.end = 0;
-
-                    if(total + ret == size && count + 1 == numOfChunks) {
-                        input.end = 1;
-                        job_done = true;
-                    }
-
-                    keyObj->add(input);
-
-                    if(job_done) {
-                        // notify thread to exit
-                        for(int i = 0; i < KEYEX_NUM_THREADS; ++i) {
-                            keyObj->inputbuffer_[i]->set_job_done();
-                        }
-                    }
-                    totalChunks++;
-                    preEnd = chunkEndIndexList[count];
-                    count++;
-                }
-                total += ret;
+        std::vector<std::thread> uploadThreads;
+        for(size_t i = 0; i < fileNames.size(); i++) {
+            auto *param = new uploadParam_t;
+            param->fileName = fileNames[i];
+            param->userID = userID;
+            param->secureType = secureType;
+            param->n = n;
+            param->m = m;
+            param->kmServerCount = kmServerCount;
+            param->r = r;
+            param->bufferSize = bufferSize;
+            param->chunkEndIndexListSize = chunkEndIndexListSize;
+            param->kmServerConf = std::make_unique<KMServerConf[]>(n + kmServerCount);
+            for(int j = 0; j < n + kmServerCount; ++j) {
+                param->kmServerConf[j] = kmServerConf[j];
             }
-            printf("\n[!>] <main> Total chunks = %d\n", totalChunks);
-
-#ifdef BREAKDOWN_ENABLED
-            printf("\n[Time] ===================\n");
-            fprintf(stderr, "[Time] [Chunker] Chunking time is /%lf/ s\n", chunking_time);
-            printf("[Time]===================\n\n");
-#endif
-        } else {
-            chunkerObj->set_key_obj(keyObj);
-            chunkerObj->trace_driven_FSL_chunking(argv[1]);
+            uploadThreads.emplace_back(&uploadFile, param);
+        }
+        for(auto &th : uploadThreads) {
+            th.join();
         }
-
-        long long tt = 0, unique = 0;
-        printf("\n[!>] <main> Indicate Start ===>\n");
-        uploaderObj->indicateEnd(&tt, &unique);
-        printf("\n[!>] <main> Indicate End ===>\n");
-
-        gettimeofday(&timeend, NULL);
-        long diff_global = 1000000 * (timeend.tv_sec - timestart.tv_sec) + timeend.tv_usec - timestart.tv_usec;
-        double second_global = diff_global / 1000000.0;
-        fprintf(stderr, "%s (%.2lf MB): upload time is /%lf/ s\n", argv[1], (double)size * 1.0 / 1024 / 1024, second_global);
-        printf("\n");
 
         delete uploaderObj;
-        delete chunkerObj;
-        delete encoderObj;
-        delete keyObj;
-        if(!TRACE_DRIVEN_FSL_ENABLED) {
-            fclose(fin);
+    } else if(strncmp(opt, "-d", 2) == 0 || strncmp(opt, "-s", 2) == 0) {
+
+        /* streaming keeps stdout for the restored data, and moves the logs onto stderr */
+        bool streaming = (strncmp(opt, "-s", 2) == 0);
+        int streamFD = -1;
+        if(streaming) {
+            fflush(stdout);
+            streamFD = dup(STDOUT_FILENO);
+            dup2(STDERR_FILENO, STDOUT_FILENO);
         }
-    } else if(strncmp(opt, "-d", 2) == 0) {
 
-        decoderObj = new Decoder(CAONT_RS_TYPE, n + 1, m, kmServerCount, r, secureType);
+        decoderObj = new Decoder(CD_CODEC_TYPE, n + kmServerCount, m, kmServerCount, r, secureType);
 
-        /* Currently, you have to set this value manually to support fault-tolerance */
-        // possible value of down_server_index: 0, 1, 2, 3, 4
-        int down_server_index = 3;
-        int down_server_num = 1;
+        /*
+         * every server is asked for the file and each secret is restored from the first k shares that arrive,
+         * a server that stops responding is skipped; set the index (0 to n + kmServerCount - 1) to leave a known
+         * down server out
+         */
+        int down_server_index = -1;
+        int down_server_num = 0;
 
-        // Assume there's one server going down
-        downloaderObj = new Downloader(n + 1, n + 1, down_server_index, down_server_num, userID, decoderObj, argv[1], namesize);
+        downloaderObj = new Downloader(n + kmServerCount, n + kmServerCount, down_server_index, down_server_num, userID,
+                                       decoderObj, argv[1], namesize);
 
         // Tell all online KM server thread to exit to prevent being blocked. Yes, it is necessary.
-        auto *keyObj = new KeyEx(n + 1, down_server_index, down_server_num, std::move(kmServerConf), userID,
+        auto *keyObj = new KeyEx(n + kmServerCount, down_server_index, down_server_num, std::move(kmServerConf), userID,
                                  DYNAMIC_KM_SERVER);
 
-        gettimeofday(&timestart, NULL);
+        /* a byte range is restored into the output file on its own */
+        if(argc == 7) {
+            downloaderObj->set_restore_range(atol(argv[5]), atol(argv[6]));
+        }
 
-        char nameBuffer[256];
-        sprintf(nameBuffer, "%s.d", argv[1]);
-        FILE *fw = fopen(nameBuffer, "wb");
+        gettimeofday(&timestart, NULL);
 
-        decoderObj->setFilePointer(fw);
+        FILE *fw = nullptr;
+        if(streaming) {
+            decoderObj->setStream(streamFD);
+        } else {
+            char nameBuffer[256];
+            sprintf(nameBuffer, "%s.d", argv[1]);
+            fw = fopen(nameBuffer, "wb");
+            decoderObj->setFilePointer(fw);
+        }
 
-        int preFlag = downloaderObj->preDownloadFile(argv[1], namesize, n + 1);
+        int preFlag = downloaderObj->preDownloadFile(argv[1], namesize, n + kmServerCount);
         if(preFlag == 1) {
-            downloaderObj->downloadFile(argv[1], namesize, n + 1, k);
+            if(downloaderObj->downloadFile(argv[1], namesize, n + kmServerCount, k) != 0) {
+                restoreFailed = true;
+            }
+        }
+        if(!decoderObj->indicateEnd()) {
+            restoreFailed = true;
         }
-        decoderObj->indicateEnd();
         printf("[main] decoder end!!\n");
         downloaderObj->indicateEnd();
         printf("[main] downloader end!!\n");
 
-        fclose(fw);
+        if(streaming) {
+            close(streamFD);
+        } else {
+            fclose(fw);
+        }
 
         gettimeofday(&timeend, NULL);
         long diff = 1000000 * (timeend.tv_sec - timestart.tv_sec) + timeend.tv_usec - timestart.tv_usec;
@@ -276,9 +358,7 @@ int main(int argc, char *argv[])
         printf("\n");
     }
 
-    free(buffer);
-    free(chunkEndIndexList);
     CryptoPrimitive::opensslLockCleanup();
 
-    return 0;
+    return restoreFailed ? 1 : 0;
 }
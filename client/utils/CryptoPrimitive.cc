@@ -109,6 +109,20 @@ bool CryptoPrimitive::opensslLockCleanup()
 #endif
 }
 
+/*
+ * initialize the CTR cipher context and bind ctrCipher_ to it
+ */
+void CryptoPrimitive::ctrContextSetup_()
+{
+#if OPENSSL_VERSION_NUMBER <= 0x10100000L
+    EVP_CIPHER_CTX_init(&ctrctx_);
+    EVP_EncryptInit_ex(&ctrctx_, ctrCipher_, NULL, NULL, NULL);
+#else
+    ctrctx_ = EVP_CIPHER_CTX_new();
+    EVP_EncryptInit_ex(ctrctx_, ctrCipher_, NULL, NULL, NULL);
+#endif
+}
+
 /*
  * constructor of CryptoPrimitive
  *
@@ -143,12 +157,16 @@ CryptoPrimitive::CryptoPrimitive(int cryptoType)
 
         /*get the EVP_CIPHER structure for AES-256*/
         cipher_ = EVP_aes_256_cbc();
+        ctrCipher_ = EVP_aes_256_ctr();
         keySize_ = 32;
         blockSize_ = 16;
 
         /*allocate a constant IV*/
         iv_ = (unsigned char *) malloc(sizeof(unsigned char) * blockSize_);
         memset(iv_, 0, blockSize_);
+
+        /*bind the CTR cipher once, so that each keystream only needs a re-key*/
+        ctrContextSetup_();
     }
 
     if(cryptoType_ == LOW_SEC_PAIR_TYPE) {
@@ -169,6 +187,7 @@ CryptoPrimitive::CryptoPrimitive(int cryptoType)
 
         /*get the EVP_CIPHER structure for AES-128*/
         cipher_ = EVP_aes_128_cbc();
+        ctrCipher_ = EVP_aes_128_ctr();
         keySize_ = 16;
         blockSize_ = 16;
 
@@ -176,6 +195,9 @@ CryptoPrimitive::CryptoPrimitive(int cryptoType)
         iv_ = (unsigned char *) malloc(sizeof(unsigned char) * blockSize_);
         memset(iv_, 0, blockSize_);
 
+        /*bind the CTR cipher once, so that each keystream only needs a re-key*/
+        ctrContextSetup_();
+
         fprintf(stdout, "\nA CryptoPrimitive based on a pair of MD5 and AES-128 has been constructed! \n");
         fprintf(stdout, "Parameters: \n");
         fprintf(stdout, "      hashSize_: %d \n", hashSize_);
@@ -241,9 +263,11 @@ CryptoPrimitive::~CryptoPrimitive()
         EVP_MD_CTX_cleanup(&mdctx_);
         /**clean up the cipher context cipherctx_ and free up the space allocated to it */
         EVP_CIPHER_CTX_cleanup(&cipherctx_);
+        EVP_CIPHER_CTX_cleanup(&ctrctx_);
 #else
         EVP_MD_CTX_free(mdctx_);
         EVP_CIPHER_CTX_free(cipherctx_);
+        EVP_CIPHER_CTX_free(ctrctx_);
 #endif
         free(iv_);
     }
@@ -422,3 +446,43 @@ bool CryptoPrimitive::decryptWithKey(unsigned char *ciphertext, const int &dataS
 
     return 1;
 }
+
+/*
+ * XOR the data stored in a buffer with the AES-CTR keystream of a key (the IV is the constant zero block),
+ * i.e., CTR encryption, which is also its own inverse
+ *
+ * @param dataBuffer - the buffer that stores the data
+ * @param dataSize - the size of the data (no need to be a multiple of the block size)
+ * @param key - the key used to generate the keystream
+ * @param output - the data XORed with the keystream <return>
+ *
+ * @return - a boolean value that indicates if the keystream XOR succeeds
+ */
+bool CryptoPrimitive::xorWithKeystream(unsigned char *dataBuffer, const int &dataSize, unsigned char *key,
+                                       unsigned char *output)
+{
+    int outputSize, outputTailSize;
+
+    /*the cipher stays bound to ctrctx_, passing NULL only resets the key schedule and the counter*/
+#if OPENSSL_VERSION_NUMBER <= 0x10100000L
+    EVP_EncryptInit_ex(&ctrctx_, NULL, NULL, key, iv_);
+    EVP_EncryptUpdate(&ctrctx_, output, &outputSize, dataBuffer, dataSize);
+    EVP_EncryptFinal_ex(&ctrctx_, output + outputSize, &outputTailSize);
+#else
+    EVP_EncryptInit_ex(ctrctx_, NULL, NULL, key, iv_);
+    EVP_EncryptUpdate(ctrctx_, output, &outputSize, dataBuffer, dataSize);
+    EVP_EncryptFinal_ex(ctrctx_, output + outputSize, &outputTailSize);
+#endif
+
+    outputSize += outputTailSize;
+
+    if(outputSize != dataSize) {
+        fprintf(stdout,
+                "Error: the size of the keystream output (%d bytes) does not match with that of the input (%d bytes)!\n",
+                outputSize, dataSize);
+
+        return 0;
+    }
+
+    return 1;
+}
@@ -52,15 +52,21 @@ private:
     EVP_MD_CTX mdctx_;
     /*variables used in encryption*/
     EVP_CIPHER_CTX cipherctx_;
+    /*cipher context for the CTR keystream, bound to ctrCipher_ once and only re-keyed per call*/
+    EVP_CIPHER_CTX ctrctx_;
 
 #else
 
     EVP_CIPHER_CTX *cipherctx_;
     EVP_MD_CTX *mdctx_;
+    /*cipher context for the CTR keystream, bound to ctrCipher_ once and only re-keyed per call*/
+    EVP_CIPHER_CTX *ctrctx_;
 
 #endif
 
     const EVP_CIPHER *cipher_;
+    /*the CTR-mode counterpart of cipher_ with the same key size*/
+    const EVP_CIPHER *ctrCipher_;
     unsigned char *iv_;
 
     /*the size of the key for encryption*/
@@ -83,6 +89,11 @@ private:
 	 */
     static void opensslThreadID_(CRYPTO_THREADID *id);
 
+    /*
+	 * initialize the CTR cipher context and bind ctrCipher_ to it
+	 */
+    void ctrContextSetup_();
+
 public:
     /*
 	 * constructor of CryptoPrimitive
@@ -155,6 +166,19 @@ public:
     bool encryptWithKey(unsigned char *dataBuffer, const int &dataSize, unsigned char *key, unsigned char *ciphertext);
 
     bool decryptWithKey(unsigned char *ciphertext, const int &dataSize, unsigned char *key, unsigned char *dataBuffer);
+
+    /*
+	 * XOR the data stored in a buffer with the AES-CTR keystream of a key (the IV is the constant zero block),
+	 * i.e., CTR encryption, which is also its own inverse
+	 *
+	 * @param dataBuffer - the buffer that stores the data
+	 * @param dataSize - the size of the data (no need to be a multiple of the block size)
+	 * @param key - the key used to generate the keystream
+	 * @param output - the data XORed with the keystream <return>
+	 *
+	 * @return - a boolean value that indicates if the keystream XOR succeeds
+	 */
+    bool xorWithKeystream(unsigned char *dataBuffer, const int &dataSize, unsigned char *key, unsigned char *output);
 };
 
 #endif
@@ -1,18 +1,18 @@
 #ifndef __DATASTRUCT_HH__
 #define __DATASTRUCT_HH__
 
+#include <stdlib.h>
+
 #define HASH_SIZE 32
 #define KEY_SIZE 32
 #define FP_SIZE 32
 #define KEYEX_COMPUTE_SIZE 128
 
-/* num of total servers. 5 is default(= TOTAL_SHARES_NUM + 1) */
-#define TOTAL_SERVERS_NUM 5
-/* num of total shares in current version of system. 4 is default(= k + 1) */
-#define TOTAL_SHARES_NUM 4
+/* max num of shares of a secret (n without the KM-assisted servers); n and k are taken from the configuration */
+#define MAX_SHARES_NUM 8
 
-/* max chunk data size. Its value depends on setting of chunker. default: 4 * 16KB */
-#define MAX_DATA_SIZE (TOTAL_SHARES_NUM * 16 * 1024)
+/* max size of the n shares of a secret, enough for n / k <= 4 at the max secret size */
+#define MAX_DATA_SIZE (4 * 16 * 1024)
 
 /* max secret size */
 #define SECRET_SIZE (16 * 1024)
@@ -65,7 +65,7 @@ typedef struct {
  * */
 typedef struct {
     unsigned char content[MAX_DATA_SIZE];
-    unsigned char total_FP[TOTAL_SHARES_NUM * FP_SIZE];
+    unsigned char total_FP[MAX_SHARES_NUM * FP_SIZE];
     int chunk_id;
     int seg_id;
     int share_id;
@@ -75,4 +75,48 @@ typedef struct {
     short end;
 } Chunk_t;
 
+/* a received buffer shared by the shares pointing into it, freed with the last reference */
+typedef struct {
+    char *data;
+    int refs;
+} ShareBuffer_t;
+
+/*
+ * allocate a shared buffer holding one reference
+ *
+ * @param size - the size of the buffer
+ *
+ * @return - the shared buffer
+ */
+static inline ShareBuffer_t *newShareBuffer(size_t size)
+{
+    auto *buffer = (ShareBuffer_t *) malloc(sizeof(ShareBuffer_t));
+    buffer->data = (char *) malloc(size);
+    buffer->refs = 1;
+    return buffer;
+}
+
+/*
+ * take one more reference of a shared buffer
+ *
+ * @param buffer - the shared buffer
+ */
+static inline void holdShareBuffer(ShareBuffer_t *buffer)
+{
+    __atomic_add_fetch(&buffer->refs, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * drop one reference of a shared buffer, the last one frees it
+ *
+ * @param buffer - the shared buffer
+ */
+static inline void releaseShareBuffer(ShareBuffer_t *buffer)
+{
+    if(__atomic_sub_fetch(&buffer->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(buffer->data);
+        free(buffer);
+    }
+}
+
 #endif // __DATASTRUCT_HH__
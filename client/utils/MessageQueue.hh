@@ -38,6 +38,11 @@ public:
         return true;
     }
 
+    bool try_push(T &data)
+    {
+        return queue.push(data);
+    }
+
     bool pop(T &data)
     {
         return queue.pop(data);
@@ -46,6 +51,7 @@ public:
     bool set_job_done()
     {
         done_ = true;
+        return true;
     }
 
     void read(T &data)
@@ -0,0 +1,764 @@
+/*
+ * NetEngine.cc
+ */
+
+#include "NetEngine.hh"
+
+/*the user data marking the completion of the wakeup read*/
+#define NET_ENGINE_WAKE_TAG 0
+
+/*
+ * constructor of NetEngine
+ *
+ * @param numOfConns - the number of connections
+ * @param backend - NET_ENGINE_AUTO, NET_ENGINE_EPOLL or NET_ENGINE_URING (falls back to epoll if unusable)
+ */
+NetEngine::NetEngine(int numOfConns, int backend)
+{
+    numOfConns_ = numOfConns;
+    conns_ = (netConn_t *) malloc(sizeof(netConn_t) * numOfConns_);
+    memset(conns_, 0, sizeof(netConn_t) * numOfConns_);
+    for(int i = 0; i < numOfConns_; i++) {
+        conns_[i].fd = -1;
+    }
+
+    pthread_mutex_init(&lock_, NULL);
+    pendingHead_ = NULL;
+    pendingTail_ = NULL;
+    stop_ = false;
+    running_ = false;
+
+    wakeFd_ = eventfd(0, EFD_CLOEXEC);
+    if(wakeFd_ == -1) {
+        fprintf(stderr, "Error: fail to create the eventfd of the network engine %d\n", errno);
+        exit(1);
+    }
+    wakeValue_ = 0;
+    wakeArmed_ = false;
+
+    epollFd_ = -1;
+    ringFd_ = -1;
+    buffersRegistered_ = false;
+
+    backend_ = NET_ENGINE_EPOLL;
+    if(backend != NET_ENGINE_EPOLL) {
+        if(setupUring()) {
+            backend_ = NET_ENGINE_URING;
+        } else if(backend == NET_ENGINE_URING) {
+            fprintf(stderr, "Warning: io_uring is not available, falling back to epoll\n");
+        }
+    }
+    if(backend_ == NET_ENGINE_EPOLL) {
+        setupEpoll();
+    }
+}
+
+/*
+ * destructor of NetEngine
+ */
+NetEngine::~NetEngine()
+{
+    stop();
+
+    /*drop the operations never completed*/
+    while(pendingHead_ != NULL) {
+        netOp_t *op = pendingHead_;
+        pendingHead_ = op->next;
+        free(op->iov);
+        free(op);
+    }
+    for(int i = 0; i < numOfConns_; i++) {
+        netOp_t *heads[2] = {conns_[i].sendHead, conns_[i].recvHead};
+        for(int j = 0; j < 2; j++) {
+            while(heads[j] != NULL) {
+                netOp_t *op = heads[j];
+                heads[j] = op->next;
+                free(op->iov);
+                free(op);
+            }
+        }
+    }
+
+#ifdef NET_ENGINE_HAS_URING
+    if(ringFd_ != -1) {
+        munmap(sqes_, sqesSize_);
+        if(cqRing_ != sqRing_) {
+            munmap(cqRing_, cqRingSize_);
+        }
+        munmap(sqRing_, sqRingSize_);
+        close(ringFd_);
+    }
+#endif
+    if(epollFd_ != -1) {
+        close(epollFd_);
+    }
+    close(wakeFd_);
+    pthread_mutex_destroy(&lock_);
+    free(conns_);
+}
+
+/*
+ * get the backend in use
+ *
+ * @return - NET_ENGINE_EPOLL or NET_ENGINE_URING
+ */
+int NetEngine::getBackend()
+{
+    return backend_;
+}
+
+/*
+ * set up the io_uring backend
+ *
+ * @return - a boolean value that indicates if io_uring is usable
+ */
+bool NetEngine::setupUring()
+{
+#ifdef NET_ENGINE_HAS_URING
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    ringFd_ = syscall(__NR_io_uring_setup, NET_ENGINE_RING_ENTRIES, &params);
+    if(ringFd_ < 0) {
+        ringFd_ = -1;
+        return 0;
+    }
+
+    /*map the rings, which share one mapping on recent kernels*/
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(cqRingSize_ > sqRingSize_) {
+            sqRingSize_ = cqRingSize_;
+        }
+        cqRingSize_ = sqRingSize_;
+    }
+    sqRing_ = mmap(NULL, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_,
+                   IORING_OFF_SQ_RING);
+    if(sqRing_ == MAP_FAILED) {
+        close(ringFd_);
+        ringFd_ = -1;
+        return 0;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        cqRing_ = sqRing_;
+    } else {
+        cqRing_ = mmap(NULL, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_,
+                       IORING_OFF_CQ_RING);
+        if(cqRing_ == MAP_FAILED) {
+            munmap(sqRing_, sqRingSize_);
+            close(ringFd_);
+            ringFd_ = -1;
+            return 0;
+        }
+    }
+    sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = mmap(NULL, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES);
+    if(sqes_ == MAP_FAILED) {
+        if(cqRing_ != sqRing_) {
+            munmap(cqRing_, cqRingSize_);
+        }
+        munmap(sqRing_, sqRingSize_);
+        close(ringFd_);
+        ringFd_ = -1;
+        return 0;
+    }
+
+    sqHead_ = (unsigned *) ((char *) sqRing_ + params.sq_off.head);
+    sqTail_ = (unsigned *) ((char *) sqRing_ + params.sq_off.tail);
+    sqMask_ = (unsigned *) ((char *) sqRing_ + params.sq_off.ring_mask);
+    sqArray_ = (unsigned *) ((char *) sqRing_ + params.sq_off.array);
+    cqHead_ = (unsigned *) ((char *) cqRing_ + params.cq_off.head);
+    cqTail_ = (unsigned *) ((char *) cqRing_ + params.cq_off.tail);
+    cqMask_ = (unsigned *) ((char *) cqRing_ + params.cq_off.ring_mask);
+    cqes_ = (char *) cqRing_ + params.cq_off.cqes;
+    sqEntries_ = params.sq_entries;
+    toSubmit_ = 0;
+
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * set up the epoll backend
+ */
+void NetEngine::setupEpoll()
+{
+    struct epoll_event event;
+
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    if(epollFd_ == -1) {
+        fprintf(stderr, "Error: fail to create the epoll instance %d\n", errno);
+        exit(1);
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if(epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &event) == -1) {
+        fprintf(stderr, "Error: fail to watch the eventfd %d\n", errno);
+        exit(1);
+    }
+}
+
+/*
+ * attach a connected socket (before start())
+ *
+ * @param conn - the connection number
+ * @param fd - the socket
+ */
+void NetEngine::addConnection(int conn, int fd)
+{
+    conns_[conn].fd = fd;
+
+    if(backend_ == NET_ENGINE_EPOLL) {
+        struct epoll_event event;
+
+        /*the socket is driven without blocking, interest is armed only while an operation waits*/
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        memset(&event, 0, sizeof(event));
+        event.events = 0;
+        event.data.ptr = &conns_[conn];
+        if(epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) == -1) {
+            fprintf(stderr, "Error: fail to watch connection %d (%d)\n", conn, errno);
+        }
+    }
+}
+
+/*
+ * register receive buffers with the kernel (before start(), io_uring only)
+ *
+ * @param buffers - the buffers
+ * @param count - number of buffers
+ *
+ * @return - a boolean value that indicates if the buffers are registered
+ */
+bool NetEngine::registerBuffers(struct iovec *buffers, int count)
+{
+#ifdef NET_ENGINE_HAS_URING
+    if(backend_ != NET_ENGINE_URING) {
+        return 0;
+    }
+    if(syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_BUFFERS, buffers, count) < 0) {
+        /*usually RLIMIT_MEMLOCK, the plain receive path does the same job*/
+        fprintf(stderr, "Warning: fail to register the receive buffers (%d), using unregistered ones\n", errno);
+        return 0;
+    }
+    buffersRegistered_ = true;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * start the event-loop thread
+ */
+void NetEngine::start()
+{
+    running_ = true;
+    pthread_create(&tid_, 0, &thread_handler, (void *) this);
+}
+
+/*
+ * stop the event-loop thread (operations still queued are dropped)
+ */
+void NetEngine::stop()
+{
+    uint64_t one = 1;
+
+    if(!running_) {
+        return;
+    }
+
+    pthread_mutex_lock(&lock_);
+    stop_ = true;
+    pthread_mutex_unlock(&lock_);
+    if(write(wakeFd_, &one, sizeof(one)) != sizeof(one)) {
+        fprintf(stderr, "Error: fail to wake the network engine up %d\n", errno);
+    }
+
+    pthread_join(tid_, NULL);
+    running_ = false;
+}
+
+/*
+ * queue sending the buffers on a connection, the vector is copied but the data has to stay
+ * valid until the callback
+ *
+ * @param conn - the connection number
+ * @param iov - the buffers to be sent
+ * @param iovcnt - number of buffers
+ * @param callback - the completion callback (can be NULL)
+ * @param arg - argument of the callback
+ */
+void NetEngine::submitSend(int conn, struct iovec *iov, int iovcnt, NetCallback callback, void *arg)
+{
+    uint64_t one = 1;
+    netOp_t *op = (netOp_t *) malloc(sizeof(netOp_t));
+
+    memset(op, 0, sizeof(netOp_t));
+    op->conn = conn;
+    op->send = true;
+    op->iov = (struct iovec *) malloc(sizeof(struct iovec) * (iovcnt + 1));
+    memcpy(op->iov, iov, sizeof(struct iovec) * iovcnt);
+    op->iovIndex = 0;
+    op->iovcnt = iovcnt;
+    op->bufIndex = -1;
+    op->callback = callback;
+    op->arg = arg;
+
+    /*skip empty buffers, a frame without payload completes right away*/
+    while(op->iovIndex < op->iovcnt && op->iov[op->iovIndex].iov_len == 0) {
+        op->iovIndex++;
+    }
+
+    pthread_mutex_lock(&lock_);
+    if(pendingTail_ == NULL) {
+        pendingHead_ = op;
+    } else {
+        pendingTail_->next = op;
+    }
+    pendingTail_ = op;
+    pthread_mutex_unlock(&lock_);
+
+    if(write(wakeFd_, &one, sizeof(one)) != sizeof(one)) {
+        fprintf(stderr, "Error: fail to wake the network engine up %d\n", errno);
+    }
+}
+
+/*
+ * queue receiving exactly size bytes on a connection
+ *
+ * @param conn - the connection number
+ * @param buffer - the buffer <return>
+ * @param size - the number of bytes
+ * @param bufIndex - index of the registered buffer holding it, -1 if none
+ * @param callback - the completion callback (can be NULL)
+ * @param arg - argument of the callback
+ */
+void NetEngine::submitRecv(int conn, char *buffer, int size, int bufIndex, NetCallback callback, void *arg)
+{
+    uint64_t one = 1;
+    netOp_t *op = (netOp_t *) malloc(sizeof(netOp_t));
+
+    memset(op, 0, sizeof(netOp_t));
+    op->conn = conn;
+    op->send = false;
+    op->buffer = buffer;
+    op->bufIndex = bufIndex;
+    op->size = size;
+    op->callback = callback;
+    op->arg = arg;
+
+    pthread_mutex_lock(&lock_);
+    if(pendingTail_ == NULL) {
+        pendingHead_ = op;
+    } else {
+        pendingTail_->next = op;
+    }
+    pendingTail_ = op;
+    pthread_mutex_unlock(&lock_);
+
+    if(write(wakeFd_, &one, sizeof(one)) != sizeof(one)) {
+        fprintf(stderr, "Error: fail to wake the network engine up %d\n", errno);
+    }
+}
+
+/*
+ * move the submitted operations to their connections
+ *
+ * @return - a boolean value that indicates if the engine is asked to stop
+ */
+bool NetEngine::drainPending()
+{
+    netOp_t *op;
+    bool stop;
+
+    pthread_mutex_lock(&lock_);
+    op = pendingHead_;
+    pendingHead_ = NULL;
+    pendingTail_ = NULL;
+    stop = stop_;
+    pthread_mutex_unlock(&lock_);
+
+    while(op != NULL) {
+        netOp_t *next = op->next;
+        netConn_t *conn = &conns_[op->conn];
+
+        op->next = NULL;
+        conn->queued = true;
+        if(op->send) {
+            if(conn->sendTail == NULL) {
+                conn->sendHead = op;
+            } else {
+                conn->sendTail->next = op;
+            }
+            conn->sendTail = op;
+        } else {
+            if(conn->recvTail == NULL) {
+                conn->recvHead = op;
+            } else {
+                conn->recvTail->next = op;
+            }
+            conn->recvTail = op;
+        }
+        op = next;
+    }
+
+    return stop;
+}
+
+/*
+ * account for bytes transferred by an operation
+ *
+ * @param op - the operation
+ * @param bytes - the number of bytes transferred
+ *
+ * @return - a boolean value that indicates if the operation is complete
+ */
+bool NetEngine::advance(netOp_t *op, int bytes)
+{
+    op->done += bytes;
+    if(!op->send) {
+        return op->done >= op->size;
+    }
+
+    /*skip the buffers sent completely and advance into a partially sent one*/
+    while(op->iovIndex < op->iovcnt && (size_t) bytes >= op->iov[op->iovIndex].iov_len) {
+        bytes -= op->iov[op->iovIndex].iov_len;
+        op->iovIndex++;
+    }
+    if(bytes > 0) {
+        op->iov[op->iovIndex].iov_base = (char *) op->iov[op->iovIndex].iov_base + bytes;
+        op->iov[op->iovIndex].iov_len -= bytes;
+    }
+    return op->iovIndex >= op->iovcnt;
+}
+
+/*
+ * remove the head operation of a direction of a connection and run its callback
+ *
+ * @param conn - the connection
+ * @param send - the direction
+ * @param result - the result passed to the callback
+ */
+void NetEngine::finishOp(netConn_t *conn, bool send, int result)
+{
+    netOp_t *op;
+
+    if(send) {
+        op = conn->sendHead;
+        conn->sendHead = op->next;
+        if(conn->sendHead == NULL) {
+            conn->sendTail = NULL;
+        }
+    } else {
+        op = conn->recvHead;
+        conn->recvHead = op->next;
+        if(conn->recvHead == NULL) {
+            conn->recvTail = NULL;
+        }
+    }
+
+    if(result < 0) {
+        fprintf(stderr, "[NetEngine] <%d> %s failed: %s\n", op->conn, send ? "send" : "recv", strerror(-result));
+    }
+    if(op->callback != NULL) {
+        op->callback(op->arg, result);
+    }
+    free(op->iov);
+    free(op);
+}
+
+/*
+ * epoll backend: transfer as much of the head operations of a connection as possible
+ *
+ * @param conn - the connection
+ */
+void NetEngine::progressEpoll(netConn_t *conn)
+{
+    struct epoll_event event;
+    ssize_t bytecount;
+
+    while(conn->sendHead != NULL) {
+        netOp_t *op = conn->sendHead;
+        if(op->iovIndex >= op->iovcnt) {
+            finishOp(conn, true, op->done);
+            continue;
+        }
+        op->msg.msg_iov = op->iov + op->iovIndex;
+        op->msg.msg_iovlen = (op->iovcnt - op->iovIndex > IOV_MAX) ? IOV_MAX : op->iovcnt - op->iovIndex;
+        bytecount = sendmsg(conn->fd, &op->msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(bytecount == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            finishOp(conn, true, -errno);
+            continue;
+        }
+        if(advance(op, bytecount)) {
+            finishOp(conn, true, op->done);
+        }
+    }
+
+    while(conn->recvHead != NULL) {
+        netOp_t *op = conn->recvHead;
+        if(op->done >= op->size) {
+            finishOp(conn, false, op->done);
+            continue;
+        }
+        bytecount = recv(conn->fd, op->buffer + op->done, op->size - op->done, MSG_DONTWAIT);
+        if(bytecount == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            finishOp(conn, false, -errno);
+            continue;
+        }
+        if(bytecount == 0) {
+            finishOp(conn, false, -ECONNRESET);
+            continue;
+        }
+        if(advance(op, bytecount)) {
+            finishOp(conn, false, op->done);
+        }
+    }
+
+    /*arm the directions still waiting for the socket*/
+    unsigned int events = (conn->sendHead != NULL ? (unsigned int) EPOLLOUT : 0) |
+                          (conn->recvHead != NULL ? (unsigned int) EPOLLIN : 0);
+    if(events != conn->events) {
+        memset(&event, 0, sizeof(event));
+        event.events = events;
+        event.data.ptr = conn;
+        if(epoll_ctl(epollFd_, EPOLL_CTL_MOD, conn->fd, &event) == -1) {
+            fprintf(stderr, "Error: fail to update the epoll events %d\n", errno);
+        }
+        conn->events = events;
+    }
+}
+
+/*
+ * epoll backend: the event loop
+ */
+void NetEngine::loopEpoll()
+{
+    struct epoll_event events[NET_ENGINE_MAX_EVENTS];
+    uint64_t value;
+    int num, i;
+
+    while(!drainPending()) {
+        /*new operations may be transferable without waiting*/
+        for(i = 0; i < numOfConns_; i++) {
+            if(conns_[i].queued) {
+                conns_[i].queued = false;
+                progressEpoll(&conns_[i]);
+            }
+        }
+
+        num = epoll_wait(epollFd_, events, NET_ENGINE_MAX_EVENTS, -1);
+        if(num == -1) {
+            if(errno != EINTR) {
+                fprintf(stderr, "Error: epoll_wait failed %d\n", errno);
+            }
+            continue;
+        }
+        for(i = 0; i < num; i++) {
+            if(events[i].data.ptr == NULL) {
+                if(read(wakeFd_, &value, sizeof(value)) != sizeof(value)) {
+                    fprintf(stderr, "Error: fail to reset the eventfd %d\n", errno);
+                }
+                continue;
+            }
+            progressEpoll((netConn_t *) events[i].data.ptr);
+        }
+    }
+}
+
+#ifdef NET_ENGINE_HAS_URING
+
+/*
+ * io_uring backend: get a free submission queue entry
+ *
+ * @return - the entry, or NULL if the submission queue is full
+ */
+struct io_uring_sqe *NetEngine::getSqe()
+{
+    unsigned tail = *sqTail_;
+    struct io_uring_sqe *sqe;
+
+    if(tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_) {
+        return NULL;
+    }
+
+    sqe = (struct io_uring_sqe *) sqes_ + (tail & *sqMask_);
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqArray_[tail & *sqMask_] = tail & *sqMask_;
+    __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+    toSubmit_++;
+
+    return sqe;
+}
+
+/*
+ * io_uring backend: queue the head operation of a direction of a connection
+ *
+ * @param conn - the connection
+ * @param send - the direction
+ */
+void NetEngine::prepareOp(netConn_t *conn, bool send)
+{
+    struct io_uring_sqe *sqe;
+    netOp_t *op = send ? conn->sendHead : conn->recvHead;
+
+    while(op != NULL && (send ? op->iovIndex >= op->iovcnt : op->done >= op->size)) {
+        finishOp(conn, send, op->done);
+        op = send ? conn->sendHead : conn->recvHead;
+    }
+    if(op == NULL || (sqe = getSqe()) == NULL) {
+        return;
+    }
+
+    if(send) {
+        op->msg.msg_iov = op->iov + op->iovIndex;
+        op->msg.msg_iovlen = (op->iovcnt - op->iovIndex > IOV_MAX) ? IOV_MAX : op->iovcnt - op->iovIndex;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = conn->fd;
+        sqe->addr = (uint64_t) (uintptr_t) &op->msg;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        conn->sendBusy = true;
+    } else {
+        if(op->bufIndex >= 0 && buffersRegistered_) {
+            /*the kernel keeps the pages of a registered buffer pinned, no per-request mapping*/
+            sqe->opcode = IORING_OP_READ_FIXED;
+            sqe->buf_index = op->bufIndex;
+        } else {
+            sqe->opcode = IORING_OP_RECV;
+        }
+        sqe->fd = conn->fd;
+        sqe->addr = (uint64_t) (uintptr_t) (op->buffer + op->done);
+        sqe->len = op->size - op->done;
+        conn->recvBusy = true;
+    }
+    sqe->user_data = (uint64_t) (uintptr_t) op;
+}
+
+/*
+ * io_uring backend: handle the completions
+ */
+void NetEngine::reapUring()
+{
+    unsigned head = *cqHead_;
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    struct io_uring_cqe *cqe;
+
+    while(head != tail) {
+        cqe = (struct io_uring_cqe *) cqes_ + (head & *cqMask_);
+        uint64_t userData = cqe->user_data;
+        int res = cqe->res;
+        head++;
+
+        if(userData == NET_ENGINE_WAKE_TAG) {
+            wakeArmed_ = false;
+            continue;
+        }
+
+        netOp_t *op = (netOp_t *) (uintptr_t) userData;
+        netConn_t *conn = &conns_[op->conn];
+        if(op->send) {
+            conn->sendBusy = false;
+        } else {
+            conn->recvBusy = false;
+        }
+
+        /*an interrupted operation stays at the head and is submitted again*/
+        if(res == -EINTR || res == -EAGAIN) {
+            continue;
+        }
+        if(res < 0) {
+            finishOp(conn, op->send, res);
+        } else if(res == 0 && !op->send) {
+            finishOp(conn, false, -ECONNRESET);
+        } else if(advance(op, res)) {
+            finishOp(conn, op->send, op->done);
+        }
+    }
+
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * io_uring backend: the event loop
+ */
+void NetEngine::loopUring()
+{
+    struct io_uring_sqe *sqe;
+    int ret, i;
+
+    while(!drainPending()) {
+        /*a pending read of the eventfd wakes the loop up on new submissions*/
+        if(!wakeArmed_ && (sqe = getSqe()) != NULL) {
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = wakeFd_;
+            sqe->addr = (uint64_t) (uintptr_t) &wakeValue_;
+            sqe->len = sizeof(wakeValue_);
+            sqe->user_data = NET_ENGINE_WAKE_TAG;
+            wakeArmed_ = true;
+        }
+
+        for(i = 0; i < numOfConns_; i++) {
+            if(conns_[i].fd == -1) {
+                continue;
+            }
+            if(!conns_[i].sendBusy) {
+                prepareOp(&conns_[i], true);
+            }
+            if(!conns_[i].recvBusy) {
+                prepareOp(&conns_[i], false);
+            }
+        }
+
+        /*submit everything queued in this round and wait for at least one completion in one syscall*/
+        ret = syscall(__NR_io_uring_enter, ringFd_, toSubmit_, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(ret < 0) {
+            if(errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                fprintf(stderr, "Error: io_uring_enter failed %d\n", errno);
+            }
+        } else {
+            toSubmit_ -= ret;
+        }
+
+        reapUring();
+    }
+}
+
+#endif
+
+/*
+ * event-loop thread handler
+ *
+ * @param param - the engine
+ */
+void *NetEngine::thread_handler(void *param)
+{
+    NetEngine *obj = (NetEngine *) param;
+
+#ifdef NET_ENGINE_HAS_URING
+    if(obj->backend_ == NET_ENGINE_URING) {
+        obj->loopUring();
+        pthread_exit(NULL);
+    }
+#endif
+    obj->loopEpoll();
+    pthread_exit(NULL);
+}
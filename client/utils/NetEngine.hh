@@ -0,0 +1,296 @@
+/*
+ * NetEngine.hh
+ */
+
+#ifndef __NETENGINE_HH__
+#define __NETENGINE_HH__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <climits>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/*io_uring is driven through its raw syscalls, so only the kernel header is needed*/
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define NET_ENGINE_HAS_URING 1
+#endif
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/*macros for the backend of the engine*/
+#define NET_ENGINE_AUTO 0
+#define NET_ENGINE_EPOLL 1
+#define NET_ENGINE_URING 2
+
+/*macro for the number of submission queue entries of the io_uring*/
+#define NET_ENGINE_RING_ENTRIES 256
+/*macro for the max number of epoll events handled per wakeup*/
+#define NET_ENGINE_MAX_EVENTS 64
+
+/*the completion callback: result is the number of bytes transferred, or -errno if the operation fails*/
+typedef void (*NetCallback)(void *arg, int result);
+
+/*
+ * asynchronous network engine: a single event-loop thread drives the sends and receives of all
+ * connections through io_uring (batched submissions, registered receive buffers), or through
+ * epoll on non-blocking sockets where io_uring is not available; operations of the same direction
+ * on a connection complete in the order they are submitted
+ */
+class NetEngine {
+private:
+    /*a queued send or receive*/
+    typedef struct netOp {
+        int conn;
+        bool send;
+        /*send: the remaining buffers (a private copy of the vector)*/
+        struct iovec *iov;
+        int iovIndex;
+        int iovcnt;
+        /*receive: the buffer, its registered index (-1 if none) and the bytes still expected*/
+        char *buffer;
+        int bufIndex;
+        int size;
+        /*bytes transferred so far*/
+        int done;
+        struct msghdr msg;
+        NetCallback callback;
+        void *arg;
+        struct netOp *next;
+    } netOp_t;
+
+    /*the state of a connection*/
+    typedef struct {
+        int fd;
+        netOp_t *sendHead;
+        netOp_t *sendTail;
+        netOp_t *recvHead;
+        netOp_t *recvTail;
+        /*indicate an operation of the direction is in the kernel (io_uring)*/
+        bool sendBusy;
+        bool recvBusy;
+        /*indicate operations are queued since the connection was last served (epoll)*/
+        bool queued;
+        /*the epoll events armed*/
+        unsigned int events;
+    } netConn_t;
+
+    /*the backend in use*/
+    int backend_;
+
+    /*connections indexed by the caller's connection number*/
+    netConn_t *conns_;
+    int numOfConns_;
+
+    /*operations submitted by other threads, moved to the connections by the loop*/
+    pthread_mutex_t lock_;
+    netOp_t *pendingHead_;
+    netOp_t *pendingTail_;
+    bool stop_;
+    bool running_;
+
+    /*eventfd waking the loop up when operations are submitted*/
+    int wakeFd_;
+    uint64_t wakeValue_;
+    bool wakeArmed_;
+
+    /*the event-loop thread*/
+    pthread_t tid_;
+
+    /*epoll backend*/
+    int epollFd_;
+
+    /*io_uring backend*/
+    int ringFd_;
+    void *sqRing_;
+    void *cqRing_;
+    size_t sqRingSize_;
+    size_t cqRingSize_;
+    void *sqes_;
+    size_t sqesSize_;
+    unsigned *sqHead_;
+    unsigned *sqTail_;
+    unsigned *sqMask_;
+    unsigned *sqArray_;
+    unsigned *cqHead_;
+    unsigned *cqTail_;
+    unsigned *cqMask_;
+    void *cqes_;
+    unsigned sqEntries_;
+    unsigned toSubmit_;
+    bool buffersRegistered_;
+
+    /*
+     * event-loop thread handler
+     *
+     * @param param - the engine
+     */
+    static void *thread_handler(void *param);
+
+    /*
+     * set up the io_uring backend
+     *
+     * @return - a boolean value that indicates if io_uring is usable
+     */
+    bool setupUring();
+
+    /*
+     * set up the epoll backend
+     */
+    void setupEpoll();
+
+    /*
+     * move the submitted operations to their connections
+     *
+     * @return - a boolean value that indicates if the engine is asked to stop
+     */
+    bool drainPending();
+
+    /*
+     * account for bytes transferred by an operation
+     *
+     * @param op - the operation
+     * @param bytes - the number of bytes transferred
+     *
+     * @return - a boolean value that indicates if the operation is complete
+     */
+    bool advance(netOp_t *op, int bytes);
+
+    /*
+     * remove the head operation of a direction of a connection and run its callback
+     *
+     * @param conn - the connection
+     * @param send - the direction
+     * @param result - the result passed to the callback
+     */
+    void finishOp(netConn_t *conn, bool send, int result);
+
+    /*
+     * epoll backend: transfer as much of the head operations of a connection as possible
+     *
+     * @param conn - the connection
+     */
+    void progressEpoll(netConn_t *conn);
+
+    /*
+     * epoll backend: the event loop
+     */
+    void loopEpoll();
+
+#ifdef NET_ENGINE_HAS_URING
+    /*
+     * io_uring backend: get a free submission queue entry
+     *
+     * @return - the entry, or NULL if the submission queue is full
+     */
+    struct io_uring_sqe *getSqe();
+
+    /*
+     * io_uring backend: queue the head operation of a direction of a connection
+     *
+     * @param conn - the connection
+     * @param send - the direction
+     */
+    void prepareOp(netConn_t *conn, bool send);
+
+    /*
+     * io_uring backend: handle the completions
+     */
+    void reapUring();
+
+    /*
+     * io_uring backend: the event loop
+     */
+    void loopUring();
+#endif
+
+public:
+    /*
+     * constructor of NetEngine
+     *
+     * @param numOfConns - the number of connections
+     * @param backend - NET_ENGINE_AUTO, NET_ENGINE_EPOLL or NET_ENGINE_URING (falls back to epoll if unusable)
+     */
+    NetEngine(int numOfConns, int backend);
+
+    /*
+     * destructor of NetEngine
+     */
+    ~NetEngine();
+
+    /*
+     * get the backend in use
+     *
+     * @return - NET_ENGINE_EPOLL or NET_ENGINE_URING
+     */
+    int getBackend();
+
+    /*
+     * attach a connected socket (before start())
+     *
+     * @param conn - the connection number
+     * @param fd - the socket
+     */
+    void addConnection(int conn, int fd);
+
+    /*
+     * register receive buffers with the kernel (before start(), io_uring only)
+     *
+     * @param buffers - the buffers
+     * @param count - number of buffers
+     *
+     * @return - a boolean value that indicates if the buffers are registered
+     */
+    bool registerBuffers(struct iovec *buffers, int count);
+
+    /*
+     * start the event-loop thread
+     */
+    void start();
+
+    /*
+     * stop the event-loop thread (operations still queued are dropped)
+     */
+    void stop();
+
+    /*
+     * queue sending the buffers on a connection, the vector is copied but the data has to stay
+     * valid until the callback
+     *
+     * @param conn - the connection number
+     * @param iov - the buffers to be sent
+     * @param iovcnt - number of buffers
+     * @param callback - the completion callback (can be NULL)
+     * @param arg - argument of the callback
+     */
+    void submitSend(int conn, struct iovec *iov, int iovcnt, NetCallback callback, void *arg);
+
+    /*
+     * queue receiving exactly size bytes on a connection
+     *
+     * @param conn - the connection number
+     * @param buffer - the buffer <return>
+     * @param size - the number of bytes
+     * @param bufIndex - index of the registered buffer holding it, -1 if none
+     * @param callback - the completion callback (can be NULL)
+     * @param arg - argument of the callback
+     */
+    void submitRecv(int conn, char *buffer, int size, int bufIndex, NetCallback callback, void *arg);
+};
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ * ShareFilter.cc
+ */
+
+#include "ShareFilter.hh"
+
+/*
+ * derive the two base hashes of a fingerprint (it is already a cryptographic hash)
+ *
+ * @param fp - the share fingerprint
+ * @param h1 - the first base hash <return>
+ * @param h2 - the second base hash <return>
+ */
+void ShareFilter::baseHashes_(const unsigned char *fp, uint64_t &h1, uint64_t &h2)
+{
+    memcpy(&h1, fp, sizeof(uint64_t));
+    memcpy(&h2, fp + sizeof(uint64_t), sizeof(uint64_t));
+    /*an odd step visits distinct positions*/
+    h2 |= 1;
+}
+
+/*
+ * constructor of ShareFilter: load the filter from its file if it exists
+ *
+ * @param path - the file keeping the filter
+ */
+ShareFilter::ShareFilter(const char *path)
+{
+    int head[2];
+
+    strncpy(path_, path, sizeof(path_) - 1);
+    path_[sizeof(path_) - 1] = '\0';
+
+    bloom_ = (unsigned char *) malloc(SHARE_FILTER_BLOOM_SIZE);
+    recent_ = (unsigned char *) malloc(SHARE_FILTER_RECENT_ENTRIES * SHARE_FILTER_FP_SIZE);
+    if(bloom_ == NULL || recent_ == NULL) {
+        fprintf(stderr, "Error: fail to allocate the share filter!\n");
+        exit(1);
+    }
+    memset(bloom_, 0, SHARE_FILTER_BLOOM_SIZE);
+    memset(recent_, 0, SHARE_FILTER_RECENT_ENTRIES * SHARE_FILTER_FP_SIZE);
+    count_ = 0;
+    dirty_ = false;
+
+    FILE *fp = fopen(path_, "rb");
+    if(fp == NULL) {
+        return;
+    }
+
+    /*file layout: magic<int> + bloom size<int> + count<long> + bloom + recent table*/
+    if(fread(head, sizeof(int), 2, fp) != 2 || head[0] != SHARE_FILTER_MAGIC || head[1] != SHARE_FILTER_BLOOM_SIZE ||
+       fread(&count_, sizeof(long), 1, fp) != 1 ||
+       fread(bloom_, 1, SHARE_FILTER_BLOOM_SIZE, fp) != SHARE_FILTER_BLOOM_SIZE ||
+       fread(recent_, SHARE_FILTER_FP_SIZE, SHARE_FILTER_RECENT_ENTRIES, fp) != SHARE_FILTER_RECENT_ENTRIES) {
+        fprintf(stderr, "Warning: share filter '%s' is invalid, starting with an empty one\n", path_);
+        memset(bloom_, 0, SHARE_FILTER_BLOOM_SIZE);
+        memset(recent_, 0, SHARE_FILTER_RECENT_ENTRIES * SHARE_FILTER_FP_SIZE);
+        count_ = 0;
+    }
+    fclose(fp);
+}
+
+/*
+ * destructor of ShareFilter
+ */
+ShareFilter::~ShareFilter()
+{
+    free(bloom_);
+    free(recent_);
+}
+
+/*
+ * check if a share has been stored before
+ *
+ * @param fp - the share fingerprint
+ *
+ * @return - 1 if the share is (probably) stored, 0 if it definitely is not
+ */
+bool ShareFilter::lookup(const unsigned char *fp)
+{
+    uint64_t h1, h2, bit;
+    int i;
+
+    baseHashes_(fp, h1, h2);
+
+    /*the recent table answers exactly*/
+    if(memcmp(recent_ + (h1 & (SHARE_FILTER_RECENT_ENTRIES - 1)) * SHARE_FILTER_FP_SIZE, fp,
+              SHARE_FILTER_FP_SIZE) == 0) {
+        return 1;
+    }
+
+    for(i = 0; i < SHARE_FILTER_NUM_HASHES; i++) {
+        bit = (h1 + i * h2) % ((uint64_t) SHARE_FILTER_BLOOM_SIZE * 8);
+        if((bloom_[bit >> 3] & (1 << (bit & 7))) == 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * record a share confirmed by the server
+ *
+ * @param fp - the share fingerprint
+ */
+void ShareFilter::insert(const unsigned char *fp)
+{
+    uint64_t h1, h2, bit;
+    int i;
+
+    baseHashes_(fp, h1, h2);
+
+    memcpy(recent_ + (h1 & (SHARE_FILTER_RECENT_ENTRIES - 1)) * SHARE_FILTER_FP_SIZE, fp, SHARE_FILTER_FP_SIZE);
+
+    for(i = 0; i < SHARE_FILTER_NUM_HASHES; i++) {
+        bit = (h1 + i * h2) % ((uint64_t) SHARE_FILTER_BLOOM_SIZE * 8);
+        bloom_[bit >> 3] |= (1 << (bit & 7));
+    }
+
+    count_++;
+    dirty_ = true;
+}
+
+/*
+ * write the filter back to its file if it has changed
+ *
+ * @return - a boolean value that indicates if the filter is saved
+ */
+bool ShareFilter::save()
+{
+    int head[2] = {SHARE_FILTER_MAGIC, SHARE_FILTER_BLOOM_SIZE};
+    char tempPath[sizeof(path_) + 4];
+
+    if(!dirty_) {
+        return 1;
+    }
+
+    /*write a temporary file and rename it, so a crash never leaves a torn filter behind*/
+    sprintf(tempPath, "%s.tmp", path_);
+    FILE *fp = fopen(tempPath, "wb");
+    if(fp == NULL) {
+        fprintf(stderr, "Error: fail to open share filter '%s'!\n", tempPath);
+        return 0;
+    }
+    if(fwrite(head, sizeof(int), 2, fp) != 2 || fwrite(&count_, sizeof(long), 1, fp) != 1 ||
+       fwrite(bloom_, 1, SHARE_FILTER_BLOOM_SIZE, fp) != SHARE_FILTER_BLOOM_SIZE ||
+       fwrite(recent_, SHARE_FILTER_FP_SIZE, SHARE_FILTER_RECENT_ENTRIES, fp) != SHARE_FILTER_RECENT_ENTRIES) {
+        fprintf(stderr, "Error: fail to write share filter '%s'!\n", tempPath);
+        fclose(fp);
+        return 0;
+    }
+    fclose(fp);
+
+    if(rename(tempPath, path_) != 0) {
+        fprintf(stderr, "Error: fail to replace share filter '%s'!\n", path_);
+        return 0;
+    }
+
+    dirty_ = false;
+    return 1;
+}
@@ -0,0 +1,92 @@
+/*
+ * ShareFilter.hh
+ */
+
+#ifndef __SHAREFILTER_HH__
+#define __SHAREFILTER_HH__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*macro for the size of a share fingerprint*/
+#define SHARE_FILTER_FP_SIZE 32
+/*macro for the size of the Bloom filter in bytes (32M bits, ~1% false positives for 3M shares)*/
+#define SHARE_FILTER_BLOOM_SIZE (4 * 1024 * 1024)
+/*macro for the number of bit positions set per fingerprint*/
+#define SHARE_FILTER_NUM_HASHES 7
+/*macro for the number of entries in the recent-fingerprint table (a power of 2)*/
+#define SHARE_FILTER_RECENT_ENTRIES 8192
+/*macro for the magic number of a filter file*/
+#define SHARE_FILTER_MAGIC 0x53464c54
+
+/*
+ * persistent filter of the shares a client has already stored on a server: a direct-mapped table of
+ * recently confirmed fingerprints answers exactly, the Bloom filter answers for all older ones
+ * (false positives are possible, so a hit is only a hint that the server has to validate)
+ */
+class ShareFilter {
+private:
+    /*the file keeping the filter across runs*/
+    char path_[256];
+
+    /*the bit array of the Bloom filter*/
+    unsigned char *bloom_;
+
+    /*the recent-fingerprint table*/
+    unsigned char *recent_;
+
+    /*number of fingerprints inserted*/
+    long count_;
+
+    /*indicate if the filter has changed since it was loaded*/
+    bool dirty_;
+
+    /*
+     * derive the two base hashes of a fingerprint (it is already a cryptographic hash)
+     *
+     * @param fp - the share fingerprint
+     * @param h1 - the first base hash <return>
+     * @param h2 - the second base hash <return>
+     */
+    static void baseHashes_(const unsigned char *fp, uint64_t &h1, uint64_t &h2);
+
+public:
+    /*
+     * constructor of ShareFilter: load the filter from its file if it exists
+     *
+     * @param path - the file keeping the filter
+     */
+    ShareFilter(const char *path);
+
+    /*
+     * destructor of ShareFilter
+     */
+    ~ShareFilter();
+
+    /*
+     * check if a share has been stored before
+     *
+     * @param fp - the share fingerprint
+     *
+     * @return - 1 if the share is (probably) stored, 0 if it definitely is not
+     */
+    bool lookup(const unsigned char *fp);
+
+    /*
+     * record a share confirmed by the server
+     *
+     * @param fp - the share fingerprint
+     */
+    void insert(const unsigned char *fp);
+
+    /*
+     * write the filter back to its file if it has changed
+     *
+     * @return - a boolean value that indicates if the filter is saved
+     */
+    bool save();
+};
+
+#endif
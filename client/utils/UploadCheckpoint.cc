@@ -0,0 +1,314 @@
+/*
+ * UploadCheckpoint.cc
+ */
+
+#include "UploadCheckpoint.hh"
+
+#include <fcntl.h>
+
+/*
+ * constructor of UploadCheckpoint: load the checkpoint of the file if it exists
+ *
+ * @param prefix - prefix of the checkpoint files
+ * @param userID - the user id
+ * @param fileName - the file to be uploaded
+ * @param numOfClouds - number of servers
+ */
+UploadCheckpoint::UploadCheckpoint(const char *prefix, int userID, const char *fileName, int numOfClouds)
+{
+    struct stat fileStat;
+    uint64_t nameHash = 14695981039346656037ULL;
+    int i;
+
+    /*one checkpoint per user and file name (FNV-1a of the name)*/
+    for(i = 0; fileName[i] != '\0'; i++) {
+        nameHash = (nameHash ^ (unsigned char) fileName[i]) * 1099511628211ULL;
+    }
+    snprintf(path_, sizeof(path_), "%s%d_%016llx", prefix, userID, (unsigned long long) nameHash);
+    snprintf(keyPath_, sizeof(keyPath_), "%s.keys", path_);
+
+    memset(fileName_, 0, CHECKPOINT_NAME_SIZE);
+    strncpy(fileName_, fileName, CHECKPOINT_NAME_SIZE - 1);
+    fileSize_ = 0;
+    fileTime_ = 0;
+    if(stat(fileName, &fileStat) == 0) {
+        fileSize_ = fileStat.st_size;
+        fileTime_ = fileStat.st_mtime;
+    }
+
+    numOfClouds_ = numOfClouds;
+    numOfSecrets_ = (int *) malloc(sizeof(int) * numOfClouds_);
+    sizeOfSecrets_ = (long *) malloc(sizeof(long) * numOfClouds_);
+    lastSecretID_ = (int *) malloc(sizeof(int) * numOfClouds_);
+    resumeSecrets_ = (int *) malloc(sizeof(int) * numOfClouds_);
+    resumeSize_ = (long *) malloc(sizeof(long) * numOfClouds_);
+    failed_ = (bool *) malloc(sizeof(bool) * numOfClouds_);
+    for(i = 0; i < numOfClouds_; i++) {
+        numOfSecrets_[i] = 0;
+        sizeOfSecrets_[i] = 0;
+        lastSecretID_[i] = 0;
+        failed_[i] = false;
+    }
+    dirty_ = false;
+
+    if(load_()) {
+        printf("[Checkpoint] resuming the upload of '%s'\n", fileName_);
+        for(i = 0; i < numOfClouds_; i++) {
+            printf("[Checkpoint] <%d> %d secrets acknowledged, last secret ID %d\n", i, numOfSecrets_[i],
+                   lastSecretID_[i]);
+        }
+    }
+    for(i = 0; i < numOfClouds_; i++) {
+        resumeSecrets_[i] = numOfSecrets_[i];
+        resumeSize_[i] = sizeOfSecrets_[i];
+    }
+
+    /*keys only depend on the hashes they are derived from, so the log is kept even for a changed file*/
+    pthread_mutex_init(&keyLock_, NULL);
+    loadKeys_();
+
+    /*the keys are secrets of the user, keep the log private*/
+    int fd = open(keyPath_, O_WRONLY | O_APPEND | O_CREAT, 0600);
+    keyLog_ = (fd == -1) ? NULL : fdopen(fd, "ab");
+    if(keyLog_ == NULL) {
+        fprintf(stderr, "Warning: fail to open the key log '%s', keys will not be kept\n", keyPath_);
+        if(fd != -1) {
+            close(fd);
+        }
+    }
+}
+
+/*
+ * destructor of UploadCheckpoint
+ */
+UploadCheckpoint::~UploadCheckpoint()
+{
+    if(keyLog_ != NULL) {
+        fclose(keyLog_);
+    }
+    pthread_mutex_destroy(&keyLock_);
+    free(numOfSecrets_);
+    free(sizeOfSecrets_);
+    free(lastSecretID_);
+    free(resumeSecrets_);
+    free(resumeSize_);
+    free(failed_);
+}
+
+/*
+ * load the acknowledged secrets, if the checkpoint belongs to the same version of the file
+ *
+ * @return - a boolean value that indicates if an upload is resumed
+ */
+bool UploadCheckpoint::load_()
+{
+    int head[2];
+    long identity[2];
+    char name[CHECKPOINT_NAME_SIZE];
+    int i;
+
+    FILE *fp = fopen(path_, "rb");
+    if(fp == NULL) {
+        return 0;
+    }
+
+    /*file layout: magic<int> + number of servers<int> + file size<long> + file time<long> + file name +
+      [number of secrets<int> + size of secrets<long> + last secret ID<int>] per server*/
+    if(fread(head, sizeof(int), 2, fp) != 2 || head[0] != CHECKPOINT_MAGIC || head[1] != numOfClouds_ ||
+       fread(identity, sizeof(long), 2, fp) != 2 || fread(name, 1, CHECKPOINT_NAME_SIZE, fp) != CHECKPOINT_NAME_SIZE) {
+        fprintf(stderr, "Warning: checkpoint '%s' is invalid, uploading from the beginning\n", path_);
+        fclose(fp);
+        return 0;
+    }
+    if(identity[0] != fileSize_ || identity[1] != fileTime_ || memcmp(name, fileName_, CHECKPOINT_NAME_SIZE) != 0) {
+        printf("[Checkpoint] '%s' changed since it was checkpointed, uploading from the beginning\n", fileName_);
+        fclose(fp);
+        return 0;
+    }
+    for(i = 0; i < numOfClouds_; i++) {
+        if(fread(&numOfSecrets_[i], sizeof(int), 1, fp) != 1 || fread(&sizeOfSecrets_[i], sizeof(long), 1, fp) != 1 ||
+           fread(&lastSecretID_[i], sizeof(int), 1, fp) != 1) {
+            fprintf(stderr, "Warning: checkpoint '%s' is invalid, uploading from the beginning\n", path_);
+            for(i = 0; i < numOfClouds_; i++) {
+                numOfSecrets_[i] = 0;
+                sizeOfSecrets_[i] = 0;
+                lastSecretID_[i] = 0;
+            }
+            fclose(fp);
+            return 0;
+        }
+    }
+    fclose(fp);
+    return 1;
+}
+
+/*
+ * load the logged keys (a torn record at the end is dropped)
+ */
+void UploadCheckpoint::loadKeys_()
+{
+    unsigned char record[CHECKPOINT_HASH_SIZE + CHECKPOINT_KEY_SIZE];
+
+    FILE *fp = fopen(keyPath_, "rb");
+    if(fp == NULL) {
+        return;
+    }
+    while(fread(record, sizeof(record), 1, fp) == 1) {
+        keys_[std::string((char *) record, CHECKPOINT_HASH_SIZE)] =
+                std::string((char *) record + CHECKPOINT_HASH_SIZE, CHECKPOINT_KEY_SIZE);
+    }
+    fclose(fp);
+    if(!keys_.empty()) {
+        printf("[Checkpoint] %lu keys obtained before\n", (unsigned long) keys_.size());
+    }
+}
+
+/*
+ * get the secrets a server acknowledged before the restart
+ *
+ * @param cloudIndex - the server
+ * @param sizeOfSecrets - total size of the secrets <return>
+ *
+ * @return - the number of secrets to be skipped
+ */
+int UploadCheckpoint::getResumeSecrets(int cloudIndex, long *sizeOfSecrets)
+{
+    *sizeOfSecrets = resumeSize_[cloudIndex];
+    return resumeSecrets_[cloudIndex];
+}
+
+/*
+ * record a batch acknowledged by a server (batches are acknowledged in order)
+ *
+ * @param cloudIndex - the server
+ * @param numOfSecrets - number of secrets in the batch
+ * @param sizeOfSecrets - total size of the secrets in the batch
+ * @param lastSecretID - ID of the last secret in the batch
+ */
+void UploadCheckpoint::acknowledge(int cloudIndex, int numOfSecrets, long sizeOfSecrets, int lastSecretID)
+{
+    if(failed_[cloudIndex] || numOfSecrets == 0) {
+        return;
+    }
+    numOfSecrets_[cloudIndex] += numOfSecrets;
+    sizeOfSecrets_[cloudIndex] += sizeOfSecrets;
+    lastSecretID_[cloudIndex] = lastSecretID;
+    dirty_ = true;
+}
+
+/*
+ * stop advancing the acknowledgements of a server whose batch failed
+ *
+ * @param cloudIndex - the server
+ */
+void UploadCheckpoint::fail(int cloudIndex)
+{
+    failed_[cloudIndex] = true;
+}
+
+/*
+ * write the acknowledged secrets back to the file if they have changed
+ *
+ * @return - a boolean value that indicates if the checkpoint is saved
+ */
+bool UploadCheckpoint::save()
+{
+    int head[2] = {CHECKPOINT_MAGIC, numOfClouds_};
+    long identity[2] = {fileSize_, fileTime_};
+    char tempPath[sizeof(path_) + 4];
+    int i;
+
+    if(!dirty_) {
+        return 1;
+    }
+
+    /*write a temporary file and rename it, so a crash never leaves a torn checkpoint behind*/
+    sprintf(tempPath, "%s.tmp", path_);
+    FILE *fp = fopen(tempPath, "wb");
+    if(fp == NULL) {
+        fprintf(stderr, "Error: fail to open checkpoint '%s'!\n", tempPath);
+        return 0;
+    }
+    bool ok = (fwrite(head, sizeof(int), 2, fp) == 2 && fwrite(identity, sizeof(long), 2, fp) == 2 &&
+               fwrite(fileName_, 1, CHECKPOINT_NAME_SIZE, fp) == CHECKPOINT_NAME_SIZE);
+    for(i = 0; ok && i < numOfClouds_; i++) {
+        ok = (fwrite(&numOfSecrets_[i], sizeof(int), 1, fp) == 1 && fwrite(&sizeOfSecrets_[i], sizeof(long), 1, fp) == 1 &&
+              fwrite(&lastSecretID_[i], sizeof(int), 1, fp) == 1);
+    }
+    if(fclose(fp) != 0 || !ok) {
+        fprintf(stderr, "Error: fail to write checkpoint '%s'!\n", tempPath);
+        return 0;
+    }
+
+    if(rename(tempPath, path_) != 0) {
+        fprintf(stderr, "Error: fail to replace checkpoint '%s'!\n", path_);
+        return 0;
+    }
+
+    dirty_ = false;
+    return 1;
+}
+
+/*
+ * find a key obtained before
+ *
+ * @param hash - the hash the key is derived from
+ * @param key - the key <return>
+ *
+ * @return - a boolean value that indicates if the key is found
+ */
+bool UploadCheckpoint::lookupKey(const unsigned char *hash, unsigned char *key)
+{
+    pthread_mutex_lock(&keyLock_);
+    auto it = keys_.find(std::string((const char *) hash, CHECKPOINT_HASH_SIZE));
+    bool found = (it != keys_.end());
+    if(found) {
+        memcpy(key, it->second.data(), CHECKPOINT_KEY_SIZE);
+    }
+    pthread_mutex_unlock(&keyLock_);
+    return found;
+}
+
+/*
+ * log a key obtained from a key manager
+ *
+ * @param hash - the hash the key is derived from
+ * @param key - the key
+ */
+void UploadCheckpoint::recordKey(const unsigned char *hash, const unsigned char *key)
+{
+    std::string index((const char *) hash, CHECKPOINT_HASH_SIZE);
+
+    pthread_mutex_lock(&keyLock_);
+    if(keys_.find(index) == keys_.end()) {
+        keys_[index] = std::string((const char *) key, CHECKPOINT_KEY_SIZE);
+
+        /*flushed at once, a key obtained is never exchanged again after a crash*/
+        if(keyLog_ != NULL && (fwrite(hash, CHECKPOINT_HASH_SIZE, 1, keyLog_) != 1 ||
+                               fwrite(key, CHECKPOINT_KEY_SIZE, 1, keyLog_) != 1 || fflush(keyLog_) != 0)) {
+            fprintf(stderr, "Warning: fail to log a key into '%s'\n", keyPath_);
+        }
+    }
+    pthread_mutex_unlock(&keyLock_);
+}
+
+/*
+ * remove the checkpoint once the upload completes (kept if a server failed a batch)
+ */
+void UploadCheckpoint::finish()
+{
+    for(int i = 0; i < numOfClouds_; i++) {
+        if(failed_[i]) {
+            save();
+            printf("[Checkpoint] server %d failed a batch, checkpoint '%s' kept for resuming\n", i, path_);
+            return;
+        }
+    }
+
+    if(keyLog_ != NULL) {
+        fclose(keyLog_);
+        keyLog_ = NULL;
+    }
+    unlink(path_);
+    unlink(keyPath_);
+}
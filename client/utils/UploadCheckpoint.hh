@@ -0,0 +1,155 @@
+/*
+ * UploadCheckpoint.hh
+ */
+
+#ifndef __UPLOADCHECKPOINT_HH__
+#define __UPLOADCHECKPOINT_HH__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <unordered_map>
+#include <unistd.h>
+
+/*macro for the size of the hash a key is derived from*/
+#define CHECKPOINT_HASH_SIZE 32
+/*macro for the size of a key*/
+#define CHECKPOINT_KEY_SIZE 32
+/*macro for the magic number of a checkpoint file*/
+#define CHECKPOINT_MAGIC 0x55434b50
+/*macro for the max length of the file name kept in a checkpoint*/
+#define CHECKPOINT_NAME_SIZE 256
+
+/*
+ * checkpoint of an upload: the number (and total size) of secrets each server has acknowledged as
+ * recorded in its recipe, and a log of the keys already obtained from the key managers; a restarted
+ * client skips what the servers acknowledged and continues the same recipe, without exchanging the
+ * logged keys again (the files are removed once the upload completes)
+ */
+class UploadCheckpoint {
+private:
+    /*the file keeping the acknowledged secrets*/
+    char path_[256];
+
+    /*the file logging the keys obtained*/
+    char keyPath_[256 + 8];
+
+    /*the uploaded file, identified by its name, size and modification time*/
+    char fileName_[CHECKPOINT_NAME_SIZE];
+    long fileSize_;
+    long fileTime_;
+
+    /*number of servers*/
+    int numOfClouds_;
+
+    /*secrets acknowledged by each server, their total size and the ID of the last one*/
+    int *numOfSecrets_;
+    long *sizeOfSecrets_;
+    int *lastSecretID_;
+
+    /*secrets acknowledged before the restart*/
+    int *resumeSecrets_;
+    long *resumeSize_;
+
+    /*indicate a batch of the server failed, so its acknowledgements stop advancing*/
+    bool *failed_;
+
+    /*indicate the acknowledgements have changed since the last save*/
+    bool dirty_;
+
+    /*the keys obtained, indexed by the hash they are derived from*/
+    std::unordered_map<std::string, std::string> keys_;
+    FILE *keyLog_;
+    pthread_mutex_t keyLock_;
+
+    /*
+     * load the acknowledged secrets, if the checkpoint belongs to the same version of the file
+     *
+     * @return - a boolean value that indicates if an upload is resumed
+     */
+    bool load_();
+
+    /*
+     * load the logged keys (a torn record at the end is dropped)
+     */
+    void loadKeys_();
+
+public:
+    /*
+     * constructor of UploadCheckpoint: load the checkpoint of the file if it exists
+     *
+     * @param prefix - prefix of the checkpoint files
+     * @param userID - the user id
+     * @param fileName - the file to be uploaded
+     * @param numOfClouds - number of servers
+     */
+    UploadCheckpoint(const char *prefix, int userID, const char *fileName, int numOfClouds);
+
+    /*
+     * destructor of UploadCheckpoint
+     */
+    ~UploadCheckpoint();
+
+    /*
+     * get the secrets a server acknowledged before the restart
+     *
+     * @param cloudIndex - the server
+     * @param sizeOfSecrets - total size of the secrets <return>
+     *
+     * @return - the number of secrets to be skipped
+     */
+    int getResumeSecrets(int cloudIndex, long *sizeOfSecrets);
+
+    /*
+     * record a batch acknowledged by a server (batches are acknowledged in order)
+     *
+     * @param cloudIndex - the server
+     * @param numOfSecrets - number of secrets in the batch
+     * @param sizeOfSecrets - total size of the secrets in the batch
+     * @param lastSecretID - ID of the last secret in the batch
+     */
+    void acknowledge(int cloudIndex, int numOfSecrets, long sizeOfSecrets, int lastSecretID);
+
+    /*
+     * stop advancing the acknowledgements of a server whose batch failed
+     *
+     * @param cloudIndex - the server
+     */
+    void fail(int cloudIndex);
+
+    /*
+     * write the acknowledged secrets back to the file if they have changed
+     *
+     * @return - a boolean value that indicates if the checkpoint is saved
+     */
+    bool save();
+
+    /*
+     * find a key obtained before
+     *
+     * @param hash - the hash the key is derived from
+     * @param key - the key <return>
+     *
+     * @return - a boolean value that indicates if the key is found
+     */
+    bool lookupKey(const unsigned char *hash, unsigned char *key);
+
+    /*
+     * log a key obtained from a key manager
+     *
+     * @param hash - the hash the key is derived from
+     * @param key - the key
+     */
+    void recordKey(const unsigned char *hash, const unsigned char *key);
+
+    /*
+     * remove the checkpoint once the upload completes (kept if a server failed a batch)
+     */
+    void finish();
+};
+
+#endif
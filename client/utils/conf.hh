@@ -16,6 +16,10 @@
 /* 0 for disabling trace-driven, 1 for enabling trace-driven */
 #define TRACE_DRIVEN_FSL_ENABLED (0)
 
+/* convergent dispersal type of encoder and decoder; CAONT_RS_CTR_TYPE masks the package with a faster CTR
+   keystream, but the type is not recorded with a file, so only a client built with the same type restores it */
+#define CD_CODEC_TYPE (CAONT_RS_TYPE)
+
 using namespace std;
 
 typedef struct kmServerConf {
@@ -73,14 +77,14 @@ public:
         bufferSize_ = 128 * 1024 * 1024;
         chunkEndIndexListSize_ = 1024 * 1024;
 
-        kmServerConf = std::make_unique<KMServerConf[]>(n_ + 1);
+        kmServerConf = std::make_unique<KMServerConf[]>(n_ + kmServerCount_);
 
         /* read key management server ip & port from config file */
         /* must put the config to the end of file */
         int numLines = 0;
         string configPath("./config");
         int lineEnd = getLineNumberFromFile(configPath);
-        int lineStart = lineEnd - 4;
+        int lineStart = lineEnd - (n_ + kmServerCount_) + 1;
         ifstream in(configPath);
         std::string currentLine;
         int count = 0;
@@ -100,7 +104,7 @@ public:
         }
 
         /* safety check */
-        if(count != n_ + 1) {
+        if(count != n_ + kmServerCount_) {
             cout << "Read error from file" << endl;
             exit(-2);
         }
@@ -62,6 +62,16 @@ Socket::Socket(char *ip, int port, int userID)
     if((bytecount = send(hostSock_, &netorder, sizeof(int), 0)) == -1) {
         fprintf(stderr, "Error sending userID %d\n", errno);
     }
+
+    /* get the upload credits granted by the server, fall back to stop-and-wait if they are missing */
+    credit_ = 1;
+    if(genericDownload((char *) &netorder, sizeof(int)) == sizeof(int)) {
+        credit_ = ntohl(netorder);
+    }
+    if(credit_ < 1 || credit_ > MAX_UPLOAD_CREDIT) {
+        fprintf(stderr, "Invalid upload credit %d, using 1\n", credit_);
+        credit_ = 1;
+    }
 }
 
 /*
@@ -93,6 +103,47 @@ int Socket::genericSend(char *raw, int rawSize)
     return total;
 }
 
+/*
+ * scatter-gather send function: send all buffers with as few syscalls as possible
+ *
+ * @param iov - the buffers to be sent (consumed while sending)
+ * @param iovcnt - number of buffers
+ *
+ * @return - the number of bytes sent, or -1 if an error occurs
+ */
+int Socket::genericSendv(struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg;
+    ssize_t bytecount;
+    int total = 0;
+
+    while(iovcnt > 0) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (iovcnt > IOV_MAX) ? IOV_MAX : iovcnt;
+        if((bytecount = sendmsg(hostSock_, &msg, MSG_NOSIGNAL)) == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Error sending data %d\n", errno);
+            return -1;
+        }
+        total += bytecount;
+
+        /* skip the buffers sent completely and advance into a partially sent one */
+        while(iovcnt > 0 && bytecount >= (ssize_t) iov->iov_len) {
+            bytecount -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(bytecount > 0) {
+            iov->iov_base = (char *) iov->iov_base + bytecount;
+            iov->iov_len -= bytecount;
+        }
+    }
+    return total;
+}
+
 /*
  * file meta-data send function
  *
@@ -104,19 +155,13 @@ int Socket::sendFileMeta(char *filename, int namesize)
 {
     /* SEND_FILE_META<client> = FILE_META<server> */
     int indicator = SEND_FILE_META;
+    struct iovec vec[3];
 
-    int bytecount;
-    if((bytecount = send(hostSock_, &indicator, sizeof(int), 0)) == -1) {
-        fprintf(stderr, "Error sending indicator! Error code: %d\n", errno);
-        return -1;
-    }
-
-    if((bytecount = send(hostSock_, &namesize, sizeof(int), 0)) == -1) {
-        fprintf(stderr, "Error sending nameSize! Error code: %d\n", errno);
-        return -1;
-    }
+    fillIOV(vec[0], &indicator, sizeof(int));
+    fillIOV(vec[1], &namesize, sizeof(int));
+    fillIOV(vec[2], filename, namesize);
 
-    if((bytecount = send(hostSock_, filename, namesize, 0)) == -1) {
+    if(genericSendv(vec, 3) == -1) {
         fprintf(stderr, "Error sending file name! Error code: %d\n", errno);
         return -1;
     }
@@ -124,69 +169,112 @@ int Socket::sendFileMeta(char *filename, int namesize)
     return 0;
 }
 
+/*
+ * build the head of an upload frame: indicator, end indicator (only for metaDedupCore, on
+ * SEND_META_REF and SEND_DATA), batch ID, file slot (only on SEND_META and SEND_META_REF) and
+ * payload size
+ *
+ * @param head - buffer of UPLOAD_HEAD_MAX_INTS ints for the head <return>
+ * @param indicator - SEND_META, SEND_META_REF or SEND_DATA
+ * @param metaType - indicate the frame goes to metaDedupCore
+ * @param end - indicate ending(only used for metaDedupCore)
+ * @param batchID - the ID of the upload batch
+ * @param fileID - the file slot the batch belongs to
+ * @param rawSize - size of the payload following the head
+ *
+ * @return - the size of the head in bytes
+ */
+int Socket::buildUploadHead(int *head, int indicator, bool metaType, bool end, int batchID, int fileID,
+                            int rawSize)
+{
+    int count = 0;
+
+    head[count++] = indicator;
+    if(metaType && indicator != SEND_META) {
+        /* metaDedupCore receives different size, and a reference batch may complete without a data package */
+        head[count++] = end ? METACORE_END : METACORE_NOT_END;
+    }
+    head[count++] = batchID;
+    if(indicator != SEND_DATA) {
+        /* the data of a batch follows its metadata, so only the metadata names the file */
+        head[count++] = fileID;
+    }
+    head[count++] = rawSize;
+
+    return count * sizeof(int);
+}
+
 /*
  * metadata send function
  *
  * @param raw - raw data buffer_
  * @param rawSize - size of raw data
+ * @param batchID - the ID of the upload batch
  *
  */
-int Socket::sendMeta(char *raw, int rawSize)
+int Socket::sendMeta(char *raw, int rawSize, int batchID)
 {
-    int indicator = SEND_META;
+    int head[UPLOAD_HEAD_MAX_INTS];
+    struct iovec vec[2];
 
-    int bytecount;
-    if((bytecount = send(hostSock_, &indicator, sizeof(int), 0)) == -1) {
-        fprintf(stderr, "Error sending data %d\n", errno);
-        return -1;
-    }
+    fillIOV(vec[0], head, buildUploadHead(head, SEND_META, false, false, batchID, 0, rawSize));
+    fillIOV(vec[1], raw, rawSize);
 
-    if((bytecount = send(hostSock_, &rawSize, sizeof(int), 0)) == -1) {
-        fprintf(stderr, "Error sending data %d\n", errno);
+    if(genericSendv(vec, 2) == -1) {
         return -1;
     }
-
-    genericSend(raw, rawSize);
     return 0;
 }
 
 /*
- * data send function
+ * reference metadata send function: the shares are believed stored, so no data follows
+ * unless the returned status list says otherwise
  *
  * @param raw - raw data buffer_
  * @param rawSize - size of raw data
+ * @param metaType - indicate the batch goes to metaDedupCore
+ * @param end - indicate ending(only used for metaDedupCore)
+ * @param batchID - the ID of the upload batch
  *
  */
-int Socket::sendData(char *raw, int rawSize, bool metaType, bool end)
+int Socket::sendMetaRef(char *raw, int rawSize, bool metaType, bool end, int batchID)
 {
+    int head[UPLOAD_HEAD_MAX_INTS];
+    struct iovec vec[2];
 
-    int meta_indicator = METACORE_NOT_END;
-    if(end) {
-        meta_indicator = METACORE_END;
-    }
+    fillIOV(vec[0], head, buildUploadHead(head, SEND_META_REF, metaType, end, batchID, 0, rawSize));
+    fillIOV(vec[1], raw, rawSize);
 
-    int indicator = SEND_DATA;
-    int bytecount;
-
-    if((bytecount = send(hostSock_, &indicator, sizeof(int), 0)) == -1) {
-        fprintf(stderr, "Error sending data %d\n", errno);
+    if(genericSendv(vec, 2) == -1) {
         return -1;
     }
+    return 0;
+}
 
-    if(metaType) {
-        // send end indicator to metaCore since metaDedupCore receive different size
-        if((bytecount = send(hostSock_, &meta_indicator, sizeof(int), 0)) == -1) {
-            fprintf(stderr, "Error sending meta_indicator %d\n", errno);
-            return -1;
-        }
-    }
+/*
+ * data send function: the shares are gathered from where they are buffered, without staging copies
+ *
+ * @param data - the buffers holding the data
+ * @param dataCount - number of buffers
+ * @param rawSize - total size of the data
+ * @param metaType - indicate the batch goes to metaDedupCore
+ * @param end - indicate ending(only used for metaDedupCore)
+ * @param batchID - the ID of the upload batch that the data belongs to
+ *
+ */
+int Socket::sendData(struct iovec *data, int dataCount, int rawSize, bool metaType, bool end, int batchID)
+{
+    int head[UPLOAD_HEAD_MAX_INTS];
+    struct iovec *vec = (struct iovec *) malloc(sizeof(struct iovec) * (dataCount + 1));
 
-    if((bytecount = send(hostSock_, &rawSize, sizeof(int), 0)) == -1) {
-        fprintf(stderr, "Error sending data %d\n", errno);
+    fillIOV(vec[0], head, buildUploadHead(head, SEND_DATA, metaType, end, batchID, 0, rawSize));
+    memcpy(vec + 1, data, sizeof(struct iovec) * dataCount);
+
+    int ret = genericSendv(vec, dataCount + 1);
+    free(vec);
+    if(ret == -1) {
         return -1;
     }
-
-    genericSend(raw, rawSize);
     return 0;
 }
 
@@ -203,10 +291,62 @@ int Socket::genericDownload(char *raw, int rawSize)
     int total = 0;
     while(total < rawSize) {
         if((bytecount = recv(hostSock_, raw + total, rawSize - total, 0)) == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Error receiving data %d\n", errno);
+            return -1;
+        }
+        if(bytecount == 0) {
+            fprintf(stderr, "Error receiving data: connection closed\n");
+            return -1;
+        }
+        total += bytecount;
+    }
+    return total;
+}
+
+/*
+ * scatter-gather data download function
+ *
+ * @param iov - the buffers to be filled <return> (consumed while receiving)
+ * @param iovcnt - number of buffers
+ *
+ * @return - the number of bytes received, or -1 if an error occurs
+ */
+int Socket::genericDownloadv(struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg;
+    ssize_t bytecount;
+    int total = 0;
+
+    while(iovcnt > 0) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (iovcnt > IOV_MAX) ? IOV_MAX : iovcnt;
+        if((bytecount = recvmsg(hostSock_, &msg, MSG_WAITALL)) == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
             fprintf(stderr, "Error receiving data %d\n", errno);
             return -1;
         }
+        if(bytecount == 0) {
+            fprintf(stderr, "Error receiving data: connection closed\n");
+            return -1;
+        }
         total += bytecount;
+
+        /* skip the buffers filled completely and advance into a partially filled one */
+        while(iovcnt > 0 && bytecount >= (ssize_t) iov->iov_len) {
+            bytecount -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(bytecount > 0) {
+            iov->iov_base = (char *) iov->iov_base + bytecount;
+            iov->iov_len -= bytecount;
+        }
     }
     return total;
 }
@@ -216,163 +356,98 @@ int Socket::genericDownload(char *raw, int rawSize)
  *
  * @param statusList - return int list
  * @param num - num of returned indicator
+ * @param batchID - the ID of the upload batch that the status list belongs to <return>
  *
  * @return statusList
  */
-int Socket::getStatus(bool *statusList, int *num)
+int Socket::getStatus(bool *statusList, int *num, int *batchID)
 {
-
-    int bytecount;
     int indicator = 0;
-
-    if((bytecount = recv(hostSock_, &indicator, sizeof(int), 0)) == -1) {
-        fprintf(stderr, "Error sending data %d\n", errno);
+    struct iovec vec[3];
+
+    /* indicator, batch ID and number of shares arrive together */
+    fillIOV(vec[0], &indicator, sizeof(int));
+    fillIOV(vec[1], batchID, sizeof(int));
+    fillIOV(vec[2], num, sizeof(int));
+    if(genericDownloadv(vec, 3) == -1) {
+        fprintf(stderr, "Error receiving status head %d\n", errno);
         return -1;
     }
     if(indicator != GET_STAT) {
         fprintf(stderr, "Status wrong %d\n", errno);
         return -1;
     }
-    if((bytecount = recv(hostSock_, num, sizeof(int), 0)) == -1) {
-        fprintf(stderr, "Error sending data %d\n", errno);
-        return -1;
-    }
 
     genericDownload((char *) statusList, sizeof(bool) * (*num));
     return 0;
 }
 
 /*
- * initiate downloading a file
+ * build the request initiating downloading a file
  *
+ * @param vec - buffer of DOWNLOAD_REQUEST_MAX_IOV entries for the request <return>
+ * @param head - buffer of DOWNLOAD_HEAD_MAX_INTS ints for the head <return>
  * @param filename - the full name of the targeting file
  * @param namesize - the size of the file path
+ * @param token - the token of the restore, returned by the meta server with the file recipe
+ * @param selection - the sorted ranges [first, last] of the secret IDs whose shares are requested
+ * @param numOfRanges - the number of ranges (< 0 for the shares of all the secrets)
  *
+ * @return - the number of entries of the request
  */
-int Socket::initDownload(char *filename, int namesize)
+int Socket::buildDownloadRequest(struct iovec *vec, int *head, char *filename, int namesize, const long *token,
+                                 const int *selection, int numOfRanges)
 {
     /* INIT_DOWNLOAD<client> = DOWNLOAD<server> */
-    int indicator = INIT_DOWNLOAD;
+    head[0] = INIT_DOWNLOAD;
+    head[1] = namesize;
+    head[2] = numOfRanges;
 
-    int bytecount;
-    if((bytecount = send(hostSock_, &indicator, sizeof(int), 0)) == -1) {
-        fprintf(stderr, "Error sending indicator! Error code: %d\n", errno);
-        return -1;
-    }
+    fillIOV(vec[0], head, 2 * sizeof(int));
+    fillIOV(vec[1], filename, namesize);
+    fillIOV(vec[2], token, sizeof(long));
+    fillIOV(vec[3], &head[2], sizeof(int));
+    fillIOV(vec[4], selection, (numOfRanges > 0) ? 2 * numOfRanges * sizeof(int) : 0);
 
-    if((bytecount = send(hostSock_, &namesize, sizeof(int), 0)) == -1) {
-        fprintf(stderr, "Error sending nameSize! Error code: %d\n", errno);
-        return -1;
-    }
-
-    if((bytecount = send(hostSock_, filename, namesize, 0)) == -1) {
-        fprintf(stderr, "Error sending file name! Error code: %d\n", errno);
-        return -1;
-    }
-
-
-    return 0;
+    return 5;
 }
 
 /*
- * initiate downloading a file and send original filename and filename length
- *  for server-side generated file recipe use
+ * build the request initiating downloading a file with its plain file name, for the server-side
+ * generated file recipe
  *
+ * @param vec - buffer of DOWNLOAD_REQUEST_MAX_IOV entries for the request <return>
+ * @param head - buffer of DOWNLOAD_HEAD_MAX_INTS ints for the head <return>
+ * @param range - buffer of 2 longs for the byte range <return>
  * @param filename - the full name of the targeting file
  * @param namesize - the size of the file path
- * @param plainFileName - the plain text of file name
- * @param plainFileNameLength - the length of plain text of file name
+ * @param plainFilename - the plain text of file name
+ * @param plainFilenameLength - the length of plain text of file name
  * @param special_indicator - indicator for special server which has the 4-th shares and it is enough(no need to
  *                            send back to client)
+ * @param rangeOffset - the offset of the byte range to be restored
+ * @param rangeLength - the length of the byte range to be restored (< 0 for up to the end of the file)
  *
- *
+ * @return - the number of entries of the request
  */
-int Socket::initDownloadWithFileMeta(char *filename, int namesize, const char *plainFilename, int plainFilenameLength,
-                                     bool special_indicator)
+int Socket::buildMetaRequest(struct iovec *vec, int *head, long *range, char *filename, int namesize,
+                             const char *plainFilename, int plainFilenameLength, bool special_indicator,
+                             long rangeOffset, long rangeLength)
 {
-    int indicator = INIT_META_REQUEST;
-
-    int bytecount;
-    if((bytecount = send(hostSock_, &indicator, sizeof(int), 0)) == -1) {
-        fprintf(stderr, "Error sending data %d\n", errno);
-        return -1;
-    }
-
-    if(special_indicator) {
-        int last_share_server_indicator = LAST_SHARE_SERVER;
-        if((bytecount = send(hostSock_, &last_share_server_indicator, sizeof(int), 0)) == -1) {
-            fprintf(stderr, "Error sending special indicator! Error code: %d\n", errno);
-            return -1;
-        }
-    } else {
-        int not_special_indicator = NOT_LAST_SHARE_SERVER;
-        if((bytecount = send(hostSock_, &not_special_indicator, sizeof(int), 0)) == -1) {
-            fprintf(stderr, "Error sending special indicator! Error code: %d\n", errno);
-            return -1;
-        }
-    }
-
-    if((bytecount = send(hostSock_, &namesize, sizeof(int), 0)) == -1) {
-        fprintf(stderr, "Error sending data %d\n", errno);
-        return -1;
-    }
-
-    if((bytecount = send(hostSock_, filename, namesize, 0)) == -1) {
-        fprintf(stderr, "Error sending data %d\n", errno);
-        return -1;
-    }
-
-    /* send length of plain file name to be downloaded */
-    genericSend((char *) &plainFilenameLength, sizeof(int));
-
-    /* send plain file name to be downloaded */
-    genericSend(const_cast<char *>(plainFilename), plainFilenameLength);
-
-    return 0;
-}
-
-
-/*
- * download a chunk of data
- *
- * @param raw - the returned raw data chunk <return>
- * @param retSize - the size of returned data chunk <return>
- * @param end - indicate the end of loop
- */
-int Socket::downloadChunk(char *raw, int *retSize, int &end)
-{
-    int indicator;
-
-    /* receive indicator: -5(dafult value) */
-    int bytecount;
-    if((bytecount = recv(hostSock_, &indicator, sizeof(int), 0)) == -1) {
-        fprintf(stderr, "Error receiving indicator! Error code: %d\n", errno);
-        return -1;
-    }
-
-    /* `NO_DATA_CHUNKS_FOUND` means empty data chunks and exit */
-    if(ntohl(indicator) == NO_DATA_CHUNKS_FOUND) {
-        *retSize = 0;
-        printf("[Socket] [downloadChunk] Indicator = -6! Empty data chunks. Exiting...\n");
-        return -2;
-    }
-
-    /* `END_OF_DATA_CHUNKS` means less chunks received than expected but this is normal and retSize is not 0*/
-    if(ntohl(indicator) == END_OF_DATA_CHUNKS) {
-        end = 1;
-    }
-
-    /* indicator = `-7` also use codes below */
-    /* receive data size */
-    int size;
-    if((bytecount = recv(hostSock_, &size, sizeof(int), 0)) == -1) {
-        fprintf(stderr, "Error receiving size! Error code: %d\n", errno);
-        return -1;
-    }
-    *retSize = ntohl(size);
-
-    /* download data according to data size */
-    genericDownload(raw, *retSize);
-
-    return 0;
+    head[0] = INIT_META_REQUEST;
+    head[1] = special_indicator ? LAST_SHARE_SERVER : NOT_LAST_SHARE_SERVER;
+    head[2] = namesize;
+    head[3] = plainFilenameLength;
+    range[0] = rangeOffset;
+    range[1] = rangeLength;
+
+    fillIOV(vec[0], head, 3 * sizeof(int));
+    fillIOV(vec[1], filename, namesize);
+    /* length and plain text of the file name to be downloaded */
+    fillIOV(vec[2], &head[3], sizeof(int));
+    fillIOV(vec[3], plainFilename, plainFilenameLength);
+    /* the byte range of the file to be restored */
+    fillIOV(vec[4], range, 2 * sizeof(long));
+
+    return 5;
 }
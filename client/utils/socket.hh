@@ -15,14 +15,38 @@
 #include <stdlib.h>
 #include <string>
 #include <cstring>
+#include <climits>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/*
+ * fill an iovec entry
+ *
+ * @param vec - the iovec entry <return>
+ * @param base - start of the buffer
+ * @param len - size of the buffer
+ */
+static inline void fillIOV(struct iovec &vec, const void *base, size_t len)
+{
+    vec.iov_base = const_cast<void *>(base);
+    vec.iov_len = len;
+}
+
 /* action indicators */
 #define SEND_META (-1)
 #define SEND_DATA (-2)
+/* metadata of a batch whose shares are all believed stored (sent without data unless the server rejects) */
+#define SEND_META_REF (-4)
 #define SEND_FILE_META (-8)
 #define GET_STAT (-3)
+/* acknowledgement that the server recorded an upload batch */
+#define GET_ACK (-10)
 #define INIT_DOWNLOAD (-7)
 #define INIT_META_REQUEST (-9)
 #define NO_DATA_CHUNKS_FOUND (-6)
@@ -32,6 +56,13 @@
 /* the indicator of sending meta_list back to client */
 #define METACORE_NOT_END (-707)
 #define METACORE_END (707)
+/* upper bound of the upload credits accepted from a server */
+#define MAX_UPLOAD_CREDIT (16)
+/* max number of ints in the head of an upload frame */
+#define UPLOAD_HEAD_MAX_INTS 5
+/* max number of ints in the head and of buffers in a download request */
+#define DOWNLOAD_HEAD_MAX_INTS 4
+#define DOWNLOAD_REQUEST_MAX_IOV 5
 
 class Socket {
 private:
@@ -48,6 +79,9 @@ public:
     /* host socket */
     int hostSock_;
 
+    /* number of upload batches the server accepts to be outstanding (granted on connection) */
+    int credit_;
+
     /*
      * constructor: initialize sock structure and connect
      *
@@ -69,6 +103,34 @@ public:
      */
     int genericSend(char *raw, int rawSize);
 
+    /*
+     * scatter-gather send function: send all buffers with as few syscalls as possible
+     *
+     * @param iov - the buffers to be sent (consumed while sending)
+     * @param iovcnt - number of buffers
+     *
+     * @return - the number of bytes sent, or -1 if an error occurs
+     */
+    int genericSendv(struct iovec *iov, int iovcnt);
+
+    /*
+     * build the head of an upload frame: indicator, end indicator (only for metaDedupCore, on
+     * SEND_META_REF and SEND_DATA), batch ID, file slot (only on SEND_META and SEND_META_REF) and
+     * payload size
+     *
+     * @param head - buffer of UPLOAD_HEAD_MAX_INTS ints for the head <return>
+     * @param indicator - SEND_META, SEND_META_REF or SEND_DATA
+     * @param metaType - indicate the frame goes to metaDedupCore
+     * @param end - indicate ending(only used for metaDedupCore)
+     * @param batchID - the ID of the upload batch
+     * @param fileID - the file slot the batch belongs to
+     * @param rawSize - size of the payload following the head
+     *
+     * @return - the size of the head in bytes
+     */
+    static int buildUploadHead(int *head, int indicator, bool metaType, bool end, int batchID, int fileID,
+                               int rawSize);
+
     /*
      * file meta-data send function
      *
@@ -83,58 +145,84 @@ public:
      *
      * @param raw - raw data buffer_
      * @param rawSize - size of raw data
+     * @param batchID - the ID of the upload batch
      *
      */
-    int sendMeta(char *raw, int rawSize);
+    int sendMeta(char *raw, int rawSize, int batchID);
 
     /*
-     * data send function
+     * reference metadata send function: the shares are believed stored, so no data follows
+     * unless the returned status list says otherwise
      *
      * @param raw - raw data buffer_
      * @param rawSize - size of raw data
+     * @param metaType - indicate the batch goes to metaDedupCore
+     * @param end - indicate ending(only used for metaDedupCore)
+     * @param batchID - the ID of the upload batch
      *
      */
-    int sendData(char *raw, int rawSize, bool metaType, bool end);
+    int sendMetaRef(char *raw, int rawSize, bool metaType, bool end, int batchID);
 
     /*
-     * status recv function
+     * data send function: the shares are gathered from where they are buffered, without staging copies
      *
-     * @param statusList - return int list
-     * @param num - num of returned indicator
+     * @param data - the buffers holding the data
+     * @param dataCount - number of buffers
+     * @param rawSize - total size of the data
+     * @param metaType - indicate the batch goes to metaDedupCore
+     * @param end - indicate ending(only used for metaDedupCore)
+     * @param batchID - the ID of the upload batch that the data belongs to
      *
-     * @return statusList
      */
-    int getStatus(bool *statusList, int *num);
+    int sendData(struct iovec *data, int dataCount, int rawSize, bool metaType, bool end, int batchID);
 
     /*
-     * initiate downloading a file
-     *
-     * @param filename - the full name of the targeting file
-     * @param nameSize - the size of the file path
+     * status recv function
      *
+     * @param statusList - return int list
+     * @param num - num of returned indicator
+     * @param batchID - the ID of the upload batch that the status list belongs to <return>
      *
+     * @return statusList
      */
-    int initDownload(char *filename, int namesize);
+    int getStatus(bool *statusList, int *num, int *batchID);
 
     /*
-     * initiate downloading a file and send file name with length
+     * build the request initiating downloading a file
      *
+     * @param vec - buffer of DOWNLOAD_REQUEST_MAX_IOV entries for the request <return>
+     * @param head - buffer of DOWNLOAD_HEAD_MAX_INTS ints for the head <return>
      * @param filename - the full name of the targeting file
-     * @param nameSize - the size of the file path
-     *
+     * @param namesize - the size of the file path
+     * @param token - the token of the restore, returned by the meta server with the file recipe
+     * @param selection - the sorted ranges [first, last] of the secret IDs whose shares are requested
+     * @param numOfRanges - the number of ranges (< 0 for the shares of all the secrets)
      *
+     * @return - the number of entries of the request
      */
-    int initDownloadWithFileMeta(char *filename, int namesize, const char *plainFilename, int plainFilenameLength,
-                                 bool special_indicator);
+    static int buildDownloadRequest(struct iovec *vec, int *head, char *filename, int namesize, const long *token,
+                                    const int *selection, int numOfRanges);
 
     /*
-     * download a chunk of data
+     * build the request initiating downloading a file with its plain file name, for the server-side
+     * generated file recipe
      *
-     * @param raw - the returned raw data chunk <return>
-     * @param retSize - the size of returned data chunk <return>
-     * @param end - indicate the end of loop
+     * @param vec - buffer of DOWNLOAD_REQUEST_MAX_IOV entries for the request <return>
+     * @param head - buffer of DOWNLOAD_HEAD_MAX_INTS ints for the head <return>
+     * @param range - buffer of 2 longs for the byte range <return>
+     * @param filename - the full name of the targeting file
+     * @param namesize - the size of the file path
+     * @param plainFilename - the plain text of file name
+     * @param plainFilenameLength - the length of plain text of file name
+     * @param special_indicator - indicator for special server which has the 4-th shares and it is enough
+     * @param rangeOffset - the offset of the byte range to be restored
+     * @param rangeLength - the length of the byte range to be restored (< 0 for up to the end of the file)
+     *
+     * @return - the number of entries of the request
      */
-    int downloadChunk(char *raw, int *retSize, int &end);
+    static int buildMetaRequest(struct iovec *vec, int *head, long *range, char *filename, int namesize,
+                                const char *plainFilename, int plainFilenameLength, bool special_indicator,
+                                long rangeOffset, long rangeLength);
 
     /*
      * data download function
@@ -143,6 +231,16 @@ public:
      * @param rawSize - the size of data to be downloaded
      */
     int genericDownload(char *raw, int rawSize);
+
+    /*
+     * scatter-gather data download function
+     *
+     * @param iov - the buffers to be filled <return> (consumed while receiving)
+     * @param iovcnt - number of buffers
+     *
+     * @return - the number of bytes received, or -1 if an error occurs
+     */
+    int genericDownloadv(struct iovec *iov, int iovcnt);
 };
 
 #endif
@@ -0,0 +1,73 @@
+/*
+ * DeltaVarint.hh
+ *
+ * The compact coding of the fields of a share, shared by the client (metadata chunks, reference batches) and the
+ * server (reading them back): each field is the zigzag varint of its delta against the previous share
+ */
+
+#ifndef __DELTAVARINT_HH__
+#define __DELTAVARINT_HH__
+
+#include <stdint.h>
+
+/* fields of a share coded as deltas, in this order: secretID, secretSize, shareSize, segID, shareID */
+#define DELTA_FIELDS 5
+
+/*
+ * write the fields of a share as the zigzag varints of their deltas against the previous share
+ *
+ * @param buffer - the buffer to write into (up to 5 bytes per field)
+ * @param offset - the write offset
+ * @param fields - the DELTA_FIELDS fields of the share
+ * @param previous - the fields of the previous share (all zero for the first one), overwritten by these ones <return>
+ *
+ * @return - the write offset after the fields
+ */
+inline int putDeltaFields(unsigned char *buffer, int offset, const int *fields, int *previous)
+{
+    for(int i = 0; i < DELTA_FIELDS; i++) {
+        int delta = fields[i] - previous[i];
+        uint32_t value = ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31);
+
+        while(value >= 0x80) {
+            buffer[offset++] = (unsigned char) (value | 0x80);
+            value >>= 7;
+        }
+        buffer[offset++] = (unsigned char) value;
+        previous[i] = fields[i];
+    }
+
+    return offset;
+}
+
+/*
+ * read the fields of a share written by putDeltaFields
+ *
+ * @param buffer - the buffer to read from
+ * @param size - the size of the buffer
+ * @param offset - the read offset
+ * @param fields - the fields of the previous share (all zero for the first one), overwritten by the read ones <return>
+ *
+ * @return - the read offset after the fields, -1 if a varint is cut off by the end of the buffer or too long
+ */
+inline int getDeltaFields(const unsigned char *buffer, int size, int offset, int *fields)
+{
+    for(int i = 0; i < DELTA_FIELDS; i++) {
+        uint32_t value = 0;
+        int shift = 0;
+
+        do {
+            if((offset >= size) || (shift > 28)) {
+                return -1;
+            }
+            value |= (uint32_t) (buffer[offset] & 0x7f) << shift;
+            shift += 7;
+        } while(buffer[offset++] & 0x80);
+
+        fields[i] += (int) ((value >> 1) ^ (~(value & 1) + 1));
+    }
+
+    return offset;
+}
+
+#endif
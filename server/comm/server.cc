@@ -3,10 +3,14 @@
  */
 
 #include "server.hh"
+#include "DeltaVarint.hh"
 
+#include <signal.h>
 #include <string.h>
 #include <string>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <linux/tcp.h>
 
 #include <openssl/pem.h>
 #include <openssl/bn.h>
@@ -16,10 +20,13 @@
 #include <openssl/err.h>
 #include <sysexits.h>
 #include <memory>
+#include <vector>
 
 DedupCore *metaDedupObj_;
 minDedupCore *dataDedupObj_;
-pthread_mutex_t mutex;
+
+pthread_mutex_t Server::uploadLock_ = PTHREAD_MUTEX_INITIALIZER;
+size_t Server::uploadReserved_ = 0;
 
 using namespace std;
 
@@ -75,6 +82,7 @@ Server::Server(int metaPort, int dataPort, int kmPort,
     *p_int = 1;
 
     if((setsockopt(dataHostSock_, SOL_SOCKET, SO_REUSEADDR, (char *) p_int, sizeof(int)) == -1) ||
+       (setsockopt(dataHostSock_, SOL_SOCKET, SO_REUSEPORT, (char *) p_int, sizeof(int)) == -1) ||
        (setsockopt(dataHostSock_, SOL_SOCKET, SO_KEEPALIVE, (char *) p_int, sizeof(int)) == -1)) {
 
         printf("Error setting options %d\n", errno);
@@ -85,6 +93,7 @@ Server::Server(int metaPort, int dataPort, int kmPort,
     *p_int = 1;
 
     if((setsockopt(metaHostSock_, SOL_SOCKET, SO_REUSEADDR, (char *) p_int, sizeof(int)) == -1) ||
+       (setsockopt(metaHostSock_, SOL_SOCKET, SO_REUSEPORT, (char *) p_int, sizeof(int)) == -1) ||
        (setsockopt(metaHostSock_, SOL_SOCKET, SO_KEEPALIVE, (char *) p_int, sizeof(int)) == -1)) {
 
         printf("Error setting options %d\n", errno);
@@ -95,6 +104,7 @@ Server::Server(int metaPort, int dataPort, int kmPort,
     *p_int = 1;
 
     if((setsockopt(kmHostSock_, SOL_SOCKET, SO_REUSEADDR, (char *) p_int, sizeof(int)) == -1) ||
+       (setsockopt(kmHostSock_, SOL_SOCKET, SO_REUSEPORT, (char *) p_int, sizeof(int)) == -1) ||
        (setsockopt(kmHostSock_, SOL_SOCKET, SO_KEEPALIVE, (char *) p_int, sizeof(int)) == -1)) {
 
         printf("Error setting options %d\n", errno);
@@ -119,10 +129,15 @@ Server::Server(int metaPort, int dataPort, int kmPort,
     }
 
     //start to listen
-    if(listen(dataHostSock_, 10) == -1) {
+    if(listen(dataHostSock_, SOMAXCONN) == -1) {
         fprintf(stderr, "Error listening %d\n", errno);
     }
 
+    //accept without blocking, the acceptor drains whichever listener epoll reports
+    if(fcntl(dataHostSock_, F_SETFL, fcntl(dataHostSock_, F_GETFL, 0) | O_NONBLOCK) == -1) {
+        fprintf(stderr, "Error setting non-blocking listener %d\n", errno);
+    }
+
     /* Meta socket */
     metaAddr_.sin_family = AF_INET;
     metaAddr_.sin_port = htons(metaHostPort_);
@@ -136,10 +151,15 @@ Server::Server(int metaPort, int dataPort, int kmPort,
     }
 
     //start to listen
-    if(listen(metaHostSock_, 10) == -1) {
+    if(listen(metaHostSock_, SOMAXCONN) == -1) {
         fprintf(stderr, "Error listening %d\n", errno);
     }
 
+    //accept without blocking, the acceptor drains whichever listener epoll reports
+    if(fcntl(metaHostSock_, F_SETFL, fcntl(metaHostSock_, F_GETFL, 0) | O_NONBLOCK) == -1) {
+        fprintf(stderr, "Error setting non-blocking listener %d\n", errno);
+    }
+
     /* Key manager socket */
     kmAddr_.sin_family = AF_INET;
     kmAddr_.sin_port = htons(kmHostPort_);
@@ -153,9 +173,14 @@ Server::Server(int metaPort, int dataPort, int kmPort,
     }
 
     //start to listen
-    if(listen(kmHostSock_, 10) == -1) {
+    if(listen(kmHostSock_, SOMAXCONN) == -1) {
         fprintf(stderr, "Error listening %d\n", errno);
     }
+
+    //accept without blocking, the acceptor drains whichever listener epoll reports
+    if(fcntl(kmHostSock_, F_SETFL, fcntl(kmHostSock_, F_GETFL, 0) | O_NONBLOCK) == -1) {
+        fprintf(stderr, "Error setting non-blocking listener %d\n", errno);
+    }
 }
 
 void Server::timerStart(double *t)
@@ -175,596 +200,1648 @@ double Server::timerSplit(const double *t)
 }
 
 /*
- * Meta Thread function: each thread maintains a socket from a certain client
- *
- * @param lp - input parameter structure
+ * initialize the batch slots of an upload window, their buffers are leased per batch
  *
+ * @param window - the array of UPLOAD_CREDIT batch slots
  */
-void *Server::SocketHandlerMeta(void *lp)
+void Server::initUploadWindow(uploadBatch_t *window)
 {
-    //double timer,split,bw;
-
-    //get socket from input param
-    int *clientSock = (int *) lp;
-
-    //variable initialization
-    int bytecount;
-    char *buffer = (char *) malloc(sizeof(char) * BUFFER_LEN);
-    char *metaBuffer = (char *) malloc(sizeof(char) * META_LEN);
-    bool *statusList = (bool *) malloc(sizeof(bool) * BUFFER_LEN);
-    memset(statusList, 0, sizeof(bool) * BUFFER_LEN);
-    int metaSize;
-    int user = 0;
-    int dataSize = 0;
-    //get user ID
-    if((bytecount = recv(*clientSock, buffer, sizeof(int), 0)) == -1) {
-        fprintf(stderr, "Error recv userID %d\n", errno);
+    for(int i = 0; i < UPLOAD_CREDIT; i++) {
+        window[i].batchID = -1;
+        window[i].fileID = 0;
+        window[i].inUse = false;
+        window[i].metaBuffer = NULL;
+        window[i].metaSize = 0;
+        window[i].statusList = NULL;
+        window[i].metaLease = 0;
+        window[i].statusLease = 0;
     }
-    user = ntohl(*(int *) buffer);
-    printf("[Meta] connection from user %d\n", user);
-
-    memset(buffer, 0, BUFFER_LEN);
-    int numOfShare = 0;
-    int total_numOfShares = 0;
-
-    //initialize hash object
-    CryptoPrimitive *hashObj = new CryptoPrimitive(SHA256_TYPE);
-
-    //main loop for recv data package
-    while(true) {
-
-        /*recv indicator first*/
-        if((bytecount = recv(*clientSock, buffer, sizeof(int), 0)) == -1) {
-            fprintf(stderr, "Error receiving data %d\n", errno);
-        }
-
-        /*if client closes, break loop*/
-        if(bytecount == 0) {
-            printf("[!>] [Meta] Thread: client closed!! Breaking loops...\n");
-            break;
-        }
+}
 
-        int indicator = *(int *) buffer;
+/*
+ * release the batch slots of an upload window, with the buffers of the batches still outstanding
+ *
+ * @param window - the array of UPLOAD_CREDIT batch slots
+ */
+void Server::freeUploadWindow(uploadBatch_t *window)
+{
+    for(int i = 0; i < UPLOAD_CREDIT; i++) {
+        retireUploadBatch(&window[i]);
+    }
+}
 
-        /*while metadata recv.ed, perform first stage deduplication*/
-        if(indicator == META) {
+/*
+ * free the slot of an upload batch once it is recorded, and give its buffers back to the arena
+ *
+ * @param batch - the batch slot
+ */
+void Server::retireUploadBatch(uploadBatch_t *batch)
+{
+    BufferArena::release(batch->metaBuffer, batch->metaLease);
+    BufferArena::release(batch->statusList, batch->statusLease);
+    batch->metaBuffer = NULL;
+    batch->statusList = NULL;
+    batch->metaLease = 0;
+    batch->statusLease = 0;
+    batch->inUse = false;
+}
 
-            /*recv following package size*/
-            if((bytecount = recv(*clientSock, buffer, sizeof(int), 0)) == -1) {
-                fprintf(stderr, "Error receiving data %d\n", errno);
-            }
+/*
+ * take a free slot for a new upload batch (META) and lease its buffers at the size of the batch; the lease does not
+ * wait since the memory of the granted credits is reserved already
+ *
+ * @param conn - the client connection
+ * @param batchID - the ID of the upload batch
+ * @param metaSize - the size of the share metadata of the batch
+ * @param numOfShares - the number of shares in the batch
+ *
+ * @return - the batch slot, or NULL if the client exceeds its credits or no buffer is left
+ */
+Server::uploadBatch_t *Server::newUploadBatch(connection_t *conn, int batchID, int metaSize, int numOfShares)
+{
+    if(batchID < 0) {
+        return NULL;
+    }
 
-            int packageSize = *(int *) buffer;
-            int count = 0;
+    /*the slots beyond the granted credits are never used*/
+    int outstanding = 0;
+    for(int i = 0; i < UPLOAD_CREDIT; i++) {
+        outstanding += conn->window[i].inUse;
+    }
+    uploadBatch_t *batch = &conn->window[batchID % UPLOAD_CREDIT];
+    if(batch->inUse || outstanding >= conn->credit) {
+        return NULL;
+    }
 
-            /*recv following data*/
-            while(count < packageSize) {
-                if((bytecount = recv(*clientSock, buffer + count, packageSize - count, 0)) == -1) {
-                    fprintf(stderr, "Error receiving data %d\n", errno);
-                }
-                count += bytecount;
-            }
+    batch->metaLease = sizeof(char) * metaSize;
+    batch->statusLease = sizeof(bool) * numOfShares;
+    batch->metaBuffer = (char *) BufferArena::tryLease(batch->metaLease);
+    batch->statusList = (bool *) BufferArena::tryLease(batch->statusLease);
+    if(batch->metaBuffer == NULL || batch->statusList == NULL) {
+        fprintf(stderr, "Error: no buffer left for batch %d!\n", batchID);
+        retireUploadBatch(batch);
+        return NULL;
+    }
+    batch->batchID = batchID;
+    batch->fileID = 0;
+    batch->inUse = true;
+    batch->refAccepted = false;
+    batch->end = false;
+    return batch;
+}
 
-            memcpy(metaBuffer, buffer, count);
-            metaSize = count;
+/*
+ * find the slot of an outstanding upload batch (DATA)
+ *
+ * @param window - the array of UPLOAD_CREDIT batch slots
+ * @param batchID - the ID of the upload batch
+ *
+ * @return - the batch slot, or NULL if the client sends an unknown batch
+ */
+Server::uploadBatch_t *Server::findUploadBatch(uploadBatch_t *window, int batchID)
+{
+    if(batchID < 0) {
+        return NULL;
+    }
 
-            metaDedupObj_->firstStageDedup(user, (unsigned char *) metaBuffer, count, statusList, numOfShare, dataSize);
-            total_numOfShares += numOfShare;
+    uploadBatch_t *batch = &window[batchID % UPLOAD_CREDIT];
+    if(!batch->inUse || batch->batchID != batchID) {
+        return NULL;
+    }
+    return batch;
+}
 
-            int ind = STAT;
-            memcpy(buffer, &ind, sizeof(int));
+/*
+ * find an accepted reference batch that waits for the batches before it to be recorded
+ *
+ * @param window - the array of UPLOAD_CREDIT batch slots
+ * @param batchID - the ID of the upload batch to be recorded next
+ *
+ * @return - the batch slot, or NULL if the batch is not an accepted reference batch held back
+ */
+Server::uploadBatch_t *Server::findDeferredBatch(uploadBatch_t *window, int batchID)
+{
+    uploadBatch_t *batch = findUploadBatch(window, batchID);
+    if(batch == NULL || !batch->refAccepted) {
+        return NULL;
+    }
+    return batch;
+}
 
-            /*return the status list*/
-            int bytecount;
-            if((bytecount = send(*clientSock, buffer, sizeof(int), 0)) == -1) {
-                fprintf(stderr, "Error sending data %d\n", errno);
+/*
+ * expand the reference list of a batch back into share metadata
+ *
+ * @param refList - the reference list: [fileShareMDHead_t + full file name + [shareFP + 5 delta varints] ...] ...
+ * @param refSize - the size of the reference list
+ * @param metaBuffer - a buffer for storing the share metadata, NULL to get its size only <return>
+ * @param numOfShares - the number of shares in the list <return>
+ *
+ * @return - the size of the share metadata, -1 if the reference list is malformed
+ */
+int Server::expandReferences(const char *refList, int refSize, char *metaBuffer, int *numOfShares)
+{
+    fileShareMDHead_t head;
+    shareMDEntry_t entry;
+    int fields[DELTA_FIELDS];
+    int refOffset = 0, metaSize = 0;
+
+    *numOfShares = 0;
+    while(refOffset < refSize) {
+        /*the file head and name are kept as they are*/
+        if(refOffset + (int) sizeof(fileShareMDHead_t) > refSize) {
+            return -1;
+        }
+        memcpy(&head, refList + refOffset, sizeof(fileShareMDHead_t));
+        if(head.fullNameSize < 0 || head.numOfComingSecrets < 0 ||
+           refOffset + (int) sizeof(fileShareMDHead_t) + head.fullNameSize > refSize) {
+            return -1;
+        }
+        if(metaBuffer != NULL) {
+            memcpy(metaBuffer + metaSize, refList + refOffset, sizeof(fileShareMDHead_t) + head.fullNameSize);
+        }
+        refOffset += sizeof(fileShareMDHead_t) + head.fullNameSize;
+        metaSize += sizeof(fileShareMDHead_t) + head.fullNameSize;
+
+        /*each share is its fingerprint and the zigzag deltas of its fields against the previous share*/
+        memset(fields, 0, sizeof(fields));
+        for(int i = 0; i < head.numOfComingSecrets; i++) {
+            if(refOffset + FP_SIZE > refSize) {
+                return -1;
             }
+            memcpy(entry.shareFP, refList + refOffset, FP_SIZE);
+            refOffset += FP_SIZE;
 
-            memcpy(buffer, &numOfShare, sizeof(int));
-            if((bytecount = send(*clientSock, buffer, sizeof(int), 0)) == -1) {
-                fprintf(stderr, "Error sending data %d\n", errno);
+            refOffset = getDeltaFields((const unsigned char *) refList, refSize, refOffset, fields);
+            if(refOffset < 0) {
+                return -1;
             }
-
-            if((bytecount = send(*clientSock, statusList, sizeof(bool) * numOfShare, 0)) == -1) {
-                fprintf(stderr, "Error sending data %d\n", errno);
+            entry.secretID = fields[0];
+            entry.secretSize = fields[1];
+            entry.shareSize = fields[2];
+            entry.segID = fields[3];
+            entry.shareID = fields[4];
+
+            if(metaBuffer != NULL) {
+                memcpy(metaBuffer + metaSize, &entry, sizeof(shareMDEntry_t));
             }
+            metaSize += sizeof(shareMDEntry_t);
+            (*numOfShares)++;
         }
+    }
 
-        /*while data recv.ed, perform second stage deduplication*/
-        if(indicator == DATA) {
-
-            bool end = false;
-            int meta_end_indicator = -1;
-            char buffer_indicator[10];
-            /* 1. recv meta end indicator */
-            if((bytecount = recv(*clientSock, buffer_indicator, sizeof(int), 0)) == -1) {
-                fprintf(stderr, "Error receiving metaCore end indicator %d\n", errno);
-            }
-            meta_end_indicator = *(int *) buffer_indicator;
-            if(meta_end_indicator == METACORE_END) {
-                /* metaDedupCore meets ending */
-                end = true;
-                printf("[Meta] <Data> End indicator = %d\n\n", end);
-            }
-
-            /* 2. recv following package size */
-            if((bytecount = recv(*clientSock, buffer, sizeof(int), 0)) == -1) {
-                fprintf(stderr, "Error receiving data %d\n", errno);
-            }
-
-            int packageSize = *(int *) buffer;
-            int count = 0;
+    return metaSize;
+}
 
-            /* 3. recv following data */
-            while(count < packageSize) {
-                if((bytecount = recv(*clientSock, buffer + count, packageSize - count, 0)) == -1) {
-                    fprintf(stderr, "Error receiving data %d\n", errno);
-                }
-                count += bytecount;
-            }
+/*
+ * count the shares in the share metadata of a batch
+ *
+ * @param metaBuffer - the share metadata: [fileShareMDHead_t + full file name + shareMDEntry_t ...] ...
+ * @param metaSize - the size of the share metadata
+ *
+ * @return - the number of shares, -1 if the share metadata is malformed
+ */
+int Server::countShares(const char *metaBuffer, int metaSize)
+{
+    fileShareMDHead_t head;
+    int metaOffset = 0, numOfShares = 0;
 
-            printf("[Meta] <Upload:Data> total shares = %d\n\n", total_numOfShares);
-            metaDedupObj_->secondStageDedup(user, (unsigned char *) metaBuffer, metaSize, statusList,
-                                            (unsigned char *) buffer, hashObj, end);
+    while(metaOffset < metaSize) {
+        if(metaOffset + (int) sizeof(fileShareMDHead_t) > metaSize) {
+            return -1;
         }
+        memcpy(&head, metaBuffer + metaOffset, sizeof(fileShareMDHead_t));
+        if(head.fullNameSize < 0 || head.fullNameSize > metaSize - metaOffset || head.numOfComingSecrets < 0 ||
+           head.numOfComingSecrets > (metaSize - metaOffset) / (int) sizeof(shareMDEntry_t)) {
+            return -1;
+        }
+        metaOffset += sizeof(fileShareMDHead_t) + head.fullNameSize;
+        metaOffset += head.numOfComingSecrets * sizeof(shareMDEntry_t);
+        if(metaOffset > metaSize) {
+            return -1;
+        }
+        numOfShares += head.numOfComingSecrets;
+    }
 
-        /*while download request recv.ed, perform restore and write file recipe*/
-        if(indicator == INIT_REQUEST) {
-
-            pthread_mutex_lock(&mutex);
-
-            /* 1. receive the special indicator for restoring */
-            if((bytecount = recv(*clientSock, buffer, sizeof(int), 0)) == -1) {
-                fprintf(stderr, "Error receiving size! Error code: %d\n", errno);
-            }
-            int special_indicator = *(int *) buffer;
-            if(special_indicator == LAST_SHARE_SERVER) {
-                // Tell meta to set shareID as -1
-                metaDedupObj_->set_last_share_special_flag(true);
-                // Tell data to discard original share and set a placeholder
-                dataDedupObj_->set_last_share_special_flag(true);
-            }
+    return numOfShares;
+}
 
-            /* 2. receive encoded filename size */
-            if((bytecount = recv(*clientSock, buffer, sizeof(int), 0)) == -1) {
-                fprintf(stderr, "Error receiving data %d\n", errno);
+/*
+ * send the status list of an upload batch: indicator, batch ID, number of shares and the list in one writev
+ *
+ * @param clientSock - the client socket
+ * @param batchID - the ID of the upload batch
+ * @param statusList - the intra-user duplicate status of each share
+ * @param numOfShares - number of entries in statusList
+ *
+ * @return - a boolean value that indicates if the status list is sent
+ */
+bool Server::sendStatus(int clientSock, int batchID, bool *statusList, int numOfShares)
+{
+    int head[3] = {STAT, batchID, numOfShares};
+    struct iovec vec[2];
+    int iovcnt = 2;
+    ssize_t bytecount;
+
+    vec[0].iov_base = head;
+    vec[0].iov_len = sizeof(head);
+    vec[1].iov_base = statusList;
+    vec[1].iov_len = sizeof(bool) * numOfShares;
+
+    struct iovec *iov = vec;
+    while(iovcnt > 0) {
+        if((bytecount = writev(clientSock, iov, iovcnt)) == -1) {
+            if(errno == EINTR) {
+                continue;
             }
+            return 0;
+        }
+        while(iovcnt > 0 && bytecount >= (ssize_t) iov->iov_len) {
+            bytecount -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(bytecount > 0) {
+            iov->iov_base = (char *) iov->iov_base + bytecount;
+            iov->iov_len -= bytecount;
+        }
+    }
+    return 1;
+}
 
-            int packageSize = *(int *) buffer;
-            printf("[!>] [INIT_REQUEST] package size: %d\n", packageSize);
-            int count = 0;
-
-            /* 3. receive encoded filename */
-            while(count < packageSize) {
-                if((bytecount = recv(*clientSock, buffer + count, packageSize - count, 0)) == -1) {
-                    fprintf(stderr, "Error receiving data %d\n", errno);
-                }
-                count += bytecount;
+/*
+ * acknowledge an upload batch once its second stage deduplication is done: indicator, batch ID and result
+ *
+ * @param clientSock - the client socket
+ * @param batchID - the ID of the upload batch
+ * @param recorded - if the shares and recipe entries of the batch are recorded
+ *
+ * @return - a boolean value that indicates if the acknowledgement is sent
+ */
+bool Server::sendAck(int clientSock, int batchID, bool recorded)
+{
+    int head[3] = {ACK, batchID, recorded ? 1 : 0};
+    int count = 0;
+    ssize_t bytecount;
+
+    while(count < (int) sizeof(head)) {
+        if((bytecount = send(clientSock, (char *) head + count, sizeof(head) - count, 0)) == -1) {
+            if(errno == EINTR) {
+                continue;
             }
+            return 0;
+        }
+        count += bytecount;
+    }
+    return 1;
+}
 
-            printf("[!>] [INIT_REQUEST] Received package size: %d\n", count);
-            std::string fullFileName;
-            fullFileName.assign(buffer, count);
-            printf("[!>] [INIT_REQUEST] hex encoded file name: ");
-            Logger::printHexValue(reinterpret_cast<const unsigned char *>(fullFileName.c_str()), fullFileName.length());
-            printf("\n");
+/*
+ * get the most memory the buffers of one upload batch may lease
+ *
+ * @return - the bytes taken in the buffer arena
+ */
+size_t Server::uploadBatchMemory()
+{
+    /*a share takes one entry of the metadata at least*/
+    return BufferArena::footprint(sizeof(char) * META_LEN) +
+           BufferArena::footprint(sizeof(bool) * (META_LEN / sizeof(shareMDEntry_t)));
+}
 
-            /* 4. get plain file name size for file recipe */
-            if((bytecount = recv(*clientSock, buffer, sizeof(int), 0)) == -1) {
-                fprintf(stderr, "Error receiving data %d\n", errno);
-            }
-            int nameSize = *(int *) buffer;
+/*
+ * tell a newly connected client how many upload batches it may keep outstanding, as many as the buffer arena still
+ * holds beside the receive buffers of the workers, and reserve their memory while the client is connected
+ *
+ * @param conn - the client connection
+ *
+ * @return - a boolean value that indicates if the credits are sent, false if no upload batch fits in the arena
+ */
+bool Server::grantUploadCredit(connection_t *conn)
+{
+    size_t batchMemory = uploadBatchMemory();
+    size_t workerMemory = SERVER_WORKER_NUM * BufferArena::footprint(sizeof(char) * BUFFER_LEN);
+    size_t cap = BufferArena::cap();
+
+    pthread_mutex_lock(&uploadLock_);
+    size_t budget = (cap > workerMemory + uploadReserved_) ? cap - workerMemory - uploadReserved_ : 0;
+    conn->credit = (budget / batchMemory < UPLOAD_CREDIT) ? (int) (budget / batchMemory) : UPLOAD_CREDIT;
+    uploadReserved_ += conn->credit * batchMemory;
+    pthread_mutex_unlock(&uploadLock_);
+
+    if(conn->credit < 1) {
+        fprintf(stderr, "Error: no upload memory left for user %d, refusing the connection\n", conn->user);
+        return 0;
+    }
 
-            /* 5. get plain file name for file recipe */
-            char nameBuffer[nameSize + 1];
-            if((bytecount = recv(*clientSock, nameBuffer, nameSize, 0)) == -1) {
+    int credit = htonl(conn->credit);
+    if(send(conn->sock, &credit, sizeof(int), 0) == -1) {
+        fprintf(stderr, "Error sending upload credit %d\n", errno);
+        return 0;
+    }
+    return 1;
+}
 
-                fprintf(stderr, "Error receiving data %d\n", errno);
-            }
+/*
+ * give the upload memory reserved for a client back once it is disconnected
+ *
+ * @param conn - the client connection
+ */
+void Server::returnUploadCredit(connection_t *conn)
+{
+    pthread_mutex_lock(&uploadLock_);
+    uploadReserved_ -= conn->credit * uploadBatchMemory();
+    pthread_mutex_unlock(&uploadLock_);
+    conn->credit = 0;
+}
 
-            nameBuffer[nameSize] = '\0';
-            int id = 0;
-            while(nameBuffer[id] != '\0') {
-                id++;
-                if(nameBuffer[id] == '/') {
-                    nameBuffer[id] = '_';
-                }
-            }
+/*
+ * receive a field of a request
+ *
+ * @param clientSock - the client socket
+ * @param buffer - the buffer for the field <return>
+ * @param size - the size of the field
+ *
+ * @return - a boolean value that indicates if the whole field is received, false once the client closes,
+ * fails or sends nothing for SERVER_RECV_TIMEOUT
+ */
+bool Server::recvFully(int clientSock, void *buffer, int size)
+{
+    int count = 0;
+    while(count < size) {
+        ssize_t bytecount = recv(clientSock, (char *) buffer + count, size - count, 0);
+        if(bytecount == -1 && errno == EINTR) {
+            continue;
+        }
+        if(bytecount <= 0) {
+            return 0;
+        }
+        count += bytecount;
+    }
+    return 1;
+}
 
-            printf("[!>] [INIT_REQUEST] downloaded file name from socket: %s\n", nameBuffer);
-            /* create a new cipher file */
-            char fileRecipeName[256];
-            sprintf(fileRecipeName, "meta/RecipeFiles/%s.recipe", nameBuffer);
+/*
+ * receive the user ID of a newly connected client and grant it the upload credits
+ *
+ * @param conn - the client connection
+ * @param buffer - the receive buffer of the worker
+ *
+ * @return - a boolean value that indicates if the client goes on with its requests
+ */
+bool Server::greetClient(connection_t *conn, char *buffer)
+{
+    //get user ID
+    if(recv(conn->sock, buffer, sizeof(int), MSG_WAITALL) != sizeof(int)) {
+        fprintf(stderr, "Error recv userID %d\n", errno);
+        return 0;
+    }
+    conn->user = ntohl(*(int *) buffer);
+    printf("[%s] connection from user %d\n", conn->type == CONN_META ? "Meta" : "Data", conn->user);
 
-            metaDedupObj_->restoreShareFileAndWriteFileRecipe(user, fullFileName, fileRecipeName, 0, *clientSock,
-                                                              hashObj);
-            pthread_mutex_unlock(&mutex);
-            break;
-        }
+    /*grant the upload credits, a client is refused here rather than once its batches find no memory*/
+    if(!grantUploadCredit(conn)) {
+        return 0;
     }
-    delete hashObj;
-    printf("[!>] [Meta] Thread Exiting...\n");
-    printf("[!>] [Meta] Current Time: ");
-    Logger::printCurrentTime();
-    printf("\n");
-    printf("[!>] =======================\n\n");
-    free(buffer);
-    free(statusList);
-    free(metaBuffer);
-    free(clientSock);
-    return 0;
+    conn->state = CONN_REQUEST;
+    return 1;
 }
 
 /*
- * Data Thread function: each thread maintains a socket from a certain client
+ * serve one request of a meta connection
  *
- * @param lp - input parameter structure
+ * @param conn - the client connection
+ * @param worker - the worker serving the request
  *
+ * @return - a boolean value that indicates if the connection is kept for the next request
  */
-void *Server::SocketHandlerData(void *lp)
+bool Server::serveMeta(connection_t *conn, worker_t *worker)
 {
-    //get socket from input param
-    int *clientSock = (int *) lp;
+    char *buffer = worker->buffer;
+    CryptoPrimitive *hashObj = worker->hashObj;
+    int *clientSock = &conn->sock;
+    uploadBatch_t *window = conn->window;
+    int user = conn->user;
 
     //variable initialization
-    int bytecount;
-    char *buffer = (char *) malloc(sizeof(char) * BUFFER_LEN);
-    char *metaBuffer = (char *) malloc(sizeof(char) * META_LEN);
-    bool *statusList = (bool *) malloc(sizeof(bool) * BUFFER_LEN);
-    memset(statusList, 0, sizeof(bool) * BUFFER_LEN);
-    int metaSize;
-    int user = 0;
+    uploadBatch_t *batch;
+    int batchID;
     int dataSize = 0;
-    //get user ID
-    if((bytecount = recv(*clientSock, buffer, sizeof(int), 0)) == -1) {
-        fprintf(stderr, "Error receiving userID %d\n", errno);
+    int numOfShare = 0;
+
+    if(conn->state == CONN_HELLO) {
+        return greetClient(conn, buffer);
     }
-    user = ntohl(*(int *) buffer);
-    printf("[Data] connection from user %d\n", user);
 
-    memset(buffer, 0, BUFFER_LEN);
-    int numOfShare = 0;
+    /*recv indicator first, if client closes, drop the connection*/
+    if(!recvFully(*clientSock, buffer, sizeof(int))) {
+        printf("[!>] [Meta] client closed!! Closing connection...\n");
+        return 0;
+    }
 
-    //initialize hash object
-    CryptoPrimitive *hashObj = new CryptoPrimitive(SHA256_TYPE);
+    int indicator = *(int *) buffer;
+    ServerStats::countRequest(conn->type);
 
-    //main loop for recv data package
-    while(true) {
+    /*while metadata recv.ed, perform first stage deduplication*/
+    if(indicator == META || indicator == META_REF) {
 
-        /*recv indicator first*/
-        if((bytecount = recv(*clientSock, buffer, sizeof(int), 0)) == -1) {
-            fprintf(stderr, "Error receiving indicator! Error code: %d\n", errno);
+        /*references come with the end indicator since they may complete without a data package*/
+        bool end = false;
+        if(indicator == META_REF) {
+            if(!recvFully(*clientSock, buffer, sizeof(int))) {
+                fprintf(stderr, "Error receiving metaCore end indicator %d\n", errno);
+                return 0;
+            }
+            end = (*(int *) buffer == METACORE_END);
         }
 
-        /*if client closes, break loop*/
-        if(bytecount == 0) {
-            printf("[!>] [Data] byteCount = %d -> Thread: client closed!! Breaking loops...\n", bytecount);
-            break;
+        /*recv the batch ID*/
+        if(!recvFully(*clientSock, buffer, sizeof(int))) {
+            fprintf(stderr, "Error receiving data %d\n", errno);
+            return 0;
         }
+        batchID = *(int *) buffer;
 
-        int indicator = *(int *) buffer;
-        /*while metadata recv.ed, perform first stage deduplication*/
-        if(indicator == META) {
-
-            /*recv following package size*/
-            if((bytecount = recv(*clientSock, buffer, sizeof(int), 0)) == -1) {
-                fprintf(stderr, "Error receiving data %d\n", errno);
-            }
-
-            int packageSize = *(int *) buffer;
-            int count = 0;
+        /*recv the file slot of the batch*/
+        if(!recvFully(*clientSock, buffer, sizeof(int))) {
+            fprintf(stderr, "Error receiving data %d\n", errno);
+            return 0;
+        }
+        int fileID = *(int *) buffer;
 
-            /*recv following data*/
-            while(count < packageSize) {
-                if((bytecount = recv(*clientSock, buffer + count, packageSize - count, 0)) == -1) {
-                    fprintf(stderr, "Error receiving data %d\n", errno);
-                }
-                count += bytecount;
-            }
+        /*recv following package size*/
+        if(!recvFully(*clientSock, buffer, sizeof(int))) {
+            fprintf(stderr, "Error receiving data %d\n", errno);
+            return 0;
+        }
 
-            memcpy(metaBuffer, buffer, count);
-            metaSize = count;
-            dataDedupObj_->firstStageDedup(user, (unsigned char *) metaBuffer, count, statusList, numOfShare, dataSize);
+        int packageSize = *(int *) buffer;
+        if(packageSize < 0 || packageSize > BUFFER_LEN) {
+            fprintf(stderr, "Error: package of %d bytes!\n", packageSize);
+            return 0;
+        }
 
-            int ind = STAT;
-            memcpy(buffer, &ind, sizeof(int));
+        /*recv following data*/
+        if(!recvFully(*clientSock, buffer, packageSize)) {
+            fprintf(stderr, "Error receiving data %d\n", errno);
+            return 0;
+        }
 
-            /*return the status list*/
-            int bytecount;
-            if((bytecount = send(*clientSock, buffer, sizeof(int), 0)) == -1) {
-                fprintf(stderr, "Error sending data %d\n", errno);
-            }
+        /*references are expanded back into share metadata*/
+        int numOfBatchShares;
+        int metaSize = (indicator == META_REF) ? expandReferences(buffer, packageSize, NULL, &numOfBatchShares)
+                                               : packageSize;
+        if(indicator == META) {
+            numOfBatchShares = countShares(buffer, packageSize);
+        }
+        if(metaSize < 0 || metaSize > META_LEN || numOfBatchShares < 0) {
+            fprintf(stderr, "Error: malformed metadata of batch %d!\n", batchID);
+            return 0;
+        }
 
-            memcpy(buffer, &numOfShare, sizeof(int));
-            if((bytecount = send(*clientSock, buffer, sizeof(int), 0)) == -1) {
-                fprintf(stderr, "Error sending data %d\n", errno);
-            }
+        /*keep the metadata and the status list until the data of the batch arrives, leased at their size*/
+        batch = newUploadBatch(conn, batchID, metaSize, numOfBatchShares);
+        if(batch == NULL) {
+            fprintf(stderr, "Error: batch %d exceeds the upload credits!\n", batchID);
+            return 0;
+        }
+        if(indicator == META_REF) {
+            expandReferences(buffer, packageSize, batch->metaBuffer, &numOfBatchShares);
+        } else {
+            memcpy(batch->metaBuffer, buffer, packageSize);
+        }
+        batch->metaSize = metaSize;
+        batch->fileID = fileID;
+
+        metaDedupObj_->firstStageDedup(user, (unsigned char *) batch->metaBuffer, metaSize, batch->statusList,
+                                       numOfShare, dataSize);
+        conn->total_numOfShares += numOfShare;
+
+        /*accept references only if the user really stores every share, they are then only acknowledged,
+          otherwise ask for the data with the status list and its head in one go*/
+        if(indicator == META_REF && dataSize == 0) {
+            batch->refAccepted = true;
+            batch->end = end;
+        } else if(!sendStatus(*clientSock, batchID, batch->statusList, numOfShare)) {
+            fprintf(stderr, "Error sending data %d\n", errno);
+            return 0;
+        }
 
-            if((bytecount = send(*clientSock, statusList, sizeof(bool) * numOfShare, 0)) == -1) {
-                fprintf(stderr, "Error sending data %d\n", errno);
+        /*record accepted references at once unless earlier batches still wait for their data*/
+        batch = (batchID == conn->nextRecordID) ? findDeferredBatch(window, batchID) : NULL;
+        while(batch != NULL) {
+            bool recorded = metaDedupObj_->secondStageDedup(user, batch->fileID,
+                                                            (unsigned char *) batch->metaBuffer,
+                                                            batch->metaSize, batch->statusList,
+                                                            (unsigned char *) buffer, hashObj, batch->end);
+            retireUploadBatch(batch);
+            if(!sendAck(*clientSock, batch->batchID, recorded)) {
+                fprintf(stderr, "Error sending ack %d\n", errno);
+                return 0;
             }
+            batch = findDeferredBatch(window, ++conn->nextRecordID);
         }
+    }
 
-        /*while data recv.ed, perform second stage deduplication*/
-        if(indicator == DATA) {
-
-            /*recv following package size*/
+    /*while data recv.ed, perform second stage deduplication*/
+    if(indicator == DATA) {
 
-            if((bytecount = recv(*clientSock, buffer, sizeof(int), 0)) == -1) {
-                fprintf(stderr, "Error receiving data %d\n", errno);
-            }
+        bool end = false;
+        int meta_end_indicator = -1;
+        char buffer_indicator[10];
+        /* 1. recv meta end indicator */
+        if(!recvFully(*clientSock, buffer_indicator, sizeof(int))) {
+            fprintf(stderr, "Error receiving metaCore end indicator %d\n", errno);
+            return 0;
+        }
+        meta_end_indicator = *(int *) buffer_indicator;
+        if(meta_end_indicator == METACORE_END) {
+            /* metaDedupCore meets ending */
+            end = true;
+            printf("[Meta] <Data> End indicator = %d\n\n", end);
+        }
 
-            int packageSize = *(int *) buffer;
-            int count = 0;
+        /* 2. recv the batch ID */
+        if(!recvFully(*clientSock, buffer, sizeof(int))) {
+            fprintf(stderr, "Error receiving data %d\n", errno);
+            return 0;
+        }
+        batchID = *(int *) buffer;
 
-            /*recv following data*/
-            while(count < packageSize) {
-                if((bytecount = recv(*clientSock, buffer + count, packageSize - count, 0)) == -1) {
-                    fprintf(stderr, "Error receiving data %d\n", errno);
-                }
-                count += bytecount;
-            }
+        /* 3. recv following package size */
+        if(!recvFully(*clientSock, buffer, sizeof(int))) {
+            fprintf(stderr, "Error receiving data %d\n", errno);
+            return 0;
+        }
 
-            dataDedupObj_->secondStageDedup(user, (unsigned char *) metaBuffer, metaSize, statusList,
-                                            (unsigned char *) buffer, hashObj);
+        int packageSize = *(int *) buffer;
+        if(packageSize < 0 || packageSize > BUFFER_LEN) {
+            fprintf(stderr, "Error: package of %d bytes!\n", packageSize);
+            return 0;
         }
 
-        /*while download request recv.ed, perform restore*/
-        if(indicator == DOWNLOAD) {
+        /* 4. recv following data */
+        if(!recvFully(*clientSock, buffer, packageSize)) {
+            fprintf(stderr, "Error receiving data %d\n", errno);
+            return 0;
+        }
 
-            /*1. receive following package size*/
-            if((bytecount = recv(*clientSock, buffer, sizeof(int), 0)) == -1) {
-                fprintf(stderr, "Error receiving size! Error code: %d\n", errno);
-            }
+        batch = findUploadBatch(window, batchID);
+        if(batch == NULL) {
+            fprintf(stderr, "Error: data of unknown batch %d!\n", batchID);
+            return 0;
+        }
 
-            int packageSize = *(int *) buffer;
+        if(batchID != conn->nextRecordID) {
+            fprintf(stderr, "Error: data of batch %d arrives before batch %d is recorded!\n", batchID,
+                    conn->nextRecordID);
+            return 0;
+        }
 
-            int count = 0;
-            /*2. receive following data*/
-            while(count < packageSize) {
-                if((bytecount = recv(*clientSock, buffer + count, packageSize - count, 0)) == -1) {
-                    fprintf(stderr, "Error receiving package data! Error code: %d\n", errno);
-                }
-                count += bytecount;
+        /*record the batch, then the accepted references held back behind it*/
+        printf("[Meta] <Upload:Data> total shares = %d\n\n", conn->total_numOfShares);
+        batch->end = end;
+        while(batch != NULL) {
+            bool recorded = metaDedupObj_->secondStageDedup(user, batch->fileID,
+                                                            (unsigned char *) batch->metaBuffer,
+                                                            batch->metaSize, batch->statusList,
+                                                            (unsigned char *) buffer, hashObj, batch->end);
+            retireUploadBatch(batch);
+            if(!sendAck(*clientSock, batch->batchID, recorded)) {
+                fprintf(stderr, "Error sending ack %d\n", errno);
+                return 0;
             }
-            buffer[packageSize] = '\0';
-            int id = 0;
-            while(buffer[id] != '\0') {
-                id++;
-                if(buffer[id] == '/') {
-                    buffer[id] = '_';
-                }
-            }
-            char name[256];
-
-            sprintf(name, "meta/RecipeFiles/%s", buffer);
-            std::string fullFileName(name);
-
-            pthread_mutex_lock(&mutex);
-            dataDedupObj_->restoreShareFile(user, fullFileName, 0, *clientSock, hashObj);
-            pthread_mutex_unlock(&mutex);
-            break;
+            batch = findDeferredBatch(window, ++conn->nextRecordID);
         }
     }
 
-    delete hashObj;
-    printf("[!>] [Data] Thread Exiting...\n");
-    printf("[!>] [Data] Current Time: ");
-    Logger::printCurrentTime();
-    printf("\n");
-    printf("[!>] =======================\n\n");
-    free(buffer);
-    free(statusList);
-    free(metaBuffer);
-    free(clientSock);
-    return 0;
+    /*a restore runs until the file is sent, it is handed to a restore thread instead of holding the worker*/
+    if(indicator == INIT_REQUEST) {
+        conn->state = CONN_RESTORE;
+    }
+    return 1;
 }
 
-
 /*
- * Key Manager Thread function: each thread maintains a socket from a certain client
+ * serve one request of a data connection
+ *
+ * @param conn - the client connection
+ * @param worker - the worker serving the request
  *
- * @param lp - input parameter structure
+ * @return - a boolean value that indicates if the connection is kept for the next request
  */
-void *Server::SocketHandlerKeyManager(void *lp)
+bool Server::serveData(connection_t *conn, worker_t *worker)
 {
-    auto *temp = (km_param *) lp;
-    int *clientSock = temp->kmclientSocket;
-
-    printf("\n[KM] KeyServer::SocketHandler ===>\n");
-    //double timer,split,bw;
-    //get socket from input param
-    SSL *ssl = temp->obj->ssl_;
-    delete temp;
+    char *buffer = worker->buffer;
+    CryptoPrimitive *hashObj = worker->hashObj;
+    int *clientSock = &conn->sock;
+    uploadBatch_t *window = conn->window;
+    int user = conn->user;
 
     //variable initialization
-    int bytecount;
-    char *buffer = (char *) malloc(sizeof(char) * BUFFER_SIZE + sizeof(int));
-    char *output = (char *) malloc(sizeof(char) * BUFFER_SIZE + sizeof(int));
-    /* read userID from client */
-    if((bytecount = SSL_read(ssl, buffer, sizeof(int))) == -1) {
+    uploadBatch_t *batch;
+    int batchID;
+    int dataSize = 0;
+    int numOfShare = 0;
 
-        ERR_print_errors_fp(stderr);
-        fprintf(stderr, "Error SSL_read! Error code: %d\n", errno);
-    }
-    printf("[!>] [SSL:Receive UserID] bytecount: %d\n", bytecount);
-    int user = ntohl(*(int *) buffer);
-    printf("connection from user %d\n", user);
-    // RSA structure
-    RSA *rsa = RSA_new();
-    BIO *key = BIO_new_file("./keys/private.pem", "r");
-    PEM_read_bio_RSAPrivateKey(key, &rsa, NULL, NULL);
-    // Big number init
-    BN_CTX *ctx = BN_CTX_new();
-    BIGNUM *ret = BN_new();
-    // read the server private key
-    while(true) {
+    if(conn->state == CONN_HELLO) {
+        return greetClient(conn, buffer);
+    }
 
-        // recv the number count of data
-        if((bytecount = SSL_read(ssl, buffer, sizeof(int))) == -1) {
+    /*recv indicator first, if client closes, drop the connection*/
+    if(!recvFully(*clientSock, buffer, sizeof(int))) {
+        printf("[!>] [Data] client closed!! Closing connection...\n");
+        return 0;
+    }
 
-            ERR_print_errors_fp(stderr);
-            fprintf(stderr, "[SSL_read] No count of data received!\n");
-        }
-        /*if client closes, break loop*/
-        if(bytecount == 0) {
-            printf("[!>] [KM] Thread: client closed!! Breaking loops...\n");
-            break;
-        }
+    int indicator = *(int *) buffer;
+    ServerStats::countRequest(conn->type);
 
-        if(!checkSSLERRStatus(ssl, bytecount)) {
-            printf("[!>] [SSL Error] Abort operation! Resetting...\n");
-            break;
-        }
-        // prepare to recv data itself
-        int num, total;
-        memcpy(&num, buffer, sizeof(int));
+    /*while metadata recv.ed, perform first stage deduplication*/
+    if(indicator == META || indicator == META_REF) {
 
-        /* Exit thread when client downloading files. `-202` is set in client::KeyEx::sendEndIndicator */
-        if(num == -202) {
-            printf("[!>] [KM] client download -> Thread: client closed!! Breaking loops...\n");
-            break;
+        /*recv the batch ID*/
+        if(!recvFully(*clientSock, buffer, sizeof(int))) {
+            fprintf(stderr, "Error receiving data %d\n", errno);
+            return 0;
         }
+        batchID = *(int *) buffer;
 
-        total = 0;
-        // recv data (blinded hash, 1024bits values)
-        while(total < num * RSA_LENGTH) {
+        /*recv the file slot of the batch*/
+        if(!recvFully(*clientSock, buffer, sizeof(int))) {
+            fprintf(stderr, "Error receiving data %d\n", errno);
+            return 0;
+        }
+        int fileID = *(int *) buffer;
 
-            if((bytecount = SSL_read(ssl, buffer + sizeof(int) + total, num * RSA_LENGTH - total)) == -1) {
-                ERR_print_errors_fp(stderr);
-                fprintf(stderr, "Error SSL_read data(blinded hash, 1024bits values)! Error code: %d\n", errno);
-                exit(-1);
-            }
-            total += bytecount;
+        /*recv following package size*/
+        if(!recvFully(*clientSock, buffer, sizeof(int))) {
+            fprintf(stderr, "Error receiving data %d\n", errno);
+            return 0;
         }
 
-        // main loop for computing keys
-        double timer, split;
-        timerStart(&timer);
-        for(int i = 0; i < num; i++) {
+        int packageSize = *(int *) buffer;
+        if(packageSize < 0 || packageSize > BUFFER_LEN) {
+            fprintf(stderr, "Error: package of %d bytes!\n", packageSize);
+            return 0;
+        }
 
-            // hash x r^e to BN
-            BN_bin2bn((unsigned char *) (buffer + sizeof(int) + i * RSA_LENGTH), RSA_LENGTH, ret);
-#if OPENSSL_VERSION_NUMBER >= 0x10100000L
-            const BIGNUM *n;
-            const BIGNUM *d;
-            RSA_get0_key(rsa, &n, nullptr, &d);
-            // compute (Hash x r^e)^d mod n
-            BN_mod_exp(ret, ret, d, n, ctx);
-#else
-            // compute (Hash x r^e)^d mod n
-            BN_mod_exp(ret, ret, rsa->d, rsa->n, ctx);
-#endif
-            memset(output + sizeof(int) + i * RSA_LENGTH, 0, RSA_LENGTH);
-            BN_bn2bin(ret, (unsigned char *) output + sizeof(int) + i * RSA_LENGTH + (RSA_LENGTH - BN_num_bytes(ret)));
-            //BN_bn2bin(ret,(unsigned char*)output+sizeof(int)+i*32);
+        /*recv following data*/
+        if(!recvFully(*clientSock, buffer, packageSize)) {
+            fprintf(stderr, "Error receiving data %d\n", errno);
+            return 0;
         }
-        split = timerSplit(&timer);
-        // send back the result
-        total = 0;
-        while(total < num * RSA_LENGTH) {
 
-            if((bytecount = SSL_write(ssl, output + sizeof(int) + total, num * RSA_LENGTH - total)) <= 0) {
+        /*references are expanded back into share metadata*/
+        int numOfBatchShares;
+        int metaSize = (indicator == META_REF) ? expandReferences(buffer, packageSize, NULL, &numOfBatchShares)
+                                               : packageSize;
+        if(indicator == META) {
+            numOfBatchShares = countShares(buffer, packageSize);
+        }
+        if(metaSize < 0 || metaSize > META_LEN || numOfBatchShares < 0) {
+            fprintf(stderr, "Error: malformed metadata of batch %d!\n", batchID);
+            return 0;
+        }
+
+        /*keep the metadata and the status list until the data of the batch arrives, leased at their size*/
+        batch = newUploadBatch(conn, batchID, metaSize, numOfBatchShares);
+        if(batch == NULL) {
+            fprintf(stderr, "Error: batch %d exceeds the upload credits!\n", batchID);
+            return 0;
+        }
+        if(indicator == META_REF) {
+            expandReferences(buffer, packageSize, batch->metaBuffer, &numOfBatchShares);
+        } else {
+            memcpy(batch->metaBuffer, buffer, packageSize);
+        }
+        batch->metaSize = metaSize;
+        batch->fileID = fileID;
+        dataDedupObj_->firstStageDedup(user, (unsigned char *) batch->metaBuffer, metaSize, batch->statusList,
+                                       numOfShare, dataSize);
+
+        /*accept references only if the user really stores every share, they are then only acknowledged,
+          otherwise ask for the data with the status list and its head in one go*/
+        if(indicator == META_REF && dataSize == 0) {
+            batch->refAccepted = true;
+        } else if(!sendStatus(*clientSock, batchID, batch->statusList, numOfShare)) {
+            fprintf(stderr, "Error sending data %d\n", errno);
+            return 0;
+        }
+
+        /*record accepted references at once unless earlier batches still wait for their data*/
+        batch = (batchID == conn->nextRecordID) ? findDeferredBatch(window, batchID) : NULL;
+        while(batch != NULL) {
+            bool recorded = dataDedupObj_->secondStageDedup(user, (unsigned char *) batch->metaBuffer,
+                                                            batch->metaSize, batch->statusList,
+                                                            (unsigned char *) buffer, hashObj);
+            retireUploadBatch(batch);
+            if(!sendAck(*clientSock, batch->batchID, recorded)) {
+                fprintf(stderr, "Error sending ack %d\n", errno);
+                return 0;
+            }
+            batch = findDeferredBatch(window, ++conn->nextRecordID);
+        }
+    }
+
+    /*while data recv.ed, perform second stage deduplication*/
+    if(indicator == DATA) {
+
+        /*recv the batch ID*/
+        if(!recvFully(*clientSock, buffer, sizeof(int))) {
+            fprintf(stderr, "Error receiving data %d\n", errno);
+            return 0;
+        }
+        batchID = *(int *) buffer;
+
+        /*recv following package size*/
+
+        if(!recvFully(*clientSock, buffer, sizeof(int))) {
+            fprintf(stderr, "Error receiving data %d\n", errno);
+            return 0;
+
+        }
+
+        int packageSize = *(int *) buffer;
+        if(packageSize < 0 || packageSize > BUFFER_LEN) {
+            fprintf(stderr, "Error: package of %d bytes!\n", packageSize);
+            return 0;
+        }
+
+        /*recv following data*/
+        if(!recvFully(*clientSock, buffer, packageSize)) {
+            fprintf(stderr, "Error receiving data %d\n", errno);
+            return 0;
+        }
+
+        batch = findUploadBatch(window, batchID);
+        if(batch == NULL) {
+            fprintf(stderr, "Error: data of unknown batch %d!\n", batchID);
+            return 0;
+        }
+
+        if(batchID != conn->nextRecordID) {
+            fprintf(stderr, "Error: data of batch %d arrives before batch %d is recorded!\n", batchID,
+                    conn->nextRecordID);
+            return 0;
+        }
+
+        /*record the batch, then the accepted references held back behind it*/
+        while(batch != NULL) {
+            bool recorded = dataDedupObj_->secondStageDedup(user, (unsigned char *) batch->metaBuffer,
+                                                            batch->metaSize, batch->statusList,
+                                                            (unsigned char *) buffer, hashObj);
+            retireUploadBatch(batch);
+            if(!sendAck(*clientSock, batch->batchID, recorded)) {
+                fprintf(stderr, "Error sending ack %d\n", errno);
+                return 0;
+            }
+            batch = findDeferredBatch(window, ++conn->nextRecordID);
+        }
+    }
+
+    /*a restore runs until the file is sent, it is handed to a restore thread instead of holding the worker*/
+    if(indicator == DOWNLOAD) {
+        conn->state = CONN_RESTORE;
+    }
+    return 1;
+}
+
+/*
+ * serve the restore request of a meta connection: resolve the metadata of the file for the client and write the
+ * file recipe for the data core
+ *
+ * @param conn - the client connection, closed once the restore is sent
+ * @param worker - the restore thread serving the request
+ */
+void Server::restoreMeta(connection_t *conn, worker_t *worker)
+{
+    char *buffer = worker->buffer;
+    CryptoPrimitive *hashObj = worker->hashObj;
+    int *clientSock = &conn->sock;
+    int user = conn->user;
+
+    /* 1. receive the special indicator for restoring */
+    int special_indicator;
+    if(!recvFully(*clientSock, &special_indicator, sizeof(int))) {
+        fprintf(stderr, "Error receiving special indicator %d\n", errno);
+        return;
+    }
+    // meta sets shareID as -1, data discards the original share and sets a placeholder (for this restore only)
+    bool lastShareOnServer = (special_indicator == LAST_SHARE_SERVER);
+
+    /* 2. receive encoded filename size */
+    int packageSize;
+    if(!recvFully(*clientSock, &packageSize, sizeof(int))) {
+        fprintf(stderr, "Error receiving data %d\n", errno);
+        return;
+    }
+    printf("[!>] [INIT_REQUEST] package size: %d\n", packageSize);
+    if(packageSize < 0 || packageSize > BUFFER_LEN) {
+        fprintf(stderr, "Error: encoded file name of %d bytes!\n", packageSize);
+        return;
+    }
+
+    /* 3. receive encoded filename */
+    if(!recvFully(*clientSock, buffer, packageSize)) {
+        fprintf(stderr, "Error receiving data %d\n", errno);
+        return;
+    }
+
+    printf("[!>] [INIT_REQUEST] Received package size: %d\n", packageSize);
+    std::string fullFileName;
+    fullFileName.assign(buffer, packageSize);
+    printf("[!>] [INIT_REQUEST] hex encoded file name: ");
+    Logger::printHexValue(reinterpret_cast<const unsigned char *>(fullFileName.c_str()), fullFileName.length());
+    printf("\n");
+
+    /* 4. get plain file name size for file recipe */
+    char fileRecipeName[256];
+    int nameSize;
+    if(!recvFully(*clientSock, &nameSize, sizeof(int))) {
+        fprintf(stderr, "Error receiving data %d\n", errno);
+        return;
+    }
+    if(nameSize < 0 || nameSize >= (int) sizeof(fileRecipeName) - (int) strlen("meta/RecipeFiles/.recipe")) {
+        fprintf(stderr, "Error: file name of %d bytes!\n", nameSize);
+        return;
+    }
+
+    /* 5. get plain file name for file recipe */
+    char nameBuffer[nameSize + 1];
+    if(!recvFully(*clientSock, nameBuffer, nameSize)) {
+        fprintf(stderr, "Error receiving data %d\n", errno);
+        return;
+    }
+
+    nameBuffer[nameSize] = '\0';
+    int id = 0;
+    while(nameBuffer[id] != '\0') {
+        id++;
+        if(nameBuffer[id] == '/') {
+            nameBuffer[id] = '_';
+        }
+    }
+
+    printf("[!>] [INIT_REQUEST] downloaded file name from socket: %s\n", nameBuffer);
+
+    /* 6. get the byte range to be restored: offset and length (< 0 for up to the end of the file) */
+    long range[2];
+    if(!recvFully(*clientSock, range, sizeof(range))) {
+        /*no restore without the whole range, drop the connection*/
+        fprintf(stderr, "Error receiving byte range %d\n", errno);
+        return;
+    }
+    printf("[!>] [INIT_REQUEST] byte range: offset %ld, length %ld\n", range[0], range[1]);
+    /* create a new cipher file */
+    sprintf(fileRecipeName, "meta/RecipeFiles/%s.recipe", nameBuffer);
+
+    ServerStats::beginRestore(*clientSock, conn->type, user);
+    metaDedupObj_->restoreShareFileAndWriteFileRecipe(user, fullFileName, fileRecipeName, 0, range[0], range[1],
+                                                      lastShareOnServer, *clientSock, hashObj);
+    ServerStats::endRestore(*clientSock);
+}
+
+/*
+ * serve the restore request of a data connection: send the shares of the file recipe written by the meta core
+ *
+ * @param conn - the client connection, closed once the restore is sent
+ * @param worker - the restore thread serving the request
+ */
+void Server::restoreData(connection_t *conn, worker_t *worker)
+{
+    char *buffer = worker->buffer;
+    CryptoPrimitive *hashObj = worker->hashObj;
+    int *clientSock = &conn->sock;
+    int user = conn->user;
+
+    /*1. receive following package size*/
+    char name[256];
+    int packageSize;
+    if(!recvFully(*clientSock, &packageSize, sizeof(int))) {
+        fprintf(stderr, "Error receiving size! Error code: %d\n", errno);
+        return;
+    }
+    if(packageSize < 0 || packageSize >= (int) sizeof(name) - (int) strlen("meta/RecipeFiles/")) {
+        fprintf(stderr, "Error: recipe name of %d bytes!\n", packageSize);
+        return;
+    }
+
+    /*2. receive following data*/
+    if(!recvFully(*clientSock, buffer, packageSize)) {
+        fprintf(stderr, "Error receiving package data! Error code: %d\n", errno);
+        return;
+    }
+    buffer[packageSize] = '\0';
+    int id = 0;
+    while(buffer[id] != '\0') {
+        id++;
+        if(buffer[id] == '/') {
+            buffer[id] = '_';
+        }
+    }
+
+    sprintf(name, "meta/RecipeFiles/%s", buffer);
+    std::string fullFileName(name);
+
+    /*3. receive the token of the restore, returned by the meta core with the file recipe*/
+    long recipeToken;
+    if(!recvFully(*clientSock, &recipeToken, sizeof(long))) {
+        fprintf(stderr, "Error receiving the restore token! Error code: %d\n", errno);
+        return;
+    }
+
+    /*4. receive the ranges of the secrets whose shares the client wants from this server*/
+    int numOfRanges = -1;
+    if(!recvFully(*clientSock, &numOfRanges, sizeof(int))) {
+        fprintf(stderr, "Error receiving the number of ranges! Error code: %d\n", errno);
+        return;
+    }
+    /*-1 asks for all the secrets, anything else below zero is malformed*/
+    if((numOfRanges < -1) || (numOfRanges > BUFFER_LEN / (int) (2 * sizeof(int)))) {
+        fprintf(stderr, "Error: %d ranges of secrets requested!\n", numOfRanges);
+        return;
+    }
+    std::vector<int> selection(numOfRanges > 0 ? 2 * numOfRanges : 0);
+    int selectionSize = selection.size() * sizeof(int);
+    if(selectionSize > 0 && !recvFully(*clientSock, selection.data(), selectionSize)) {
+        fprintf(stderr, "Error receiving the ranges! Error code: %d\n", errno);
+        return;
+    }
+    printf("[Data] <restore> %d ranges of secrets requested\n", numOfRanges);
+
+    ServerStats::beginRestore(*clientSock, conn->type, user);
+    dataDedupObj_->restoreShareFile(user, fullFileName, recipeToken, 0, *clientSock, hashObj, selection.data(),
+                                    numOfRanges);
+    ServerStats::endRestore(*clientSock);
+}
+
+/*
+ * serve one step of a key manager connection: the TLS handshake, the user ID or one signing request
+ *
+ * @param conn - the client connection
+ * @param worker - the worker serving the request
+ *
+ * @return - a boolean value that indicates if the connection is kept for the next request
+ */
+bool Server::serveKeyManager(connection_t *conn, worker_t *worker)
+{
+    SSL *ssl = conn->ssl;
+    int bytecount;
+
+    /* the handshake runs in a key manager worker, a slow client never holds up the acceptor or the meta and data
+       requests */
+    if(conn->state == CONN_HANDSHAKE) {
+        printf("\n[KM] KeyServer::SocketHandler ===>\n");
+        if(SSL_accept(ssl) <= 0) {
+            ERR_print_errors_fp(stderr);
+            return 0;
+        }
+        conn->state = CONN_HELLO;
+        return 1;
+    }
+
+    if(conn->state == CONN_HELLO) {
+        char userID[sizeof(int)];
+        /* read userID from client */
+        if((bytecount = SSL_read(ssl, userID, sizeof(int))) <= 0) {
+            ERR_print_errors_fp(stderr);
+            fprintf(stderr, "Error SSL_read! Error code: %d\n", errno);
+            return 0;
+        }
+        printf("[!>] [SSL:Receive UserID] bytecount: %d\n", bytecount);
+        conn->user = ntohl(*(int *) userID);
+        printf("connection from user %d\n", conn->user);
+        // read the server private key
+        conn->rsa = RSA_new();
+        BIO *key = BIO_new_file("./keys/private.pem", "r");
+        PEM_read_bio_RSAPrivateKey(key, &conn->rsa, NULL, NULL);
+        BIO_free_all(key);
+        conn->state = CONN_REQUEST;
+        return 1;
+    }
+
+    RSA *rsa = conn->rsa;
+    BN_CTX *ctx = worker->bnCtx;
+    BIGNUM *ret = worker->bn;
+
+    // recv the number count of data
+    char head[sizeof(int)];
+    if((bytecount = SSL_read(ssl, head, sizeof(int))) == -1) {
+
+        ERR_print_errors_fp(stderr);
+        fprintf(stderr, "[SSL_read] No count of data received!\n");
+    }
+    /*if client closes, drop the connection*/
+    if(bytecount == 0) {
+        printf("[!>] [KM] client closed!! Closing connection...\n");
+        return 0;
+    }
+
+    if(!checkSSLERRStatus(ssl, bytecount)) {
+        printf("[!>] [SSL Error] Abort operation! Resetting...\n");
+        return 0;
+    }
+    // prepare to recv data itself
+    int num, total;
+    memcpy(&num, head, sizeof(int));
+
+    /* Close the connection when client downloading files. `-202` is set in client::KeyEx::sendEndIndicator */
+    if(num == -202) {
+        printf("[!>] [KM] client download -> client closed!! Closing connection...\n");
+        return 0;
+    }
+
+    if(num < 0 || num > BUFFER_SIZE / RSA_LENGTH) {
+        fprintf(stderr, "Error: invalid count of blinded hashes %d!\n", num);
+        return 0;
+    }
+    ServerStats::countRequest(conn->type);
+
+    // lease the input and output of the request
+    size_t bufferSize = sizeof(char) * num * RSA_LENGTH + sizeof(int);
+    auto *buffer = (char *) BufferArena::lease(bufferSize);
+    auto *output = (char *) BufferArena::lease(bufferSize);
+    if(buffer == NULL || output == NULL) {
+        BufferArena::release(buffer, bufferSize);
+        BufferArena::release(output, bufferSize);
+        return 0;
+    }
+
+    total = 0;
+    // recv data (blinded hash, 1024bits values)
+    while(total < num * RSA_LENGTH) {
+
+        if((bytecount = SSL_read(ssl, buffer + sizeof(int) + total, num * RSA_LENGTH - total)) <= 0) {
+            ERR_print_errors_fp(stderr);
+            fprintf(stderr, "Error SSL_read data(blinded hash, 1024bits values)! Error code: %d\n", errno);
+            BufferArena::release(buffer, bufferSize);
+            BufferArena::release(output, bufferSize);
+            return 0;
+        }
+        total += bytecount;
+    }
+
+    // main loop for computing keys
+    double timer, split;
+    timerStart(&timer);
+    for(int i = 0; i < num; i++) {
+
+        // hash x r^e to BN
+        BN_bin2bn((unsigned char *) (buffer + sizeof(int) + i * RSA_LENGTH), RSA_LENGTH, ret);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+        const BIGNUM *n;
+        const BIGNUM *d;
+        RSA_get0_key(rsa, &n, nullptr, &d);
+        // compute (Hash x r^e)^d mod n
+        BN_mod_exp(ret, ret, d, n, ctx);
+#else
+        // compute (Hash x r^e)^d mod n
+        BN_mod_exp(ret, ret, rsa->d, rsa->n, ctx);
+#endif
+        memset(output + sizeof(int) + i * RSA_LENGTH, 0, RSA_LENGTH);
+        BN_bn2bin(ret, (unsigned char *) output + sizeof(int) + i * RSA_LENGTH + (RSA_LENGTH - BN_num_bytes(ret)));
+        //BN_bn2bin(ret,(unsigned char*)output+sizeof(int)+i*32);
+    }
+    split = timerSplit(&timer);
+    // send back the result
+    total = 0;
+    while(total < num * RSA_LENGTH) {
+
+        if((bytecount = SSL_write(ssl, output + sizeof(int) + total, num * RSA_LENGTH - total)) <= 0) {
+
+            ERR_print_errors_fp(stderr);
+            fprintf(stderr, "Error SSL_write result back to client! Error code: %d\n", errno);
+            BufferArena::release(buffer, bufferSize);
+            BufferArena::release(output, bufferSize);
+            return 0;
+        }
+        total += bytecount;
+    }
+    BufferArena::release(buffer, bufferSize);
+    BufferArena::release(output, bufferSize);
+    return 1;
+}
+
+/*
+ * serve the pending request of a connection according to its service
+ *
+ * @param conn - the client connection
+ * @param worker - the worker serving the request
+ *
+ * @return - a boolean value that indicates if the connection is kept for the next request
+ */
+bool Server::serveConnection(connection_t *conn, worker_t *worker)
+{
+    bool keep = 1;
+
+    switch(conn->type) {
+        case CONN_META:
+        case CONN_DATA:
+            /* the receive buffer is leased for the request only */
+            worker->buffer = (char *) BufferArena::lease(sizeof(char) * BUFFER_LEN);
+            if(worker->buffer == NULL) {
+                return 0;
+            }
+            keep = (conn->type == CONN_META) ? serveMeta(conn, worker) : serveData(conn, worker);
+            BufferArena::release(worker->buffer, sizeof(char) * BUFFER_LEN);
+            worker->buffer = NULL;
+            break;
+        default:
+            /* records already decrypted by TLS are not seen by epoll, serve them before waiting again */
+            do {
+                keep = serveKeyManager(conn, worker);
+            } while(keep && SSL_pending(conn->ssl) > 0);
+            break;
+    }
+
+    countTraffic(conn);
+    return keep;
+}
+
+/*
+ * count the bytes a connection has received and sent since they are last counted, as the kernel reports them
+ *
+ * @param conn - the client connection
+ */
+void Server::countTraffic(connection_t *conn)
+{
+    struct tcp_info info;
+    socklen_t size = sizeof(info);
+
+    /*an older kernel fills in less of the structure, its traffic is then not counted*/
+    memset(&info, 0, sizeof(info));
+    if(getsockopt(conn->sock, IPPROTO_TCP, TCP_INFO, &info, &size) == -1) {
+        return;
+    }
+
+    long bytesIn = (long) info.tcpi_bytes_received;
+    long bytesOut = (long) info.tcpi_bytes_acked;
+    if(bytesIn >= conn->bytesIn && bytesOut >= conn->bytesOut) {
+        ServerStats::countTraffic(conn->type, bytesIn - conn->bytesIn, bytesOut - conn->bytesOut);
+        conn->bytesIn = bytesIn;
+        conn->bytesOut = bytesOut;
+    }
+}
+
+/*
+ * accept all the pending connections of a listener and let epoll watch them
+ *
+ * @param listener - the listener of a service
+ */
+void Server::acceptConnections(connection_t *listener)
+{
+    static const char *names[CONN_SERVICES] = {"Meta", "Data", "KM"};
 
-                ERR_print_errors_fp(stderr);
-                fprintf(stderr, "Error SSL_write result back to client! Error code: %d\n", errno);
-                exit(-1);
+    while(true) {
+        int clientSock = accept(listener->sock, (sockaddr *) &sadr_, &addrSize_);
+        if(clientSock == -1) {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                fprintf(stderr, "[%s] Error accepting %d\n", names[listener->type], errno);
+            }
+            if(errno == EINTR) {
+                continue;
             }
-            total += bytecount;
+            return;
+        }
+        printf("\n[!>] [%s] Received %s connection from %s\n", names[listener->type], names[listener->type],
+               inet_ntoa(sadr_.sin_addr));
+
+        /*a worker waits at most SERVER_RECV_TIMEOUT for the rest of a request, a stalled client is dropped*/
+        struct timeval timeout = {SERVER_RECV_TIMEOUT, 0};
+        if(setsockopt(clientSock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1) {
+            fprintf(stderr, "[%s] Error setting receive timeout %d\n", names[listener->type], errno);
+        }
+
+        auto *conn = (connection_t *) malloc(sizeof(connection_t));
+        conn->sock = clientSock;
+        conn->type = listener->type;
+        conn->state = CONN_HELLO;
+        conn->user = 0;
+        conn->credit = 0;
+        conn->nextRecordID = 0;
+        conn->total_numOfShares = 0;
+        conn->bytesIn = 0;
+        conn->bytesOut = 0;
+        conn->ssl = NULL;
+        conn->rsa = NULL;
+        initUploadWindow(conn->window);
+        if(conn->type == CONN_KM) {
+            // SSL verify
+            conn->ssl = SSL_new(ctx_);
+            SSL_set_fd(conn->ssl, clientSock);
+            conn->state = CONN_HANDSHAKE;
         }
+        ServerStats::countConnection(conn->type, true);
+
+        if(!watchConnection(conn, EPOLL_CTL_ADD)) {
+            closeConnection(conn);
+        }
+    }
+}
+
+/*
+ * let epoll report the next request of a connection (once, to one worker)
+ *
+ * @param conn - the listener or the client connection
+ * @param op - EPOLL_CTL_ADD for a new connection, EPOLL_CTL_MOD once its request is served
+ *
+ * @return - a boolean value that indicates if the connection is watched
+ */
+bool Server::watchConnection(connection_t *conn, int op)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = (conn->state == CONN_LISTEN) ? EPOLLIN : (EPOLLIN | EPOLLRDHUP | EPOLLONESHOT);
+    event.data.ptr = conn;
+
+    if(epoll_ctl(epollFD_, op, conn->sock, &event) == -1) {
+        fprintf(stderr, "Error watching connection %d\n", errno);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * close a client connection and release what it keeps
+ *
+ * @param conn - the client connection
+ */
+void Server::closeConnection(connection_t *conn)
+{
+    static const char *names[CONN_SERVICES] = {"Meta", "Data", "KM"};
+
+    epoll_ctl(epollFD_, EPOLL_CTL_DEL, conn->sock, NULL);
+    countTraffic(conn);
+    ServerStats::countConnection(conn->type, false);
+    if(conn->ssl != NULL) {
+        SSL_free(conn->ssl);
+    }
+    if(conn->rsa != NULL) {
+        RSA_free(conn->rsa);
     }
-    BN_CTX_free(ctx);
-    BN_clear_free(ret);
-    printf("[!>] [KM] Thread Exiting...\n");
-    printf("[!>] [KM] Current Time: ");
+    close(conn->sock);
+    freeUploadWindow(conn->window);
+    returnUploadCredit(conn);
+
+    printf("[!>] [%s] Connection of user %d closed\n", names[conn->type], conn->user);
+    printf("[!>] [%s] Current Time: ", names[conn->type]);
     Logger::printCurrentTime();
     printf("\n");
     printf("[!>] =======================\n\n");
-    //clean up
-    BIO_free_all(key);
-    RSA_free(rsa);
-    SSL_free(ssl);
-    free(buffer);
-    free(output);
-    free(clientSock);
-    return 0;
+    free(conn);
 }
 
 /*
- * start linsten sockets and bind correct thread for coming connection
+ * hand a connection with a pending request to the workers of its pool, waiting while too many are queued
  *
+ * @param conn - the client connection
  */
-void Server::runReceive()
+void Server::pushReady(connection_t *conn)
 {
+    int pool = (conn->type == CONN_KM) ? SERVER_POOL_KM : SERVER_POOL_STORE;
+
+    pthread_mutex_lock(&readyLock_);
+    while(readyQueue_[pool].size() >= SERVER_QUEUE_SIZE) {
+        pthread_cond_wait(&readyNotFull_[pool], &readyLock_);
+    }
+    readyQueue_[pool].push_back(conn);
+    pthread_cond_signal(&readyNotEmpty_[pool]);
+    pthread_mutex_unlock(&readyLock_);
+}
+
+/*
+ * take the next connection with a pending request of a pool, waiting for one
+ *
+ * @param pool - SERVER_POOL_STORE or SERVER_POOL_KM
+ *
+ * @return - the client connection
+ */
+Server::connection_t *Server::popReady(int pool)
+{
+    pthread_mutex_lock(&readyLock_);
+    while(readyQueue_[pool].empty()) {
+        pthread_cond_wait(&readyNotEmpty_[pool], &readyLock_);
+    }
+    connection_t *conn = readyQueue_[pool].front();
+    readyQueue_[pool].pop_front();
+    pthread_cond_signal(&readyNotFull_[pool]);
+    pthread_mutex_unlock(&readyLock_);
+
+    return conn;
+}
+
+/*
+ * Worker Thread function: serve one request at a time from whichever connection of its pool has one pending
+ *
+ * @param lp - the server object and the pool (restorer_t)
+ */
+void *Server::workerThread(void *lp)
+{
+    auto *param = (restorer_t *) lp;
+    Server *obj = param->obj;
+    int pool = param->type;
+    free(param);
+
+    //the buffers are leased per request, neither an idle worker nor an idle connection holds any
+    worker_t worker;
+    worker.buffer = NULL;
+    worker.bnCtx = BN_CTX_new();
+    worker.bn = BN_new();
+    worker.hashObj = new CryptoPrimitive(SHA256_TYPE);
 
-    addrSize_ = sizeof(sockaddr_in);
-    pthread_mutex_init(&mutex, NULL);
-    //create a thread whenever a client connects
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wmissing-noreturn"
     while(true) {
+        connection_t *conn = obj->popReady(pool);
+        ServerStats::countWorker(true);
+
+        /*wait for the next request of the connection unless it is done or hands over a restore*/
+        bool keep = obj->serveConnection(conn, &worker);
+        if(keep && conn->state == CONN_RESTORE) {
+            obj->pushRestore(conn);
+        } else if(!keep || !obj->watchConnection(conn, EPOLL_CTL_MOD)) {
+            obj->closeConnection(conn);
+        }
+        ServerStats::countWorker(false);
+    }
+#pragma clang diagnostic pop
+    return 0;
+}
 
-        printf("[!>] Server::runReceive ===>\n");
-        printf("[!>] runReceive: waiting for a connection\n");
-        dataclientSock_ = (int *) malloc(sizeof(int));
-        metaclientSock_ = (int *) malloc(sizeof(int));
-        kmclientSock_ = (int *) malloc(sizeof(int));
+/*
+ * hand a connection requesting a restore to the restore threads of its service
+ *
+ * @param conn - the client connection
+ */
+void Server::pushRestore(connection_t *conn)
+{
+    pthread_mutex_lock(&restoreLock_);
+    restoreQueue_[conn->type].push_back(conn);
+    pthread_cond_signal(&restoreNotEmpty_[conn->type]);
+    pthread_mutex_unlock(&restoreLock_);
+}
 
-        /* Data Client Socket  */
-        if((*dataclientSock_ = accept(dataHostSock_, (sockaddr *) &sadr_, &addrSize_)) != -1) {
+/*
+ * take the next connection requesting a restore of a service, waiting for one
+ *
+ * @param type - CONN_META or CONN_DATA
+ *
+ * @return - the client connection
+ */
+Server::connection_t *Server::popRestore(int type)
+{
+    pthread_mutex_lock(&restoreLock_);
+    while(restoreQueue_[type].empty()) {
+        pthread_cond_wait(&restoreNotEmpty_[type], &restoreLock_);
+    }
+    connection_t *conn = restoreQueue_[type].front();
+    restoreQueue_[type].pop_front();
+    pthread_mutex_unlock(&restoreLock_);
 
-            printf("\n[!>] [Data] <Server::runReceive> Received data connection===>\n");
-            printf("\n[!>] [Data] Received data connection from %s\n", inet_ntoa(sadr_.sin_addr));
-            pthread_create(&threadId_, 0, &SocketHandlerData, (void *) dataclientSock_);
+    return conn;
+}
 
-            pthread_detach(threadId_);
+/*
+ * Restore Thread function: serve one restore at a time of a service, the workers go on with the other requests
+ *
+ * @param lp - the server object and the service (restorer_t)
+ */
+void *Server::restoreThread(void *lp)
+{
+    auto *param = (restorer_t *) lp;
+    Server *obj = param->obj;
+    int type = param->type;
+    free(param);
 
-        } else {
+    worker_t worker;
+    worker.buffer = NULL;
+    worker.bnCtx = NULL;
+    worker.bn = NULL;
+    worker.hashObj = new CryptoPrimitive(SHA256_TYPE);
 
-            fprintf(stderr, "[Data] Error accepting %d\n", errno);
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wmissing-noreturn"
+    while(true) {
+        connection_t *conn = obj->popRestore(type);
+
+        /*the receive buffer is leased for the restore only, the connection is closed once it is sent*/
+        worker.buffer = (char *) BufferArena::lease(sizeof(char) * BUFFER_LEN);
+        if(worker.buffer != NULL) {
+            if(type == CONN_META) {
+                restoreMeta(conn, &worker);
+            } else {
+                restoreData(conn, &worker);
+            }
+            BufferArena::release(worker.buffer, sizeof(char) * BUFFER_LEN);
+            worker.buffer = NULL;
         }
+        obj->closeConnection(conn);
+    }
+#pragma clang diagnostic pop
+    return 0;
+}
 
-        /* Meta Client Socket  */
-        if((*metaclientSock_ = accept(metaHostSock_, (sockaddr *) &sadr_, &addrSize_)) != -1) {
+/*
+ * report the live statistics to a client of the admin socket
+ *
+ * @param clientSock - the client socket, it sends "text" or "json" and reads the report in that format
+ */
+void Server::serveAdmin(int clientSock)
+{
+    char request[64];
+    struct timeval timeout = {1, 0};
+    std::string report;
+
+    /*a client that sends nothing gets the text report*/
+    setsockopt(clientSock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ssize_t size = recv(clientSock, request, sizeof(request) - 1, 0);
+    request[size > 0 ? size : 0] = '\0';
+
+    int format = STATS_TEXT;
+    if(strncmp(request, "json", 4) == 0) {
+        format = STATS_JSON;
+    } else if(size > 0 && strncmp(request, "text", 4) != 0) {
+        report = "Error: unknown request, send \"text\" or \"json\"\n";
+    }
 
-            printf("\n[!>] [Meta] <Server::runReceive> Received meta connection===>\n");
-            printf("\n[!>] [Meta] Received meta connection from %s\n", inet_ntoa(sadr_.sin_addr));
-            pthread_create(&threadId_, 0, &SocketHandlerMeta, (void *) metaclientSock_);
+    if(report.empty()) {
+        std::map<int, size_t> bufferNodes[STATS_SERVICES];
+        if(metaDedupObj_ != NULL) {
+            metaDedupObj_->reportBufferNodes(bufferNodes[CONN_META]);
+        }
+        if(dataDedupObj_ != NULL) {
+            dataDedupObj_->reportBufferNodes(bufferNodes[CONN_DATA]);
+        }
 
-            pthread_detach(threadId_);
+        pthread_mutex_lock(&readyLock_);
+        int queued = readyQueue_[SERVER_POOL_STORE].size() + readyQueue_[SERVER_POOL_KM].size();
+        pthread_mutex_unlock(&readyLock_);
 
-        } else {
+        ServerStats::report(report, format, queued, bufferNodes);
+    }
 
-            fprintf(stderr, "[Meta] Error accepting %d\n", errno);
+    size_t count = 0;
+    while(count < report.size()) {
+        ssize_t bytecount = send(clientSock, report.data() + count, report.size() - count, MSG_NOSIGNAL);
+        if(bytecount == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Error sending statistics %d\n", errno);
+            return;
         }
+        count += bytecount;
+    }
+}
+
+/*
+ * Admin Thread function: listen on the admin socket and report the live statistics to each of its clients in turn
+ *
+ * @param lp - the server object
+ */
+void *Server::adminThread(void *lp)
+{
+    auto *obj = (Server *) lp;
+    struct sockaddr_un addr;
 
-        /* Key Manager Client Socket  */
-        if((*kmclientSock_ = accept(kmHostSock_, (sockaddr *) &sadr_, &addrSize_)) != -1) {
+    int adminSock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(adminSock == -1) {
+        fprintf(stderr, "Error initializing admin socket %d\n", errno);
+        return 0;
+    }
 
-            printf("\n[!>] [KM] <Server::runReceive> Received km connection===>\n");
-            printf("\n[!>] [KM] Received km connection from %s\n", inet_ntoa(sadr_.sin_addr));
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, ADMIN_SOCKET, sizeof(addr.sun_path) - 1);
 
-            // SSL verify
-            ssl_ = SSL_new(ctx_);
-            SSL_set_fd(ssl_, *kmclientSock_);
-            if(SSL_accept(ssl_) <= 0) {
-                ERR_print_errors_fp(stderr);
+    /*the socket of a previous run is replaced, and only the user running the server may connect*/
+    unlink(ADMIN_SOCKET);
+    if(bind(adminSock, (sockaddr *) &addr, sizeof(addr)) == -1 || chmod(ADMIN_SOCKET, S_IRUSR | S_IWUSR) == -1 ||
+       listen(adminSock, SOMAXCONN) == -1) {
+        fprintf(stderr, "Error setting up admin socket %s %d\n", ADMIN_SOCKET, errno);
+        close(adminSock);
+        return 0;
+    }
+    printf("[!>] statistics on %s (send \"text\" or \"json\")\n", ADMIN_SOCKET);
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wmissing-noreturn"
+    while(true) {
+        int clientSock = accept(adminSock, NULL, NULL);
+        if(clientSock == -1) {
+            if(errno != EINTR) {
+                fprintf(stderr, "Error accepting admin connection %d\n", errno);
             }
-            auto *temp = new km_param;
-            temp->obj = this;
-            temp->kmclientSocket = kmclientSock_;
-            pthread_create(&threadId_, 0, &SocketHandlerKeyManager, (void *) temp);
+            continue;
+        }
+        obj->serveAdmin(clientSock);
+        close(clientSock);
+    }
+#pragma clang diagnostic pop
+    return 0;
+}
 
-            pthread_detach(threadId_);
+/*
+ * start listen sockets, accept the connections of all services as they come and hand their requests to the workers
+ *
+ */
+void Server::runReceive()
+{
 
-        } else {
+    addrSize_ = sizeof(sockaddr_in);
+
+    /*a client closing mid-reply fails the send and drops its connection instead of killing the server*/
+    signal(SIGPIPE, SIG_IGN);
+
+    pthread_mutex_init(&readyLock_, NULL);
+    for(int i = 0; i < SERVER_POOLS; i++) {
+        pthread_cond_init(&readyNotEmpty_[i], NULL);
+        pthread_cond_init(&readyNotFull_[i], NULL);
+    }
+    pthread_mutex_init(&restoreLock_, NULL);
+    pthread_cond_init(&restoreNotEmpty_[CONN_META], NULL);
+    pthread_cond_init(&restoreNotEmpty_[CONN_DATA], NULL);
+
+    epollFD_ = epoll_create1(0);
+    if(epollFD_ == -1) {
+        fprintf(stderr, "Error creating epoll instance %d\n", errno);
+        return;
+    }
+
+    /*the listeners are watched together, an idle service never holds up the accepts of another*/
+    listeners_[CONN_META].sock = metaHostSock_;
+    listeners_[CONN_DATA].sock = dataHostSock_;
+    listeners_[CONN_KM].sock = kmHostSock_;
+    for(int i = 0; i < CONN_SERVICES; i++) {
+        listeners_[i].type = i;
+        listeners_[i].state = CONN_LISTEN;
+        if(!watchConnection(&listeners_[i], EPOLL_CTL_ADD)) {
+            return;
+        }
+    }
+
+    for(int i = 0; i < SERVER_WORKER_NUM; i++) {
+        auto *param = (restorer_t *) malloc(sizeof(restorer_t));
+        param->obj = this;
+        param->type = SERVER_POOL_STORE;
+        pthread_create(&workers_[i], 0, &workerThread, (void *) param);
+        pthread_detach(workers_[i]);
+    }
+
+    /*the key manager connections have workers of their own, slow TLS clients never hold up the meta and data ones*/
+    for(int i = 0; i < SERVER_KM_WORKER_NUM; i++) {
+        auto *param = (restorer_t *) malloc(sizeof(restorer_t));
+        param->obj = this;
+        param->type = SERVER_POOL_KM;
+        pthread_t kmWorker;
+        pthread_create(&kmWorker, 0, &workerThread, (void *) param);
+        pthread_detach(kmWorker);
+    }
+
+    /*the restores of each service have threads of their own, they never hold up the workers*/
+    for(int type = CONN_META; type <= CONN_DATA; type++) {
+        for(int i = 0; i < SERVER_RESTORE_NUM; i++) {
+            auto *param = (restorer_t *) malloc(sizeof(restorer_t));
+            param->obj = this;
+            param->type = type;
+            pthread_t restorer;
+            pthread_create(&restorer, 0, &restoreThread, (void *) param);
+            pthread_detach(restorer);
+        }
+    }
+
+    /*the statistics are reported by a thread of their own, a report is still served when every worker is busy*/
+    pthread_t admin;
+    pthread_create(&admin, 0, &adminThread, (void *) this);
+    pthread_detach(admin);
+
+    printf("[!>] Server::runReceive ===>\n");
+    printf("[!>] runReceive: waiting for connections\n");
+    struct epoll_event events[SERVER_EPOLL_EVENTS];
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wmissing-noreturn"
+    while(true) {
 
-            fprintf(stderr, "[KM] Error accepting %d\n", errno);
+        int numOfEvents = epoll_wait(epollFD_, events, SERVER_EPOLL_EVENTS, -1);
+        if(numOfEvents == -1) {
+            if(errno != EINTR) {
+                fprintf(stderr, "Error waiting for connections %d\n", errno);
+            }
+            continue;
+        }
+
+        for(int i = 0; i < numOfEvents; i++) {
+            auto *conn = (connection_t *) events[i].data.ptr;
+            if(conn->state == CONN_LISTEN) {
+                acceptConnections(conn);
+            } else {
+                /*the connection is not reported again until its worker has served the request*/
+                pushReady(conn);
+            }
         }
     }
 
 #pragma clang diagnostic pop
-    pthread_mutex_destroy(&mutex);
+    close(epollFD_);
 }
 
 /*
@@ -773,7 +1850,6 @@ void Server::runReceive()
 Server::~Server()
 {
 
-    SSL_free(ssl_);
     SSL_CTX_free(ctx_);
     cleanup_openssl();
 }
@@ -861,50 +1937,3 @@ bool Server::checkSSLERRStatus(SSL *ssl, int byteCount)
             return true;
     }
 }
-
-/*
- * rebuild file recipe by downloaded metadata chunk & keyRecipe
- *
- * @param input - metadata chunk object
- * @param index - cloud id that metadata chunk download
- *
- */
-int Server::writeRetrievedFileRecipe(ItemMeta_t &input, int index)
-{
-
-    char nameBuffer[256];
-    memset(nameBuffer, 0, 256);
-    sprintf(nameBuffer, "share-%d.recipe", index);
-    string writeName(nameBuffer);
-
-    /* -n = ~n + 1 */
-    int metaChunkID = ~input.shareObj.share_header.secretID + 1;
-
-    memset(nameBuffer, 0, 256);
-
-    FILE *fp = fopen(writeName.c_str(), "ab+");
-    if(fp == NULL) {
-        printf("can't open recipe file %s\n", writeName.c_str());
-        return 0;
-    } else {
-        fseek(fp, 0, SEEK_END);
-        int nodeNumber = input.shareObj.share_header.shareSize / sizeof(metaNode);
-        unique_ptr<int[]> fileSizeCounter(new int[5]);
-        for(int i = 0; i < nodeNumber; i++) {
-
-            metaNode newNode;
-            memcpy(&newNode, input.shareObj.data + i * sizeof(metaNode), sizeof(metaNode));
-            fileRecipeEntry_t writeEntryNode;
-            memcpy(writeEntryNode.shareFP, newNode.shareFP, FP_SIZE);
-            writeEntryNode.secretID = newNode.secretID;
-            writeEntryNode.secretSize = newNode.secretSize;
-            writeEntryNode.segID = newNode.segID;
-            fileSizeCounter[index] += newNode.secretSize;
-            fwrite(&writeEntryNode, sizeof(fileRecipeEntry_t), 1, fp);
-        }
-        fclose(fp);
-
-        return 1;
-    }
-    return 1;
-}
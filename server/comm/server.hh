@@ -14,10 +14,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
+#include <deque>
 
 #include "BackendStorer.hh"
+#include "BufferArena.hh"
+#include "ServerStats.hh"
 #include "DedupCore.hh"
 #include "minDedupCore.hh"
 #include "Logger.hh"
@@ -28,9 +34,55 @@
 #define META (-1)
 #define DATA (-2)
 #define STAT (-3)
+/* a batch of references: [fileShareMDHead_t + full file name + [shareFP + varints of the zigzag deltas of
+   (secretID, secretSize, shareSize, segID, shareID) against the previous share] ...] ..., acknowledged without
+   a status list once the references are accepted */
+#define META_REF (-4)
 #define DOWNLOAD (-7)
 #define UPLOAD_FILE_META (-8)
 #define INIT_REQUEST (-9)
+/* acknowledgement that the recipe entries of an upload batch are recorded */
+#define ACK (-10)
+
+/* max number of upload batches a client may keep outstanding on a connection (granted on connection, fewer if the
+   buffer arena cannot hold them) */
+#define UPLOAD_CREDIT 4
+
+/* number of worker threads serving the requests of the meta and data connections */
+#define SERVER_WORKER_NUM 16
+/* number of worker threads serving the key manager connections, whose TLS handshakes and reads block apart from the
+   meta and data requests */
+#define SERVER_KM_WORKER_NUM 8
+/* pools of worker threads, each with its own queue of connections with a pending request */
+#define SERVER_POOL_STORE 0
+#define SERVER_POOL_KM 1
+#define SERVER_POOLS 2
+/* number of connections with a pending request that may wait for a worker */
+#define SERVER_QUEUE_SIZE 1024
+/* max number of events taken from epoll at once */
+#define SERVER_EPOLL_EVENTS 64
+/* number of restore threads of each of the meta and data services, a restore runs until its file is sent and is
+   never served by a worker, the restores beyond them wait for one */
+#define SERVER_RESTORE_NUM 4
+/* seconds a request may take to arrive in full before its connection is dropped */
+#define SERVER_RECV_TIMEOUT 30
+
+/* services of the server, one listener each */
+#define CONN_META 0
+#define CONN_DATA 1
+#define CONN_KM 2
+#define CONN_SERVICES 3
+
+/* local socket reporting the live statistics, send "text" or "json" and read the report */
+#define ADMIN_SOCKET "./admin.sock"
+
+/* states of a connection: a listener, or a client going through the protocol of its service */
+#define CONN_LISTEN 0
+#define CONN_HANDSHAKE 1
+#define CONN_HELLO 2
+#define CONN_REQUEST 3
+/* the client requests a restore, the connection waits for a restore thread and is closed once it is sent */
+#define CONN_RESTORE 4
 
 #define KEYFILE (-108)
 #define KEY_RECIPE (-101)
@@ -75,33 +127,161 @@ private:
     //socket size
     socklen_t addrSize_;
 
-    //client socket
-    int *dataclientSock_;
-    int *metaclientSock_;
-    int *kmclientSock_;
     //socket address
     struct sockaddr_in sadr_;
 
-    //thread ID
-    pthread_t threadId_;
-
     // SSL context
     SSL_CTX *ctx_;
 
+    /* upload batch whose first-stage deduplication is done and whose data is awaited */
+    typedef struct {
+        int batchID;
+        /* slot of the file the batch belongs to, files uploaded at once are interleaved on a connection */
+        int fileID;
+        bool inUse;
+        char *metaBuffer;
+        int metaSize;
+        bool *statusList;
+        /* the sizes the buffers are leased with */
+        int metaLease;
+        int statusLease;
+        /* references accepted but held back until the earlier batches are recorded */
+        bool refAccepted;
+        bool end;
+    } uploadBatch_t;
+
+    /* a listener or a client connection, with what the protocol keeps between the requests of the client */
+    typedef struct {
+        int sock;
+        /* CONN_META, CONN_DATA or CONN_KM */
+        int type;
+        /* CONN_LISTEN, CONN_HANDSHAKE (key manager only), CONN_HELLO, CONN_REQUEST or CONN_RESTORE */
+        int state;
+        int user;
+        uploadBatch_t window[UPLOAD_CREDIT];
+        /* the upload batches granted to the client, their memory is reserved in the buffer arena while connected */
+        int credit;
+        /*batches are recorded in order, the ID of the next one*/
+        int nextRecordID;
+        int total_numOfShares;
+        /* the bytes received and sent already counted in the statistics */
+        long bytesIn;
+        long bytesOut;
+        /* key manager only */
+        SSL *ssl;
+        RSA *rsa;
+    } connection_t;
+
+    /* what a worker thread needs to serve one request, whichever connection it comes from */
+    typedef struct {
+        /* the receive buffer, leased for the request */
+        char *buffer;
+        BN_CTX *bnCtx;
+        BIGNUM *bn;
+        CryptoPrimitive *hashObj;
+    } worker_t;
+
+    //epoll instance watching the listeners and the idle client connections
+    int epollFD_;
+
+    //listeners of the services
+    connection_t listeners_[CONN_SERVICES];
+
+    //worker threads
+    pthread_t workers_[SERVER_WORKER_NUM];
+
+    //connections with a pending request, waiting for a worker of their pool
+    std::deque<connection_t *> readyQueue_[SERVER_POOLS];
+    pthread_mutex_t readyLock_;
+    pthread_cond_t readyNotEmpty_[SERVER_POOLS];
+    pthread_cond_t readyNotFull_[SERVER_POOLS];
+
+    //connections requesting a restore, waiting for a restore thread of their service (meta or data)
+    std::deque<connection_t *> restoreQueue_[CONN_KM];
+    pthread_mutex_t restoreLock_;
+    pthread_cond_t restoreNotEmpty_[CONN_KM];
+
+    /* what a worker or restore thread is started with */
     typedef struct {
         Server *obj;
-        int *kmclientSocket;
-    }km_param;
+        /* the pool of a worker (SERVER_POOL_STORE or SERVER_POOL_KM), the service of a restore thread (CONN_META or
+           CONN_DATA) */
+        int type;
+    } restorer_t;
+
+    //upload memory reserved by the credits granted to the connected clients
+    static pthread_mutex_t uploadLock_;
+    static size_t uploadReserved_;
+
+    static void initUploadWindow(uploadBatch_t *window);
+
+    static void freeUploadWindow(uploadBatch_t *window);
+
+    static uploadBatch_t *newUploadBatch(connection_t *conn, int batchID, int metaSize, int numOfShares);
+
+    static uploadBatch_t *findUploadBatch(uploadBatch_t *window, int batchID);
+
+    static uploadBatch_t *findDeferredBatch(uploadBatch_t *window, int batchID);
+
+    static int expandReferences(const char *refList, int refSize, char *metaBuffer, int *numOfShares);
+
+    static int countShares(const char *metaBuffer, int metaSize);
+
+    static bool recvFully(int clientSock, void *buffer, int size);
+
+    static void retireUploadBatch(uploadBatch_t *batch);
+
+    static size_t uploadBatchMemory();
+
+    static bool grantUploadCredit(connection_t *conn);
+
+    static void returnUploadCredit(connection_t *conn);
+
+    static bool sendAck(int clientSock, int batchID, bool recorded);
+
+    static bool sendStatus(int clientSock, int batchID, bool *statusList, int numOfShares);
 
     static void timerStart(double *t);
 
     static double timerSplit(const double *t);
 
-    static void *SocketHandlerMeta(void *lp);
+    static bool serveMeta(connection_t *conn, worker_t *worker);
 
-    static void *SocketHandlerData(void *lp);
+    static bool serveData(connection_t *conn, worker_t *worker);
 
-    static void *SocketHandlerKeyManager(void *lp);
+    static void restoreMeta(connection_t *conn, worker_t *worker);
+
+    static void restoreData(connection_t *conn, worker_t *worker);
+
+    static bool serveKeyManager(connection_t *conn, worker_t *worker);
+
+    static bool greetClient(connection_t *conn, char *buffer);
+
+    static void countTraffic(connection_t *conn);
+
+    bool serveConnection(connection_t *conn, worker_t *worker);
+
+    void acceptConnections(connection_t *listener);
+
+    bool watchConnection(connection_t *conn, int op);
+
+    void closeConnection(connection_t *conn);
+
+    void pushReady(connection_t *conn);
+
+    connection_t *popReady(int pool);
+
+    static void *workerThread(void *lp);
+
+    void pushRestore(connection_t *conn);
+
+    connection_t *popRestore(int type);
+
+    static void *restoreThread(void *lp);
+
+    void serveAdmin(int clientSock);
+
+    static void *adminThread(void *lp);
 
     void init_openssl();
 
@@ -114,9 +294,6 @@ private:
     static bool checkSSLERRStatus(SSL *ssl, int byteCount);
 
 public:
-    // SSL connection structure
-    SSL *ssl_;
-
     /*the entry structure of the recipes of a file*/
     typedef struct {
         char shareFP[FP_SIZE];
@@ -161,8 +338,6 @@ public:
 
     ~Server();
 
-    int writeRetrievedFileRecipe(ItemMeta_t &input, int index);
-
 };
 
 #endif
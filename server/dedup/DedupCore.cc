@@ -5,6 +5,7 @@
  */
 
 #include "DedupCore.hh"
+#include "DeltaVarint.hh"
 #include <cstdio>
 
 using namespace std;
@@ -31,7 +32,6 @@ DedupCore::DedupCore(const std::string &dedupDirName, const std::string &dbDirNa
     recipeStorerObj_ = recipeStorerObj;
     containerStorerObj_ = containerStorerObj;
 
-    last_share_on_server_ = false;
 
     /*format all input dir names*/
     if(!formatDirName_(dedupDirName_)) {
@@ -458,6 +458,53 @@ inline void DedupCore::getCurrTime_(double &time)
     time = (double) tv.tv_sec + (double) tv.tv_usec * 1e-6;
 }
 
+/*
+ * look a key up in the database, timed for the live statistics
+ *
+ * @param key - the key
+ * @param value - the value of the key <return>
+ *
+ * @return - the status of the lookup
+ */
+leveldb::Status DedupCore::dbGet_(const leveldb::Slice &key, std::string *value)
+{
+    long start = ServerStats::clockMicros();
+    leveldb::Status stat = db_->Get(readOptions_, key, value);
+    ServerStats::recordLatency(STATS_DB_GET, start);
+    return stat;
+}
+
+/*
+ * store a key-value entry into the database, timed for the live statistics
+ *
+ * @param key - the key
+ * @param value - the value
+ *
+ * @return - the status of the write
+ */
+leveldb::Status DedupCore::dbPut_(const leveldb::Slice &key, const leveldb::Slice &value)
+{
+    long start = ServerStats::clockMicros();
+    leveldb::Status stat = db_->Put(writeOptions_, key, value);
+    ServerStats::recordLatency(STATS_DB_WRITE, start);
+    return stat;
+}
+
+/*
+ * apply a write batch to the database, timed for the live statistics
+ *
+ * @param batch - the write batch
+ *
+ * @return - the status of the write
+ */
+leveldb::Status DedupCore::dbWrite_(leveldb::WriteBatch *batch)
+{
+    long start = ServerStats::clockMicros();
+    leveldb::Status stat = db_->Write(writeOptions_, batch);
+    ServerStats::recordLatency(STATS_DB_WRITE, start);
+    return stat;
+}
+
 /*
  * flush a buffer node into the disk
  *
@@ -631,6 +678,7 @@ bool DedupCore::flushBufferNodeIntoDisk_(perUserBufferNode_t *targetBufferNode)
         }
 
         /*create a container file for writing shares*/
+        long flushStart = ServerStats::clockMicros();
         fp = fopen(shareContainerName.c_str(), "wb");
         if(fp == NULL) {
             fprintf(stderr, "Error: fail to open the file '%s' for writing shares!\n", shareContainerName.c_str());
@@ -646,6 +694,7 @@ bool DedupCore::flushBufferNodeIntoDisk_(perUserBufferNode_t *targetBufferNode)
         }
 
         fclose(fp);
+        ServerStats::recordLatency(STATS_CONTAINER_FLUSH, flushStart);
 
         if(containerStorerObj_ != NULL) {
             containerStorerObj_->addNewFile(shareContainerName);
@@ -661,7 +710,7 @@ bool DedupCore::flushBufferNodeIntoDisk_(perUserBufferNode_t *targetBufferNode)
  * @param userID - the user id
  * @param targetBufferNode - the resulting buffer node <return>
  */
-void DedupCore::findOrCreateBufferNode_(const int &userID, perUserBufferNode_t *&targetBufferNode)
+void DedupCore::findOrCreateBufferNode_(const int &userID, const int &fileID, perUserBufferNode_t *&targetBufferNode)
 {
     perUserBufferNode_t *currBufferNode, *preBufferNode;
     double currTime, preTime;
@@ -677,7 +726,7 @@ void DedupCore::findOrCreateBufferNode_(const int &userID, perUserBufferNode_t *
     while(currBufferNode != NULL) {
         goForward = 1;
 
-        if(currBufferNode->userID == userID) {
+        if(currBufferNode->userID == userID && currBufferNode->fileID == fileID) {
             getCurrTime_(currTime);
             currBufferNode->lastUseTime = currTime;
             targetBufferNode = currBufferNode;
@@ -737,6 +786,7 @@ void DedupCore::findOrCreateBufferNode_(const int &userID, perUserBufferNode_t *
         targetBufferNode = (perUserBufferNode_t *) malloc(perUserBufferNodeSize_);
 
         targetBufferNode->userID = userID;
+        targetBufferNode->fileID = fileID;
 
         /*get the mutex lock globalRecipeFileNameLock_*/
         pthread_mutex_lock(&globalRecipeFileNameLock_);
@@ -828,7 +878,7 @@ bool DedupCore::addFileIntoInodeIndex_(const std::string &fullFileName, const in
     pthread_mutex_lock(&DBLock_);
 
     /*enquire the key in the database*/
-    fileStat = db_->Get(readOptions_, *fileKeySlice, &valueString);
+    fileStat = dbGet_(*fileKeySlice, &valueString);
 
     /*if such an inode for fullFileName exists*/
     if(fileStat.ok()) {
@@ -866,7 +916,7 @@ bool DedupCore::addFileIntoInodeIndex_(const std::string &fullFileName, const in
         batch_.Put(*fileKeySlice, *valueSlice);
 
         /*execute all batched database update ops*/
-        leveldb::Status writeStat = db_->Write(writeOptions_, &batch_);
+        leveldb::Status writeStat = dbWrite_(&batch_);
         if(writeStat.ok() == false) {
             fprintf(stderr, "Error: fail to perform batched writes!\n");
             fprintf(stderr, "Status: %s \n", writeStat.ToString().c_str());
@@ -920,7 +970,7 @@ bool DedupCore::addFileIntoInodeIndex_(const std::string &fullFileName, const in
         pthread_mutex_lock(&DBLock_);
 
         /*store the key-value entry into the inode index*/
-        db_->Put(writeOptions_, *fileKeySlice, *valueSlice);
+        dbPut_(*fileKeySlice, *valueSlice);
 
         /*release the mutex lock DBLock_*/
         pthread_mutex_unlock(&DBLock_);
@@ -943,7 +993,7 @@ bool DedupCore::addFileIntoInodeIndex_(const std::string &fullFileName, const in
             pthread_mutex_lock(&DBLock_);
 
             /*enquire the key in the database*/
-            dirStat = db_->Get(readOptions_, *dirKeySlice, &valueString);
+            dirStat = dbGet_(*dirKeySlice, &valueString);
 
             /*if such an inode for dirName exists*/
             if(dirStat.ok()) {
@@ -993,7 +1043,7 @@ bool DedupCore::addFileIntoInodeIndex_(const std::string &fullFileName, const in
                     batch_.Put(*dirKeySlice, *valueSlice);
 
                     /*execute all batched database update ops*/
-                    leveldb::Status writeStat = db_->Write(writeOptions_, &batch_);
+                    leveldb::Status writeStat = dbWrite_(&batch_);
                     if(writeStat.ok() == false) {
                         fprintf(stderr, "Error: fail to perform batched writes!\n");
                         fprintf(stderr, "Status: %s \n", writeStat.ToString().c_str());
@@ -1061,7 +1111,7 @@ bool DedupCore::addFileIntoInodeIndex_(const std::string &fullFileName, const in
                 pthread_mutex_lock(&DBLock_);
 
                 /*(b) store the key-value entry into the inode index*/
-                db_->Put(writeOptions_, *dirKeySlice, *valueSlice);
+                dbPut_(*dirKeySlice, *valueSlice);
 
                 /*release the mutex lock DBLock_*/
                 pthread_mutex_unlock(&DBLock_);
@@ -1161,7 +1211,7 @@ bool DedupCore::intraUserIndexUpdate_(char *shareFP, const int &userID, bool &in
     /*get the mutex lock DBLock_*/
     pthread_mutex_lock(&DBLock_);
 
-    leveldb::Status getStat = db_->Get(readOptions_, *keySlice, &valueString);
+    leveldb::Status getStat = dbGet_(*keySlice, &valueString);
 
     if(getStat.ok()) {
         valueOffset = 0;
@@ -1203,7 +1253,7 @@ bool DedupCore::intraUserIndexUpdate_(char *shareFP, const int &userID, bool &in
             batch_.Put(*keySlice, *valueSlice);
 
             /*execute all batched database update ops*/
-            leveldb::Status writeStat = db_->Write(writeOptions_, &batch_);
+            leveldb::Status writeStat = dbWrite_(&batch_);
             if(writeStat.ok() == false) {
                 fprintf(stderr, "Error: fail to perform batched writes!\n");
                 fprintf(stderr, "Status: %s \n", writeStat.ToString().c_str());
@@ -1293,9 +1343,11 @@ bool DedupCore::interUserIndexUpdate_(char *shareFP, const int &userID, const in
     /*get the mutex lock DBLock_*/
     pthread_mutex_lock(&DBLock_);
 
-    leveldb::Status getStat = db_->Get(readOptions_, *keySlice, &valueString);
+    leveldb::Status getStat = dbGet_(*keySlice, &valueString);
 
     if(getStat.ok()) {
+        ServerStats::countShare(STATS_META, STATS_SHARE_INTER_DUP, shareSize);
+
         valueOffset = 0;
         pShareIndexValueHead = (shareIndexValueHead_t *) (valueString.data() + valueOffset);
         valueOffset += shareIndexValueHeadSize_;
@@ -1340,7 +1392,7 @@ bool DedupCore::interUserIndexUpdate_(char *shareFP, const int &userID, const in
             batch_.Put(*keySlice, *valueSlice);
 
             /*execute all batched database update ops*/
-            leveldb::Status writeStat = db_->Write(writeOptions_, &batch_);
+            leveldb::Status writeStat = dbWrite_(&batch_);
             if(writeStat.ok() == false) {
                 fprintf(stderr, "Error: fail to perform batched writes!\n");
                 fprintf(stderr, "Status: %s \n", writeStat.ToString().c_str());
@@ -1385,7 +1437,7 @@ bool DedupCore::interUserIndexUpdate_(char *shareFP, const int &userID, const in
             batch_.Put(*keySlice, *valueSlice);
 
             /*execute all batched database update ops*/
-            leveldb::Status writeStat = db_->Write(writeOptions_, &batch_);
+            leveldb::Status writeStat = dbWrite_(&batch_);
             if(writeStat.ok() == false) {
                 fprintf(stderr, "Error: fail to perform batched writes!\n");
                 fprintf(stderr, "Status: %s \n", writeStat.ToString().c_str());
@@ -1405,6 +1457,8 @@ bool DedupCore::interUserIndexUpdate_(char *shareFP, const int &userID, const in
     }
 
     if(getStat.IsNotFound()) {
+        ServerStats::countShare(STATS_META, STATS_SHARE_UNIQUE, shareSize);
+
         /*release the mutex lock DBLock_*/
         pthread_mutex_unlock(&DBLock_);
 
@@ -1448,7 +1502,7 @@ bool DedupCore::interUserIndexUpdate_(char *shareFP, const int &userID, const in
         pthread_mutex_lock(&DBLock_);
 
         /*(b) store the key-value entry into the share index*/
-        db_->Put(writeOptions_, *keySlice, *valueSlice);
+        dbPut_(*keySlice, *valueSlice);
 
         /*release the mutex lock DBLock_*/
         pthread_mutex_unlock(&DBLock_);
@@ -1573,7 +1627,7 @@ bool DedupCore::findOldRecipeFile_(perUserBufferNode_t *targetBufferNode, std::s
     /*get the mutex lock DBLock_*/
     pthread_mutex_lock(&DBLock_);
 
-    leveldb::Status getStat = db_->Get(readOptions_, *keySlice, &valueString);
+    leveldb::Status getStat = dbGet_(*keySlice, &valueString);
 
     /*release the mutex lock DBLock_*/
     pthread_mutex_unlock(&DBLock_);
@@ -1710,6 +1764,33 @@ bool DedupCore::appendOldRecipeFile_(perUserBufferNode_t *targetBufferNode, std:
     return 1;
 }
 
+/*
+ * store the recipes buffered for other files, so that the continuation of a file can start its own
+ * recipe head (the buffer may have moved on to another file when an upload is resumed)
+ *
+ * @param targetBufferNode - the corresponding buffer node
+ * @param recipeFileName - the recipe file name <return>
+ *
+ * @return - a boolean value that indicates if the store op succeeds
+ */
+bool DedupCore::storeBufferedRecipes_(perUserBufferNode_t *targetBufferNode, std::string &recipeFileName)
+{
+    int recipeFileOffset;
+
+    /*a single file whose recipe starts in a previous recipe file is appended there*/
+    if(targetBufferNode->lastRecipeHeadPos == 0) {
+        if(!findOldRecipeFile_(targetBufferNode, recipeFileName, recipeFileOffset)) {
+            fprintf(stderr, "<storeBufferedRecipes_>Error: fail to find the old recipe file info in the database!\n");
+            return 0;
+        }
+        if(recipeFileName.compare(targetBufferNode->recipeFileName) != 0) {
+            return appendOldRecipeFile_(targetBufferNode, recipeFileName);
+        }
+    }
+
+    return storeNewRecipeFile_(targetBufferNode, recipeFileName);
+}
+
 /*
  * store the data of the share container buffer into a container
  *
@@ -1729,6 +1810,7 @@ bool DedupCore::storeShareContainer_(perUserBufferNode_t *targetBufferNode, std:
     }
 
     /*create a container file for writing shares*/
+    long flushStart = ServerStats::clockMicros();
     FILE *fp = fopen(shareContainerName.c_str(), "wb");
     if(fp == NULL) {
         fprintf(stderr, "Error: fail to open the file '%s' for writing shares!\n", shareContainerName.c_str());
@@ -1758,6 +1840,7 @@ bool DedupCore::storeShareContainer_(perUserBufferNode_t *targetBufferNode, std:
     targetBufferNode->shareContainerBufferCurrLen = 0;
 
     fclose(fp);
+    ServerStats::recordLatency(STATS_CONTAINER_FLUSH, flushStart);
     return 1;
 }
 
@@ -1778,14 +1861,15 @@ bool DedupCore::readRecipeFileFromBuffer_(const int &userID, char *recipeFileNam
     /*get the mutex lock bufferLock_*/
     pthread_mutex_lock(&bufferLock_);
 
-    /*find the buffer node for this user*/
+    /*find the buffer node of this user that buffers the recipe file (one per file slot)*/
     targetBufferNode = headBufferNode_;
-    while((targetBufferNode != NULL) && (targetBufferNode->userID != userID)) {
+    while((targetBufferNode != NULL) && ((targetBufferNode->userID != userID) ||
+                                         (strcmp(targetBufferNode->recipeFileName, recipeFileName) != 0))) {
         targetBufferNode = targetBufferNode->next;
     }
 
-    /*if find the buffer node, then check if the recipe file is stored in the buffer*/
-    if((targetBufferNode != NULL) && (strcmp(targetBufferNode->recipeFileName, recipeFileName) == 0)) {
+    /*if find the buffer node, then get the data of the recipe file buffer*/
+    if(targetBufferNode != NULL) {
         /*get the data of the recipe file buffer*/
         memcpy(recipeFileBuffer, targetBufferNode->recipeFileBuffer,
                targetBufferNode->recipeFileBufferCurrLen);
@@ -1885,6 +1969,8 @@ bool DedupCore::firstStageDedup(const int &userID, unsigned char *shareMDBuffer,
             }
             if(intraUserDupStatList[numOfShares] == 0) {
                 sentShareDataSize += pShareMDEntry->shareSize;
+            } else {
+                ServerStats::countShare(STATS_META, STATS_SHARE_INTRA_DUP, pShareMDEntry->shareSize);
             }
 
             numOfShares++;
@@ -1907,7 +1993,8 @@ bool DedupCore::firstStageDedup(const int &userID, unsigned char *shareMDBuffer,
  *
  * @return - a boolean value that indicates if the second-stage deduplication succeeds
  */
-bool DedupCore::secondStageDedup(const int &userID, unsigned char *shareMDBuffer, const int &shareMDSize,
+bool DedupCore::secondStageDedup(const int &userID, const int &fileID, unsigned char *shareMDBuffer,
+                                 const int &shareMDSize,
                                  bool *intraUserDupStatList,
                                  unsigned char *shareDataBuffer, CryptoPrimitive *cryptoObj, bool end)
 {
@@ -1918,6 +2005,7 @@ bool DedupCore::secondStageDedup(const int &userID, unsigned char *shareMDBuffer
     fileRecipeEntry_t *pFileRecipeEntry;
     std::string fullFileName;
     char shareFP[FP_SIZE];
+    char inodeFP[FP_SIZE];
     int shareMDBufferOffset = 0, shareDataBufferOffset = 0;
     int recipeFileBufferAddedLen;
     std::string recipeFileName;
@@ -1929,9 +2017,9 @@ bool DedupCore::secondStageDedup(const int &userID, unsigned char *shareMDBuffer
         return 0;
     }
 
-    /*find the corresponding buffer node for the user*/
+    /*find the corresponding buffer node for the file slot of the user*/
     targetBufferNode = NULL;
-    findOrCreateBufferNode_(userID, targetBufferNode);
+    findOrCreateBufferNode_(userID, fileID, targetBufferNode);
 
     while(shareMDBufferOffset < shareMDSize) {
         /*1. read the file share metadata head and file name*/
@@ -1950,6 +2038,18 @@ bool DedupCore::secondStageDedup(const int &userID, unsigned char *shareMDBuffer
             return 0;
         }
 
+        /*a continuation buffered behind the recipes of another file (e.g. an upload resumed after the user
+          stored other files) gets its own recipe head, the entries are appended to its recipe file later*/
+        if(pFileShareMDHead->numOfPastSecrets != 0 && targetBufferNode->recipeFileBufferCurrLen != 0) {
+            fileName2InodeFP_(fullFileName, userID, inodeFP, cryptoObj);
+            if(memcmp(inodeFP, targetBufferNode->lastInodeFP, FP_SIZE) != 0 &&
+               !storeBufferedRecipes_(targetBufferNode, recipeFileName)) {
+                fprintf(stderr, "Error: fail to store the recipes buffered for other files!\n");
+
+                return 0;
+            }
+        }
+
         /*2. make sure the recipe file buffer has enough space for storing the coming file recipe head and entries*/
 
         /*if this is a new file*/
@@ -2240,14 +2340,40 @@ bool DedupCore::cleanupAllBufferNodes()
     return 1;
 }
 
+/*
+ * add up the memory held by the buffer nodes of each user
+ *
+ * @param usage - the bytes of the buffer nodes by user id <return>
+ */
+void DedupCore::reportBufferNodes(std::map<int, size_t> &usage)
+{
+    /*get the mutex lock bufferLock_*/
+    pthread_mutex_lock(&bufferLock_);
+
+    for(perUserBufferNode_t *currBufferNode = headBufferNode_; currBufferNode != NULL;
+        currBufferNode = currBufferNode->next) {
+        usage[currBufferNode->userID] += perUserBufferNodeSize_;
+    }
+
+    /*release the mutex lock bufferLock_*/
+    pthread_mutex_unlock(&bufferLock_);
+}
+
 
 /*
  * restore a share file for a user and write it into file recipe(of data chunks) for data chunk restoration
  *
  *
+ * only the secrets covering the requested byte range go into the file recipe, renumbered from 0, so the data
+ * server sends and the client decodes just those secrets
+ *
  * @param userID - the user id
  * @param fullFileName - the full name of the original file
+ * @param fileRecipeName - the name the data core takes the file recipe by
  * @param versionNumber - the version number (<=0) of the original file
+ * @param rangeOffset - the offset of the byte range to be restored
+ * @param rangeLength - the length of the byte range to be restored (< 0 for up to the end of the file)
+ * @param lastShareOnServer - whether the client restores without the shares numbered k and above on this server
  * @param socketFD - the file descriptor of the sending socket
  * @param cryptoObj - the CryptoPrimitive instance for calculating hash fingerprint
  *
@@ -2255,8 +2381,8 @@ bool DedupCore::cleanupAllBufferNodes()
  */
 bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
                                                    const std::string &fullFileName, const std::string &fileRecipeName,
-                                                   const int &versionNumber,
-                                                   int socketFD, CryptoPrimitive *cryptoObj)
+                                                   const int &versionNumber, long rangeOffset, long rangeLength,
+                                                   bool lastShareOnServer, int socketFD, CryptoPrimitive *cryptoObj)
 {
     leveldb::Status inodeStat, shareStat;
     std::string formatedFullFileName;
@@ -2303,26 +2429,33 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
     inodeFP2IndexKey_(FP, key);
     inodeKeySlice = new leveldb::Slice(key, KEY_SIZE);
 
-    /*get the mutex lock DBLock_*/
-    pthread_mutex_lock(&DBLock_);
-
-    /*enquire the key in the database*/
-    inodeStat = db_->Get(readOptions_, *inodeKeySlice, &valueString);
-
-    /*release the mutex lock DBLock_*/
-    pthread_mutex_unlock(&DBLock_);
+    /*enquire the key in the database, a single lookup is safe against concurrent writes without DBLock_, so
+      restores only read and never wait for each other or for uploads*/
+    inodeStat = dbGet_(*inodeKeySlice, &valueString);
 
     /*if such an inode for fullFileName exists*/
     if(inodeStat.ok()) {
         int shareFileBufferSize = SHARE_FILE_BUFFER_SIZE;
+        size_t shareContainerCacheSize = sizeof(shareContainerCacheNode_t) * NUM_OF_CACHED_CONTAINERS;
 
-        /*allocate some caches and buffers for accelerating file restoring speed*/
-        recipeFileBuffer = (unsigned char *) malloc(sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
-        shareFileBuffer = (unsigned char *) malloc(shareFileBufferSize);
-        shareContainerCache = (shareContainerCacheNode_t *) malloc(
-                sizeof(shareContainerCacheNode_t) * NUM_OF_CACHED_CONTAINERS);
+        /*lease some caches and buffers for accelerating file restoring speed*/
+        recipeFileBuffer = (unsigned char *) BufferArena::lease(sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+        shareFileBuffer = (unsigned char *) BufferArena::lease(shareFileBufferSize);
+        shareContainerCache = (shareContainerCacheNode_t *) BufferArena::lease(shareContainerCacheSize);
         shareContainerCacheIndex = (int *) malloc(sizeof(int) * NUM_OF_CACHED_CONTAINERS);
         numOfCachedShareContainers = 0;
+        if(recipeFileBuffer == NULL || shareFileBuffer == NULL || shareContainerCache == NULL) {
+            fprintf(stderr, "Error: no buffer left for restoring '%s'!\n", fullFileName.c_str());
+
+            BufferArena::release(recipeFileBuffer, sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+            BufferArena::release(shareFileBuffer, shareFileBufferSize);
+            BufferArena::release(shareContainerCache, shareContainerCacheSize);
+            free(shareContainerCacheIndex);
+
+            delete inodeKeySlice;
+
+            return 0;
+        }
 
         /*read the inode head*/
         valueOffset = 0;
@@ -2333,9 +2466,9 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
         if((-versionNumber) >= pInodeIndexValueHead->numOfChildren) {
             fprintf(stderr, "Error: no such an old version exists for the version number %d!\n", versionNumber);
 
-            free(recipeFileBuffer);
-            free(shareFileBuffer);
-            free(shareContainerCache);
+            BufferArena::release(recipeFileBuffer, sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+            BufferArena::release(shareFileBuffer, shareFileBufferSize);
+            BufferArena::release(shareContainerCache, shareContainerCacheSize);
             free(shareContainerCacheIndex);
 
             delete inodeKeySlice;
@@ -2361,9 +2494,9 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
                 fprintf(stderr, "Error: fail to add the prefix '%s' to '%s'!\n", recipeFileDirName_.c_str(),
                         fullRecipeFileName.c_str());
 
-                free(recipeFileBuffer);
-                free(shareFileBuffer);
-                free(shareContainerCache);
+                BufferArena::release(recipeFileBuffer, sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+                BufferArena::release(shareFileBuffer, shareFileBufferSize);
+                BufferArena::release(shareContainerCache, shareContainerCacheSize);
                 free(shareContainerCacheIndex);
 
                 delete inodeKeySlice;
@@ -2383,9 +2516,9 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
             if(recipeFilePointer == NULL) {
                 fprintf(stderr, "Error: fail to open the file '%s' for reading recipes!\n", fullRecipeFileName.c_str());
 
-                free(recipeFileBuffer);
-                free(shareFileBuffer);
-                free(shareContainerCache);
+                BufferArena::release(recipeFileBuffer, sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+                BufferArena::release(shareFileBuffer, shareFileBufferSize);
+                BufferArena::release(shareContainerCache, shareContainerCacheSize);
                 free(shareContainerCacheIndex);
 
                 delete inodeKeySlice;
@@ -2400,9 +2533,9 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
 
                 fclose(recipeFilePointer);
 
-                free(recipeFileBuffer);
-                free(shareFileBuffer);
-                free(shareContainerCache);
+                BufferArena::release(recipeFileBuffer, sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+                BufferArena::release(shareFileBuffer, shareFileBufferSize);
+                BufferArena::release(shareContainerCache, shareContainerCacheSize);
                 free(shareContainerCacheIndex);
 
                 delete inodeKeySlice;
@@ -2426,41 +2559,74 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
         printf("[Meta] <restore> file size = %ld\n", pShareFileHead->fileSize);
         if(fileSize < 0) {
             printf("[Meta] <restore> file size < 0!! Interal error!!!\n");
+
+            if(!recipeFileIsInBuffer) {
+                fclose(recipeFilePointer);
+            }
+            BufferArena::release(recipeFileBuffer, sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+            BufferArena::release(shareFileBuffer, shareFileBufferSize);
+            BufferArena::release(shareContainerCache, shareContainerCacheSize);
+            free(shareContainerCacheIndex);
+
+            delete inodeKeySlice;
+
             return false;
         }
         pShareFileHead->numOfShares = pFileRecipeHead->numOfShares;
         printf("[Meta] <meta> share number = %d\n", pShareFileHead->numOfShares);
         shareFileBufferOffset += shareFileHeadSize_;
 
-        FILE *fpFileRecipeName = fopen(fileRecipeName.c_str(), "wb+");
-        if(fpFileRecipeName == nullptr) {
-            printf("can't open recipe file %s\n", fileRecipeName.c_str());
-            return false;
-        } else {
-            printf("[!>] [Meta] open recipe file %s successfully!!\n", fileRecipeName.c_str());
-        }
+        /*the data core takes the file recipe entries in memory as they are resolved, its head comes at the end*/
+        std::shared_ptr<RecipeStream> recipe = RecipeStream::publish(userID, fileRecipeName, lastShareOnServer);
+        // a restore failing half way ends the file recipe of the data core as well
+        std::unique_ptr<RecipeStream, void (*)(RecipeStream *)> recipeGuard(recipe.get(),
+                                                                           [](RecipeStream *r) { r->abort(); });
+        printf("[!>] [Meta] publish recipe %s, token %ld\n", fileRecipeName.c_str(), recipe->token());
         int numOfDataShares = 0;
 
-        /* skip fileRecipeHead_t */
-        fseek(fpFileRecipeName, sizeof(fileRecipeHead_t), SEEK_SET);
-
         int fileSizeCounter = 0;
 
-        // metaListBuffer for storing metalist and use this buffer to send back to client
-        auto metaListBuffer = std::make_unique<unsigned char[]>(METALIST_BUFFER_SIZE);
+        // metaListBuffer for the chunk of metalist being filled, a full chunk is sent on to the client at once
+        auto metaListBuffer = std::make_unique<unsigned char[]>(METALIST_CHUNK_SIZE);
+        int numOfMetaList = 0;
+        if(!this->send_meta_list_indicator(socketFD)) {
+            if(!recipeFileIsInBuffer) {
+                fclose(recipeFilePointer);
+            }
+            BufferArena::release(recipeFileBuffer, sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+            BufferArena::release(shareFileBuffer, shareFileBufferSize);
+            BufferArena::release(shareContainerCache, shareContainerCacheSize);
+            free(shareContainerCacheIndex);
+
+            delete inodeKeySlice;
+
+            return false;
+        }
+
+        /*the secrets covering the byte range: the offset of the next secret in the file, the ID of the first one,
+          the bytes of the first one before the range, and the size of all of them*/
+        long secretOffset = 0;
+        int firstSecretID = -1;
+        long rangeSkip = 0;
+        long rangeSize = 0;
 
         /*restore each share*/
         numOfShares = pShareFileHead->numOfShares;
         for(i = 0; i < numOfShares; i++) {
+            if(rangeLength >= 0 && secretOffset >= rangeOffset + rangeLength) {
+                /*the remaining metadata chunks are behind the byte range*/
+                break;
+            }
+
             /*check if recipeFileBuffer holds a complete file recipe entry*/
             if(recipeFileBufferOffset + fileRecipeEntrySize_ > RECIPE_BUFFER_SIZE) {
                 printf("[Meta] <restore> recipe buffer size limit reached!!\n");
                 if(recipeFileIsInBuffer) {
                     fprintf(stderr, "Error: encounter incomplete file recipe in buffer!\n");
 
-                    free(recipeFileBuffer);
-                    free(shareFileBuffer);
-                    free(shareContainerCache);
+                    BufferArena::release(recipeFileBuffer, sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+                    BufferArena::release(shareFileBuffer, shareFileBufferSize);
+                    BufferArena::release(shareContainerCache, shareContainerCacheSize);
                     free(shareContainerCacheIndex);
 
                     delete inodeKeySlice;
@@ -2478,9 +2644,9 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
 
                         fclose(recipeFilePointer);
 
-                        free(recipeFileBuffer);
-                        free(shareFileBuffer);
-                        free(shareContainerCache);
+                        BufferArena::release(recipeFileBuffer, sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+                        BufferArena::release(shareFileBuffer, shareFileBufferSize);
+                        BufferArena::release(shareContainerCache, shareContainerCacheSize);
                         free(shareContainerCacheIndex);
 
                         delete inodeKeySlice;
@@ -2501,14 +2667,8 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
             shareFP2IndexKey_(pFileRecipeEntry->shareFP, key);
             shareKeySlice = new leveldb::Slice(key, KEY_SIZE);
 
-            /*get the mutex lock DBLock_*/
-            pthread_mutex_lock(&DBLock_);
-
-            /*enquire the key in the database*/
-            shareStat = db_->Get(readOptions_, *shareKeySlice, &valueString);
-
-            /*release the mutex lock DBLock_*/
-            pthread_mutex_unlock(&DBLock_);
+            /*enquire the key in the database (without DBLock_, see above)*/
+            shareStat = dbGet_(*shareKeySlice, &valueString);
 
             /*if such a share exists*/
             if(shareStat.ok()) {
@@ -2569,9 +2729,9 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
                                 fclose(recipeFilePointer);
                             }
 
-                            free(recipeFileBuffer);
-                            free(shareFileBuffer);
-                            free(shareContainerCache);
+                            BufferArena::release(recipeFileBuffer, sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+                            BufferArena::release(shareFileBuffer, shareFileBufferSize);
+                            BufferArena::release(shareContainerCache, shareContainerCacheSize);
                             free(shareContainerCacheIndex);
 
                             delete inodeKeySlice;
@@ -2595,9 +2755,9 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
                                 fclose(recipeFilePointer);
                             }
 
-                            free(recipeFileBuffer);
-                            free(shareFileBuffer);
-                            free(shareContainerCache);
+                            BufferArena::release(recipeFileBuffer, sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+                            BufferArena::release(shareFileBuffer, shareFileBufferSize);
+                            BufferArena::release(shareContainerCache, shareContainerCacheSize);
                             free(shareContainerCacheIndex);
 
                             delete inodeKeySlice;
@@ -2616,9 +2776,9 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
                             }
                             fclose(containerFilePointer);
 
-                            free(recipeFileBuffer);
-                            free(shareFileBuffer);
-                            free(shareContainerCache);
+                            BufferArena::release(recipeFileBuffer, sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+                            BufferArena::release(shareFileBuffer, shareFileBufferSize);
+                            BufferArena::release(shareContainerCache, shareContainerCacheSize);
                             free(shareContainerCacheIndex);
 
                             delete inodeKeySlice;
@@ -2642,9 +2802,6 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
                 }
 
                 /* write file recipe when restoring data */
-                /* parse the share object */
-                ItemMeta_t output{};
-                output.type = 1;
 
                 /*generate and store the share info into shareFileBuffer*/
                 // This is the file recipes of metadata chunk.
@@ -2656,9 +2813,6 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
                 pShareMDEntry->segID = pFileRecipeEntry->segID;
                 pShareMDEntry->shareID = pFileRecipeEntry->shareID;
 
-
-                memcpy(&(output.shareObj.share_header), pShareMDEntry, sizeof(shareMDEntry_t));
-
                 shareFileBufferOffset += shareMDEntrySize_;
 
                 /*store the share data into shareFileBuffer*/
@@ -2667,34 +2821,82 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
                        pShareIndexValueHead->shareContainerOffset, pShareIndexValueHead->shareSize);
 
                 // read share data from meta data chunk and store them into file recipe
-                int dataShares = 0;
-                memcpy(&dataShares, shareFileBuffer + shareFileBufferOffset, sizeof(int));
-                numOfDataShares += dataShares;
+                unsigned char *metaChunk = shareFileBuffer + shareFileBufferOffset;
+                int metaChunkSize = pShareMDEntry->shareSize;
+                int metaChunkOffset = 0;
+                bool compactMetaChunk = false;
 
-                /* skip counter added in client::Encoder::collect */
-                shareFileBufferOffset += sizeof(int);
+                /* skip the head (counter, and magic for the compact format) added in client::Encoder::collect */
+                int dataShares = readMetaChunkHead_(metaChunk, metaChunkSize, metaChunkOffset, compactMetaChunk);
+                if(dataShares <= 0) {
+                    printf("[Meta] <restore> dataShares = %d. Internal error.\n", dataShares);
 
-                // output.shareObj.data <-> counter<int> + [metaNode_1, metaNode_2, metaNode_n]
-                memcpy(output.shareObj.data, shareFileBuffer + shareFileBufferOffset, pShareMDEntry->shareSize);
+                    if(!recipeFileIsInBuffer) {
+                        fclose(recipeFilePointer);
+                    }
+                    BufferArena::release(recipeFileBuffer, sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+                    BufferArena::release(shareFileBuffer, shareFileBufferSize);
+                    BufferArena::release(shareContainerCache, shareContainerCacheSize);
+                    free(shareContainerCacheIndex);
+
+                    delete inodeKeySlice;
+                    delete shareKeySlice;
 
-                // get the end of secretID in this metadata chunk
-                metaNode newNode;
-                if(dataShares - 1 < 0) {
-                    printf("[Meta] <restore> dataShare - 1 = %d. Internal error.\n", dataShares - 1);
                     return 0;
                 }
-                memcpy(&newNode, output.shareObj.data + (dataShares - 1) * sizeof(metaNode), sizeof(metaNode));
-                // save shorted file recipes(including ID and shareID) as metalist for following uploading
-                this->save_as_metalist(metaListBuffer.get(), pShareMDEntry->segID, pShareMDEntry->shareID, i,
-                                       newNode.secretID);
 
                 /* write meta-data of data into file recipe(data file recipes) */
+                metaNode newNode;
+                memset(&newNode, 0, sizeof(metaNode));
+                int endSecretID = -1;
                 for(int index = 0; index < dataShares; ++index) {
 
-                    memcpy(&newNode, output.shareObj.data + index * sizeof(metaNode), sizeof(metaNode));
+                    if(!readMetaNode_(metaChunk, metaChunkSize, metaChunkOffset, compactMetaChunk, &newNode)) {
+                        printf("[Meta] <restore> truncated metadata chunk at node %d. Internal error.\n", index);
+
+                        if(!recipeFileIsInBuffer) {
+                            fclose(recipeFilePointer);
+                        }
+                        BufferArena::release(recipeFileBuffer, sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+                        BufferArena::release(shareFileBuffer, shareFileBufferSize);
+                        BufferArena::release(shareContainerCache, shareContainerCacheSize);
+                        free(shareContainerCacheIndex);
+
+                        delete inodeKeySlice;
+                        delete shareKeySlice;
+
+                        return 0;
+                    }
+
+                    /* skip the secrets outside the byte range */
+                    long nodeOffset = secretOffset;
+                    secretOffset += newNode.secretSize;
+                    if(secretOffset <= rangeOffset || (rangeLength >= 0 && nodeOffset >= rangeOffset + rangeLength)) {
+                        continue;
+                    }
+                    if(firstSecretID < 0) {
+                        firstSecretID = newNode.secretID;
+                        rangeSkip = rangeOffset - nodeOffset;
+                    }
+                    newNode.secretID -= firstSecretID;
+                    endSecretID = newNode.secretID;
+                    rangeSize += newNode.secretSize;
+                    numOfDataShares++;
 
                     /* write meta node into file recipe */
-                    saveMetaNode2DataFileRecipe(fpFileRecipeName, &newNode, fileSizeCounter, index);
+                    saveMetaNode2DataFileRecipe(recipe.get(), &newNode, fileSizeCounter, index);
+                }
+
+                // save shorted file recipes(including ID and shareID) as metalist for following uploading,
+                // only for the metadata chunks holding secrets in the byte range
+                if(endSecretID >= 0) {
+                    this->save_as_metalist(metaListBuffer.get(), pShareMDEntry->segID, pShareMDEntry->shareID,
+                                           numOfMetaList, endSecretID, lastShareOnServer);
+                    numOfMetaList++;
+                    if(numOfMetaList == METALIST_CHUNK_ITEMS) {
+                        this->send_meta_list(metaListBuffer.get(), numOfMetaList, socketFD);
+                        ServerStats::restoreProgress(socketFD, i + 1, numOfShares);
+                    }
                 }
             }
 
@@ -2707,9 +2909,9 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
                     fclose(recipeFilePointer);
                 }
 
-                free(recipeFileBuffer);
-                free(shareFileBuffer);
-                free(shareContainerCache);
+                BufferArena::release(recipeFileBuffer, sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+                BufferArena::release(shareFileBuffer, shareFileBufferSize);
+                BufferArena::release(shareContainerCache, shareContainerCacheSize);
                 free(shareContainerCacheIndex);
 
                 delete inodeKeySlice;
@@ -2726,9 +2928,9 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
                     fclose(recipeFilePointer);
                 }
 
-                free(recipeFileBuffer);
-                free(shareFileBuffer);
-                free(shareContainerCache);
+                BufferArena::release(recipeFileBuffer, sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+                BufferArena::release(shareFileBuffer, shareFileBufferSize);
+                BufferArena::release(shareContainerCache, shareContainerCacheSize);
                 free(shareContainerCacheIndex);
 
                 delete inodeKeySlice;
@@ -2745,9 +2947,9 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
                     fclose(recipeFilePointer);
                 }
 
-                free(recipeFileBuffer);
-                free(shareFileBuffer);
-                free(shareContainerCache);
+                BufferArena::release(recipeFileBuffer, sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+                BufferArena::release(shareFileBuffer, shareFileBufferSize);
+                BufferArena::release(shareContainerCache, shareContainerCacheSize);
                 free(shareContainerCacheIndex);
 
                 delete inodeKeySlice;
@@ -2759,14 +2961,17 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
             delete shareKeySlice;
         }
 
-        // the first int value is the counter(<-> numOfShares)
-        int size_meta_list_buffer = sizeof(int) + numOfShares * sizeof(MetaList);
-        this->assemble_full_meta_list_buffer(metaListBuffer.get(), numOfShares);
-        this->send_meta_list(metaListBuffer.get(), size_meta_list_buffer, numOfShares, socketFD);
+        // send the last chunk, then an empty one to end the meta list
+        if(numOfMetaList > 0) {
+            this->send_meta_list(metaListBuffer.get(), numOfMetaList, socketFD);
+        }
+        this->send_meta_list(metaListBuffer.get(), numOfMetaList, socketFD);
+        ServerStats::restoreProgress(socketFD, numOfShares, numOfShares);
 
+        /*the data server sends, and the client decodes, the secrets covering the byte range only*/
         fileRecipeHead_t fileRecipeHeader;
         fileRecipeHeader.userID = userID;
-        fileRecipeHeader.fileSize = fileSize;
+        fileRecipeHeader.fileSize = rangeSize;
         fileRecipeHeader.numOfShares = numOfDataShares;
         printf("fileRecipe header: \n");
         printf("\tuserID: %d\n", fileRecipeHeader.userID);
@@ -2776,6 +2981,7 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
         /* IF empty data in this server, send indicator to client(downloadFileRecipes) and exit thread */
         if(fileRecipeHeader.numOfShares == 0) {
             printf("[Meta] [restore] Empty meta data chunks in this server. numOfShares = 0\n");
+            recipe->finish(fileRecipeHeader);
             /* `END_DOWNLOAD_INDICATOR` tells client to end downloading chunk */
             indicator = END_DOWNLOAD_INDICATOR;
             auto buffer = std::make_unique<char[]>(sizeof(int));
@@ -2787,46 +2993,35 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
                 return -1;
             }
             printf("[Meta] [restore] client informed!\n");
-            fclose(fpFileRecipeName);
 
             /* clean up data */
             if(!recipeFileIsInBuffer) {
                 fclose(recipeFilePointer);
             }
 
-            free(recipeFileBuffer);
-            free(shareFileBuffer);
-            free(shareContainerCache);
+            BufferArena::release(recipeFileBuffer, sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+            BufferArena::release(shareFileBuffer, shareFileBufferSize);
+            BufferArena::release(shareContainerCache, shareContainerCacheSize);
             free(shareContainerCacheIndex);
             return -1;
         }
 
-        /* set position of file to the beginning */
-        rewind(fpFileRecipeName);
-
         printf("[Meta] num of shares: %d\n", fileRecipeHeader.numOfShares);
 
-        // write header into file recipe
-        int retValue = -1;
-        retValue = fwrite(&fileRecipeHeader, sizeof(fileRecipeHead_t), 1, fpFileRecipeName);
-        if(retValue != 1) {
-            printf("[Meta] Fails to write file recipe header into %s\n", fileRecipeName.c_str());
-            return false;
-        }
-        printf("[Meta] Write file recipe header into %s\n", fileRecipeName.c_str());
+        // end the file recipe with its header
+        recipe->finish(fileRecipeHeader);
+        printf("[Meta] Finish file recipe %s\n", fileRecipeName.c_str());
 
         /* send indicator to client when file recipe is generated */
-        sendFileRecipeIndicator(socketFD);
-
-        fclose(fpFileRecipeName);
+        sendFileRecipeIndicator(socketFD, rangeSkip, recipe->token());
 
         if(!recipeFileIsInBuffer) {
             fclose(recipeFilePointer);
         }
 
-        free(recipeFileBuffer);
-        free(shareFileBuffer);
-        free(shareContainerCache);
+        BufferArena::release(recipeFileBuffer, sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
+        BufferArena::release(shareFileBuffer, shareFileBufferSize);
+        BufferArena::release(shareContainerCache, shareContainerCacheSize);
         free(shareContainerCacheIndex);
     }
 
@@ -2874,8 +3069,6 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
         return 0;
     }
 
-    // reset to default status
-    this->set_last_share_special_flag(false);
     printf("[Meta] [restore] Exiting restoring function...\n\n");
     delete inodeKeySlice;
 
@@ -2883,16 +3076,16 @@ bool DedupCore::restoreShareFileAndWriteFileRecipe(const int &userID,
 }
 
 /*
- * write a new metaNode into file (write data file recipes)
+ * append a new metaNode to the data file recipe handed to the data core
  *
- * @param fp - the pointer to opened file
+ * @param recipe - the data file recipe
  * @param metaNode - meta node to be added to file
  * @param fileSizeCounter - count the file size <return>
  * @param index - debugging only
  *
  * @return - a boolean value that indicates if the write succeeds
  */
-bool DedupCore::saveMetaNode2DataFileRecipe(FILE *fp, metaNode *node, int &fileSizeCounter, int index)
+bool DedupCore::saveMetaNode2DataFileRecipe(RecipeStream *recipe, metaNode *node, int &fileSizeCounter, int index)
 {
     fileRecipeEntry_t writeEntryNode;
     memcpy(writeEntryNode.shareFP, node->shareFP, FP_SIZE);
@@ -2902,20 +3095,104 @@ bool DedupCore::saveMetaNode2DataFileRecipe(FILE *fp, metaNode *node, int &fileS
     writeEntryNode.segID = node->segID;
     writeEntryNode.shareID = node->shareID;
     fileSizeCounter += node->secretSize;
-    fwrite(&writeEntryNode, sizeof(fileRecipeEntry_t), 1, fp);
+    recipe->push(writeEntryNode);
 
     return true;
 }
 
 
 /*
- * send file recipe indicator to client
+ * read the head of a metadata chunk in either the legacy or the compact format
+ *
+ * @param metaChunk - the metadata chunk
+ * @param metaChunkSize - the size of the metadata chunk
+ * @param offset - the offset of the first metaNode <return>
+ * @param compact - whether the metadata chunk is in the compact format <return>
+ *
+ * @return - the number of metaNodes in the metadata chunk, or -1 if the head is invalid
+ */
+int DedupCore::readMetaChunkHead_(unsigned char *metaChunk, int metaChunkSize, int &offset, bool &compact)
+{
+    int head, counter;
+
+    if(metaChunkSize < (int) sizeof(int)) {
+        return -1;
+    }
+    memcpy(&head, metaChunk, sizeof(int));
+
+    /*a legacy chunk starts with its (non-negative) counter*/
+    if(head != META_CHUNK_COMPACT_MAGIC) {
+        compact = false;
+        offset = sizeof(int);
+
+        return head;
+    }
+
+    if(metaChunkSize < (int) (2 * sizeof(int))) {
+        return -1;
+    }
+    memcpy(&counter, metaChunk + sizeof(int), sizeof(int));
+    compact = true;
+    offset = 2 * sizeof(int);
+
+    return counter;
+}
+
+/*
+ * read the next metaNode of a metadata chunk
+ *
+ * @param metaChunk - the metadata chunk
+ * @param metaChunkSize - the size of the metadata chunk
+ * @param offset - the offset of the metaNode, advanced past it <return>
+ * @param compact - whether the metadata chunk is in the compact format
+ * @param node - the previous metaNode (all zero for the first one), overwritten by the read one <return>
+ *
+ * @return - a boolean value that indicates if the read op succeeds
+ */
+bool DedupCore::readMetaNode_(unsigned char *metaChunk, int metaChunkSize, int &offset, bool compact, metaNode *node)
+{
+    if(!compact) {
+        if(offset + (int) sizeof(metaNode) > metaChunkSize) {
+            return false;
+        }
+        memcpy(node, metaChunk + offset, sizeof(metaNode));
+        offset += sizeof(metaNode);
+
+        return true;
+    }
+
+    if(offset + FP_SIZE > metaChunkSize) {
+        return false;
+    }
+    memcpy(node->shareFP, metaChunk + offset, FP_SIZE);
+    offset += FP_SIZE;
+
+    /*each field is a varint of the zigzag delta against the previous node*/
+    int fields[DELTA_FIELDS] = {node->secretID, node->secretSize, node->shareSize, node->segID, node->shareID};
+    offset = getDeltaFields(metaChunk, metaChunkSize, offset, fields);
+    if(offset < 0) {
+        return false;
+    }
+    node->secretID = fields[0];
+    node->secretSize = fields[1];
+    node->shareSize = fields[2];
+    node->segID = fields[3];
+    node->shareID = fields[4];
+
+    return true;
+}
+
+/*
+ * send file recipe indicator to client, followed by where the requested byte range starts in the first secret
+ * and the token the client takes the file recipe with from the data core
  *
  * @param socketFD - the file descriptor of the sending socket
+ * @param rangeSkip - the bytes of the first secret in the file recipe before the requested byte range
+ * @param token - the token of the restore
  *
  * @return - a boolean value that indicates if the operation succeeds
  */
-bool DedupCore::sendFileRecipeIndicator(int socketFD)
+bool DedupCore::sendFileRecipeIndicator(int socketFD, long rangeSkip, long token)
 {
 
     /* initialize */
@@ -2934,6 +3211,16 @@ bool DedupCore::sendFileRecipeIndicator(int socketFD)
         fprintf(stderr, "Error sending indicator! Error code: %d\n", errno);
         return false;
     }
+    // send where the byte range starts
+    if((byteCount = send(socketFD, &rangeSkip, sizeof(long), 0)) == -1) {
+        fprintf(stderr, "Error sending range skip! Error code: %d\n", errno);
+        return false;
+    }
+    // send the token of the restore
+    if((byteCount = send(socketFD, &token, sizeof(long), 0)) == -1) {
+        fprintf(stderr, "Error sending restore token! Error code: %d\n", errno);
+        return false;
+    }
     return true;
 }
 
@@ -2945,9 +3232,10 @@ bool DedupCore::sendFileRecipeIndicator(int socketFD)
  * @param shareID - the shareID of data shares this metadata chunk contains
  * @param write_index - the index pointing to the location of writing
  * @param end_secretID - the end of secretID in this meta_list(necessary)
+ * @param lastShareOnServer - whether the client restores without the shares numbered k and above on this server
  */
 bool DedupCore::save_as_metalist(unsigned char *meta_list_buffer, int id, int shareID, int write_index,
-                                 int end_secretID)
+                                 int end_secretID, bool lastShareOnServer)
 {
     MetaList meta_list{
             id,
@@ -2955,7 +3243,7 @@ bool DedupCore::save_as_metalist(unsigned char *meta_list_buffer, int id, int sh
             end_secretID,
     };
 
-    if(this->last_share_on_server_ && shareID >= NUM_OF_SHARES_NEEDED) {
+    if(lastShareOnServer && shareID >= NUM_OF_SHARES_NEEDED) {
         // shareID: 0, 1, 2, 3
         // 1. we do not need [ID:3] to restore in order to improve download speed
         // 2. set `shareID = -1` as a placeholder for easy implementation of client-side process
@@ -2963,9 +3251,8 @@ bool DedupCore::save_as_metalist(unsigned char *meta_list_buffer, int id, int sh
     }
 
     int buffer_offset = sizeof(int) + write_index * sizeof(MetaList);
-    if(buffer_offset > METALIST_BUFFER_SIZE) {
-        printf("[Meta] [restore] meta_list buffer overflow detected!!\n");
-        printf("[Meta] [restore] Consider using bigger size of buffer\n");
+    if(write_index >= METALIST_CHUNK_ITEMS) {
+        printf("[Meta] [restore] meta_list chunk overflow detected!!\n");
         exit(-1);
     }
     memcpy(meta_list_buffer + buffer_offset, &meta_list, sizeof(MetaList));
@@ -2986,67 +3273,51 @@ void DedupCore::assemble_full_meta_list_buffer(unsigned char *meta_list_buffer,
 }
 
 /*
- * send buffer back to client
+ * tell the client that the meta list follows
  *
- * @param buffer - buffer to be sent
- * @param total_size - total size of this buffer
- * @param count - count how many MetaList in this buffer
  * @param socketFD - the file descriptor of the sending socket
  */
-bool DedupCore::send_meta_list(unsigned char *metalist_buffer, int total_size, int count, int socketFD)
+bool DedupCore::send_meta_list_indicator(int socketFD)
 {
-
-    int byteCount = 0;
-    auto buffer = std::make_unique<unsigned char[]>(sizeof(int));
-
-    /* 1. set indicator */
     // start sending meta_list to client
     int indicator = SEND_META_LIST;
-    memcpy(buffer.get(), &indicator, sizeof(int));
-    // send indicator
-    if((byteCount = send(socketFD, buffer.get(), sizeof(int), 0)) == -1) {
+    if(send(socketFD, &indicator, sizeof(int), 0) == -1) {
         fprintf(stderr, "Error sending indicator! Error code: %d\n", errno);
         return false;
     }
+    return true;
+}
+
+/*
+ * send a chunk of the meta list back to client and start the next one
+ *
+ * @param metalist_buffer - the chunk to be sent
+ * @param count - count how many MetaList in this chunk, reset to 0 once it is sent<return>
+ * @param socketFD - the file descriptor of the sending socket
+ */
+bool DedupCore::send_meta_list(unsigned char *metalist_buffer, int &count, int socketFD)
+{
+
+    int byteCount = 0;
+
+    /* 1. set the counter, an empty chunk tells the client that the meta list ends */
+    this->assemble_full_meta_list_buffer(metalist_buffer, count);
+    int total_size = sizeof(int) + count * sizeof(MetaList);
+    count = 0;
 
     /* 2. set size to be sent */
     // send total_size
-    memcpy(buffer.get(), &total_size, sizeof(int));
-    if((byteCount = send(socketFD, buffer.get(), sizeof(int), 0)) == -1) {
-        fprintf(stderr, "Error sending indicator! Error code: %d\n", errno);
+    if((byteCount = send(socketFD, &total_size, sizeof(int), 0)) == -1) {
+        fprintf(stderr, "Error sending meta list size! Error code: %d\n", errno);
         return false;
     }
 
     /* 3. send buffer data */
     // send metalist
     if((byteCount = send(socketFD, metalist_buffer, total_size, 0)) == -1) {
-        fprintf(stderr, "Error sending indicator! Error code: %d\n", errno);
+        fprintf(stderr, "Error sending meta list! Error code: %d\n", errno);
         return false;
     }
 
     return true;
 }
-
-/*
- * set special flag for this server
- *
- * @param flag - for indicating this is special server which has the 4-th share
- *               and it is no need to send back to client
- *               Default: false
- */
-void DedupCore::set_last_share_special_flag(bool flag)
-{
-    this->last_share_on_server_ = flag;
-}
-
-/*
- * get special flag for this server
- *
- * @param flag - for indicating this is special server which has the 4-th share
- *               and it is no need to send back to client
- */
-bool DedupCore::get_last_share_special_flag()
-{
-    return this->last_share_on_server_;
-}
-
@@ -11,6 +11,7 @@
 #include <errno.h>
 #include <openssl/evp.h>
 #include <pthread.h>
+#include <map>
 #include <sstream>
 #include <stdio.h>
 #include <stdlib.h>
@@ -36,11 +37,18 @@
 /*for the use of BackendStorer*/
 #include "BackendStorer.hh"
 
+/*for the use of BufferArena*/
+#include "BufferArena.hh"
+
+/*for the use of ServerStats*/
+#include "ServerStats.hh"
+
 /*for the use of CryptoPrimitive*/
 #include "CryptoPrimitive.hh"
 
 #include "dataStruct.hh"
 #include "Logger.hh"
+#include "RecipeStream.hh"
 
 class DedupCore {
 private:
@@ -105,9 +113,6 @@ private:
     /*a mutex lock for the global share container name*/
     pthread_mutex_t globalShareContainerNameLock_;
 
-    /*indicate for a last_share on this server, this server is special for client*/
-    bool last_share_on_server_;
-
     /*
      * format a full file name (including the path) into '/.../.../shortName'
      *
@@ -237,12 +242,14 @@ private:
     bool flushBufferNodeIntoDisk_(perUserBufferNode_t *targetBufferNode);
 
     /*
-     * find or create a buffer node for a user in the buffer node link
+     * find or create a buffer node for a file slot of a user in the buffer node link
+     * (the files a user uploads at once keep their recipes in separate buffer nodes)
      *
      * @param userID - the user id
+     * @param fileID - the file slot of the user
      * @param targetBufferNode - the resulting buffer node <return>
      */
-    void findOrCreateBufferNode_(const int &userID, perUserBufferNode_t *&targetBufferNode);
+    void findOrCreateBufferNode_(const int &userID, const int &fileID, perUserBufferNode_t *&targetBufferNode);
 
     /*
      * add a file's information into the inode index
@@ -315,6 +322,17 @@ private:
      */
     bool appendOldRecipeFile_(perUserBufferNode_t *targetBufferNode, std::string &recipeFileName);
 
+    /*
+     * store the recipes buffered for other files, so that the continuation of a file can start its own
+     * recipe head (the buffer may have moved on to another file when an upload is resumed)
+     *
+     * @param targetBufferNode - the corresponding buffer node
+     * @param recipeFileName - the recipe file name <return>
+     *
+     * @return - a boolean value that indicates if the store op succeeds
+     */
+    bool storeBufferedRecipes_(perUserBufferNode_t *targetBufferNode, std::string &recipeFileName);
+
     /*
      * store the data of the share container buffer into a container
      *
@@ -349,25 +367,83 @@ private:
                                        unsigned char *shareContainerBuffer);
 
     /*
-     * write a new metaNode into file (write data file recipes)
+     * append a new metaNode to the data file recipe handed to the data core
      *
-     * @param fp - the pointer to opened file
+     * @param recipe - the data file recipe
      * @param metaNode - meta node to be added to file
      * @param fileSizeCounter - count the file size <return>
      * @param index - debugging only
      *
      * @return - a boolean value that indicates if the write succeeds
      */
-    bool saveMetaNode2DataFileRecipe(FILE *fp, metaNode *node, int &fileSizeCounter, int index);
+    bool saveMetaNode2DataFileRecipe(RecipeStream *recipe, metaNode *node, int &fileSizeCounter, int index);
+
+    /*
+     * read the head of a metadata chunk in either the legacy or the compact format
+     *
+     * @param metaChunk - the metadata chunk
+     * @param metaChunkSize - the size of the metadata chunk
+     * @param offset - the offset of the first metaNode <return>
+     * @param compact - whether the metadata chunk is in the compact format <return>
+     *
+     * @return - the number of metaNodes in the metadata chunk, or -1 if the head is invalid
+     */
+    int readMetaChunkHead_(unsigned char *metaChunk, int metaChunkSize, int &offset, bool &compact);
+
+    /*
+     * read the next metaNode of a metadata chunk
+     *
+     * @param metaChunk - the metadata chunk
+     * @param metaChunkSize - the size of the metadata chunk
+     * @param offset - the offset of the metaNode, advanced past it <return>
+     * @param compact - whether the metadata chunk is in the compact format
+     * @param node - the previous metaNode (all zero for the first one), overwritten by the read one <return>
+     *
+     * @return - a boolean value that indicates if the read op succeeds
+     */
+    bool readMetaNode_(unsigned char *metaChunk, int metaChunkSize, int &offset, bool compact, metaNode *node);
 
     /*
-     * send file recipe indicator to client
+     * send file recipe indicator to client, followed by where the requested byte range starts in the first secret
+     * and the token the client takes the file recipe with from the data core
      *
      * @param socketFD - the file descriptor of the sending socket
+     * @param rangeSkip - the bytes of the first secret in the file recipe before the requested byte range
+     * @param token - the token of the restore
      *
      * @return - a boolean value that indicates if the operation succeeds
      */
-    bool sendFileRecipeIndicator(int socketFD);
+    bool sendFileRecipeIndicator(int socketFD, long rangeSkip, long token);
+
+
+    /*
+     * look a key up in the database, timed for the live statistics
+     *
+     * @param key - the key
+     * @param value - the value of the key <return>
+     *
+     * @return - the status of the lookup
+     */
+    leveldb::Status dbGet_(const leveldb::Slice &key, std::string *value);
+
+    /*
+     * store a key-value entry into the database, timed for the live statistics
+     *
+     * @param key - the key
+     * @param value - the value
+     *
+     * @return - the status of the write
+     */
+    leveldb::Status dbPut_(const leveldb::Slice &key, const leveldb::Slice &value);
+
+    /*
+     * apply a write batch to the database, timed for the live statistics
+     *
+     * @param batch - the write batch
+     *
+     * @return - the status of the write
+     */
+    leveldb::Status dbWrite_(leveldb::WriteBatch *batch);
 
 public:
     /*
@@ -411,6 +487,7 @@ public:
      * perform the second-stage deduplication
      *
      * @param userID - the user id 
+     * @param fileID - the file slot the share metadata belongs to
      * @param shareMDBuffer - the buffer that stores the share metadata
      * @param shareMDSize - the size of the share metadata buffer
      * @param intraUserDupStatList - a list that records the intra-user duplicate status of each share 
@@ -420,8 +497,8 @@ public:
      *
      * @return - a boolean value that indicates if the second-stage deduplication succeeds
      */
-    bool secondStageDedup(const int &userID, unsigned char *shareMDBuffer, const int &shareMDSize,
-                          bool *intraUserDupStatList,
+    bool secondStageDedup(const int &userID, const int &fileID, unsigned char *shareMDBuffer,
+                          const int &shareMDSize, bool *intraUserDupStatList,
                           unsigned char *shareDataBuffer, CryptoPrimitive *cryptoObj, bool end);
 
     /*
@@ -440,12 +517,23 @@ public:
      */
     bool cleanupAllBufferNodes();
 
+    /*
+     * add up the memory held by the buffer nodes of each user
+     *
+     * @param usage - the bytes of the buffer nodes by user id <return>
+     */
+    void reportBufferNodes(std::map<int, size_t> &usage);
+
     /*
      * restore a share file for a user and write file recipe
      *
      * @param userID - the user id
      * @param fullFileName - the full name of the original file
+     * @param fileRecipeName - the name the data core takes the file recipe by
      * @param versionNumber - the version number (<=0) of the original file
+     * @param rangeOffset - the offset of the byte range to be restored
+     * @param rangeLength - the length of the byte range to be restored (< 0 for up to the end of the file)
+     * @param lastShareOnServer - whether the client restores without the shares numbered k and above on this server
      * @param socketFD - the file descriptor of the sending socket
      * @param cryptoObj - the CryptoPrimitive instance for calculating hash fingerprint
      *
@@ -453,7 +541,8 @@ public:
      */
     bool restoreShareFileAndWriteFileRecipe(const int &userID,
                                             const std::string &fullFileName, const std::string &fileRecipeName,
-                                            const int &versionNumber, int socketFD, CryptoPrimitive *cryptoObj);
+                                            const int &versionNumber, long rangeOffset, long rangeLength,
+                                            bool lastShareOnServer, int socketFD, CryptoPrimitive *cryptoObj);
 
     /*
      * extract ID and shareID from file recipes
@@ -463,11 +552,12 @@ public:
      * @param shareID - the shareID of data shares this metadata chunk contains
      * @param write_index - the index pointing to the location of writing
      * @param end_secretID - the end of secretID in this meta_list(necessary)
+     * @param lastShareOnServer - whether the client restores without the shares numbered k and above on this server
      *
      * @return - a boolean value that indicates if the op succeeds
      */
     bool save_as_metalist(unsigned char *meta_list_buffer, int id, int shareID, int write_index,
-                          int end_secretID);
+                          int end_secretID, bool lastShareOnServer);
 
     /*
      * assemble complete-version of meta_list_buffer and prepare for sending
@@ -479,30 +569,20 @@ public:
     void assemble_full_meta_list_buffer(unsigned char *meta_list_buffer, int &count);
 
     /*
-     * send buffer back to client
+     * tell the client that the meta list follows
      *
-     * @param buffer - buffer to be sent
-     * @param total_size - total size of this buffer
-     * @param count - count how many MetaList in this buffer
      * @param socketFD - the file descriptor of the sending socket
      */
-    bool send_meta_list(unsigned char *metalist_buffer, int total_size, int count, int socketFD);
+    bool send_meta_list_indicator(int socketFD);
 
     /*
-     * set special flag for this server
+     * send a chunk of the meta list back to client and start the next one
      *
-     * @param flag - for indicating this is special server which has the 4-th share
-     *               and it is no need to send back to client
-     */
-    void set_last_share_special_flag(bool flag);
-
-    /*
-     * get special flag for this server
-     *
-     * @param flag - for indicating this is special server which has the 4-th share
-     *               and it is no need to send back to client
+     * @param metalist_buffer - the chunk to be sent
+     * @param count - count how many MetaList in this chunk, reset to 0 once it is sent<return>
+     * @param socketFD - the file descriptor of the sending socket
      */
-    bool get_last_share_special_flag();
+    bool send_meta_list(unsigned char *metalist_buffer, int &count, int socketFD);
 };
 
 #endif
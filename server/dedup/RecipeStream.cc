@@ -0,0 +1,332 @@
+/*
+ * RecipeStream.cc
+ */
+
+#include "RecipeStream.hh"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+std::map<std::pair<int, long>, std::shared_ptr<RecipeStream>> RecipeStream::published_;
+pthread_mutex_t RecipeStream::publishedLock_ = PTHREAD_MUTEX_INITIALIZER;
+// the tokens of a restarted server do not repeat the ones of its previous run
+std::atomic<long> RecipeStream::nextToken_((long) time(NULL) << 20);
+
+/*
+ * constructor
+ *
+ * @param lastShareOnServer - whether the client restores without the shares numbered k and above on this server
+ */
+RecipeStream::RecipeStream(bool lastShareOnServer)
+{
+    pthread_mutex_init(&lock_, NULL);
+    pthread_cond_init(&cond_, NULL);
+    head_.userID = 0;
+    head_.fileSize = 0;
+    head_.numOfShares = 0;
+    spillFD_ = -1;
+    spilled_ = 0;
+    spillRead_ = 0;
+    done_ = false;
+    failed_ = false;
+    doneTime_ = 0;
+    lastShareOnServer_ = lastShareOnServer;
+    token_ = 0;
+}
+
+/*
+ * destructor
+ */
+RecipeStream::~RecipeStream()
+{
+    if(spillFD_ != -1) {
+        close(spillFD_);
+    }
+    pthread_cond_destroy(&cond_);
+    pthread_mutex_destroy(&lock_);
+}
+
+/*
+ * publish a new file recipe for the data core under a token of its own, so that concurrent restores of a file
+ * do not take the recipe of each other; the recipes resolved RECIPE_STREAM_TIMEOUT ago and still not taken
+ * are dropped
+ *
+ * @param userID - the user id
+ * @param recipeName - the name of the file recipe
+ * @param lastShareOnServer - whether the client restores without the shares numbered k and above on this server
+ *
+ * @return - the file recipe to be written
+ */
+std::shared_ptr<RecipeStream> RecipeStream::publish(int userID, const std::string &recipeName, bool lastShareOnServer)
+{
+    auto recipe = std::make_shared<RecipeStream>(lastShareOnServer);
+    recipe->recipeName_ = recipeName;
+    recipe->token_ = nextToken_++;
+
+    pthread_mutex_lock(&publishedLock_);
+    time_t now = time(NULL);
+    for(auto it = published_.begin(); it != published_.end();) {
+        if(it->second->expired_(now)) {
+            printf("[RecipeStream] drop the recipe %s of user %d, not restored\n", it->second->recipeName_.c_str(),
+                   it->first.first);
+            it = published_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    published_[std::make_pair(userID, recipe->token_)] = recipe;
+    pthread_mutex_unlock(&publishedLock_);
+
+    return recipe;
+}
+
+/*
+ * take a published file recipe
+ *
+ * @param userID - the user id
+ * @param recipeName - the name of the file recipe
+ * @param token - the token of the restore
+ *
+ * @return - the file recipe to be read, nullptr if no such recipe is published
+ */
+std::shared_ptr<RecipeStream> RecipeStream::take(int userID, const std::string &recipeName, long token)
+{
+    std::shared_ptr<RecipeStream> recipe;
+
+    pthread_mutex_lock(&publishedLock_);
+    auto it = published_.find(std::make_pair(userID, token));
+    if(it != published_.end() && it->second->recipeName_ == recipeName) {
+        recipe = it->second;
+        published_.erase(it);
+    }
+    pthread_mutex_unlock(&publishedLock_);
+
+    return recipe;
+}
+
+/*
+ * append a file recipe entry
+ *
+ * @param entry - the file recipe entry
+ */
+void RecipeStream::push(const fileRecipeEntry_t &entry)
+{
+    pthread_mutex_lock(&lock_);
+    if(done_) {
+        // the file recipe failed to spill
+        pthread_mutex_unlock(&lock_);
+        return;
+    }
+
+    /*once the entries spill, the later ones follow them into the spill file*/
+    if(entries_.size() < RECIPE_STREAM_MEMORY_ENTRIES && spillRead_ == spilled_ && spillBuffer_.empty()) {
+        entries_.push_back(entry);
+    } else {
+        spillBuffer_.push_back(entry);
+        if(spillBuffer_.size() == RECIPE_STREAM_SPILL_ENTRIES && !flushSpill_()) {
+            done_ = true;
+            failed_ = true;
+            doneTime_ = time(NULL);
+            pthread_cond_broadcast(&cond_);
+        }
+    }
+    pthread_cond_signal(&cond_);
+    pthread_mutex_unlock(&lock_);
+}
+
+/*
+ * write the spill buffer at the end of the spill file (lock_ held)
+ *
+ * @return - a boolean value that indicates if the write succeeds
+ */
+bool RecipeStream::flushSpill_()
+{
+    if(spillFD_ == -1) {
+        char spillName[] = RECIPE_STREAM_SPILL_TEMPLATE;
+        spillFD_ = mkstemp(spillName);
+        if(spillFD_ == -1) {
+            fprintf(stderr, "Error: fail to create the recipe spill file! Error code: %d\n", errno);
+            return false;
+        }
+        unlink(spillName);
+    }
+
+    const char *data = (const char *) spillBuffer_.data();
+    size_t size = spillBuffer_.size() * sizeof(fileRecipeEntry_t);
+    off_t offset = (off_t) spilled_ * sizeof(fileRecipeEntry_t);
+    size_t written = 0;
+    while(written < size) {
+        ssize_t ret = pwrite(spillFD_, data + written, size - written, offset + written);
+        if(ret == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Error: fail to write the recipe spill file! Error code: %d\n", errno);
+            return false;
+        }
+        written += ret;
+    }
+    spilled_ += spillBuffer_.size();
+    spillBuffer_.clear();
+
+    return true;
+}
+
+/*
+ * read the next entries of the spill file back into memory (lock_ held)
+ *
+ * @return - a boolean value that indicates if the read succeeds
+ */
+bool RecipeStream::readSpill_()
+{
+    long numOfEntries = spilled_ - spillRead_;
+    if(numOfEntries > RECIPE_STREAM_SPILL_ENTRIES) {
+        numOfEntries = RECIPE_STREAM_SPILL_ENTRIES;
+    }
+
+    std::vector<fileRecipeEntry_t> batch(numOfEntries);
+    char *data = (char *) batch.data();
+    size_t size = numOfEntries * sizeof(fileRecipeEntry_t);
+    off_t offset = (off_t) spillRead_ * sizeof(fileRecipeEntry_t);
+    size_t count = 0;
+    while(count < size) {
+        ssize_t ret = pread(spillFD_, data + count, size - count, offset + count);
+        if(ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if(ret <= 0) {
+            fprintf(stderr, "Error: fail to read the recipe spill file! Error code: %d\n", errno);
+            return false;
+        }
+        count += ret;
+    }
+    entries_.insert(entries_.end(), batch.begin(), batch.end());
+    spillRead_ += numOfEntries;
+
+    return true;
+}
+
+/*
+ * whether the file recipe has waited RECIPE_STREAM_TIMEOUT for the data core since it is resolved
+ *
+ * @param now - the current time
+ */
+bool RecipeStream::expired_(time_t now)
+{
+    pthread_mutex_lock(&lock_);
+    bool ret = done_ && now - doneTime_ >= RECIPE_STREAM_TIMEOUT;
+    pthread_mutex_unlock(&lock_);
+
+    return ret;
+}
+
+/*
+ * end the file recipe with its head
+ *
+ * @param head - the head of the file recipe
+ */
+void RecipeStream::finish(const fileRecipeHead_t &head)
+{
+    pthread_mutex_lock(&lock_);
+    if(done_) {
+        // the file recipe failed to spill
+        pthread_mutex_unlock(&lock_);
+        return;
+    }
+    head_ = head;
+    done_ = true;
+    doneTime_ = time(NULL);
+    pthread_cond_broadcast(&cond_);
+    pthread_mutex_unlock(&lock_);
+}
+
+/*
+ * end the file recipe of a failed restore, nothing after the entries so far (no effect once finished)
+ */
+void RecipeStream::abort()
+{
+    pthread_mutex_lock(&lock_);
+    if(!done_) {
+        done_ = true;
+        failed_ = true;
+        doneTime_ = time(NULL);
+        pthread_cond_broadcast(&cond_);
+    }
+    pthread_mutex_unlock(&lock_);
+}
+
+/*
+ * take the next file recipe entry, waiting for the meta core to resolve it
+ *
+ * @param entry - the file recipe entry <return>
+ *
+ * @return - false if the file recipe has no more entries
+ */
+bool RecipeStream::pop(fileRecipeEntry_t &entry)
+{
+    pthread_mutex_lock(&lock_);
+    while(entries_.empty() && spillRead_ == spilled_ && spillBuffer_.empty() && !done_) {
+        pthread_cond_wait(&cond_, &lock_);
+    }
+
+    /*the spilled entries come back in their order: the spill file first, then the spill buffer*/
+    if(entries_.empty() && !failed_) {
+        if(spillRead_ < spilled_) {
+            if(!readSpill_()) {
+                done_ = true;
+                failed_ = true;
+                doneTime_ = time(NULL);
+                pthread_cond_broadcast(&cond_);
+            }
+        } else if(!spillBuffer_.empty()) {
+            entries_.insert(entries_.end(), spillBuffer_.begin(), spillBuffer_.end());
+            spillBuffer_.clear();
+        }
+    }
+    bool ret = !entries_.empty();
+    if(ret) {
+        entry = entries_.front();
+        entries_.pop_front();
+    }
+    pthread_mutex_unlock(&lock_);
+
+    return ret;
+}
+
+/*
+ * get the head of the file recipe, waiting for the meta core to finish
+ *
+ * @param head - the head of the file recipe <return>
+ *
+ * @return - false if the restore failed in the meta core
+ */
+bool RecipeStream::getHead(fileRecipeHead_t &head)
+{
+    pthread_mutex_lock(&lock_);
+    while(!done_) {
+        pthread_cond_wait(&cond_, &lock_);
+    }
+    head = head_;
+    bool ret = !failed_;
+    pthread_mutex_unlock(&lock_);
+
+    return ret;
+}
+
+/*
+ * whether the client restores without the shares numbered k and above on this server
+ */
+bool RecipeStream::lastShareOnServer() const
+{
+    return lastShareOnServer_;
+}
+
+/*
+ * the token of the restore, the client sends it back to take the file recipe
+ */
+long RecipeStream::token() const
+{
+    return token_;
+}
@@ -0,0 +1,185 @@
+/*
+ * RecipeStream.hh
+ *
+ * Hand the data file recipe of a restore from the meta core to the data core in memory
+ */
+
+#ifndef __RECIPESTREAM_HH__
+#define __RECIPESTREAM_HH__
+
+#include <pthread.h>
+#include <time.h>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dataStruct.hh"
+
+/*the entries kept in memory, the later ones are spilled into a file until the data core catches up*/
+#define RECIPE_STREAM_MEMORY_ENTRIES (1 << 16)
+
+/*the entries written into or read from the spill file at once*/
+#define RECIPE_STREAM_SPILL_ENTRIES 4096
+
+/*the spill file, removed as soon as it is created*/
+#define RECIPE_STREAM_SPILL_TEMPLATE "meta/RecipeFiles/.spill-XXXXXX"
+
+/*seconds a resolved file recipe waits for the data core before it is dropped*/
+#define RECIPE_STREAM_TIMEOUT 300
+
+/*
+ * the file recipe entries of a restore, appended by the meta core while it resolves the metadata chunks and
+ * taken by the data core as they come; the head is only known once the meta core has resolved all of them.
+ * The data core only starts once the client has the metadata of all the meta servers, so the entries beyond
+ * RECIPE_STREAM_MEMORY_ENTRIES wait in a spill file
+ */
+class RecipeStream {
+private:
+    /*the lock and the condition of the entries and the state*/
+    pthread_mutex_t lock_;
+    pthread_cond_t cond_;
+
+    /*the entries not taken by the data core yet, the earliest ones*/
+    std::deque<fileRecipeEntry_t> entries_;
+
+    /*the spill file (-1 until the memory is full), the entries written into it and the ones read back*/
+    int spillFD_;
+    long spilled_;
+    long spillRead_;
+
+    /*the entries after the ones in the spill file, written into it once RECIPE_STREAM_SPILL_ENTRIES are there*/
+    std::vector<fileRecipeEntry_t> spillBuffer_;
+
+    /*the head of the file recipe, set when the meta core finishes*/
+    fileRecipeHead_t head_;
+
+    /*no more entries come: the meta core either finishes or fails*/
+    bool done_;
+    bool failed_;
+
+    /*when the meta core finishes or fails*/
+    time_t doneTime_;
+
+    /*the client restores without the shares numbered k and above on this server*/
+    bool lastShareOnServer_;
+
+    /*the name of the file recipe, and the token of the restore the client takes it with*/
+    std::string recipeName_;
+    long token_;
+
+    /*the recipes published and not taken yet, by user and token, and the token of the next restore*/
+    static std::map<std::pair<int, long>, std::shared_ptr<RecipeStream>> published_;
+    static pthread_mutex_t publishedLock_;
+    static std::atomic<long> nextToken_;
+
+    /*
+     * write the spill buffer at the end of the spill file (lock_ held)
+     *
+     * @return - a boolean value that indicates if the write succeeds
+     */
+    bool flushSpill_();
+
+    /*
+     * read the next entries of the spill file back into memory (lock_ held)
+     *
+     * @return - a boolean value that indicates if the read succeeds
+     */
+    bool readSpill_();
+
+    /*
+     * whether the file recipe has waited RECIPE_STREAM_TIMEOUT for the data core since it is resolved
+     *
+     * @param now - the current time
+     */
+    bool expired_(time_t now);
+
+public:
+    /*
+     * constructor
+     *
+     * @param lastShareOnServer - whether the client restores without the shares numbered k and above on this server
+     */
+    explicit RecipeStream(bool lastShareOnServer);
+
+    /*
+     * destructor
+     */
+    ~RecipeStream();
+
+    /*
+     * publish a new file recipe for the data core under a token of its own, so that concurrent restores of a file
+     * do not take the recipe of each other; the recipes resolved RECIPE_STREAM_TIMEOUT ago and still not taken
+     * are dropped
+     *
+     * @param userID - the user id
+     * @param recipeName - the name of the file recipe
+     * @param lastShareOnServer - whether the client restores without the shares numbered k and above on this server
+     *
+     * @return - the file recipe to be written
+     */
+    static std::shared_ptr<RecipeStream> publish(int userID, const std::string &recipeName, bool lastShareOnServer);
+
+    /*
+     * take a published file recipe
+     *
+     * @param userID - the user id
+     * @param recipeName - the name of the file recipe
+     * @param token - the token of the restore
+     *
+     * @return - the file recipe to be read, nullptr if no such recipe is published
+     */
+    static std::shared_ptr<RecipeStream> take(int userID, const std::string &recipeName, long token);
+
+    /*
+     * append a file recipe entry
+     *
+     * @param entry - the file recipe entry
+     */
+    void push(const fileRecipeEntry_t &entry);
+
+    /*
+     * end the file recipe with its head
+     *
+     * @param head - the head of the file recipe
+     */
+    void finish(const fileRecipeHead_t &head);
+
+    /*
+     * end the file recipe of a failed restore, nothing after the entries so far (no effect once finished)
+     */
+    void abort();
+
+    /*
+     * take the next file recipe entry, waiting for the meta core to resolve it
+     *
+     * @param entry - the file recipe entry <return>
+     *
+     * @return - false if the file recipe has no more entries
+     */
+    bool pop(fileRecipeEntry_t &entry);
+
+    /*
+     * get the head of the file recipe, waiting for the meta core to finish
+     *
+     * @param head - the head of the file recipe <return>
+     *
+     * @return - false if the restore failed in the meta core
+     */
+    bool getHead(fileRecipeHead_t &head);
+
+    /*
+     * whether the client restores without the shares numbered k and above on this server
+     */
+    bool lastShareOnServer() const;
+
+    /*
+     * the token of the restore, the client sends it back to take the file recipe
+     */
+    long token() const;
+};
+
+#endif
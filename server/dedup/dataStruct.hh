@@ -43,8 +43,10 @@
 #define NO_DATA_CHUNKS_FOUND (-6)
 #define END_OF_DATA_CHUNKS (-51)
 
-/* the size of metalist buffer */
-#define METALIST_BUFFER_SIZE (100 << 20) // size: 100MB
+/* the meta list is streamed to the client in chunks of this size, an empty chunk ends it */
+#define METALIST_CHUNK_SIZE (64 << 10) // size: 64KB
+/* the number of MetaList in a chunk, after the counter */
+#define METALIST_CHUNK_ITEMS ((int) ((METALIST_CHUNK_SIZE - sizeof(int)) / sizeof(MetaList)))
 /* the indicator of sending meta_list back to client */
 #define SEND_META_LIST (1001)
 
@@ -132,6 +134,7 @@ typedef struct {
 /*the per-user buffer node structure*/
 typedef struct perUserBufferNode {
     int userID;
+    int fileID;
     char recipeFileName[INTERNAL_FILE_NAME_SIZE];
     unsigned char recipeFileBuffer[RECIPE_BUFFER_SIZE];
     int recipeFileBufferCurrLen;
@@ -212,6 +215,11 @@ typedef struct {
     };
 } ItemMeta_t;
 
+/*metadata chunk format (legacy): count<int> + [metaNode ... metaNode]*/
+/*metadata chunk format (compact): magic<int> + count<int> + [shareFP + varints of the zigzag deltas of
+  (secretID, secretSize, shareSize, segID, shareID) against the previous node] ...*/
+#define META_CHUNK_COMPACT_MAGIC (-0x4d43)
+
 typedef struct {
     unsigned char shareFP[HASH_SIZE];
     int secretID;
@@ -28,7 +28,6 @@ minDedupCore::minDedupCore(const std::string &dedupDirName, const std::string &d
     shareContainerDirName_ = shareContainerDirName;
     containerStorerObj_ = containerStorerObj;
 
-    last_share_on_server_ = false;
 
     /*format all input dir names*/
     if(!formatDirName_(dedupDirName_)) {
@@ -378,6 +377,53 @@ inline void minDedupCore::getCurrTime_(double &time)
     time = (double) tv.tv_sec + (double) tv.tv_usec * 1e-6;
 }
 
+/*
+ * look a key up in the database, timed for the live statistics
+ *
+ * @param key - the key
+ * @param value - the value of the key <return>
+ *
+ * @return - the status of the lookup
+ */
+leveldb::Status minDedupCore::dbGet_(const leveldb::Slice &key, std::string *value)
+{
+    long start = ServerStats::clockMicros();
+    leveldb::Status stat = db_->Get(readOptions_, key, value);
+    ServerStats::recordLatency(STATS_DB_GET, start);
+    return stat;
+}
+
+/*
+ * store a key-value entry into the database, timed for the live statistics
+ *
+ * @param key - the key
+ * @param value - the value
+ *
+ * @return - the status of the write
+ */
+leveldb::Status minDedupCore::dbPut_(const leveldb::Slice &key, const leveldb::Slice &value)
+{
+    long start = ServerStats::clockMicros();
+    leveldb::Status stat = db_->Put(writeOptions_, key, value);
+    ServerStats::recordLatency(STATS_DB_WRITE, start);
+    return stat;
+}
+
+/*
+ * apply a write batch to the database, timed for the live statistics
+ *
+ * @param batch - the write batch
+ *
+ * @return - the status of the write
+ */
+leveldb::Status minDedupCore::dbWrite_(leveldb::WriteBatch *batch)
+{
+    long start = ServerStats::clockMicros();
+    leveldb::Status stat = db_->Write(writeOptions_, batch);
+    ServerStats::recordLatency(STATS_DB_WRITE, start);
+    return stat;
+}
+
 /*
  * flush a buffer node into the disk
  *
@@ -402,6 +448,7 @@ bool minDedupCore::flushBufferNodeIntoDisk_(perUserBufferNode_t *targetBufferNod
         }
 
         /*create a container file for writing shares*/
+        long flushStart = ServerStats::clockMicros();
         fp = fopen(shareContainerName.c_str(), "wb");
         if(fp == NULL) {
             fprintf(stderr, "Error: fail to open the file '%s' for writing shares!\n", shareContainerName.c_str());
@@ -417,6 +464,7 @@ bool minDedupCore::flushBufferNodeIntoDisk_(perUserBufferNode_t *targetBufferNod
         }
 
         fclose(fp);
+        ServerStats::recordLatency(STATS_CONTAINER_FLUSH, flushStart);
 
         if(containerStorerObj_ != NULL) {
             containerStorerObj_->addNewFile(shareContainerName);
@@ -573,7 +621,7 @@ bool minDedupCore::intraUserIndexUpdate_(char *shareFP, const int &userID, bool
     /*get the mutex lock DBLock_*/
     pthread_mutex_lock(&DBLock_);
 
-    leveldb::Status getStat = db_->Get(readOptions_, *keySlice, &valueString);
+    leveldb::Status getStat = dbGet_(*keySlice, &valueString);
 
     if(getStat.ok()) {
         valueOffset = 0;
@@ -616,7 +664,7 @@ bool minDedupCore::intraUserIndexUpdate_(char *shareFP, const int &userID, bool
             batch_.Put(*keySlice, *valueSlice);
 
             /*execute all batched database update ops*/
-            leveldb::Status writeStat = db_->Write(writeOptions_, &batch_);
+            leveldb::Status writeStat = dbWrite_(&batch_);
             if(writeStat.ok() == false) {
                 fprintf(stderr, "Error: fail to perform batched writes!\n");
                 fprintf(stderr, "Status: %s \n", writeStat.ToString().c_str());
@@ -707,9 +755,11 @@ bool minDedupCore::interUserIndexUpdate_(char *shareFP, const int &userID, const
     /*get the mutex lock DBLock_*/
     pthread_mutex_lock(&DBLock_);
 
-    leveldb::Status getStat = db_->Get(readOptions_, *keySlice, &valueString);
+    leveldb::Status getStat = dbGet_(*keySlice, &valueString);
 
     if(getStat.ok()) {
+        ServerStats::countShare(STATS_DATA, STATS_SHARE_INTER_DUP, shareSize);
+
         valueOffset = 0;
         pShareIndexValueHead = (shareIndexValueHead_t *) (valueString.data() + valueOffset);
         valueOffset += shareIndexValueHeadSize_;
@@ -755,7 +805,7 @@ bool minDedupCore::interUserIndexUpdate_(char *shareFP, const int &userID, const
             batch_.Put(*keySlice, *valueSlice);
 
             /*execute all batched database update ops*/
-            leveldb::Status writeStat = db_->Write(writeOptions_, &batch_);
+            leveldb::Status writeStat = dbWrite_(&batch_);
             if(writeStat.ok() == false) {
                 fprintf(stderr, "Error: fail to perform batched writes!\n");
                 fprintf(stderr, "Status: %s \n", writeStat.ToString().c_str());
@@ -800,7 +850,7 @@ bool minDedupCore::interUserIndexUpdate_(char *shareFP, const int &userID, const
             batch_.Put(*keySlice, *valueSlice);
 
             /*execute all batched database update ops*/
-            leveldb::Status writeStat = db_->Write(writeOptions_, &batch_);
+            leveldb::Status writeStat = dbWrite_(&batch_);
             if(writeStat.ok() == false) {
                 fprintf(stderr, "Error: fail to perform batched writes!\n");
                 fprintf(stderr, "Status: %s \n", writeStat.ToString().c_str());
@@ -820,6 +870,8 @@ bool minDedupCore::interUserIndexUpdate_(char *shareFP, const int &userID, const
     }
 
     if(getStat.IsNotFound()) {
+        ServerStats::countShare(STATS_DATA, STATS_SHARE_UNIQUE, shareSize);
+
         /*release the mutex lock DBLock_*/
         pthread_mutex_unlock(&DBLock_);
 
@@ -863,7 +915,7 @@ bool minDedupCore::interUserIndexUpdate_(char *shareFP, const int &userID, const
         pthread_mutex_lock(&DBLock_);
 
         /*(b) store the key-value entry into the share index*/
-        db_->Put(writeOptions_, *keySlice, *valueSlice);
+        dbPut_(*keySlice, *valueSlice);
 
         /*release the mutex lock DBLock_*/
         pthread_mutex_unlock(&DBLock_);
@@ -925,6 +977,7 @@ bool minDedupCore::storeShareContainer_(perUserBufferNode_t *targetBufferNode, s
     }
 
     /*create a container file for writing shares*/
+    long flushStart = ServerStats::clockMicros();
     FILE *fp = fopen(shareContainerName.c_str(), "wb");
     if(fp == NULL) {
         fprintf(stderr, "Error: fail to open the file '%s' for writing shares!\n", shareContainerName.c_str());
@@ -954,6 +1007,7 @@ bool minDedupCore::storeShareContainer_(perUserBufferNode_t *targetBufferNode, s
     targetBufferNode->shareContainerBufferCurrLen = 0;
 
     fclose(fp);
+    ServerStats::recordLatency(STATS_CONTAINER_FLUSH, flushStart);
     return 1;
 }
 
@@ -1041,6 +1095,8 @@ bool minDedupCore::firstStageDedup(const int &userID, unsigned char *shareMDBuff
             }
             if(intraUserDupStatList[numOfShares] == 0) {
                 sentShareDataSize += pShareMDEntry->shareSize;
+            } else {
+                ServerStats::countShare(STATS_DATA, STATS_SHARE_INTRA_DUP, pShareMDEntry->shareSize);
             }
 
             numOfShares++;
@@ -1244,19 +1300,42 @@ bool minDedupCore::cleanupAllBufferNodes()
     return 1;
 }
 
+/*
+ * add up the memory held by the buffer nodes of each user
+ *
+ * @param usage - the bytes of the buffer nodes by user id <return>
+ */
+void minDedupCore::reportBufferNodes(std::map<int, size_t> &usage)
+{
+    /*get the mutex lock bufferLock_*/
+    pthread_mutex_lock(&bufferLock_);
+
+    for(perUserBufferNode_t *currBufferNode = headBufferNode_; currBufferNode != NULL;
+        currBufferNode = currBufferNode->next) {
+        usage[currBufferNode->userID] += perUserBufferNodeSize_;
+    }
+
+    /*release the mutex lock bufferLock_*/
+    pthread_mutex_unlock(&bufferLock_);
+}
+
 /*
  * restore a share file for a user and send it through the socket
  *
  * @param userID - the user id
- * @param fullFileName - the full name of the original file 
+ * @param fullFileName - the name of the file recipe published by the meta core
+ * @param recipeToken - the token of the restore, returned by the meta core with the file recipe
  * @param versionNumber - the version number (<=0) of the original file 
  * @param socketFD - the file descriptor of the sending socket
  * @param cryptoObj - the CryptoPrimitive instance for calculating hash fingerprint
+ * @param selection - the sorted ranges [first, last] of the secret IDs whose shares are requested
+ * @param numOfRanges - the number of ranges (< 0 for the shares of all the secrets)
  *
  * @return - a boolean value that indicates if the restore op succeeds
  */
-bool minDedupCore::restoreShareFile(const int &userID, const std::string &fullRecipeFileName, const int &versionNumber,
-                                    int socketFD, CryptoPrimitive *cryptoObj)
+bool minDedupCore::restoreShareFile(const int &userID, const std::string &fullRecipeFileName, long recipeToken,
+                                    const int &versionNumber, int socketFD, CryptoPrimitive *cryptoObj,
+                                    const int *selection, int numOfRanges)
 {
 
     leveldb::Status inodeStat, shareStat;
@@ -1265,16 +1344,15 @@ bool minDedupCore::restoreShareFile(const int &userID, const std::string &fullRe
     leveldb::Slice *shareKeySlice;
     std::string valueString;
     int valueOffset;
-    unsigned char *recipeFileBuffer, *shareFileBuffer;
+    unsigned char *shareFileBuffer;
     int shareFileBufferOffset;
     shareContainerCacheNode_t *shareContainerCache;
     int *shareContainerCacheIndex, numOfCachedShareContainers;
-    FILE *recipeFilePointer, *containerFilePointer;
+    FILE *containerFilePointer;
     std::string fullShareContainerName;
     int numOfShares;
 
     shareIndexValueHead_t *pShareIndexValueHead;
-    fileRecipeHead_t *pFileRecipeHead;
     fileRecipeEntry_t *pFileRecipeEntry;
     shareFileHead_t *pShareFileHead;
     shareEntry_t *pShareEntry;
@@ -1288,117 +1366,86 @@ bool minDedupCore::restoreShareFile(const int &userID, const std::string &fullRe
         return 0;
     }
 
-    recipeFilePointer = fopen(fullRecipeFileName.c_str(), "rb+");
+    /*the meta core hands the file recipe over in memory, the shares are sent as its entries are resolved*/
+    std::shared_ptr<RecipeStream> recipe = RecipeStream::take(userID, fullRecipeFileName, recipeToken);
     printf("[Data] restore - file name = %s\n", fullRecipeFileName.c_str());
+    bool lastShareOnServer = (recipe != nullptr) && recipe->lastShareOnServer();
     /*if such an inode for fullFileName exists*/
-    if(recipeFilePointer != NULL) {
+    if(recipe != nullptr) {
 
         printf("[Data] start restore file\n");
         /*enlarge the share file buffer size with a message head (indicator, sentDataSize)*/
         int sentMsgHeadSize = sizeof(uint32_t) * 2;
         int sentShareFileBufferSize = sentMsgHeadSize + SHARE_FILE_BUFFER_SIZE;
 
-        /*allocate some caches and buffers for accelerating file restoring speed*/
-        recipeFileBuffer = (unsigned char *) malloc(sizeof(unsigned char) * RECIPE_BUFFER_SIZE);
-        shareFileBuffer = (unsigned char *) malloc(sentShareFileBufferSize);
-        shareContainerCache = (shareContainerCacheNode_t *) malloc(
-                sizeof(shareContainerCacheNode_t) * NUM_OF_CACHED_CONTAINERS);
+        /*lease some caches and buffers for accelerating file restoring speed*/
+        size_t shareContainerCacheSize = sizeof(shareContainerCacheNode_t) * NUM_OF_CACHED_CONTAINERS;
+        shareFileBuffer = (unsigned char *) BufferArena::lease(sentShareFileBufferSize);
+        shareContainerCache = (shareContainerCacheNode_t *) BufferArena::lease(shareContainerCacheSize);
         shareContainerCacheIndex = (int *) malloc(sizeof(int) * NUM_OF_CACHED_CONTAINERS);
         numOfCachedShareContainers = 0;
-
-        // Try to get file size, therefore send pointer to the end
-        fseek(recipeFilePointer, 0, SEEK_END);
-
-        /* IF empty data found in file recipe, then exit and clean up */
-        if(ftell(recipeFilePointer) == 0) {
-            // No need to check this code below unless you are testing only one-chunk file
-
-            printf("[Data] [restore] no data chunks found in this server. file recipe file size = 0\n");
-            /* `NO_DATA_CHUNKS_FOUND` tells client to end downloading chunk */
-            indicator = htonl(NO_DATA_CHUNKS_FOUND);
-            auto buffer = std::make_unique<char[]>(sizeof(int));
-            memcpy(buffer.get(), &indicator, sizeof(int));
-            int retValue = 0;
-            retValue = send(socketFD, buffer.get(), sizeof(int), 0);
-            if(retValue != sizeof(int)) {
-                fprintf(stderr, "Error informing client to end downloading chunks\n");
-                return -1;
-            }
-            printf("[Data] [restore] client informed!\n");
-
-            /* delete file recipe */
-            char cmd[256];
-            snprintf(cmd, sizeof(cmd), "rm -rf %s", fullRecipeFileName.c_str());
-            pid_t status = system(cmd);
-            if(status == -1) {
-                printf("error in system call function %s\n", cmd);
-            }
-
-            printf("[Data] [restore] Exiting restoring function...\n\n");
-            return -1;
-        }
-
-        // reset to the begging of file
-        /*read the first RECIPE_BUFFER_SIZE bytes of the recipe file and store them into recipeFileBuffer*/
-        rewind(recipeFilePointer);
-
-        if(fread(recipeFileBuffer, 1, sizeof(fileRecipeHead_t), recipeFilePointer) == 0) {
-
-            fprintf(stderr, "Error: fail to read the recipe file '%s'!\n", fullRecipeFileName.c_str());
-            fclose(recipeFilePointer);
-            free(recipeFileBuffer);
-            free(shareFileBuffer);
-            free(shareContainerCache);
+        if(shareFileBuffer == NULL || shareContainerCache == NULL) {
+            fprintf(stderr, "Error: no buffer left for restoring '%s'!\n", fullRecipeFileName.c_str());
+            BufferArena::release(shareFileBuffer, sentShareFileBufferSize);
+            BufferArena::release(shareContainerCache, shareContainerCacheSize);
             free(shareContainerCacheIndex);
             return 0;
         }
 
-        /*read the file recipe head*/
-        pFileRecipeHead = (fileRecipeHead_t *) (recipeFileBuffer);
-
-        /*generate and store the share file head into shareFileBuffer*/
+        /*the share file head goes before the first share, it is known once the meta core has resolved all the
+          entries, so the shares of the first entries are read meanwhile*/
         shareFileBufferOffset = sentMsgHeadSize;
         pShareFileHead = (shareFileHead_t *) (shareFileBuffer + shareFileBufferOffset);
-        pShareFileHead->fileSize = pFileRecipeHead->fileSize;
-        printf("[Data] file size = %ld\n", pShareFileHead->fileSize);
-        pShareFileHead->numOfShares = pFileRecipeHead->numOfShares;
-        printf("[Data] share number = %d\n", pShareFileHead->numOfShares);
         shareFileBufferOffset += shareFileHeadSize_;
-
-        /*restore each share*/
-        numOfShares = pShareFileHead->numOfShares;
-
-        int containerID = 0;
-
-        for(int i = 0; i < numOfShares; i++) {
-
-            if(fread(recipeFileBuffer, 1, sizeof(fileRecipeEntry_t), recipeFilePointer) == 0) {
-                fprintf(stderr, "Error: fail to read the file recipe entry from recipe file '%s'!\n",
+        bool headReady = false;
+        numOfShares = 0;
+        auto fillShareFileHead = [&]() -> bool {
+            fileRecipeHead_t recipeHead;
+            if(!recipe->getHead(recipeHead)) {
+                fprintf(stderr, "Error: the meta core fails to resolve the recipe '%s'!\n",
                         fullRecipeFileName.c_str());
+                return false;
+            }
+            pShareFileHead->fileSize = recipeHead.fileSize;
+            printf("[Data] file size = %ld\n", pShareFileHead->fileSize);
+            pShareFileHead->numOfShares = recipeHead.numOfShares;
+            printf("[Data] share number = %d\n", pShareFileHead->numOfShares);
+            numOfShares = recipeHead.numOfShares;
+            headReady = true;
+            return true;
+        };
 
-                fclose(recipeFilePointer);
-
-                free(recipeFileBuffer);
-                free(shareFileBuffer);
-                free(shareContainerCache);
-                free(shareContainerCacheIndex);
-                return 0;
+        int containerID = 0;
+        // the current range of the selection, the secret IDs of the recipe entries only grow
+        int rangeIndex = 0;
+        int numOfSentShares = 0;
+        // the recipe entries handled, sent or not, for the restore progress
+        int numOfEntries = 0;
+
+        fileRecipeEntry_t recipeEntry;
+        while(recipe->pop(recipeEntry)) {
+            /*the next file recipe entry*/
+            pFileRecipeEntry = &recipeEntry;
+            numOfEntries++;
+
+            /*the client restores the secret from the shares of other servers, neither read nor send the share*/
+            if(numOfRanges >= 0) {
+                while(rangeIndex < numOfRanges && selection[2 * rangeIndex + 1] < pFileRecipeEntry->secretID) {
+                    rangeIndex++;
+                }
+                if(rangeIndex == numOfRanges || selection[2 * rangeIndex] > pFileRecipeEntry->secretID) {
+                    continue;
+                }
             }
-            /*read the file recipe entry*/
-            pFileRecipeEntry = (fileRecipeEntry_t *) (recipeFileBuffer);
+            numOfSentShares++;
 
             /*generate the key for the corresponding share*/
             shareFP2IndexKey_(pFileRecipeEntry->shareFP, key);
             shareKeySlice = new leveldb::Slice(key, KEY_SIZE);
 
-            /*get the mutex lock DBLock_*/
-            pthread_mutex_lock(&DBLock_);
-
-            /*enquire the key in thshareBufferIndexe database*/
-            shareStat = db_->Get(readOptions_, *shareKeySlice, &valueString);
-
-            /*release the mutex lock DBLock_*/
-            pthread_mutex_unlock(&DBLock_);
+            /*enquire the key in the database, a single lookup is safe against concurrent writes without DBLock_, so
+              restores only read and never wait for each other or for uploads*/
+            shareStat = dbGet_(*shareKeySlice, &valueString);
 
             /*if such a share exists*/
             if(shareStat.ok()) {
@@ -1454,9 +1501,8 @@ bool minDedupCore::restoreShareFile(const int &userID, const std::string &fullRe
                         if(!addPrefixDir_(shareContainerDirName_, fullShareContainerName)) {
                             fprintf(stderr, "Error: fail to add the prefix '%s' to '%s'!\n",
                                     shareContainerDirName_.c_str(), fullShareContainerName.c_str());
-                            free(recipeFileBuffer);
-                            free(shareFileBuffer);
-                            free(shareContainerCache);
+                            BufferArena::release(shareFileBuffer, sentShareFileBufferSize);
+                            BufferArena::release(shareContainerCache, shareContainerCacheSize);
                             free(shareContainerCacheIndex);
                             return 0;
                         }
@@ -1471,9 +1517,8 @@ bool minDedupCore::restoreShareFile(const int &userID, const std::string &fullRe
                         if(containerFilePointer == NULL) {
                             fprintf(stderr, "Error: fail to open the share container file '%s'!\n",
                                     fullShareContainerName.c_str());
-                            free(recipeFileBuffer);
-                            free(shareFileBuffer);
-                            free(shareContainerCache);
+                            BufferArena::release(shareFileBuffer, sentShareFileBufferSize);
+                            BufferArena::release(shareContainerCache, shareContainerCacheSize);
                             free(shareContainerCacheIndex);
                             return 0;
                         }
@@ -1484,9 +1529,8 @@ bool minDedupCore::restoreShareFile(const int &userID, const std::string &fullRe
                                     fullShareContainerName.c_str());
                             fclose(containerFilePointer);
 
-                            free(recipeFileBuffer);
-                            free(shareFileBuffer);
-                            free(shareContainerCache);
+                            BufferArena::release(shareFileBuffer, sentShareFileBufferSize);
+                            BufferArena::release(shareContainerCache, shareContainerCacheSize);
                             free(shareContainerCacheIndex);
                             return 0;
                         }
@@ -1502,6 +1546,13 @@ bool minDedupCore::restoreShareFile(const int &userID, const std::string &fullRe
                 /*check if shareFileBuffer has enough space for keeping the share info and data*/
                 if(shareFileBufferOffset + shareEntrySize_ + pShareIndexValueHead->shareSize >
                    sentShareFileBufferSize) {
+                    if(!headReady && !fillShareFileHead()) {
+                        BufferArena::release(shareFileBuffer, sentShareFileBufferSize);
+                        BufferArena::release(shareContainerCache, shareContainerCacheSize);
+                        free(shareContainerCacheIndex);
+                        return 0;
+                    }
+
                     /*add the message head before sending the data of the share file buffer*/
                     indicator = htonl(-5);
                     sentDataSize = htonl(shareFileBufferOffset - sentMsgHeadSize);
@@ -1517,21 +1568,21 @@ bool minDedupCore::restoreShareFile(const int &userID, const std::string &fullRe
                         fprintf(stderr,
                                 "Error: fail to send the data of the share file buffer (totally in %d bytes) through the socket %d --- return %ld!\n",
                                 shareFileBufferOffset, socketFD, sentSize);
-                        free(recipeFileBuffer);
-                        free(shareFileBuffer);
-                        free(shareContainerCache);
+                        BufferArena::release(shareFileBuffer, sentShareFileBufferSize);
+                        BufferArena::release(shareContainerCache, shareContainerCacheSize);
                         free(shareContainerCacheIndex);
                         return 0;
                     }
 
                     /*reset shareFileBufferOffset*/
                     shareFileBufferOffset = sentMsgHeadSize;
+                    ServerStats::restoreProgress(socketFD, numOfEntries - 1, numOfShares);
                 }
 
                 /*generate and store the share info into shareFileBuffer*/
                 pShareEntry = (shareEntry_t *) (shareFileBuffer + shareFileBufferOffset);
                 
-                if(this->last_share_on_server_ && pFileRecipeEntry->shareID >= NUM_OF_SHARES_NEEDED) {
+                if(lastShareOnServer && pFileRecipeEntry->shareID >= NUM_OF_SHARES_NEEDED) {
                     // set a placeholder
                     pShareEntry->segID = pFileRecipeEntry->segID;
                     // secretID is necessary
@@ -1565,9 +1616,8 @@ bool minDedupCore::restoreShareFile(const int &userID, const std::string &fullRe
             if(shareStat.IsNotFound()) {
                 fprintf(stderr, "Error: cannot find a share for the key '%s' in the database!\n",
                         shareKeySlice->ToString().c_str());
-                free(recipeFileBuffer);
-                free(shareFileBuffer);
-                free(shareContainerCache);
+                BufferArena::release(shareFileBuffer, sentShareFileBufferSize);
+                BufferArena::release(shareContainerCache, shareContainerCacheSize);
                 free(shareContainerCacheIndex);
                 delete shareKeySlice;
                 return 0;
@@ -1576,9 +1626,8 @@ bool minDedupCore::restoreShareFile(const int &userID, const std::string &fullRe
             if(shareStat.IsCorruption()) {
                 fprintf(stderr, "Error: a corruption error occurs for the key '%s' in the database!\n",
                         shareKeySlice->ToString().c_str());
-                free(recipeFileBuffer);
-                free(shareFileBuffer);
-                free(shareContainerCache);
+                BufferArena::release(shareFileBuffer, sentShareFileBufferSize);
+                BufferArena::release(shareContainerCache, shareContainerCacheSize);
                 free(shareContainerCacheIndex);
                 delete shareKeySlice;
                 return 0;
@@ -1588,9 +1637,8 @@ bool minDedupCore::restoreShareFile(const int &userID, const std::string &fullRe
                 fprintf(stderr, "Error: an I/O error occurs for the key '%s' in the database!\n",
                         shareKeySlice->ToString().c_str());
 
-                free(recipeFileBuffer);
-                free(shareFileBuffer);
-                free(shareContainerCache);
+                BufferArena::release(shareFileBuffer, sentShareFileBufferSize);
+                BufferArena::release(shareContainerCache, shareContainerCacheSize);
                 free(shareContainerCacheIndex);
                 delete shareKeySlice;
                 return 0;
@@ -1599,7 +1647,33 @@ bool minDedupCore::restoreShareFile(const int &userID, const std::string &fullRe
             delete shareKeySlice;
         }
 
-        if(shareFileBufferOffset > sentMsgHeadSize) {
+        if(!headReady && !fillShareFileHead()) {
+            BufferArena::release(shareFileBuffer, sentShareFileBufferSize);
+            BufferArena::release(shareContainerCache, shareContainerCacheSize);
+            free(shareContainerCacheIndex);
+            return 0;
+        }
+
+        /* IF empty data found in file recipe, then exit and clean up */
+        if(numOfShares == 0) {
+            printf("[Data] [restore] no data chunks found in this server. numOfShares = 0\n");
+            /* `NO_DATA_CHUNKS_FOUND` tells client to end downloading chunk */
+            indicator = htonl(NO_DATA_CHUNKS_FOUND);
+            int retValue = send(socketFD, &indicator, sizeof(int), 0);
+            BufferArena::release(shareFileBuffer, sentShareFileBufferSize);
+            BufferArena::release(shareContainerCache, shareContainerCacheSize);
+            free(shareContainerCacheIndex);
+            if(retValue != sizeof(int)) {
+                fprintf(stderr, "Error informing client to end downloading chunks\n");
+                return -1;
+            }
+            printf("[Data] [restore] client informed!\n");
+            printf("[Data] [restore] Exiting restoring function...\n\n");
+            return -1;
+        }
+
+        /*the last message ends the shares, even if all the shares left were not requested*/
+        if(shareFileBufferOffset > sentMsgHeadSize || numOfSentShares < numOfShares) {
             /*add the message head before sending the data of the share file buffer*/
             if(numOfShares == 0) {
                 printf("[Data] [restore] numOfShare = %d\n", numOfShares);
@@ -1619,21 +1693,20 @@ bool minDedupCore::restoreShareFile(const int &userID, const std::string &fullRe
                         "Error: fail to send the data of the share file buffer (totally in %d bytes) through the socket %d --- return %ld!\n",
                         shareFileBufferOffset, socketFD, sentSize);
 
-                free(recipeFileBuffer);
-                free(shareFileBuffer);
-                free(shareContainerCache);
+                BufferArena::release(shareFileBuffer, sentShareFileBufferSize);
+                BufferArena::release(shareContainerCache, shareContainerCacheSize);
                 free(shareContainerCacheIndex);
                 return 0;
             }
             printf("\n[Data] [restore] Sent %d data to client successfully!\n\n", shareFileBufferOffset);
         }
+        ServerStats::restoreProgress(socketFD, numOfEntries, numOfShares);
 
-        free(recipeFileBuffer);
-        free(shareFileBuffer);
-        free(shareContainerCache);
+        BufferArena::release(shareFileBuffer, sentShareFileBufferSize);
+        BufferArena::release(shareContainerCache, shareContainerCacheSize);
         free(shareContainerCacheIndex);
     } else {
-        printf("[Data] [restore] can not start restore data chunks because recipefile = NULL\n");
+        printf("[Data] [restore] can not start restore data chunks because no recipe is published\n");
         /* `-6` tells client to end downloading chunk */
         indicator = htonl(NO_DATA_CHUNKS_FOUND);
         auto buffer = std::make_unique<char[]>(sizeof(int));
@@ -1647,40 +1720,7 @@ bool minDedupCore::restoreShareFile(const int &userID, const std::string &fullRe
         printf("[Data] [restore] client informed!\n");
     }
 
-    /* delete file recipe */
-    char cmd[256];
-    snprintf(cmd, sizeof(cmd), "rm -rf %s", fullRecipeFileName.c_str());
-    pid_t status = system(cmd);
-    if(status == -1) {
-        printf("error in system call function %s\n", cmd);
-    }
-
-    // reset to default status
-    this->set_last_share_special_flag(false);
     printf("[Data] [restore] Exiting restoring function...\n\n");
 
     return 1;
 }
-
-/*
- * set special flag for this server
- *
- * @param flag - for indicating this is special server which has the 4-th share
- *               and it is no need to send back to client
- *               Default: false
- */
-void minDedupCore::set_last_share_special_flag(bool flag)
-{
-    this->last_share_on_server_ = flag;
-}
-
-/*
- * get special flag for this server
- *
- * @param flag - for indicating this is special server which has the 4-th share
- *               and it is no need to send back to client
- */
-bool minDedupCore::get_last_share_special_flag()
-{
-    return this->last_share_on_server_;
-}
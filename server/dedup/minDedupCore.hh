@@ -11,6 +11,7 @@
 #include <errno.h>
 #include <openssl/evp.h>
 #include <pthread.h>
+#include <map>
 #include <sstream>
 #include <stdio.h>
 #include <stdlib.h>
@@ -36,9 +37,16 @@
 /*for the use of BackendStorer*/
 #include "BackendStorer.hh"
 
+/*for the use of BufferArena*/
+#include "BufferArena.hh"
+
+/*for the use of ServerStats*/
+#include "ServerStats.hh"
+
 /*for the use of CryptoPrimitive*/
 #include "CryptoPrimitive.hh"
 #include "dataStruct.hh"
+#include "RecipeStream.hh"
 
 class minDedupCore {
 private:
@@ -103,9 +111,6 @@ private:
     /*a mutex lock for the global share container name*/
     pthread_mutex_t globalShareContainerNameLock_;
 
-    /*indicate for a last_share on this server, this server is special for client*/
-    bool last_share_on_server_;
-
     /*
      * format a full file name (including the path) into '/.../.../shortName'
      *
@@ -315,6 +320,36 @@ private:
     bool readShareContainerFromBuffer_(char *shareContainerName,
                                        unsigned char *shareContainerBuffer);
 
+
+    /*
+     * look a key up in the database, timed for the live statistics
+     *
+     * @param key - the key
+     * @param value - the value of the key <return>
+     *
+     * @return - the status of the lookup
+     */
+    leveldb::Status dbGet_(const leveldb::Slice &key, std::string *value);
+
+    /*
+     * store a key-value entry into the database, timed for the live statistics
+     *
+     * @param key - the key
+     * @param value - the value
+     *
+     * @return - the status of the write
+     */
+    leveldb::Status dbPut_(const leveldb::Slice &key, const leveldb::Slice &value);
+
+    /*
+     * apply a write batch to the database, timed for the live statistics
+     *
+     * @param batch - the write batch
+     *
+     * @return - the status of the write
+     */
+    leveldb::Status dbWrite_(leveldb::WriteBatch *batch);
+
 public:
     /*
      * constructor of DedupCore
@@ -384,35 +419,30 @@ public:
      */
     bool cleanupAllBufferNodes();
 
+    /*
+     * add up the memory held by the buffer nodes of each user
+     *
+     * @param usage - the bytes of the buffer nodes by user id <return>
+     */
+    void reportBufferNodes(std::map<int, size_t> &usage);
+
     /*
      * restore a share file for a user and send it through the socket
      *
      * @param userID - the user id
-     * @param fullFileName - the full name of the original file
+     * @param fullFileName - the name of the file recipe published by the meta core
+     * @param recipeToken - the token of the restore, returned by the meta core with the file recipe
      * @param versionNumber - the version number (<=0) of the original file
      * @param socketFD - the file descriptor of the sending socket
      * @param cryptoObj - the CryptoPrimitive instance for calculating hash fingerprint
+     * @param selection - the sorted ranges [first, last] of the secret IDs whose shares are requested
+     * @param numOfRanges - the number of ranges (< 0 for the shares of all the secrets)
      *
      * @return - a boolean value that indicates if the restore op succeeds
      */
-    bool restoreShareFile(const int &userID, const std::string &fullFileName, const int &versionNumber, int socketFD,
-                          CryptoPrimitive *cryptoObj);
-
-    /*
-     * set special flag for this server
-     *
-     * @param flag - for indicating this is special server which has the 4-th share
-     *               and it is no need to send back to client
-     */
-    void set_last_share_special_flag(bool flag);
-
-    /*
-     * get special flag for this server
-     *
-     * @param flag - for indicating this is special server which has the 4-th share
-     *               and it is no need to send back to client
-     */
-    bool get_last_share_special_flag();
+    bool restoreShareFile(const int &userID, const std::string &fullFileName, long recipeToken,
+                          const int &versionNumber, int socketFD, CryptoPrimitive *cryptoObj, const int *selection,
+                          int numOfRanges);
 };
 
 #endif
@@ -13,20 +13,34 @@ Server *server;
 void usage(char *s)
 {
 
-    printf("usage: %s [metaPort] [dataPort] [kmPort]\n", s);
+    printf("usage: %s [metaPort] [dataPort] [kmPort] ([arenaMB] [arenaWait])\n", s);
     printf("\t- [metaPort]: port of meta data server\n");
     printf("\t- [dataPort]: port of data server\n");
     printf("\t- [kmPort]: port of key management server\n");
+    printf("\t- [arenaMB]: max memory of the request buffers in MB (default %ld)\n", ARENA_CAP >> 20);
+    printf("\t- [arenaWait]: seconds a request waits for a buffer once they are all taken (default %d)\n",
+           ARENA_WAIT_SECONDS);
 }
 
 int main(int argc, char *argv[])
 {
 
-    if(argc != 4) {
+    if(argc != 4 && argc != 6) {
         usage(argv[0]);
         return -1;
     }
 
+    /* limit the memory of the request buffers, upload credits are granted within it */
+    if(argc == 6) {
+        long arenaMB = atol(argv[4]);
+        int arenaWait = atoi(argv[5]);
+        if(arenaMB <= 0 || arenaWait < 0) {
+            usage(argv[0]);
+            return -1;
+        }
+        BufferArena::configure((size_t) arenaMB << 20, arenaWait);
+    }
+
     /* enable openssl locks */
     if(!CryptoPrimitive::opensslLockSetup()) {
         printf("fail to set up OpenSSL locks\n");
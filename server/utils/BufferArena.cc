@@ -0,0 +1,257 @@
+/*
+ * BufferArena.cc
+ */
+
+#include "BufferArena.hh"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <time.h>
+
+pthread_mutex_t BufferArena::lock_ = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t BufferArena::released_ = PTHREAD_COND_INITIALIZER;
+std::map<size_t, std::vector<void *>> BufferArena::idle_;
+size_t BufferArena::mapped_ = 0;
+size_t BufferArena::leased_ = 0;
+size_t BufferArena::cap_ = ARENA_CAP;
+int BufferArena::waitSeconds_ = ARENA_WAIT_SECONDS;
+
+/*
+ * get the size class of a buffer
+ *
+ * @param size - the size of the buffer
+ *
+ * @return - the size mapped for the buffer
+ */
+size_t BufferArena::classSize_(size_t size)
+{
+    if(size > ARENA_CLASS_SIZE / 2) {
+        return (size + ARENA_CLASS_SIZE - 1) / ARENA_CLASS_SIZE * ARENA_CLASS_SIZE;
+    }
+
+    /*a small buffer does not take a whole huge page*/
+    size_t classSize = ARENA_PAGE_SIZE;
+    while(classSize < size) {
+        classSize <<= 1;
+    }
+    return classSize;
+}
+
+/*
+ * map a new buffer, aligned on a huge page (if it takes one) and faulted in
+ *
+ * @param size - the size class of the buffer
+ *
+ * @return - the buffer, NULL if the memory cannot be mapped
+ */
+void *BufferArena::map_(size_t size)
+{
+    /*map one huge page more, and cut the mapping down to the aligned part; a small buffer is only page-aligned*/
+    bool huge = (size >= ARENA_CLASS_SIZE);
+    size_t span = huge ? size + ARENA_CLASS_SIZE : size;
+    auto *base = (char *) mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED) {
+        fprintf(stderr, "Error: fail to map a buffer of %zu bytes! Error code: %d\n", size, errno);
+        return NULL;
+    }
+    auto *buffer = base;
+    if(huge) {
+        buffer = (char *) (((uintptr_t) base + ARENA_CLASS_SIZE - 1) & ~(uintptr_t) (ARENA_CLASS_SIZE - 1));
+    }
+    if(buffer > base) {
+        munmap(base, buffer - base);
+    }
+    if(base + span > buffer + size) {
+        munmap(buffer + size, base + span - (buffer + size));
+    }
+
+#ifdef MADV_HUGEPAGE
+    if(huge) {
+        madvise(buffer, size, MADV_HUGEPAGE);
+    }
+#endif
+
+    /*fault the pages in now, not while serving the request*/
+    for(size_t offset = 0; offset < size; offset += ARENA_PAGE_SIZE) {
+        buffer[offset] = 0;
+    }
+
+    return buffer;
+}
+
+/*
+ * unmap an idle buffer of any size class (with lock_ held)
+ *
+ * @return - false if no buffer is idle
+ */
+bool BufferArena::trimOne_()
+{
+    for(auto &it : idle_) {
+        if(!it.second.empty()) {
+            munmap(it.second.back(), it.first);
+            it.second.pop_back();
+            mapped_ -= it.first;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * lease a buffer
+ *
+ * @param size - the size of the buffer
+ * @param waitSeconds - how long to wait for other leases to be released if the cap is reached
+ *
+ * @return - the buffer, NULL if no memory is released in time
+ */
+void *BufferArena::lease_(size_t size, int waitSeconds)
+{
+    size_t bufferSize = classSize_(size);
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += waitSeconds;
+
+    pthread_mutex_lock(&lock_);
+    while(true) {
+        /*take an idle buffer of the class*/
+        std::vector<void *> &idle = idle_[bufferSize];
+        if(!idle.empty()) {
+            void *buffer = idle.back();
+            idle.pop_back();
+            leased_ += bufferSize;
+            pthread_mutex_unlock(&lock_);
+
+            return buffer;
+        }
+
+        /*otherwise map a new one, giving the idle buffers of the other classes back if needed; a buffer larger
+          than the cap is still mapped when it is the only one*/
+        while(mapped_ + bufferSize > cap_ && trimOne_()) {
+        }
+        if(mapped_ + bufferSize <= cap_ || leased_ == 0) {
+            mapped_ += bufferSize;
+            leased_ += bufferSize;
+            pthread_mutex_unlock(&lock_);
+
+            void *buffer = map_(bufferSize);
+            if(buffer == NULL) {
+                pthread_mutex_lock(&lock_);
+                mapped_ -= bufferSize;
+                leased_ -= bufferSize;
+                pthread_cond_broadcast(&released_);
+                pthread_mutex_unlock(&lock_);
+            }
+
+            return buffer;
+        }
+
+        /*the cap is reached with every buffer leased, wait for a release*/
+        if(waitSeconds <= 0 || pthread_cond_timedwait(&released_, &lock_, &deadline) == ETIMEDOUT) {
+            size_t leased = leased_;
+            pthread_mutex_unlock(&lock_);
+            fprintf(stderr, "Error: no buffer of %zu bytes released in %d seconds (%zu bytes leased)!\n", bufferSize,
+                    waitSeconds, leased);
+
+            return NULL;
+        }
+    }
+}
+
+/*
+ * set the limits of the arena, before the first lease
+ *
+ * @param cap - the max bytes mapped, leased or idle
+ * @param waitSeconds - how long a lease waits for other leases to be released once the cap is reached
+ */
+void BufferArena::configure(size_t cap, int waitSeconds)
+{
+    pthread_mutex_lock(&lock_);
+    cap_ = cap;
+    waitSeconds_ = waitSeconds;
+    pthread_mutex_unlock(&lock_);
+}
+
+/*
+ * lease a buffer, waiting for other leases to be released if the cap is reached
+ *
+ * @param size - the size of the buffer
+ *
+ * @return - the buffer, NULL if no memory is released in time
+ */
+void *BufferArena::lease(size_t size)
+{
+    return lease_(size, waitSeconds_);
+}
+
+/*
+ * lease a buffer only if the cap leaves room for it now
+ *
+ * @param size - the size of the buffer
+ *
+ * @return - the buffer, NULL if the cap is reached with every buffer leased
+ */
+void *BufferArena::tryLease(size_t size)
+{
+    return lease_(size, 0);
+}
+
+/*
+ * get the size a buffer takes in the arena
+ *
+ * @param size - the size of the buffer
+ *
+ * @return - the size mapped for the buffer
+ */
+size_t BufferArena::footprint(size_t size)
+{
+    return classSize_(size);
+}
+
+/*
+ * release a leased buffer
+ *
+ * @param buffer - the buffer (NULL is ignored)
+ * @param size - the size the buffer is leased with
+ */
+void BufferArena::release(void *buffer, size_t size)
+{
+    if(buffer == NULL) {
+        return;
+    }
+
+    size_t bufferSize = classSize_(size);
+    pthread_mutex_lock(&lock_);
+    idle_[bufferSize].push_back(buffer);
+    leased_ -= bufferSize;
+    pthread_cond_broadcast(&released_);
+    pthread_mutex_unlock(&lock_);
+}
+
+/*
+ * get the memory of the arena
+ *
+ * @param leased - the bytes leased <return>
+ * @param mapped - the bytes mapped, leased or idle <return>
+ */
+void BufferArena::usage(size_t &leased, size_t &mapped)
+{
+    pthread_mutex_lock(&lock_);
+    leased = leased_;
+    mapped = mapped_;
+    pthread_mutex_unlock(&lock_);
+}
+
+/*
+ * get the max memory mapped by the arena
+ *
+ * @return - the cap in bytes
+ */
+size_t BufferArena::cap()
+{
+    return cap_;
+}
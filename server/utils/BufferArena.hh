@@ -0,0 +1,141 @@
+/*
+ * BufferArena.hh
+ *
+ * Lease the large buffers of the requests from a server-wide pool rather than malloc and free them each time
+ */
+
+#ifndef __BUFFERARENA_HH__
+#define __BUFFERARENA_HH__
+
+#include <pthread.h>
+#include <stddef.h>
+#include <map>
+#include <vector>
+
+/* buffers are mapped in multiples of a huge page, each multiple is a size class; smaller buffers are mapped in
+   powers of two from a page up */
+#define ARENA_CLASS_SIZE (2 << 20)
+/* the pages touched to fault a new buffer in */
+#define ARENA_PAGE_SIZE 4096
+/* default max memory mapped by the arena, leased or idle (see BufferArena::configure) */
+#define ARENA_CAP (2L << 30)
+/* default time a lease waits for other buffers to be released once the cap is reached */
+#define ARENA_WAIT_SECONDS 5
+
+/*
+ * huge-page-aligned (page-aligned below a huge page), pre-faulted buffers leased per request and kept for the next
+ * request of the same size class; the idle buffers of other classes are unmapped to make room once the cap is reached
+ */
+class BufferArena {
+private:
+    /*the lock of the idle buffers and the counters, signalled when a buffer is released*/
+    static pthread_mutex_t lock_;
+    static pthread_cond_t released_;
+
+    /*the idle buffers by size class*/
+    static std::map<size_t, std::vector<void *>> idle_;
+
+    /*the bytes mapped by the arena, and the bytes of them leased*/
+    static size_t mapped_;
+    static size_t leased_;
+
+    /*the max bytes mapped, and how long a lease waits once they are reached*/
+    static size_t cap_;
+    static int waitSeconds_;
+
+    /*
+     * get the size class of a buffer
+     *
+     * @param size - the size of the buffer
+     *
+     * @return - the size mapped for the buffer
+     */
+    static size_t classSize_(size_t size);
+
+    /*
+     * map a new buffer, aligned on a huge page (if it takes one) and faulted in
+     *
+     * @param size - the size class of the buffer
+     *
+     * @return - the buffer, NULL if the memory cannot be mapped
+     */
+    static void *map_(size_t size);
+
+    /*
+     * unmap an idle buffer of any size class (with lock_ held)
+     *
+     * @return - false if no buffer is idle
+     */
+    static bool trimOne_();
+
+    /*
+     * lease a buffer
+     *
+     * @param size - the size of the buffer
+     * @param waitSeconds - how long to wait for other leases to be released if the cap is reached
+     *
+     * @return - the buffer, NULL if no memory is released in time
+     */
+    static void *lease_(size_t size, int waitSeconds);
+
+public:
+    /*
+     * set the limits of the arena, before the first lease
+     *
+     * @param cap - the max bytes mapped, leased or idle
+     * @param waitSeconds - how long a lease waits for other leases to be released once the cap is reached
+     */
+    static void configure(size_t cap, int waitSeconds);
+
+    /*
+     * lease a buffer, waiting for other leases to be released if the cap is reached
+     *
+     * @param size - the size of the buffer
+     *
+     * @return - the buffer, NULL if no memory is released in time
+     */
+    static void *lease(size_t size);
+
+    /*
+     * lease a buffer only if the cap leaves room for it now
+     *
+     * @param size - the size of the buffer
+     *
+     * @return - the buffer, NULL if the cap is reached with every buffer leased
+     */
+    static void *tryLease(size_t size);
+
+    /*
+     * get the size a buffer takes in the arena
+     *
+     * @param size - the size of the buffer
+     *
+     * @return - the size mapped for the buffer
+     */
+    static size_t footprint(size_t size);
+
+    /*
+     * release a leased buffer
+     *
+     * @param buffer - the buffer (NULL is ignored)
+     * @param size - the size the buffer is leased with
+     */
+    static void release(void *buffer, size_t size);
+
+    /*
+     * get the memory of the arena
+     *
+     * @param leased - the bytes leased <return>
+     * @param mapped - the bytes mapped, leased or idle <return>
+     */
+    static void usage(size_t &leased, size_t &mapped);
+
+    /*
+     * get the max memory mapped by the arena
+     *
+     * @return - the cap in bytes
+     */
+    static size_t cap();
+};
+
+#endif
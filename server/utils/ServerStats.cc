@@ -0,0 +1,343 @@
+/*
+ * ServerStats.cc
+ */
+
+#include "ServerStats.hh"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "BufferArena.hh"
+
+ServerStats::service_t ServerStats::services_[STATS_SERVICES];
+ServerStats::histogram_t ServerStats::histograms_[STATS_HISTOGRAMS];
+std::atomic<int> ServerStats::busyWorkers_(0);
+pthread_mutex_t ServerStats::restoreLock_ = PTHREAD_MUTEX_INITIALIZER;
+std::map<int, ServerStats::restore_t> ServerStats::restores_;
+long ServerStats::startMicros_ = ServerStats::clockMicros();
+
+static const char *serviceNames[STATS_SERVICES] = {"meta", "data", "km"};
+static const char *histogramNames[STATS_HISTOGRAMS] = {"db_get", "db_write", "container_flush"};
+
+/*
+ * get a monotonic time stamp
+ *
+ * @return - the time stamp in microseconds
+ */
+long ServerStats::clockMicros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * count a request served
+ *
+ * @param service - the service of the request
+ */
+void ServerStats::countRequest(int service)
+{
+    services_[service].requests++;
+}
+
+/*
+ * count the bytes received from and sent to the clients of a service
+ *
+ * @param service - the service of the clients
+ * @param bytesIn - the bytes received
+ * @param bytesOut - the bytes sent
+ */
+void ServerStats::countTraffic(int service, long bytesIn, long bytesOut)
+{
+    services_[service].bytesIn += bytesIn;
+    services_[service].bytesOut += bytesOut;
+}
+
+/*
+ * count a client connection accepted or closed
+ *
+ * @param service - the service of the connection
+ * @param open - true once accepted, false once closed
+ */
+void ServerStats::countConnection(int service, bool open)
+{
+    if(open) {
+        services_[service].connections++;
+        services_[service].accepted++;
+    } else {
+        services_[service].connections--;
+    }
+}
+
+/*
+ * count a share checked by deduplication
+ *
+ * @param service - the service storing the share
+ * @param kind - STATS_SHARE_INTRA_DUP, STATS_SHARE_INTER_DUP or STATS_SHARE_UNIQUE
+ * @param size - the size of the share (counted for the unique shares only)
+ */
+void ServerStats::countShare(int service, int kind, long size)
+{
+    services_[service].shares[kind]++;
+    if(kind == STATS_SHARE_UNIQUE) {
+        services_[service].uniqueBytes += size;
+    }
+}
+
+/*
+ * add a latency to a histogram
+ *
+ * @param histogram - STATS_DB_GET, STATS_DB_WRITE or STATS_CONTAINER_FLUSH
+ * @param startMicros - the clockMicros() when the operation starts
+ */
+void ServerStats::recordLatency(int histogram, long startMicros)
+{
+    long micros = clockMicros() - startMicros;
+    histogram_t &target = histograms_[histogram];
+
+    int bucket = 0;
+    while(bucket < STATS_BUCKETS - 1 && micros >= (1L << bucket)) {
+        bucket++;
+    }
+    target.buckets[bucket]++;
+    target.count++;
+    target.sumMicros += micros;
+
+    long max = target.maxMicros.load();
+    while(micros > max && !target.maxMicros.compare_exchange_weak(max, micros)) {
+    }
+}
+
+/*
+ * count a worker starting or finishing a request
+ *
+ * @param busy - true when it starts, false when it finishes
+ */
+void ServerStats::countWorker(bool busy)
+{
+    if(busy) {
+        busyWorkers_++;
+    } else {
+        busyWorkers_--;
+    }
+}
+
+/*
+ * add a restore to the running ones
+ *
+ * @param socketFD - the socket the restore is sent through
+ * @param service - the service of the restore
+ * @param user - the user restoring the file
+ */
+void ServerStats::beginRestore(int socketFD, int service, int user)
+{
+    restore_t restore;
+    restore.service = service;
+    restore.user = user;
+    restore.startMicros = clockMicros();
+    restore.doneShares = 0;
+    restore.totalShares = 0;
+
+    pthread_mutex_lock(&restoreLock_);
+    restores_[socketFD] = restore;
+    pthread_mutex_unlock(&restoreLock_);
+}
+
+/*
+ * update the progress of a running restore
+ *
+ * @param socketFD - the socket the restore is sent through
+ * @param doneShares - the shares of the file handled so far, sent or skipped
+ * @param totalShares - the shares of the file
+ */
+void ServerStats::restoreProgress(int socketFD, long doneShares, long totalShares)
+{
+    pthread_mutex_lock(&restoreLock_);
+    auto it = restores_.find(socketFD);
+    if(it != restores_.end()) {
+        it->second.doneShares = doneShares;
+        it->second.totalShares = totalShares;
+    }
+    pthread_mutex_unlock(&restoreLock_);
+}
+
+/*
+ * remove a restore from the running ones
+ *
+ * @param socketFD - the socket the restore is sent through
+ */
+void ServerStats::endRestore(int socketFD)
+{
+    pthread_mutex_lock(&restoreLock_);
+    restores_.erase(socketFD);
+    pthread_mutex_unlock(&restoreLock_);
+}
+
+/*
+ * append a formatted string to a report
+ *
+ * @param report - the report <return>
+ * @param format - printf format of what is appended
+ */
+void ServerStats::append_(std::string &report, const char *format, ...)
+{
+    char line[512];
+    va_list args;
+
+    va_start(args, format);
+    int size = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if(size > 0) {
+        report.append(line, size < (int) sizeof(line) ? size : sizeof(line) - 1);
+    }
+}
+
+/*
+ * estimate a percentile of a histogram from its buckets
+ *
+ * @param histogram - the histogram
+ * @param percent - the percentile (0-100)
+ *
+ * @return - the upper bound of the bucket of the percentile in microseconds, 0 if the histogram is empty
+ */
+long ServerStats::percentile_(const histogram_t &histogram, int percent)
+{
+    long counts[STATS_BUCKETS];
+    long total = 0;
+    for(int i = 0; i < STATS_BUCKETS; i++) {
+        counts[i] = histogram.buckets[i].load();
+        total += counts[i];
+    }
+    if(total == 0) {
+        return 0;
+    }
+
+    long rank = (total * percent + 99) / 100;
+    long seen = 0;
+    for(int i = 0; i < STATS_BUCKETS; i++) {
+        seen += counts[i];
+        if(seen >= rank) {
+            return 1L << i;
+        }
+    }
+    return 1L << (STATS_BUCKETS - 1);
+}
+
+/*
+ * report all the counters
+ *
+ * @param report - the report <return>
+ * @param format - STATS_TEXT or STATS_JSON
+ * @param queuedRequests - the connections waiting for a worker
+ * @param bufferNodes - the bytes of the buffer nodes of each user, by service (STATS_SERVICES maps)
+ */
+void ServerStats::report(std::string &report, int format, int queuedRequests, const std::map<int, size_t> *bufferNodes)
+{
+    bool json = (format == STATS_JSON);
+    double uptime = (clockMicros() - startMicros_) / 1e6;
+    size_t leased, mapped;
+    BufferArena::usage(leased, mapped);
+
+    if(json) {
+        append_(report, "{\"uptime_seconds\":%.3f,\"busy_workers\":%d,\"queued_requests\":%d,", uptime,
+                busyWorkers_.load(), queuedRequests);
+        append_(report, "\"arena\":{\"leased_bytes\":%zu,\"mapped_bytes\":%zu},\"services\":{", leased, mapped);
+    } else {
+        append_(report, "uptime_seconds %.3f\nbusy_workers %d\nqueued_requests %d\n", uptime, busyWorkers_.load(),
+                queuedRequests);
+        append_(report, "arena leased_bytes %zu mapped_bytes %zu\n", leased, mapped);
+    }
+
+    /*the traffic and the deduplication of each service*/
+    for(int i = 0; i < STATS_SERVICES; i++) {
+        service_t &service = services_[i];
+        long intraDup = service.shares[STATS_SHARE_INTRA_DUP].load();
+        long interDup = service.shares[STATS_SHARE_INTER_DUP].load();
+        long unique = service.shares[STATS_SHARE_UNIQUE].load();
+        long total = intraDup + interDup + unique;
+        double dupRatio = total > 0 ? (double) (intraDup + interDup) / total : 0;
+
+        if(json) {
+            append_(report, "%s\"%s\":{\"requests\":%ld,\"bytes_in\":%ld,\"bytes_out\":%ld,\"connections\":%ld,"
+                            "\"accepted\":%ld,", i > 0 ? "," : "", serviceNames[i], service.requests.load(),
+                    service.bytesIn.load(), service.bytesOut.load(), service.connections.load(),
+                    service.accepted.load());
+            append_(report, "\"shares\":{\"intra_dup\":%ld,\"inter_dup\":%ld,\"unique\":%ld,\"unique_bytes\":%ld,"
+                            "\"dup_ratio\":%.4f,\"dup_per_second\":%.2f,\"unique_per_second\":%.2f},", intraDup,
+                    interDup, unique, service.uniqueBytes.load(), dupRatio, (intraDup + interDup) / uptime,
+                    unique / uptime);
+            append_(report, "\"buffer_nodes\":{");
+            bool first = true;
+            for(auto &it : bufferNodes[i]) {
+                append_(report, "%s\"%d\":%zu", first ? "" : ",", it.first, it.second);
+                first = false;
+            }
+            append_(report, "}}");
+        } else {
+            append_(report, "%s requests %ld bytes_in %ld bytes_out %ld connections %ld accepted %ld\n",
+                    serviceNames[i], service.requests.load(), service.bytesIn.load(), service.bytesOut.load(),
+                    service.connections.load(), service.accepted.load());
+            if(i != STATS_KM) {
+                append_(report, "%s shares intra_dup %ld inter_dup %ld unique %ld unique_bytes %ld dup_ratio %.4f "
+                                "dup_per_second %.2f unique_per_second %.2f\n", serviceNames[i], intraDup, interDup,
+                        unique, service.uniqueBytes.load(), dupRatio, (intraDup + interDup) / uptime,
+                        unique / uptime);
+            }
+            for(auto &it : bufferNodes[i]) {
+                append_(report, "%s buffer_nodes user %d bytes %zu\n", serviceNames[i], it.first, it.second);
+            }
+        }
+    }
+
+    /*the latencies*/
+    if(json) {
+        append_(report, "},\"latency\":{");
+    }
+    for(int i = 0; i < STATS_HISTOGRAMS; i++) {
+        histogram_t &histogram = histograms_[i];
+        long count = histogram.count.load();
+        long sum = histogram.sumMicros.load();
+        long avg = count > 0 ? sum / count : 0;
+
+        if(json) {
+            append_(report, "%s\"%s\":{\"count\":%ld,\"sum_us\":%ld,\"avg_us\":%ld,\"p50_us\":%ld,\"p99_us\":%ld,"
+                            "\"max_us\":%ld,\"buckets\":[", i > 0 ? "," : "", histogramNames[i], count, sum, avg,
+                    percentile_(histogram, 50), percentile_(histogram, 99), histogram.maxMicros.load());
+            for(int j = 0; j < STATS_BUCKETS; j++) {
+                append_(report, "%s%ld", j > 0 ? "," : "", histogram.buckets[j].load());
+            }
+            append_(report, "]}");
+        } else {
+            append_(report, "latency %s count %ld avg_us %ld p50_us %ld p99_us %ld max_us %ld\n", histogramNames[i],
+                    count, avg, percentile_(histogram, 50), percentile_(histogram, 99), histogram.maxMicros.load());
+        }
+    }
+
+    /*the restores being sent*/
+    if(json) {
+        append_(report, "},\"restores\":[");
+    }
+    long now = clockMicros();
+    pthread_mutex_lock(&restoreLock_);
+    bool first = true;
+    for(auto &it : restores_) {
+        restore_t &restore = it.second;
+        double seconds = (now - restore.startMicros) / 1e6;
+        if(json) {
+            append_(report, "%s{\"service\":\"%s\",\"user\":%d,\"done_shares\":%ld,\"total_shares\":%ld,"
+                            "\"seconds\":%.3f}", first ? "" : ",", serviceNames[restore.service], restore.user,
+                    restore.doneShares, restore.totalShares, seconds);
+        } else {
+            append_(report, "restore %s user %d done_shares %ld total_shares %ld seconds %.3f\n",
+                    serviceNames[restore.service], restore.user, restore.doneShares, restore.totalShares, seconds);
+        }
+        first = false;
+    }
+    pthread_mutex_unlock(&restoreLock_);
+    if(json) {
+        append_(report, "]}\n");
+    }
+}
@@ -0,0 +1,197 @@
+/*
+ * ServerStats.hh
+ *
+ * Live counters of the server, reported on the admin socket while the server runs
+ */
+
+#ifndef __SERVERSTATS_HH__
+#define __SERVERSTATS_HH__
+
+#include <pthread.h>
+#include <stddef.h>
+#include <atomic>
+#include <map>
+#include <string>
+
+/* services counted apart, the same numbers as the connection types of the server */
+#define STATS_META 0
+#define STATS_DATA 1
+#define STATS_KM 2
+#define STATS_SERVICES 3
+
+/* latency histograms */
+#define STATS_DB_GET 0
+#define STATS_DB_WRITE 1
+#define STATS_CONTAINER_FLUSH 2
+#define STATS_HISTOGRAMS 3
+
+/* bucket i counts the latencies below 2^i microseconds, the last one all the longer ones */
+#define STATS_BUCKETS 24
+
+/* what deduplication makes of a share */
+#define STATS_SHARE_INTRA_DUP 0
+#define STATS_SHARE_INTER_DUP 1
+#define STATS_SHARE_UNIQUE 2
+#define STATS_SHARE_KINDS 3
+
+/* formats of a report */
+#define STATS_TEXT 0
+#define STATS_JSON 1
+
+/*
+ * server-wide counters, updated without locks on the request path; only the list of the running restores is locked
+ */
+class ServerStats {
+private:
+    /*the counters of a service*/
+    typedef struct {
+        std::atomic<long> requests;
+        std::atomic<long> bytesIn;
+        std::atomic<long> bytesOut;
+        std::atomic<long> connections;
+        std::atomic<long> accepted;
+        std::atomic<long> shares[STATS_SHARE_KINDS];
+        std::atomic<long> uniqueBytes;
+    } service_t;
+
+    /*a latency histogram*/
+    typedef struct {
+        std::atomic<long> count;
+        std::atomic<long> sumMicros;
+        std::atomic<long> maxMicros;
+        std::atomic<long> buckets[STATS_BUCKETS];
+    } histogram_t;
+
+    /*a restore being sent, by the socket of its client*/
+    typedef struct {
+        int service;
+        int user;
+        long startMicros;
+        long doneShares;
+        long totalShares;
+    } restore_t;
+
+    static service_t services_[STATS_SERVICES];
+    static histogram_t histograms_[STATS_HISTOGRAMS];
+
+    /*the workers serving a request right now*/
+    static std::atomic<int> busyWorkers_;
+
+    /*the running restores*/
+    static pthread_mutex_t restoreLock_;
+    static std::map<int, restore_t> restores_;
+
+    /*when the server starts*/
+    static long startMicros_;
+
+    /*
+     * append a formatted string to a report
+     *
+     * @param report - the report <return>
+     * @param format - printf format of what is appended
+     */
+    static void append_(std::string &report, const char *format, ...);
+
+    /*
+     * estimate a percentile of a histogram from its buckets
+     *
+     * @param histogram - the histogram
+     * @param percent - the percentile (0-100)
+     *
+     * @return - the upper bound of the bucket of the percentile in microseconds, 0 if the histogram is empty
+     */
+    static long percentile_(const histogram_t &histogram, int percent);
+
+public:
+    /*
+     * get a monotonic time stamp
+     *
+     * @return - the time stamp in microseconds
+     */
+    static long clockMicros();
+
+    /*
+     * count a request served
+     *
+     * @param service - the service of the request
+     */
+    static void countRequest(int service);
+
+    /*
+     * count the bytes received from and sent to the clients of a service
+     *
+     * @param service - the service of the clients
+     * @param bytesIn - the bytes received
+     * @param bytesOut - the bytes sent
+     */
+    static void countTraffic(int service, long bytesIn, long bytesOut);
+
+    /*
+     * count a client connection accepted or closed
+     *
+     * @param service - the service of the connection
+     * @param open - true once accepted, false once closed
+     */
+    static void countConnection(int service, bool open);
+
+    /*
+     * count a share checked by deduplication
+     *
+     * @param service - the service storing the share
+     * @param kind - STATS_SHARE_INTRA_DUP, STATS_SHARE_INTER_DUP or STATS_SHARE_UNIQUE
+     * @param size - the size of the share (counted for the unique shares only)
+     */
+    static void countShare(int service, int kind, long size);
+
+    /*
+     * add a latency to a histogram
+     *
+     * @param histogram - STATS_DB_GET, STATS_DB_WRITE or STATS_CONTAINER_FLUSH
+     * @param startMicros - the clockMicros() when the operation starts
+     */
+    static void recordLatency(int histogram, long startMicros);
+
+    /*
+     * count a worker starting or finishing a request
+     *
+     * @param busy - true when it starts, false when it finishes
+     */
+    static void countWorker(bool busy);
+
+    /*
+     * add a restore to the running ones
+     *
+     * @param socketFD - the socket the restore is sent through
+     * @param service - the service of the restore
+     * @param user - the user restoring the file
+     */
+    static void beginRestore(int socketFD, int service, int user);
+
+    /*
+     * update the progress of a running restore
+     *
+     * @param socketFD - the socket the restore is sent through
+     * @param doneShares - the shares of the file handled so far, sent or skipped
+     * @param totalShares - the shares of the file
+     */
+    static void restoreProgress(int socketFD, long doneShares, long totalShares);
+
+    /*
+     * remove a restore from the running ones
+     *
+     * @param socketFD - the socket the restore is sent through
+     */
+    static void endRestore(int socketFD);
+
+    /*
+     * report all the counters
+     *
+     * @param report - the report <return>
+     * @param format - STATS_TEXT or STATS_JSON
+     * @param queuedRequests - the connections waiting for a worker
+     * @param bufferNodes - the bytes of the buffer nodes of each user, by service (STATS_SERVICES maps)
+     */
+    static void report(std::string &report, int format, int queuedRequests, const std::map<int, size_t> *bufferNodes);
+};
+
+#endif